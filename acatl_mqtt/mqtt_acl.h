@@ -0,0 +1,328 @@
+//
+//  mqtt_acl.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_acl_h
+#define acatl_mqtt_acl_h
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// Read allows to subscribe to a topic and receive its messages, write allows to publish on it.
+        enum class AclAccess : uint8_t
+        {
+            None = 0x00,
+            Read = 0x01,
+            Write = 0x02,
+            ReadWrite = 0x03
+        };
+        
+        inline AclAccess operator|(AclAccess lhs, AclAccess rhs)
+        {
+            return static_cast<AclAccess>(static_cast<uint8_t>(lhs) | static_cast<uint8_t>(rhs));
+        }
+        
+        inline AclAccess& operator|=(AclAccess& lhs, AclAccess rhs)
+        {
+            lhs = lhs | rhs;
+            return lhs;
+        }
+        
+        /// True if the granted access includes all of the required access.
+        inline bool allows(AclAccess granted, AclAccess required)
+        {
+            return (static_cast<uint8_t>(granted) & static_cast<uint8_t>(required)) == static_cast<uint8_t>(required);
+        }
+        
+        struct AclRule
+        {
+            AclRule(const std::string& pattern, AclAccess access, const std::string& username = std::string())
+            : _username(username)
+            , _pattern(pattern)
+            , _access(access)
+            {}
+            
+            // the rule only applies to clients connecting with this user name, empty applies it to all clients
+            std::string _username;
+            // a topic filter, %c is replaced by the client id and %u by the user name of the client
+            std::string _pattern;
+            AclAccess _access;
+        };
+        
+        typedef std::vector<AclRule> AclRules;
+        
+        
+        /// The ACL rules of one client, compiled into a trie of topic levels with the same wildcards as the
+        /// SubscriptionTree. Looking up a topic walks it once, independent of the number of rules. As for
+        /// subscriptions, wildcards on the first level do not match topics starting with '$'. A compiled trie is
+        /// immutable and may be shared between threads.
+        class AclTrie
+        {
+        public:
+            typedef std::shared_ptr<const AclTrie> ConstPtr;
+            
+            explicit AclTrie(uint64_t generation = 0)
+            : _generation(generation)
+            , _size(0)
+            {}
+            
+            AclTrie(const AclTrie&) = delete;
+            AclTrie& operator=(const AclTrie&) = delete;
+            
+            /// Grants access to the topics matching filter, in addition to what other filters grant.
+            void add(const std::string& filter, AclAccess access)
+            {
+                Node* node = &_root;
+                size_t pos = 0;
+                for(;;) {
+                    size_t end = levelEnd(filter, pos);
+                    std::string level = filter.substr(pos, end - pos);
+                    if(level == "#") {
+                        node->_multiLevel |= access;
+                        break;
+                    }
+                    std::unique_ptr<Node>& child = level == "+" ? node->_singleLevel : node->_children[level];
+                    if(!child) {
+                        child.reset(new Node);
+                    }
+                    node = child.get();
+                    if(end == filter.size()) {
+                        node->_access |= access;
+                        break;
+                    }
+                    pos = end + 1;
+                }
+                ++_size;
+            }
+            
+            /// @return The access granted on the topic of a publish.
+            AclAccess access(const std::string& topic) const
+            {
+                return match(_root, topic, 0);
+            }
+            
+            /// @return The access granted on all topics matching the subscription filter.
+            AclAccess filterAccess(const std::string& filter) const
+            {
+                return cover(_root, filter, 0);
+            }
+            
+            /// The generation of the rules the trie was compiled from.
+            uint64_t generation() const
+            {
+                return _generation;
+            }
+            
+            /// @return The number of filters added.
+            size_t size() const
+            {
+                return _size;
+            }
+            
+        private:
+            struct Node
+            {
+                Node()
+                : _access(AclAccess::None)
+                , _multiLevel(AclAccess::None)
+                {}
+                
+                // granted on the topic ending at this node
+                AclAccess _access;
+                // granted by a '#' below this node, on this node and everything below it
+                AclAccess _multiLevel;
+                std::unordered_map<std::string, std::unique_ptr<Node>> _children;
+                std::unique_ptr<Node> _singleLevel;
+            };
+            
+            static size_t levelEnd(const std::string& topic, size_t pos)
+            {
+                size_t end = topic.find('/', pos);
+                return end == std::string::npos ? topic.size() : end;
+            }
+            
+            static bool reserved(const std::string& topic, size_t pos)
+            {
+                return pos == 0 && !topic.empty() && topic[0] == '$';
+            }
+            
+            AclAccess match(const Node& node, const std::string& topic, size_t pos) const
+            {
+                if(pos > topic.size()) {
+                    return node._access | node._multiLevel;
+                }
+                bool wildcards = !reserved(topic, pos);
+                AclAccess result = wildcards ? node._multiLevel : AclAccess::None;
+                size_t end = levelEnd(topic, pos);
+                auto iter = node._children.find(topic.substr(pos, end - pos));
+                if(iter != node._children.end()) {
+                    result |= match(*iter->second, topic, end + 1);
+                }
+                if(wildcards && node._singleLevel) {
+                    result |= match(*node._singleLevel, topic, end + 1);
+                }
+                return result;
+            }
+            
+            /// A '+' of the subscription is only covered by a '+' or '#' of the ACL, its '#' only by a '#'.
+            AclAccess cover(const Node& node, const std::string& filter, size_t pos) const
+            {
+                if(pos > filter.size()) {
+                    return node._access | node._multiLevel;
+                }
+                bool wildcards = !reserved(filter, pos);
+                AclAccess result = wildcards ? node._multiLevel : AclAccess::None;
+                size_t end = levelEnd(filter, pos);
+                std::string level = filter.substr(pos, end - pos);
+                if(level == "#") {
+                    return result;
+                }
+                if(level != "+") {
+                    auto iter = node._children.find(level);
+                    if(iter != node._children.end()) {
+                        result |= cover(*iter->second, filter, end + 1);
+                    }
+                }
+                if(wildcards && node._singleLevel) {
+                    result |= cover(*node._singleLevel, filter, end + 1);
+                }
+                return result;
+            }
+            
+            uint64_t _generation;
+            size_t _size;
+            Node _root;
+        };
+        
+        
+        /// Holds the ACL rules of the broker and compiles them for a client. The compiled trie is meant to be cached
+        /// for the whole connection, so authorizing a publish is one lookup. Reloading replaces the rules atomically
+        /// and bumps the generation, connections notice it with one atomic load and compile their rules again. No
+        /// publisher ever waits for a reload.
+        /// A client is only granted what a rule allows, without any rule it may neither publish nor subscribe.
+        class Authorizer
+        {
+        public:
+            typedef std::shared_ptr<Authorizer> Ptr;
+            
+            explicit Authorizer(const AclRules& rules = AclRules())
+            : _rules(std::make_shared<const RuleSet>(rules, 1))
+            , _generation(1)
+            {}
+            
+            void reload(const AclRules& rules)
+            {
+                // only serializes concurrent reloads, compiling never takes this mutex
+                std::unique_lock<std::mutex> guard(_reloadMutex);
+                uint64_t generation = _generation.load(std::memory_order_relaxed) + 1;
+                std::atomic_store(&_rules, std::make_shared<const RuleSet>(rules, generation));
+                _generation.store(generation, std::memory_order_release);
+            }
+            
+            /// The generation of the current rules, compiled tries of an older generation are outdated.
+            uint64_t generation() const
+            {
+                return _generation.load(std::memory_order_acquire);
+            }
+            
+            /// Compiles the rules applying to the client, with %c and %u replaced.
+            AclTrie::ConstPtr compile(const std::string& clientId, const std::string& username) const
+            {
+                std::shared_ptr<const RuleSet> rules = std::atomic_load(&_rules);
+                std::shared_ptr<AclTrie> trie = std::make_shared<AclTrie>(rules->_generation);
+                for(const auto& rule : rules->_rules) {
+                    if(!rule._username.empty() && rule._username != username) {
+                        continue;
+                    }
+                    std::string filter;
+                    if(!substitute(rule._pattern, clientId, username, filter)) {
+                        continue;
+                    }
+                    trie->add(filter, rule._access);
+                }
+                return trie;
+            }
+            
+        private:
+            struct RuleSet
+            {
+                RuleSet(const AclRules& rules, uint64_t generation)
+                : _rules(rules)
+                , _generation(generation)
+                {}
+                
+                AclRules _rules;
+                uint64_t _generation;
+            };
+            
+            /// A client id or user name containing wildcards or separators would widen the rule to other topics, so
+            /// such a rule does not apply. Neither does a %u rule for a client without user name.
+            static bool substitute(const std::string& pattern,
+                                   const std::string& clientId,
+                                   const std::string& username,
+                                   std::string& filter)
+            {
+                filter.reserve(pattern.size());
+                for(size_t i = 0; i < pattern.size(); ++i) {
+                    if(pattern[i] != '%' || i + 1 == pattern.size() || (pattern[i + 1] != 'c' && pattern[i + 1] != 'u')) {
+                        filter.push_back(pattern[i]);
+                        continue;
+                    }
+                    const std::string& value = pattern[++i] == 'c' ? clientId : username;
+                    if(value.empty() || value.find_first_of("/+#") != std::string::npos) {
+                        return false;
+                    }
+                    filter.append(value);
+                }
+                return true;
+            }
+            
+            std::mutex _reloadMutex;
+            std::shared_ptr<const RuleSet> _rules;
+            std::atomic<uint64_t> _generation;
+        };
+        
+    }
+}
+
+#endif
@@ -0,0 +1,356 @@
+//
+//  mqtt_capture.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_capture_h
+#define acatl_mqtt_capture_h
+
+#include <acatl_mqtt/mqtt_error.h>
+#include <acatl_mqtt/mqtt_fixed_header_parser.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// A packet one client sent, or the end of its connection if the packet is empty.
+        struct CaptureRecord
+        {
+            uint32_t _connection{0};
+            /// Time since the capture started.
+            std::chrono::microseconds _time{0};
+            std::vector<uint8_t> _packet;
+        };
+        
+        
+        /// Cuts the bytes a client sends into complete packets by their fixed header, without parsing them. So the
+        /// payload of a streamed publish is part of its packet, as on the wire.
+        class PacketFramer
+        {
+        public:
+            PacketFramer()
+            : _headerDone(false)
+            , _remaining(0)
+            {}
+            
+            /// Calls handler(const std::vector<uint8_t>&) for every packet the bytes complete.
+            /// @return false if the bytes do not start a valid fixed header, no packet boundary is known after that.
+            template<typename Handler>
+            bool feed(const uint8_t* data, size_t length, Handler&& handler, std::error_code& ec)
+            {
+                size_t index = 0;
+                while(index < length) {
+                    if(!_headerDone) {
+                        _packet.push_back(data[index]);
+                        acatl::Tribool ret = _header.parse(data[index++], ec);
+                        if(ret.isFalse()) {
+                            return false;
+                        }
+                        if(ret.isIndeterminate()) {
+                            continue;
+                        }
+                        _headerDone = true;
+                        _remaining = _header.header()._length;
+                    } else {
+                        size_t count = std::min(_remaining, length - index);
+                        _packet.insert(_packet.end(), data + index, data + index + count);
+                        index += count;
+                        _remaining -= count;
+                    }
+                    if(_remaining == 0) {
+                        handler(static_cast<const std::vector<uint8_t>&>(_packet));
+                        _packet.clear();
+                        _header.reset();
+                        _headerDone = false;
+                    }
+                }
+                return true;
+            }
+            
+        private:
+            FixedHeaderParser _header;
+            bool _headerDone;
+            size_t _remaining;
+            std::vector<uint8_t> _packet;
+        };
+        
+        
+        /// Layout of a capture file. It starts with the magic and the version, followed by one record per packet in
+        /// the order they arrived:
+        ///   varint connection | varint microseconds since the previous record | varint packet length | packet
+        /// Varints hold 7 bits per byte, lowest first, with the high bit set on all but the last byte, like the
+        /// remaining length of a packet but not limited to four bytes.
+        struct CaptureFormat
+        {
+            static const std::string& magic()
+            {
+                static const std::string value("AMQC");
+                return value;
+            }
+            
+            static uint8_t version()
+            {
+                return 1;
+            }
+            
+            static void encode(uint64_t value, std::vector<uint8_t>& buffer)
+            {
+                do {
+                    uint8_t byte = static_cast<uint8_t>(value & 0x7F);
+                    value >>= 7;
+                    buffer.push_back(value != 0 ? byte | 0x80 : byte);
+                } while(value != 0);
+            }
+            
+            /// @return false at the end of the file or on a varint longer than 64 bits.
+            static bool decode(std::FILE* file, uint64_t& value)
+            {
+                value = 0;
+                for(unsigned shift = 0; shift < 64; shift += 7) {
+                    int byte = std::fgetc(file);
+                    if(byte == EOF) {
+                        return false;
+                    }
+                    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                    if((byte & 0x80) == 0) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+        };
+        
+        
+        /// Appends the packets all connections receive to one capture file. Each connection takes an id and reports
+        /// its packets as they complete, the writer stamps them with the time of arrival.
+        class CaptureWriter
+        {
+        public:
+            typedef std::shared_ptr<CaptureWriter> Ptr;
+            typedef std::chrono::steady_clock Clock;
+            
+            explicit CaptureWriter(const std::string& path)
+            : _path(path)
+            , _file(nullptr)
+            , _connections(0)
+            , _records(0)
+            {}
+            
+            ~CaptureWriter()
+            {
+                std::error_code ec;
+                close(ec);
+            }
+            
+            /// Creates the capture file, an existing one is overwritten.
+            bool open(std::error_code& ec)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if(_file) {
+                    ec.clear();
+                    return true;
+                }
+                _file = std::fopen(_path.c_str(), "wb");
+                if(!_file) {
+                    ec = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                _last = Clock::now();
+                _record.assign(CaptureFormat::magic().begin(), CaptureFormat::magic().end());
+                _record.push_back(CaptureFormat::version());
+                return writeRecord(ec);
+            }
+            
+            bool close(std::error_code& ec)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if(!_file) {
+                    ec.clear();
+                    return true;
+                }
+                bool result = std::fclose(_file) == 0;
+                if(!result) {
+                    ec = std::error_code(errno, std::generic_category());
+                }
+                _file = nullptr;
+                return result;
+            }
+            
+            /// @return The id of a new connection, ids start at 1.
+            uint32_t newConnection()
+            {
+                return _connections.fetch_add(1) + 1;
+            }
+            
+            bool write(uint32_t connection, const std::vector<uint8_t>& packet, std::error_code& ec)
+            {
+                return append(connection, packet.data(), packet.size(), ec);
+            }
+            
+            /// Records that the connection ended, nothing may be written for it afterwards.
+            bool end(uint32_t connection, std::error_code& ec)
+            {
+                return append(connection, nullptr, 0, ec);
+            }
+            
+            uint64_t records() const
+            {
+                return _records.load(std::memory_order_relaxed);
+            }
+            
+        private:
+            bool append(uint32_t connection, const uint8_t* data, size_t length, std::error_code& ec)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if(!_file) {
+                    ec = std::make_error_code(std::errc::bad_file_descriptor);
+                    return false;
+                }
+                Clock::time_point now = Clock::now();
+                _record.clear();
+                CaptureFormat::encode(connection, _record);
+                CaptureFormat::encode(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - _last).count()), _record);
+                CaptureFormat::encode(length, _record);
+                _record.insert(_record.end(), data, data + length);
+                // the next delta starts at the microsecond this one ended, so rounding does not add up
+                _last += std::chrono::duration_cast<std::chrono::microseconds>(now - _last);
+                _records.fetch_add(1, std::memory_order_relaxed);
+                return writeRecord(ec);
+            }
+            
+            /// Writes the record to the buffer of the file, it reaches the disk whenever stdio flushes.
+            bool writeRecord(std::error_code& ec)
+            {
+                if(std::fwrite(_record.data(), 1, _record.size(), _file) != _record.size()) {
+                    ec = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                return true;
+            }
+            
+            std::string _path;
+            std::FILE* _file;
+            std::mutex _mutex;
+            Clock::time_point _last;
+            std::vector<uint8_t> _record;
+            std::atomic<uint32_t> _connections;
+            std::atomic<uint64_t> _records;
+        };
+        
+        
+        /// Reads the records of a capture file one after the other.
+        class CaptureReader
+        {
+        public:
+            explicit CaptureReader(const std::string& path)
+            : _path(path)
+            , _file(nullptr)
+            , _time(0)
+            {}
+            
+            ~CaptureReader()
+            {
+                if(_file) {
+                    std::fclose(_file);
+                }
+            }
+            
+            CaptureReader(const CaptureReader&) = delete;
+            CaptureReader& operator=(const CaptureReader&) = delete;
+            
+            bool open(std::error_code& ec)
+            {
+                _file = std::fopen(_path.c_str(), "rb");
+                if(!_file) {
+                    ec = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                std::string header(CaptureFormat::magic().size() + 1, '\0');
+                if(std::fread(&header[0], 1, header.size(), _file) != header.size()
+                   || header.compare(0, CaptureFormat::magic().size(), CaptureFormat::magic()) != 0
+                   || static_cast<uint8_t>(header.back()) != CaptureFormat::version()) {
+                    ec = mqtt_error::capture_file_corrupted;
+                    return false;
+                }
+                return true;
+            }
+            
+            /// @return false at the end of the file. A record cut off at the end, as a crashed broker leaves it, ends
+            /// the file as well, a damaged record sets ec.
+            bool next(CaptureRecord& record, std::error_code& ec)
+            {
+                uint64_t connection = 0;
+                uint64_t delta = 0;
+                uint64_t length = 0;
+                if(!CaptureFormat::decode(_file, connection)) {
+                    return false;
+                }
+                if(!CaptureFormat::decode(_file, delta) || !CaptureFormat::decode(_file, length)) {
+                    return false;
+                }
+                // the remaining length of a packet takes at most four bytes, plus the fixed header byte
+                if(connection == 0 || connection > std::numeric_limits<uint32_t>::max() || length > 268435455 + 5) {
+                    ec = mqtt_error::capture_file_corrupted;
+                    return false;
+                }
+                record._packet.resize(static_cast<size_t>(length));
+                if(length != 0 && std::fread(record._packet.data(), 1, record._packet.size(), _file) != record._packet.size()) {
+                    return false;
+                }
+                _time += std::chrono::microseconds(delta);
+                record._connection = static_cast<uint32_t>(connection);
+                record._time = _time;
+                return true;
+            }
+            
+        private:
+            std::string _path;
+            std::FILE* _file;
+            std::chrono::microseconds _time;
+        };
+        
+    }
+}
+
+#endif
@@ -0,0 +1,677 @@
+//
+//  mqtt_client.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_client_h
+#define acatl_mqtt_client_h
+
+#include <acatl_network/socket_type.h>
+
+#include <acatl_mqtt/mqtt_control_packets.h>
+#include <acatl_mqtt/mqtt_error.h>
+#include <acatl_mqtt/mqtt_inflight_window.h>
+#include <acatl_mqtt/mqtt_parser.h>
+#include <acatl_mqtt/mqtt_serializer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        struct ClientOptions
+        {
+            std::string _host{"127.0.0.1"};
+            uint16_t _port{1883};
+            std::string _clientId;
+            bool _cleanSession{true};
+            /// Seconds, 0 disables PINGREQ and the detection of a dead connection.
+            uint16_t _keepAlive{60};
+            std::string _userName;
+            std::string _password;
+            /// QoS 1 and QoS 2 publishes sent before the first one is acknowledged.
+            uint16_t _receiveMaximum{InflightWindow::defaultReceiveMaximum};
+            /// Bytes of queued publishes serialized into a single write.
+            size_t _coalesceBytes{64 * 1024};
+            /// First delay after a lost connection, doubled for every failed attempt up to the maximum.
+            std::chrono::milliseconds _reconnectDelay{100};
+            std::chrono::milliseconds _maximumReconnectDelay{10000};
+        };
+        
+        /// An MQTT 3.1.1 client on asio. Publishes are pipelined: QoS 1 and QoS 2 publishes are sent without
+        /// waiting for the previous acknowledgement, up to the receive maximum, and all packets queued while a
+        /// write is in progress go out with the next write. A lost connection is reestablished with an increasing
+        /// delay until disconnect(). After a reconnect the unacknowledged publishes are sent again with the DUP flag
+        /// and the subscriptions are renewed.
+        ///
+        /// Not thread safe, all methods have to be called on the thread that runs the io_context, e.g. through
+        /// asio::post.
+        template<typename Socket>
+        class Client : public std::enable_shared_from_this<Client<Socket>>
+        {
+        public:
+            typedef Socket SocketType;
+            typedef std::shared_ptr<Client> Ptr;
+            typedef std::function<SocketType()> SocketFactory;
+            /// Called with an empty error code when the broker accepted the connection, with the error when it was
+            /// lost or refused.
+            typedef std::function<void(const std::error_code&)> ConnectionHandler;
+            typedef std::function<void(const PublishControlPacket&)> MessageHandler;
+            /// Called when a QoS 0 publish is written, or when a QoS 1 or QoS 2 publish is acknowledged. Gets
+            /// std::errc::operation_canceled if disconnect() dropped the publish.
+            typedef std::function<void(const std::error_code&)> CompletionHandler;
+            typedef std::function<void(const QoSLevels&)> SubscribeHandler;
+            
+            Client(asio::io_context& context, const ClientOptions& options, SocketFactory socketFactory)
+            : _options(options)
+            , _socketFactory(std::move(socketFactory))
+            , _socket(_socketFactory())
+            , _resolver(context)
+            , _reconnectTimer(context)
+            , _keepAliveTimer(context)
+            , _reconnectDelay(options._reconnectDelay)
+            , _window(options._receiveMaximum)
+            {
+                _readBuf.resize(64 * 1024);
+            }
+            
+            void setConnectionHandler(ConnectionHandler handler)
+            {
+                _connectionHandler = std::move(handler);
+            }
+            
+            void setMessageHandler(MessageHandler handler)
+            {
+                _messageHandler = std::move(handler);
+            }
+            
+            bool connected() const
+            {
+                return _state == State::Connected;
+            }
+            
+            /// Publishes waiting for the connection, for the coalescing limit or for room in the receive maximum.
+            /// Publishers that can outrun the network keep this bounded.
+            size_t queued() const
+            {
+                return _queue.size();
+            }
+            
+            /// QoS 1 and QoS 2 publishes sent but not acknowledged yet.
+            size_t inflight() const
+            {
+                return _window.size();
+            }
+            
+            void connect()
+            {
+                if(_state != State::Idle) {
+                    return;
+                }
+                _state = State::Connecting;
+                doConnect();
+            }
+            
+            /// Sends the packets serialized so far followed by DISCONNECT and closes the connection. Queued
+            /// publishes and those in flight are dropped.
+            void disconnect()
+            {
+                if(_state == State::Idle || _state == State::Stopped) {
+                    return;
+                }
+                bool connected = _state == State::Connected;
+                _state = State::Stopped;
+                _reconnectTimer.cancel();
+                _keepAliveTimer.cancel();
+                cancelPending();
+                if(connected) {
+                    append(DisconnectControlPacket());
+                    flush();
+                } else {
+                    close();
+                }
+            }
+            
+            void publish(const std::string& topic, const Payload& payload, QoSLevel qos = QoSLevel::AtMostOnce,
+                         bool retain = false, CompletionHandler completion = CompletionHandler())
+            {
+                Outgoing outgoing;
+                outgoing._publish._topicName = topic;
+                outgoing._publish.setQoS(qos);
+                if(retain) {
+                    outgoing._publish._header._flags |= 0x01;
+                }
+                outgoing._publish._payload = payload;
+                outgoing._completion = std::move(completion);
+                _queue.push_back(std::move(outgoing));
+                pump();
+            }
+            
+            /// The subscriptions are renewed after every reconnect, the handler is only called for the first SUBACK.
+            void subscribe(const TopicFilters& topicFilters, SubscribeHandler handler = SubscribeHandler())
+            {
+                _subscriptions.push_back({topicFilters, std::move(handler), SubscriptionState::Unsent});
+                pump();
+            }
+            
+        private:
+            enum class State
+            {
+                Idle,
+                Connecting,
+                Connected,
+                Stopped
+            };
+            
+            struct Outgoing
+            {
+                PublishControlPacket _publish;
+                CompletionHandler _completion;
+            };
+            
+            enum class SubscriptionState
+            {
+                Unsent,
+                Sent,
+                Acknowledged
+            };
+            
+            struct Subscription
+            {
+                TopicFilters _topicFilters;
+                SubscribeHandler _handler;
+                SubscriptionState _state;
+            };
+            
+            void doConnect()
+            {
+                auto self(this->shared_from_this());
+                uint64_t generation = ++_generation;
+                _resolver.async_resolve(_options._host, std::to_string(_options._port),
+                                        [self, generation](const std::error_code& ec, asio::ip::tcp::resolver::results_type results) {
+                    if(generation != self->_generation) {
+                        return;
+                    }
+                    if(ec) {
+                        self->connectionLost(ec);
+                        return;
+                    }
+                    asio::async_connect(self->_socket.lowest_layer(), results,
+                                        [self, generation](const std::error_code& ec, const asio::ip::tcp::endpoint& /*endpoint*/) {
+                        if(generation != self->_generation) {
+                            return;
+                        }
+                        if(ec) {
+                            self->connectionLost(ec);
+                            return;
+                        }
+                        asio::error_code ignored;
+                        self->_socket.lowest_layer().set_option(asio::ip::tcp::no_delay(true), ignored);
+                        self->_socket.clientHandshake([self, generation](const std::error_code& ec) {
+                            if(generation != self->_generation) {
+                                return;
+                            }
+                            if(ec) {
+                                self->connectionLost(ec);
+                                return;
+                            }
+                            self->sendConnect();
+                            self->read();
+                        });
+                    });
+                });
+            }
+            
+            void sendConnect()
+            {
+                ConnectControlPacket connect;
+                connect._protocolLevel = protocolLevel311;
+                connect._cleanSession = _options._cleanSession;
+                connect._keepAlive = _options._keepAlive;
+                connect._clientId = _options._clientId;
+                connect._userNameFlag = !_options._userName.empty();
+                connect._userName = _options._userName;
+                connect._passwordFlag = !_options._password.empty();
+                connect._password = _options._password;
+                _parser.reset();
+                append(connect);
+                flush();
+            }
+            
+            /// Closes the socket and schedules the next connection attempt.
+            void connectionLost(const std::error_code& ec)
+            {
+                if(_state == State::Stopped || _state == State::Idle) {
+                    return;
+                }
+                close();
+                _state = State::Connecting;
+                _keepAliveTimer.cancel();
+                
+                // subscriptions without SUBACK are sent again, their identifiers are taken anew
+                for(const auto& subscribing : _subscribing) {
+                    _window.unreserve(subscribing.first);
+                    _subscriptions[subscribing.second]._state = SubscriptionState::Unsent;
+                }
+                _subscribing.clear();
+                // the QoS 0 publishes of the lost writes are gone
+                failCompletions(_writeCompletions, ec);
+                failCompletions(_outCompletions, ec);
+                
+                if(_connectionHandler) {
+                    _connectionHandler(ec);
+                }
+                
+                auto self(this->shared_from_this());
+                uint64_t generation = _generation;
+                _reconnectTimer.expires_after(_reconnectDelay);
+                _reconnectTimer.async_wait([self, generation](const std::error_code& ec) {
+                    if(!ec && generation == self->_generation && self->_state == State::Connecting) {
+                        self->doConnect();
+                    }
+                });
+                _reconnectDelay = std::min(_reconnectDelay * 2, _options._maximumReconnectDelay);
+            }
+            
+            void close()
+            {
+                // handlers of the old socket see a different generation and are ignored
+                ++_generation;
+                asio::error_code ignored;
+                _socket.lowest_layer().close(ignored);
+                _socket = _socketFactory();
+                _writing = false;
+                _outBuf.clear();
+                _writeBuf.clear();
+            }
+            
+            void connected(const ConnAckControlPacket& connAck)
+            {
+                _state = State::Connected;
+                _reconnectDelay = _options._reconnectDelay;
+                bool sessionPresent = connAck._connectAcknowledgeFlag == ConnectAcknowledgeFlags::SessionPresent;
+                if(!sessionPresent) {
+                    _receivedExactlyOnce.clear();
+                }
+                
+                std::vector<ControlPacket::Ptr> packets;
+                _window.retransmissions(packets);
+                for(const auto& packet : packets) {
+                    append(*packet);
+                }
+                if(!sessionPresent) {
+                    for(auto& subscription : _subscriptions) {
+                        subscription._state = SubscriptionState::Unsent;
+                    }
+                }
+                
+                armKeepAlive();
+                if(_connectionHandler) {
+                    _connectionHandler(std::error_code());
+                }
+            }
+            
+            /// Serializes what the receive maximum and the coalescing limit allow into the next write.
+            void pump()
+            {
+                if(_state != State::Connected) {
+                    return;
+                }
+                for(size_t i = 0; i < _subscriptions.size() && !_window.full(); ++i) {
+                    if(_subscriptions[i]._state != SubscriptionState::Unsent) {
+                        continue;
+                    }
+                    SubscribeControlPacket subscribe;
+                    subscribe._packetIdentifier = _window.reserve();
+                    subscribe._topicFilters = _subscriptions[i]._topicFilters;
+                    _subscriptions[i]._state = SubscriptionState::Sent;
+                    _subscribing[subscribe._packetIdentifier] = i;
+                    append(subscribe);
+                }
+                
+                while(!_queue.empty() && _outBuf.size() < _options._coalesceBytes) {
+                    Outgoing& outgoing = _queue.front();
+                    if(outgoing._publish.qos() != QoSLevel::AtMostOnce) {
+                        if(_window.full()) {
+                            break;
+                        }
+                        PacketIdentifier packetIdentifier = _window.add(outgoing._publish);
+                        if(outgoing._completion) {
+                            _completions[packetIdentifier] = std::move(outgoing._completion);
+                        }
+                    } else if(outgoing._completion) {
+                        _outCompletions.push_back(std::move(outgoing._completion));
+                    }
+                    append(outgoing._publish);
+                    _queue.pop_front();
+                }
+                flush();
+            }
+            
+            void append(const ControlPacket& packet)
+            {
+                std::error_code ec;
+                size_t length = 0;
+                if(_serializer.serialize(packet, _serializeBuf, length, ec)) {
+                    _outBuf.insert(_outBuf.end(), _serializeBuf.begin(), _serializeBuf.begin() + static_cast<std::ptrdiff_t>(length));
+                }
+            }
+            
+            void flush()
+            {
+                if(_writing || _outBuf.empty()) {
+                    return;
+                }
+                _writing = true;
+                _written = true;
+                std::swap(_outBuf, _writeBuf);
+                std::swap(_outCompletions, _writeCompletions);
+                auto self(this->shared_from_this());
+                uint64_t generation = _generation;
+                asio::async_write(_socket(), asio::buffer(_writeBuf), [self, generation](const std::error_code& ec, std::size_t /*length*/) {
+                    if(generation != self->_generation) {
+                        return;
+                    }
+                    self->_writing = false;
+                    self->_writeBuf.clear();
+                    if(ec) {
+                        self->connectionLost(ec);
+                        return;
+                    }
+                    std::vector<CompletionHandler> completions;
+                    std::swap(completions, self->_writeCompletions);
+                    for(auto& completion : completions) {
+                        completion(std::error_code());
+                    }
+                    if(self->_state == State::Stopped) {
+                        if(self->_outBuf.empty()) {
+                            self->close();
+                        } else {
+                            self->flush();
+                        }
+                        return;
+                    }
+                    self->pump();
+                });
+            }
+            
+            void read()
+            {
+                auto self(this->shared_from_this());
+                uint64_t generation = _generation;
+                _socket().async_read_some(asio::buffer(_readBuf), [self, generation](const std::error_code& ec, std::size_t length) {
+                    if(generation != self->_generation) {
+                        return;
+                    }
+                    if(ec) {
+                        self->connectionLost(ec);
+                        return;
+                    }
+                    self->handleRead(length);
+                });
+            }
+            
+            void handleRead(size_t length)
+            {
+                if(_state == State::Stopped) {
+                    return;
+                }
+                uint64_t generation = _generation;
+                _received = true;
+                _pingOutstanding = false;
+                size_t index = 0;
+                while(index < length) {
+                    std::error_code ec;
+                    acatl::Tribool ret;
+                    while(ret.isIndeterminate() && index < length) {
+                        ret = _parser.parse(_readBuf[index++], ec);
+                    }
+                    if(ret.isFalse() || ec) {
+                        connectionLost(ec ? ec : make_error_code(mqtt_error::malformed_control_packet));
+                        return;
+                    } else if(ret.isTrue()) {
+                        handlePacket(_parser.consumePacket());
+                        // a handler may have disconnected
+                        if(generation != _generation || _state == State::Stopped) {
+                            return;
+                        }
+                    }
+                }
+                pump();
+                read();
+            }
+            
+            void handlePacket(ControlPacket::Ptr packet)
+            {
+                switch(packet->_header._controlPacketType) {
+                    case ControlPacketType::Connack: {
+                        const auto& connAck = static_cast<const ConnAckControlPacket&>(*packet);
+                        if(connAck._connectReturnCode != ConnectReturnCode::ConnectionAccepted) {
+                            connectionLost(mqtt_error::connection_refused);
+                        } else {
+                            connected(connAck);
+                        }
+                        break;
+                    }
+                    case ControlPacketType::Suback: {
+                        const auto& subAck = static_cast<const SubAckControlPacket&>(*packet);
+                        auto it = _subscribing.find(subAck._packetIdentifier);
+                        if(it != _subscribing.end()) {
+                            _window.unreserve(it->first);
+                            Subscription& subscription = _subscriptions[it->second];
+                            _subscribing.erase(it);
+                            subscription._state = SubscriptionState::Acknowledged;
+                            if(subscription._handler) {
+                                SubscribeHandler handler = std::move(subscription._handler);
+                                subscription._handler = SubscribeHandler();
+                                handler(subAck._qosLevels);
+                            }
+                        }
+                        break;
+                    }
+                    case ControlPacketType::Publish: {
+                        const auto& publish = static_cast<const PublishControlPacket&>(*packet);
+                        if(publish.qos() == QoSLevel::ExactlyOnce) {
+                            // a duplicate is acknowledged again but delivered only once
+                            if(_receivedExactlyOnce.insert(publish._packetIdentifier).second && _messageHandler) {
+                                _messageHandler(publish);
+                            }
+                            append(PubRecControlPacket(publish._packetIdentifier));
+                            break;
+                        }
+                        if(_messageHandler) {
+                            _messageHandler(publish);
+                        }
+                        if(publish.qos() == QoSLevel::AtLeastOnce) {
+                            append(PubAckControlPacket(publish._packetIdentifier));
+                        }
+                        break;
+                    }
+                    case ControlPacketType::Pubrel: {
+                        PacketIdentifier packetIdentifier = static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier;
+                        _receivedExactlyOnce.erase(packetIdentifier);
+                        append(PubCompControlPacket(packetIdentifier));
+                        break;
+                    }
+                    case ControlPacketType::Puback: {
+                        PacketIdentifier packetIdentifier = static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier;
+                        if(_window.acknowledge(packetIdentifier)) {
+                            complete(packetIdentifier);
+                        }
+                        break;
+                    }
+                    case ControlPacketType::Pubrec: {
+                        PacketIdentifier packetIdentifier = static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier;
+                        _window.receive(packetIdentifier);
+                        append(PubRelControlPacket(packetIdentifier));
+                        break;
+                    }
+                    case ControlPacketType::Pubcomp: {
+                        PacketIdentifier packetIdentifier = static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier;
+                        if(_window.complete(packetIdentifier)) {
+                            complete(packetIdentifier);
+                        }
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+            
+            void complete(PacketIdentifier packetIdentifier)
+            {
+                auto it = _completions.find(packetIdentifier);
+                if(it != _completions.end()) {
+                    CompletionHandler completion = std::move(it->second);
+                    _completions.erase(it);
+                    completion(std::error_code());
+                }
+            }
+            
+            void failCompletions(std::vector<CompletionHandler>& completions, const std::error_code& ec)
+            {
+                std::vector<CompletionHandler> failed;
+                std::swap(failed, completions);
+                for(auto& completion : failed) {
+                    completion(ec);
+                }
+            }
+            
+            void cancelPending()
+            {
+                std::error_code ec = std::make_error_code(std::errc::operation_canceled);
+                std::vector<CompletionHandler> failed;
+                for(auto& outgoing : _queue) {
+                    if(outgoing._completion) {
+                        failed.push_back(std::move(outgoing._completion));
+                    }
+                }
+                _queue.clear();
+                for(auto& completion : _completions) {
+                    failed.push_back(std::move(completion.second));
+                }
+                _completions.clear();
+                _window.clear();
+                _subscribing.clear();
+                for(auto& subscription : _subscriptions) {
+                    subscription._state = SubscriptionState::Unsent;
+                }
+                failCompletions(failed, ec);
+            }
+            
+            /// Sends PINGREQ if nothing was written for a keep alive period. A connection that stays silent for a
+            /// whole period after the PINGREQ is considered lost.
+            void armKeepAlive()
+            {
+                if(_options._keepAlive == 0) {
+                    return;
+                }
+                _written = false;
+                _received = false;
+                auto self(this->shared_from_this());
+                uint64_t generation = _generation;
+                _keepAliveTimer.expires_after(std::chrono::seconds(_options._keepAlive));
+                _keepAliveTimer.async_wait([self, generation](const std::error_code& ec) {
+                    if(ec || generation != self->_generation || self->_state != State::Connected) {
+                        return;
+                    }
+                    if(self->_pingOutstanding && !self->_received) {
+                        self->connectionLost(std::make_error_code(std::errc::timed_out));
+                        return;
+                    }
+                    if(!self->_written) {
+                        self->_pingOutstanding = true;
+                        self->append(PingReqControlPacket());
+                        self->flush();
+                    }
+                    self->armKeepAlive();
+                });
+            }
+            
+            ClientOptions _options;
+            SocketFactory _socketFactory;
+            SocketType _socket;
+            asio::ip::tcp::resolver _resolver;
+            asio::steady_timer _reconnectTimer;
+            asio::steady_timer _keepAliveTimer;
+            State _state{State::Idle};
+            // incremented whenever the socket is closed, handlers of an older socket return early
+            uint64_t _generation{0};
+            std::chrono::milliseconds _reconnectDelay;
+            MQTTParser _parser;
+            Serializer _serializer;
+            InflightWindow _window;
+            std::deque<Outgoing> _queue;
+            std::unordered_map<PacketIdentifier, CompletionHandler> _completions;
+            std::vector<Subscription> _subscriptions;
+            // SUBSCRIBE packet identifier to index in _subscriptions
+            std::unordered_map<PacketIdentifier, size_t> _subscribing;
+            std::unordered_set<PacketIdentifier> _receivedExactlyOnce;
+            ConnectionHandler _connectionHandler;
+            MessageHandler _messageHandler;
+            std::vector<uint8_t> _readBuf;
+            std::vector<uint8_t> _serializeBuf;
+            std::vector<uint8_t> _outBuf;
+            std::vector<uint8_t> _writeBuf;
+            // completions of the QoS 0 publishes in _outBuf and _writeBuf
+            std::vector<CompletionHandler> _outCompletions;
+            std::vector<CompletionHandler> _writeCompletions;
+            bool _writing{false};
+            bool _written{false};
+            bool _received{false};
+            bool _pingOutstanding{false};
+        };
+        
+        /// Creates a client that connects through sockets of the given type, e.g.
+        /// make_client<acatl::net::SecureSocket>(context, options, sslContext).
+        template<typename SocketType, typename ContextType>
+        typename Client<SocketType>::Ptr make_client(asio::io_context& context, const ClientOptions& options, ContextType& sslContext)
+        {
+            return std::make_shared<Client<SocketType>>(context, options, [&context, &sslContext]() {
+                return acatl::net::make_socket<SocketType>(context, sslContext);
+            });
+        }
+        
+    }
+}
+
+#endif
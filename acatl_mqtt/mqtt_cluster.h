@@ -0,0 +1,316 @@
+//
+//  mqtt_cluster.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_cluster_h
+#define acatl_mqtt_cluster_h
+
+#include <acatl/logging.h>
+
+#include <acatl_mqtt/mqtt_client.h>
+#include <acatl_mqtt/mqtt_processor.h>
+#include <acatl_mqtt/mqtt_session_manager.h>
+#include <acatl_mqtt/mqtt_subscription_tree_manager.h>
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        struct ClusterPeer
+        {
+            std::string _host;
+            uint16_t _port{1883};
+        };
+        
+        struct ClusterOptions
+        {
+            /// Unique within the cluster, the links connect to the peers as client $cluster/<node id>.
+            std::string _nodeId;
+            std::vector<ClusterPeer> _peers;
+            /// Topic levels kept in the announced interest, deeper filters are cut to their prefix followed by '#'.
+            /// 0 announces the filters as they are.
+            size_t _summaryDepth{2};
+            /// Forwarded publishes are delivered with the lower of their QoS and this one.
+            QoSLevel _qos{QoSLevel::AtLeastOnce};
+            /// Credentials of the links, shared by all nodes. A node only accepts links of its peers presenting them,
+            /// so the password must not be empty. The ACL of the peers has to allow the links to read.
+            std::string _userName;
+            std::string _password;
+        };
+        
+        /// The connection of a cluster node to one of its peers. The link is an MQTT client of the peer, which
+        /// subscribes to the interest of the local clients. So the peer forwards exactly the publishes of its own
+        /// clients that match the interest, through its regular subscription tree and send queues. Received
+        /// publishes are delivered to the local clients only, every node forwards to all others directly.
+        template<typename Socket>
+        class ClusterLink : public std::enable_shared_from_this<ClusterLink<Socket>>
+        {
+        public:
+            typedef std::shared_ptr<ClusterLink> Ptr;
+            typedef typename Client<Socket>::SocketFactory SocketFactory;
+            
+            ClusterLink(asio::io_context& context,
+                        const ClusterOptions& options,
+                        const ClusterPeer& peer,
+                        SubscriptionTreeManager& subscriptionTreeManager,
+                        SessionManager& sessionManager,
+                        SocketFactory socketFactory)
+            : _context(context)
+            , _peer(peer)
+            , _client(std::make_shared<Client<Socket>>(context, clientOptions(options, peer), std::move(socketFactory)))
+            , _processor(subscriptionTreeManager, sessionManager)
+            , _received(0)
+            {
+                _processor.setLocalDelivery(true);
+            }
+            
+            void start()
+            {
+                std::weak_ptr<ClusterLink> weakSelf(this->shared_from_this());
+                asio::post(_context, [weakSelf]() {
+                    auto self = weakSelf.lock();
+                    if(!self) {
+                        return;
+                    }
+                    self->_client->setMessageHandler([weakSelf](const PublishControlPacket& pub) {
+                        if(auto self = weakSelf.lock()) {
+                            self->forward(pub);
+                        }
+                    });
+                    self->_client->setConnectionHandler([weakSelf](const std::error_code& ec) {
+                        if(auto self = weakSelf.lock()) {
+                            if(ec) {
+                                ACATL_CLASSLOG(ClusterLink, 2, "Link to " << self->_peer._host << ":" << self->_peer._port << " lost: " << ec.message());
+                            } else {
+                                ACATL_CLASSLOG(ClusterLink, 1, "Linked to " << self->_peer._host << ":" << self->_peer._port);
+                            }
+                        }
+                    });
+                    self->_client->connect();
+                });
+            }
+            
+            void stop()
+            {
+                auto self(this->shared_from_this());
+                asio::post(_context, [self]() { self->_client->disconnect(); });
+            }
+            
+            /// Announces additional interest to the peer. The client renews the subscriptions after a reconnect.
+            void subscribe(const TopicFilters& topicFilters)
+            {
+                auto self(this->shared_from_this());
+                asio::post(_context, [self, topicFilters]() { self->_client->subscribe(topicFilters); });
+            }
+            
+            const ClusterPeer& peer() const
+            {
+                return _peer;
+            }
+            
+            /// @return The publishes the peer forwarded.
+            uint64_t received() const
+            {
+                return _received.load(std::memory_order_relaxed);
+            }
+            
+        private:
+            static ClientOptions clientOptions(const ClusterOptions& options, const ClusterPeer& peer)
+            {
+                ClientOptions clientOptions;
+                clientOptions._host = peer._host;
+                clientOptions._port = peer._port;
+                clientOptions._clientId = clusterLinkPrefix + options._nodeId;
+                clientOptions._userName = options._userName;
+                clientOptions._password = options._password;
+                return clientOptions;
+            }
+            
+            void forward(const PublishControlPacket& pub)
+            {
+                _received.fetch_add(1, std::memory_order_relaxed);
+                std::error_code ec;
+                _processor.publish(pub, ec);
+                if(ec) {
+                    ACATL_CLASSLOG(ClusterLink, 2, "Cannot deliver forwarded publish on '" << pub._topicName._name << "': " << ec.message());
+                }
+            }
+            
+            asio::io_context& _context;
+            ClusterPeer _peer;
+            typename Client<Socket>::Ptr _client;
+            // only used on the io_context of the link
+            Processor _processor;
+            std::atomic<uint64_t> _received;
+        };
+        
+        
+        /// The links of a node to all other nodes of the cluster and the interest announced over them. The interest
+        /// is a summary of the subscriptions of the local clients: filters cut to a few topic levels, so it stays
+        /// small and changes rarely while clients come and go. The peers match their publishes against it and
+        /// forward only what a local client may want.
+        ///
+        /// The subscription tree never drops filters, neither does the announced interest. Retained messages and
+        /// topics starting with '$' stay local to each node.
+        template<typename Socket>
+        class Cluster
+        {
+        public:
+            typedef ClusterLink<Socket> Link;
+            
+            Cluster(const ClusterOptions& options, SubscriptionTreeManager& subscriptionTreeManager, SessionManager& sessionManager)
+            : _options(options)
+            , _subscriptionTreeManager(subscriptionTreeManager)
+            , _sessionManager(sessionManager)
+            {}
+            
+            const ClusterOptions& options() const
+            {
+                return _options;
+            }
+            
+            /// The link runs on the given io_context, which has to outlive it.
+            void addLink(asio::io_context& context, const ClusterPeer& peer, typename Link::SocketFactory socketFactory)
+            {
+                typename Link::Ptr link = std::make_shared<Link>(context, _options, peer, _subscriptionTreeManager,
+                                                                 _sessionManager, std::move(socketFactory));
+                if(!_summary.empty()) {
+                    link->subscribe(announced());
+                }
+                _links.push_back(link);
+            }
+            
+            /// Adds a link whose sockets are created from the given SSL context, e.g. acatl::net::NullContext for
+            /// plain TCP.
+            template<typename ContextType>
+            void addLink(asio::io_context& context, const ClusterPeer& peer, ContextType& sslContext)
+            {
+                addLink(context, peer, [&context, &sslContext]() {
+                    return acatl::net::make_socket<Socket>(context, sslContext);
+                });
+            }
+            
+            void start()
+            {
+                for(const auto& link : _links) {
+                    link->start();
+                }
+            }
+            
+            void stop()
+            {
+                for(const auto& link : _links) {
+                    link->stop();
+                }
+            }
+            
+            /// Summarizes the current subscriptions and announces the filters that were not announced before, all of
+            /// them in one SUBSCRIBE per link. Does nothing if the subscriptions did not change since the last call.
+            /// Not synchronized, has to be called from one thread at a time.
+            /// @return The number of filters announced.
+            size_t updateSummary()
+            {
+                SubscriptionTree::ConstPtr tree = _subscriptionTreeManager.getCurrentSubscriptionTree();
+                if(tree == _summarizedTree.lock()) {
+                    return 0;
+                }
+                _summarizedTree = tree;
+                
+                std::set<std::string> filters;
+                tree->summarize(_options._summaryDepth, [](const Session& session) {
+                    return !isClusterLink(session.clientId());
+                }, filters);
+                TopicFilters added;
+                for(const auto& filter : filters) {
+                    if(filter.empty() || filter[0] == '$') {
+                        continue;
+                    }
+                    if(_summary.insert(filter).second) {
+                        added.emplace_back(filter, _options._qos);
+                    }
+                }
+                if(added.empty()) {
+                    return 0;
+                }
+                ACATL_CLASSLOG(Cluster, 2, "Announcing " << added.size() << " filters to " << _links.size() << " peers");
+                for(const auto& link : _links) {
+                    link->subscribe(added);
+                }
+                return added.size();
+            }
+            
+            /// @return The filters announced so far.
+            const std::set<std::string>& summary() const
+            {
+                return _summary;
+            }
+            
+            /// @return The publishes forwarded by all peers.
+            uint64_t received() const
+            {
+                uint64_t received = 0;
+                for(const auto& link : _links) {
+                    received += link->received();
+                }
+                return received;
+            }
+            
+        private:
+            TopicFilters announced() const
+            {
+                TopicFilters filters;
+                for(const auto& filter : _summary) {
+                    filters.emplace_back(filter, _options._qos);
+                }
+                return filters;
+            }
+            
+            ClusterOptions _options;
+            SubscriptionTreeManager& _subscriptionTreeManager;
+            SessionManager& _sessionManager;
+            std::vector<typename Link::Ptr> _links;
+            std::weak_ptr<const SubscriptionTree> _summarizedTree;
+            std::set<std::string> _summary;
+        };
+        
+    }
+}
+
+#endif
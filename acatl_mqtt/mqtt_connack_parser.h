@@ -35,6 +35,7 @@
 #define acatl_mqtt_connack_parser_h
 
 #include <acatl_mqtt/mqtt_control_packets.h>
+#include <acatl_mqtt/mqtt_properties.h>
 
 #include <acatl/tribool.h>
 
@@ -51,16 +52,25 @@ namespace acatl
             {
                 ConnectAcknowledgeFlag,
                 ConnectReturnCode,
+                Properties,
                 Ready
             };
 
             ConnectAckParser()
             : _status(Status::ConnectAcknowledgeFlag)
+            , _protocolLevel(protocolLevel311)
             {}
             
+            /// An MQTT 5.0 CONNACK carries a reason code instead of a return code and properties. Survives reset.
+            void setProtocolLevel(uint8_t protocolLevel)
+            {
+                _protocolLevel = protocolLevel;
+            }
+            
             void reset()
             {
                 _status = Status::ConnectAcknowledgeFlag;
+                _packet._properties = acatl::mqtt::Properties();
             }
             
             acatl::Tribool parse(uint8_t byte, std::error_code& ec)
@@ -76,6 +86,13 @@ namespace acatl
                         _status = Status::ConnectReturnCode;
                         break;
                     case Status::ConnectReturnCode:
+                        if(_protocolLevel == protocolLevel5) {
+                            // the reason codes of MQTT 5.0 are passed on as they are
+                            _packet._connectReturnCode = ConnectReturnCode(byte);
+                            _propertiesParser.reset();
+                            _status = Status::Properties;
+                            break;
+                        }
                         if(byte > 5) {
                             ec = mqtt_error::invalid_connect_return_code;
                             _status = Status::Ready;
@@ -84,6 +101,14 @@ namespace acatl
                         _packet._connectReturnCode = ConnectReturnCode(byte);
                         _status = Status::Ready;
                         return acatl::Tribool(true);
+                    case Status::Properties: {
+                        acatl::Tribool ret = _propertiesParser.parse(byte, ec);
+                        if(!ret.isIndeterminate()) {
+                            _packet._properties = _propertiesParser.properties();
+                            _status = Status::Ready;
+                        }
+                        return ret;
+                    }
                     case Status::Ready:
                         ec = mqtt_error::packet_identifier_length_violation;
                         return acatl::Tribool(false);
@@ -99,6 +124,8 @@ namespace acatl
         private:
             Status _status;
             ConnAckControlPacket _packet;
+            uint8_t _protocolLevel;
+            PropertiesParser _propertiesParser;
         };
         
     }
@@ -35,6 +35,7 @@
 #define acatl_mqtt_connect_parser_h
 
 #include <acatl_mqtt/mqtt_control_packets.h>
+#include <acatl_mqtt/mqtt_properties.h>
 #include <acatl_mqtt/mqtt_string_parser.h>
 
 #include <acatl/tribool.h>
@@ -56,7 +57,9 @@ namespace acatl
                 ConnectFlags,
                 KeepAliveMsb,
                 KeepAliveLsb,
+                Properties,
                 ClientId,
+                WillProperties,
                 WillTopic,
                 WillMessage,
                 Username,
@@ -75,6 +78,7 @@ namespace acatl
                 _status = Status::ProtocolName;
                 _length = length;
                 _stringParser.reset();
+                _packet._properties = acatl::mqtt::Properties();
             }
             
             acatl::Tribool parse(uint8_t byte, std::error_code& ec)
@@ -105,7 +109,7 @@ namespace acatl
                         break;
                     }
                     case Status::ProtocolLevel:
-                        if(byte != 0x04) {
+                        if(byte != protocolLevel311 && byte != protocolLevel5) {
                             ec = mqtt_error::unacceptable_protocol_level;
                             _status = Status::Ready;
                             _ret.set(false);
@@ -136,8 +140,24 @@ namespace acatl
                         break;
                     case Status::KeepAliveLsb:
                         _packet._keepAlive |= static_cast<uint16_t>(byte);
-                        _status = Status::ClientId;
+                        if(_packet._protocolLevel == protocolLevel5) {
+                            _propertiesParser.reset();
+                            _status = Status::Properties;
+                        } else {
+                            _status = Status::ClientId;
+                        }
+                        break;
+                    case Status::Properties: {
+                        acatl::Tribool ret = _propertiesParser.parse(byte, ec);
+                        if(ret.isFalse()) {
+                            _status = Status::Ready;
+                            _ret.set(false);
+                        } else if(ret.isTrue()) {
+                            _packet._properties = _propertiesParser.properties();
+                            _status = Status::ClientId;
+                        }
                         break;
+                    }
                     case Status::ClientId: {
                         acatl::Tribool ret = _stringParser.parse(byte, ec);
                         if(!ret.isIndeterminate()) {
@@ -154,7 +174,10 @@ namespace acatl
                                     }
                                     _packet._clientId = acatl::UuidGenerator::generate().toString();
                                 }
-                                if(_packet._willFlag) {
+                                if(_packet._willFlag && _packet._protocolLevel == protocolLevel5) {
+                                    _propertiesParser.reset();
+                                    _status = Status::WillProperties;
+                                } else if(_packet._willFlag) {
                                     _status = Status::WillTopic;
                                 } else if(_packet._userNameFlag) {
                                     _status = Status::Username;
@@ -167,6 +190,17 @@ namespace acatl
                         }
                         break;
                     }
+                    case Status::WillProperties: {
+                        // the will delay and the other will properties are not supported and skipped
+                        acatl::Tribool ret = _propertiesParser.parse(byte, ec);
+                        if(ret.isFalse()) {
+                            _status = Status::Ready;
+                            _ret.set(false);
+                        } else if(ret.isTrue()) {
+                            _status = Status::WillTopic;
+                        }
+                        break;
+                    }
                     case Status::WillTopic: {
                         acatl::Tribool ret = _stringParser.parse(byte, ec);
                         if(!ret.isIndeterminate()) {
@@ -251,6 +285,7 @@ namespace acatl
             acatl::Tribool _ret;
             uint32_t _length;
             StringParser _stringParser;
+            PropertiesParser _propertiesParser;
         };
         
     }
@@ -34,8 +34,14 @@
 #ifndef acatl_mqtt_control_packets_h
 #define acatl_mqtt_control_packets_h
 
+#include <acatl_mqtt/mqtt_payload_stream.h>
+#include <acatl_mqtt/mqtt_properties.h>
 #include <acatl_mqtt/mqtt_topic.h>
 
+#include <chrono>
+#include <initializer_list>
+#include <vector>
+
 
 namespace acatl
 {
@@ -149,6 +155,8 @@ namespace acatl
             std::string _willMessage;
             std::string _userName;
             std::string _password;
+            // MQTT 5.0 only
+            Properties _properties;
         };
         
         struct ConnAckControlPacket : public ControlPacket
@@ -163,6 +171,8 @@ namespace acatl
             
             ConnectAcknowledgeFlags _connectAcknowledgeFlag;
             ConnectReturnCode _connectReturnCode;
+            // MQTT 5.0 only
+            Properties _properties;
         };
         
         struct PingReqControlPacket : public ControlPacket
@@ -183,17 +193,159 @@ namespace acatl
             {}
         };
 
+        struct FlowCredit;
+        
+        /// The bytes of a publish payload. Copies share the bytes, so fanning a publish out to many sessions or keeping
+        /// it as retained message does not copy the payload. Modifying a shared payload detaches it first.
+        class Payload
+        {
+        public:
+            typedef std::vector<uint8_t>::const_iterator const_iterator;
+            
+            Payload() = default;
+            
+            Payload(std::initializer_list<uint8_t> bytes)
+            : _bytes(std::make_shared<std::vector<uint8_t>>(bytes))
+            {}
+            
+            Payload& operator=(std::initializer_list<uint8_t> bytes)
+            {
+                _bytes = std::make_shared<std::vector<uint8_t>>(bytes);
+                return *this;
+            }
+            
+            bool operator==(const Payload& rhs) const
+            {
+                return _bytes == rhs._bytes || bytes() == rhs.bytes();
+            }
+            
+            size_t size() const
+            {
+                return _bytes ? _bytes->size() : 0;
+            }
+            
+            bool empty() const
+            {
+                return size() == 0;
+            }
+            
+            const uint8_t& operator[](size_t index) const
+            {
+                return (*_bytes)[index];
+            }
+            
+            const_iterator begin() const
+            {
+                return bytes().begin();
+            }
+            
+            const_iterator end() const
+            {
+                return bytes().end();
+            }
+            
+            void clear()
+            {
+                _bytes.reset();
+            }
+            
+            void reserve(size_t size)
+            {
+                mutableBytes().reserve(size);
+            }
+            
+            void push_back(uint8_t byte)
+            {
+                mutableBytes().push_back(byte);
+            }
+            
+            template<typename InputIterator>
+            void assign(InputIterator first, InputIterator last)
+            {
+                _bytes = std::make_shared<std::vector<uint8_t>>(first, last);
+            }
+            
+            void assign(size_t count, uint8_t byte)
+            {
+                _bytes = std::make_shared<std::vector<uint8_t>>(count, byte);
+            }
+            
+            /// True if both payloads refer to the same bytes.
+            bool shares(const Payload& rhs) const
+            {
+                return _bytes && _bytes == rhs._bytes;
+            }
+            
+        private:
+            const std::vector<uint8_t>& bytes() const
+            {
+                static const std::vector<uint8_t> empty;
+                return _bytes ? *_bytes : empty;
+            }
+            
+            std::vector<uint8_t>& mutableBytes()
+            {
+                if(!_bytes) {
+                    _bytes = std::make_shared<std::vector<uint8_t>>();
+                } else if(_bytes.use_count() > 1) {
+                    _bytes = std::make_shared<std::vector<uint8_t>>(*_bytes);
+                }
+                return *_bytes;
+            }
+            
+            std::shared_ptr<std::vector<uint8_t>> _bytes;
+        };
+        
         struct PublishControlPacket : public ControlPacket
         {
             typedef std::unique_ptr<PublishControlPacket> Ptr;
             
             PublishControlPacket()
             : ControlPacket(ControlPacketType::Publish)
+            , _packetIdentifier(0)
             {}
             
+            QoSLevel qos() const
+            {
+                return QoSLevel((_header._flags & 0x06) >> 1);
+            }
+            
+            /// Sets the QoS level and clears the DUP flag, which only a retransmission sets again.
+            void setQoS(QoSLevel qos)
+            {
+                _header._flags = static_cast<HeaderFlags>((_header._flags & 0x01) | (static_cast<uint8_t>(qos) << 1));
+            }
+            
+            /// The payload bytes, including those of a streamed payload that are not in _payload.
+            size_t payloadSize() const
+            {
+                if(_stream) {
+                    return _stream->size();
+                } else if(_streamReader) {
+                    return _streamReader->size();
+                }
+                return _payload.size();
+            }
+            
+            /// True if the publish was sampled by a LatencyTracer.
+            bool traced() const
+            {
+                return _traceTimestamp.time_since_epoch().count() != 0;
+            }
+            
             TopicName _topicName;
             PacketIdentifier _packetIdentifier;
-            std::vector<uint8_t> _payload;
+            // MQTT 5.0 only, a topic alias is resolved by the parser and assigned by the serializer of each connection
+            Properties _properties;
+            Payload _payload;
+            // a large payload that is still being received, set on the publish passed to the processor
+            PayloadStream::Ptr _stream;
+            // the payload of a streamed delivery, the packet itself only carries the topic
+            PayloadStream::Reader::Ptr _streamReader;
+            // accounts the bytes of a delivery against the publisher's flow control until the packet is released
+            std::shared_ptr<FlowCredit> _credit;
+            // the start of the current stage of a sampled publish, see LatencyTracer
+            std::chrono::steady_clock::time_point _traceTimestamp;
         };
         
         struct SubscribeControlPacket : public ControlPacket
@@ -206,6 +358,8 @@ namespace acatl
             
             PacketIdentifier _packetIdentifier;
             TopicFilters _topicFilters;
+            // MQTT 5.0 only
+            Properties _properties;
         };
         
         struct SubAckControlPacket : public ControlPacket
@@ -218,6 +372,62 @@ namespace acatl
             
             PacketIdentifier _packetIdentifier;
             QoSLevels _qosLevels;
+            // MQTT 5.0 only
+            Properties _properties;
+        };
+        
+        /// Common layout of PUBACK, PUBREC, PUBREL and PUBCOMP, which only carry the identifier of the publish they
+        /// acknowledge.
+        struct AcknowledgeControlPacket : public ControlPacket
+        {
+            typedef std::unique_ptr<AcknowledgeControlPacket> Ptr;
+            
+            AcknowledgeControlPacket(ControlPacketType controlPacketType, PacketIdentifier packetIdentifier)
+            : ControlPacket(controlPacketType)
+            , _packetIdentifier(packetIdentifier)
+            {
+                _header._length = 2;
+            }
+            
+            PacketIdentifier _packetIdentifier;
+        };
+        
+        struct PubAckControlPacket : public AcknowledgeControlPacket
+        {
+            typedef std::unique_ptr<PubAckControlPacket> Ptr;
+            
+            explicit PubAckControlPacket(PacketIdentifier packetIdentifier = 0)
+            : AcknowledgeControlPacket(ControlPacketType::Puback, packetIdentifier)
+            {}
+        };
+        
+        struct PubRecControlPacket : public AcknowledgeControlPacket
+        {
+            typedef std::unique_ptr<PubRecControlPacket> Ptr;
+            
+            explicit PubRecControlPacket(PacketIdentifier packetIdentifier = 0)
+            : AcknowledgeControlPacket(ControlPacketType::Pubrec, packetIdentifier)
+            {}
+        };
+        
+        struct PubRelControlPacket : public AcknowledgeControlPacket
+        {
+            typedef std::unique_ptr<PubRelControlPacket> Ptr;
+            
+            explicit PubRelControlPacket(PacketIdentifier packetIdentifier = 0)
+            : AcknowledgeControlPacket(ControlPacketType::Pubrel, packetIdentifier)
+            {
+                _header._flags = 0x02;
+            }
+        };
+        
+        struct PubCompControlPacket : public AcknowledgeControlPacket
+        {
+            typedef std::unique_ptr<PubCompControlPacket> Ptr;
+            
+            explicit PubCompControlPacket(PacketIdentifier packetIdentifier = 0)
+            : AcknowledgeControlPacket(ControlPacketType::Pubcomp, packetIdentifier)
+            {}
         };
         
         struct DisconnectControlPacket : public ControlPacket
@@ -228,6 +438,16 @@ namespace acatl
             : ControlPacket(ControlPacketType::Disconnect)
             {}
         };
+        
+        /// Estimates the number of bytes a packet occupies on the wire, which is good enough for accounting.
+        inline size_t estimatedPacketSize(const ControlPacket& packet)
+        {
+            if(packet._header._controlPacketType == ControlPacketType::Publish) {
+                const PublishControlPacket& publish = static_cast<const PublishControlPacket&>(packet);
+                return 9 + publish._topicName._name.size() + publish._properties._other.size() + publish._payload.size();
+            }
+            return 5 + packet._header._length;
+        }
     }
 }
 
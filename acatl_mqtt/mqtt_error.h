@@ -72,7 +72,15 @@ namespace acatl
             session_not_found = 25,
             no_packet_sender = 26,
             invalid_wildcard_in_topic = 27,
-            clean_session_not_set_for_empty_client_id = 28
+            clean_session_not_set_for_empty_client_id = 28,
+            session_store_corrupted = 29,
+            packet_too_large = 30,
+            topic_too_long = 31,
+            too_many_subscriptions = 32,
+            malformed_properties = 33,
+            invalid_topic_alias = 34,
+            connection_refused = 35,
+            capture_file_corrupted = 36
         };
         
         class mqtt_error_category_t : public std::error_category
@@ -142,13 +150,29 @@ namespace acatl
                         return "Invalid wildcard in topic name";
                     case mqtt_error::clean_session_not_set_for_empty_client_id:
                         return "Clean session not set for empty client id";
+                    case mqtt_error::session_store_corrupted:
+                        return "Session store corrupted";
+                    case mqtt_error::packet_too_large:
+                        return "Packet exceeds maximum packet size";
+                    case mqtt_error::topic_too_long:
+                        return "Topic exceeds maximum topic length";
+                    case mqtt_error::too_many_subscriptions:
+                        return "Too many subscriptions in one packet";
+                    case mqtt_error::malformed_properties:
+                        return "Malformed properties";
+                    case mqtt_error::invalid_topic_alias:
+                        return "Invalid topic alias";
+                    case mqtt_error::connection_refused:
+                        return "Connection refused by the broker";
+                    case mqtt_error::capture_file_corrupted:
+                        return "Capture file corrupted";
                     default:
                         throw std::runtime_error("unknown error code");
                 }
             }
         };
         
-        static const std::error_category& mqtt_error_category()
+        inline const std::error_category& mqtt_error_category()
         {
             static mqtt_error_category_t instance;
             return instance;
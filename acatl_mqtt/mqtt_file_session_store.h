@@ -0,0 +1,695 @@
+//
+//  mqtt_file_session_store.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_file_session_store_h
+#define acatl_mqtt_file_session_store_h
+
+#include <acatl_mqtt/mqtt_session_store.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// Options of the file based session store.
+        struct FileSessionStoreOptions
+        {
+            /// The log is synced to disk by a background thread after this many records, so the threads persisting
+            /// sessions never wait for the disk. Records written since the last sync may get lost on a crash, flush()
+            /// syncs at once.
+            size_t _syncEvery{64};
+            
+            /// The log gets compacted as soon as it is larger than the live records times this ratio ...
+            double _compactionRatio{2.0};
+            
+            /// ... and larger than this number of bytes.
+            uint64_t _compactionMinBytes{1024 * 1024};
+        };
+        
+        
+        /// A session store that keeps all sessions in a single append-only log file. Every change appends a record,
+        /// which either holds the complete subscription set of a client or marks the client as removed. A session
+        /// persisted without a change since its last record is not written again. Opening the store only reads the
+        /// type and client id of every record and seeks past its subscriptions, in order to build an index of the
+        /// latest record per client. The subscriptions are read when the client connects for the first time.
+        /// Removing a client leaves a tombstone with the latest revision in memory, so a state copied before the
+        /// removal but persisted after it does not bring the session back. Superseded records are dropped by rewriting the live records into a new file, once they take up too
+        /// much space.
+        ///
+        /// Record layout, all integers in network byte order:
+        ///   uint32 body length | uint8 type | uint16 client id length | client id
+        ///   put records continue with: uint32 filter count | (uint16 filter length | filter | uint8 qos)*
+        class FileSessionStore : public SessionStore
+        {
+        public:
+            typedef std::shared_ptr<FileSessionStore> Ptr;
+            
+            explicit FileSessionStore(const std::string& path,
+                                      const FileSessionStoreOptions& options = FileSessionStoreOptions())
+            : _path(path)
+            , _options(options)
+            {}
+            
+            ~FileSessionStore()
+            {
+                std::error_code ec;
+                close(ec);
+            }
+            
+            /// Opens or creates the log file, builds the client index and starts the sync thread. A truncated record
+            /// at the end of the log, as it is left by a crash during a write, is cut off. A complete record that
+            /// cannot be decoded is skipped.
+            bool open(std::error_code& ec)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if(_file) {
+                    ec.clear();
+                    return true;
+                }
+                
+                _file = std::fopen(_path.c_str(), "r+b");
+                if(!_file && errno == ENOENT) {
+                    _file = std::fopen(_path.c_str(), "w+b");
+                }
+                if(!_file) {
+                    ec = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                
+                if(!buildIndex(ec)) {
+                    return false;
+                }
+                _stopping = false;
+                _syncThread = std::thread([this]() { syncLoop(); });
+                return true;
+            }
+            
+            bool close(std::error_code& ec)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if(!_file) {
+                    ec.clear();
+                    return true;
+                }
+                _stopping = true;
+                guard.unlock();
+                _syncCondition.notify_all();
+                if(_syncThread.joinable()) {
+                    _syncThread.join();
+                }
+                
+                guard.lock();
+                bool result = sync(ec);
+                std::fclose(_file);
+                _file = nullptr;
+                _index.clear();
+                _removed.clear();
+                return result;
+            }
+            
+            using SessionStore::persistSession;
+            
+            bool persistSession(const SessionState& state, std::error_code& ec) override
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                auto removed = _removed.find(state._clientId);
+                if(removed != _removed.end()) {
+                    if(state._revision <= removed->second) {
+                        ec.clear();
+                        return true;
+                    }
+                    _removed.erase(removed);
+                }
+                auto iter = _index.find(state._clientId);
+                if(iter != _index.end() && state._revision <= iter->second._revision) {
+                    ec.clear();
+                    return true;
+                }
+                
+                _record.clear();
+                encodeHeader(RecordType::Put, state._clientId, _record);
+                encode(static_cast<uint32_t>(state._subscriptions.size()), _record);
+                for(const auto& filter : state._subscriptions) {
+                    encode(filter._filter, _record);
+                    _record.push_back(static_cast<uint8_t>(filter._qos));
+                }
+                
+                uint64_t offset = _end;
+                if(!append(ec)) {
+                    return false;
+                }
+                
+                if(iter != _index.end()) {
+                    _liveBytes -= iter->second._size;
+                    iter->second = Entry{offset, static_cast<uint32_t>(_record.size()), state._revision};
+                } else {
+                    _index.emplace(state._clientId, Entry{offset, static_cast<uint32_t>(_record.size()), state._revision});
+                }
+                _liveBytes += _record.size();
+                
+                bool due = compactionDue();
+                guard.unlock();
+                return !due || compact(ec);
+            }
+            
+            bool loadSession(const std::string& clientId, TopicFilters& subscriptions, std::error_code& ec) override
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                ec.clear();
+                auto iter = _index.find(clientId);
+                if(iter == _index.end()) {
+                    return false;
+                }
+                
+                if(!readRecord(iter->second, ec)) {
+                    return false;
+                }
+                
+                size_t pos = 0;
+                RecordType type;
+                std::string storedClientId;
+                uint32_t count = 0;
+                if(!decodeHeader(pos, type, storedClientId) || type != RecordType::Put || storedClientId != clientId
+                   || !decode(pos, count)) {
+                    ec = mqtt_error::session_store_corrupted;
+                    return false;
+                }
+                
+                subscriptions.clear();
+                subscriptions.reserve(count);
+                for(uint32_t i = 0; i < count; ++i) {
+                    TopicFilter filter;
+                    if(!decode(pos, filter._filter) || pos >= _record.size() || _record[pos] > 2) {
+                        ec = mqtt_error::session_store_corrupted;
+                        return false;
+                    }
+                    filter._qos = static_cast<QoSLevel>(_record[pos++]);
+                    subscriptions.push_back(std::move(filter));
+                }
+                
+                return true;
+            }
+            
+            bool removeSession(const std::string& clientId, std::error_code& ec) override
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                ec.clear();
+                _removed[clientId] = Session::lastRevision();
+                auto iter = _index.find(clientId);
+                if(iter == _index.end()) {
+                    return true;
+                }
+                
+                _record.clear();
+                encodeHeader(RecordType::Remove, clientId, _record);
+                if(!append(ec)) {
+                    return false;
+                }
+                _liveBytes -= iter->second._size;
+                _index.erase(iter);
+                
+                bool due = compactionDue();
+                guard.unlock();
+                return !due || compact(ec);
+            }
+            
+            bool flush(std::error_code& ec) override
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return sync(ec);
+            }
+            
+            /// Rewrites the log so that it only contains the latest record of every stored client. The live records
+            /// are copied without holding the store lock, so sessions are persisted and loaded in the meantime. Only
+            /// the records appended during the copy are moved to the new file under the lock.
+            bool compact(std::error_code& ec)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                ec.clear();
+                if(!_file) {
+                    ec = std::make_error_code(std::errc::bad_file_descriptor);
+                    return false;
+                }
+                if(_compacting) {
+                    return true;
+                }
+                _compacting = true;
+                
+                // write the records in log order, so the new file is read sequentially on the next start
+                std::vector<std::pair<std::string, Entry>> entries(_index.begin(), _index.end());
+                std::sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) {
+                    return lhs.second._offset < rhs.second._offset;
+                });
+                uint64_t copiedEnd = _end;
+                std::fflush(_file);
+                // an own descriptor, as pread leaves the file position of the appending writers alone
+                int fd = ::dup(fileno(_file));
+                guard.unlock();
+                
+                std::string compactPath = _path + ".compact";
+                std::FILE* out = nullptr;
+                if(fd < 0 || !(out = std::fopen(compactPath.c_str(), "w+b"))) {
+                    ec = std::error_code(errno, std::generic_category());
+                }
+                std::unordered_map<std::string, uint64_t> offsets;
+                std::vector<uint8_t> buffer;
+                uint64_t offset = 0;
+                for(const auto& entry : entries) {
+                    if(ec || !copy(fd, entry.second._offset, entry.second._size, out, buffer, ec)) {
+                        break;
+                    }
+                    offsets.emplace(entry.first, offset);
+                    offset += entry.second._size;
+                }
+                if(!ec && (std::fflush(out) != 0 || ::fsync(fileno(out)) != 0)) {
+                    ec = std::error_code(errno, std::generic_category());
+                }
+                
+                guard.lock();
+                if(!ec && !_file) {
+                    ec = std::make_error_code(std::errc::bad_file_descriptor);
+                }
+                if(!ec) {
+                    std::fflush(_file);
+                    if(copy(fd, copiedEnd, _end - copiedEnd, out, buffer, ec)
+                       && (std::fflush(out) != 0 || ::fsync(fileno(out)) != 0
+                           || std::rename(compactPath.c_str(), _path.c_str()) != 0)) {
+                        ec = std::error_code(errno, std::generic_category());
+                    }
+                }
+                if(fd >= 0) {
+                    ::close(fd);
+                }
+                _compacting = false;
+                if(ec) {
+                    if(out) {
+                        std::fclose(out);
+                        std::remove(compactPath.c_str());
+                    }
+                    return false;
+                }
+                
+                // records appended during the copy follow the compacted ones, all others were copied
+                std::fclose(_file);
+                _file = out;
+                _liveBytes = 0;
+                for(auto& entry : _index) {
+                    if(entry.second._offset >= copiedEnd) {
+                        entry.second._offset = entry.second._offset - copiedEnd + offset;
+                    } else {
+                        entry.second._offset = offsets[entry.first];
+                    }
+                    _liveBytes += entry.second._size;
+                }
+                _end = offset + (_end - copiedEnd);
+                _unsynced = 0;
+                guard.unlock();
+                
+                // the rename only survives a crash once the directory entry is on disk
+                return syncDirectory(ec);
+            }
+            
+            size_t count() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _index.size();
+            }
+            
+            uint64_t fileSize() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _end;
+            }
+            
+            uint64_t liveBytes() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _liveBytes;
+            }
+            
+            /// The number of undecodable records skipped when the log was opened.
+            size_t skippedRecords() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _skippedRecords;
+            }
+            
+        private:
+            enum class RecordType : uint8_t
+            {
+                Put = 1,
+                Remove = 2
+            };
+            
+            struct Entry
+            {
+                uint64_t _offset;
+                uint32_t _size;
+                /// The revision of the stored state, 0 for records read from the log on open.
+                uint64_t _revision;
+            };
+            
+            static constexpr size_t headerSize = 4;
+            
+            bool buildIndex(std::error_code& ec)
+            {
+                _index.clear();
+                _liveBytes = 0;
+                _end = 0;
+                _skippedRecords = 0;
+                
+                ::fseeko(_file, 0, SEEK_END);
+                uint64_t fileSize = static_cast<uint64_t>(::ftello(_file));
+                ::fseeko(_file, 0, SEEK_SET);
+                
+                // Only the type and the client id are read, the subscriptions are skipped. A record reaching past the
+                // end of the file is the torn tail of an interrupted write and ends the log. A complete record that
+                // cannot be decoded is skipped by its length, so the records after it are not lost.
+                const size_t typeAndLengthSize = 1 + 2;
+                while(_end + headerSize <= fileSize) {
+                    _record.resize(headerSize);
+                    if(std::fread(_record.data(), 1, headerSize, _file) != headerSize) {
+                        break;
+                    }
+                    size_t pos = 0;
+                    uint32_t length = 0;
+                    decode(pos, length);
+                    uint64_t size = headerSize + static_cast<uint64_t>(length);
+                    if(_end + size > fileSize) {
+                        break;
+                    }
+                    
+                    RecordType type = RecordType::Put;
+                    std::string clientId;
+                    bool valid = false;
+                    _record.resize(headerSize + typeAndLengthSize);
+                    if(length >= typeAndLengthSize
+                       && std::fread(_record.data() + headerSize, 1, typeAndLengthSize, _file) == typeAndLengthSize) {
+                        uint16_t clientIdLength = 0;
+                        pos = headerSize + 1;
+                        decode(pos, clientIdLength);
+                        if(length >= typeAndLengthSize + clientIdLength) {
+                            _record.resize(pos + clientIdLength);
+                            valid = std::fread(_record.data() + pos, 1, clientIdLength, _file) == clientIdLength
+                                && decodeHeader(pos, type, clientId);
+                        }
+                    }
+                    
+                    if(valid) {
+                        auto iter = _index.find(clientId);
+                        if(iter != _index.end()) {
+                            _liveBytes -= iter->second._size;
+                            _index.erase(iter);
+                        }
+                        if(type == RecordType::Put) {
+                            _index.emplace(std::move(clientId), Entry{_end, static_cast<uint32_t>(size), 0});
+                            _liveBytes += size;
+                        }
+                    } else {
+                        ++_skippedRecords;
+                    }
+                    _end += size;
+                    if(::fseeko(_file, static_cast<off_t>(_end), SEEK_SET) != 0) {
+                        break;
+                    }
+                }
+                
+                ::fseeko(_file, 0, SEEK_END);
+                if(static_cast<uint64_t>(::ftello(_file)) != _end) {
+                    std::fflush(_file);
+                    if(::ftruncate(fileno(_file), static_cast<off_t>(_end)) != 0) {
+                        ec = std::error_code(errno, std::generic_category());
+                        return false;
+                    }
+                }
+                ec.clear();
+                return true;
+            }
+            
+            bool append(std::error_code& ec)
+            {
+                if(!_file) {
+                    ec = std::make_error_code(std::errc::bad_file_descriptor);
+                    return false;
+                }
+                uint32_t length = static_cast<uint32_t>(_record.size() - headerSize);
+                _record[0] = static_cast<uint8_t>(length >> 24);
+                _record[1] = static_cast<uint8_t>(length >> 16);
+                _record[2] = static_cast<uint8_t>(length >> 8);
+                _record[3] = static_cast<uint8_t>(length);
+                
+                if(::fseeko(_file, static_cast<off_t>(_end), SEEK_SET) != 0
+                   || std::fwrite(_record.data(), 1, _record.size(), _file) != _record.size()) {
+                    ec = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                _end += _record.size();
+                
+                if(++_unsynced >= _options._syncEvery) {
+                    _syncCondition.notify_one();
+                }
+                // a failed background sync is reported to the next writer
+                ec = _syncError;
+                _syncError.clear();
+                return !ec;
+            }
+            
+            bool readRecord(const Entry& entry, std::error_code& ec)
+            {
+                _record.resize(entry._size);
+                if(::fseeko(_file, static_cast<off_t>(entry._offset), SEEK_SET) != 0
+                   || std::fread(_record.data(), 1, entry._size, _file) != entry._size) {
+                    ec = mqtt_error::session_store_corrupted;
+                    return false;
+                }
+                return true;
+            }
+            
+            bool sync(std::error_code& ec)
+            {
+                ec.clear();
+                if(!_file || _unsynced == 0) {
+                    return true;
+                }
+                if(std::fflush(_file) != 0 || ::fsync(fileno(_file)) != 0) {
+                    ec = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                _unsynced = 0;
+                return true;
+            }
+            
+            /// Syncs the log in the background whenever enough records were appended. The descriptor is duplicated,
+            /// so the fsync runs without the store lock even if a compaction replaces the file meanwhile.
+            void syncLoop()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                while(true) {
+                    _syncCondition.wait(guard, [this]() {
+                        return _stopping || (_unsynced > 0 && _unsynced >= _options._syncEvery);
+                    });
+                    if(_stopping) {
+                        return;
+                    }
+                    int fd = -1;
+                    if(std::fflush(_file) == 0) {
+                        fd = ::dup(fileno(_file));
+                    }
+                    _unsynced = 0;
+                    std::error_code ec;
+                    if(fd < 0) {
+                        ec = std::error_code(errno, std::generic_category());
+                    } else {
+                        guard.unlock();
+                        if(::fsync(fd) != 0) {
+                            ec = std::error_code(errno, std::generic_category());
+                        }
+                        ::close(fd);
+                        guard.lock();
+                    }
+                    if(ec) {
+                        _syncError = ec;
+                    }
+                }
+            }
+            
+            bool syncDirectory(std::error_code& ec) const
+            {
+                std::string::size_type slash = _path.find_last_of('/');
+                std::string directory = slash == std::string::npos ? "." : _path.substr(0, std::max<size_t>(slash, 1));
+                int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+                if(fd < 0 || ::fsync(fd) != 0) {
+                    ec = std::error_code(errno, std::generic_category());
+                }
+                if(fd >= 0) {
+                    ::close(fd);
+                }
+                return !ec;
+            }
+            
+            bool compactionDue() const
+            {
+                return !_compacting && _end >= _options._compactionMinBytes
+                    && static_cast<double>(_end) >= static_cast<double>(_liveBytes) * _options._compactionRatio;
+            }
+            
+            static bool copy(int fd, uint64_t offset, uint64_t size, std::FILE* out, std::vector<uint8_t>& buffer,
+                             std::error_code& ec)
+            {
+                buffer.resize(size);
+                ssize_t read = size == 0 ? 0 : ::pread(fd, buffer.data(), size, static_cast<off_t>(offset));
+                if(read < 0) {
+                    ec = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                if(static_cast<uint64_t>(read) != size) {
+                    ec = mqtt_error::session_store_corrupted;
+                    return false;
+                }
+                if(std::fwrite(buffer.data(), 1, size, out) != size) {
+                    ec = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                return true;
+            }
+            
+            static void encode(uint16_t value, std::vector<uint8_t>& out)
+            {
+                out.push_back(static_cast<uint8_t>(value >> 8));
+                out.push_back(static_cast<uint8_t>(value));
+            }
+            
+            static void encode(uint32_t value, std::vector<uint8_t>& out)
+            {
+                out.push_back(static_cast<uint8_t>(value >> 24));
+                out.push_back(static_cast<uint8_t>(value >> 16));
+                out.push_back(static_cast<uint8_t>(value >> 8));
+                out.push_back(static_cast<uint8_t>(value));
+            }
+            
+            static void encode(const std::string& value, std::vector<uint8_t>& out)
+            {
+                encode(static_cast<uint16_t>(value.size()), out);
+                out.insert(out.end(), value.begin(), value.end());
+            }
+            
+            static void encodeHeader(RecordType type, const std::string& clientId, std::vector<uint8_t>& out)
+            {
+                out.resize(headerSize);
+                out.push_back(static_cast<uint8_t>(type));
+                encode(clientId, out);
+            }
+            
+            bool decode(size_t& pos, uint16_t& value) const
+            {
+                if(pos + 2 > _record.size()) {
+                    return false;
+                }
+                value = static_cast<uint16_t>((_record[pos] << 8) | _record[pos + 1]);
+                pos += 2;
+                return true;
+            }
+            
+            bool decode(size_t& pos, uint32_t& value) const
+            {
+                if(pos + 4 > _record.size()) {
+                    return false;
+                }
+                value = (uint32_t(_record[pos]) << 24) | (uint32_t(_record[pos + 1]) << 16) |
+                        (uint32_t(_record[pos + 2]) << 8) | uint32_t(_record[pos + 3]);
+                pos += 4;
+                return true;
+            }
+            
+            bool decode(size_t& pos, std::string& value) const
+            {
+                uint16_t length = 0;
+                if(!decode(pos, length) || pos + length > _record.size()) {
+                    return false;
+                }
+                value.assign(reinterpret_cast<const char*>(_record.data()) + pos, length);
+                pos += length;
+                return true;
+            }
+            
+            bool decodeHeader(size_t& pos, RecordType& type, std::string& clientId) const
+            {
+                pos = headerSize;
+                if(pos >= _record.size()) {
+                    return false;
+                }
+                uint8_t rawType = _record[pos++];
+                if(rawType != static_cast<uint8_t>(RecordType::Put) && rawType != static_cast<uint8_t>(RecordType::Remove)) {
+                    return false;
+                }
+                type = static_cast<RecordType>(rawType);
+                return decode(pos, clientId);
+            }
+            
+            const std::string _path;
+            const FileSessionStoreOptions _options;
+            mutable std::mutex _mutex;
+            std::FILE* _file{nullptr};
+            std::unordered_map<std::string, Entry> _index;
+            /// The latest revision at the removal of a client, until the client is persisted again.
+            std::unordered_map<std::string, uint64_t> _removed;
+            std::vector<uint8_t> _record;
+            uint64_t _end{0};
+            uint64_t _liveBytes{0};
+            size_t _unsynced{0};
+            size_t _skippedRecords{0};
+            bool _compacting{false};
+            bool _stopping{false};
+            std::error_code _syncError;
+            std::condition_variable _syncCondition;
+            std::thread _syncThread;
+        };
+        
+    }
+}
+
+#endif
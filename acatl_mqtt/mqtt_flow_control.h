@@ -0,0 +1,150 @@
+//
+//  mqtt_flow_control.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_flow_control_h
+#define acatl_mqtt_flow_control_h
+
+#include <acatl_mqtt/mqtt_control_packets.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// Tracks the bytes that are still pending in subscriber send queues on behalf of one publisher. As soon as
+        /// the pending bytes exceed the high watermark, the publisher should stop reading from its socket. Once the
+        /// deliveries drained below the low watermark, the resume handler is called to restart reading. This turns
+        /// overload into TCP backpressure. A high watermark of 0 disables flow control.
+        class FlowControl : public std::enable_shared_from_this<FlowControl>
+        {
+        public:
+            typedef std::shared_ptr<FlowControl> Ptr;
+            typedef std::function<void()> ResumeHandler;
+            
+            FlowControl(size_t highWatermark, size_t lowWatermark)
+            : _highWatermark(highWatermark)
+            , _lowWatermark(std::min(lowWatermark, highWatermark))
+            , _pendingBytes(0)
+            , _paused(false)
+            {}
+            
+            bool enabled() const
+            {
+                return _highWatermark != 0;
+            }
+            
+            size_t pendingBytes() const
+            {
+                return _pendingBytes.load(std::memory_order_relaxed);
+            }
+            
+            /// The resume handler can be called from any thread.
+            void setResumeHandler(ResumeHandler handler)
+            {
+                _resumeHandler = handler;
+            }
+            
+            /// Accounts bytes of a delivery. The bytes are released as soon as the returned credit is destroyed.
+            std::shared_ptr<FlowCredit> acquire(size_t bytes);
+            
+            /// Checks whether the publisher has to pause reading. If true is returned, the resume handler will be
+            /// called once the pending bytes dropped below the low watermark.
+            bool shouldPause()
+            {
+                if(!enabled() || _pendingBytes.load() <= _highWatermark) {
+                    return false;
+                }
+                _paused.store(true);
+                // the deliveries might have drained meanwhile, without anyone seeing the paused flag
+                if(_pendingBytes.load() <= _lowWatermark && _paused.exchange(false)) {
+                    return false;
+                }
+                return true;
+            }
+            
+        private:
+            friend struct FlowCredit;
+            
+            void release(size_t bytes)
+            {
+                size_t pending = _pendingBytes.fetch_sub(bytes) - bytes;
+                if(pending <= _lowWatermark && _paused.load() && _paused.exchange(false)) {
+                    if(_resumeHandler) {
+                        _resumeHandler();
+                    }
+                }
+            }
+            
+            size_t _highWatermark;
+            size_t _lowWatermark;
+            std::atomic<size_t> _pendingBytes;
+            std::atomic<bool> _paused;
+            ResumeHandler _resumeHandler;
+        };
+        
+        
+        struct FlowCredit
+        {
+            FlowCredit(FlowControl::Ptr flowControl, size_t bytes)
+            : _flowControl(flowControl)
+            , _bytes(bytes)
+            {}
+            
+            FlowCredit(const FlowCredit&) = delete;
+            FlowCredit& operator=(const FlowCredit&) = delete;
+            
+            ~FlowCredit()
+            {
+                _flowControl->release(_bytes);
+            }
+            
+            FlowControl::Ptr _flowControl;
+            size_t _bytes;
+        };
+        
+        
+        inline std::shared_ptr<FlowCredit> FlowControl::acquire(size_t bytes)
+        {
+            _pendingBytes.fetch_add(bytes);
+            return std::make_shared<FlowCredit>(shared_from_this(), bytes);
+        }
+
+    }
+}
+
+#endif
@@ -0,0 +1,404 @@
+//
+//  mqtt_heavy_hitters.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_heavy_hitters_h
+#define acatl_mqtt_heavy_hitters_h
+
+#include <acatl/json.h>
+
+#include <acatl_mqtt/mqtt_per_thread.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        struct HeavyHitterOptions
+        {
+            HeavyHitterOptions()
+            : _topK(0)
+            , _width(1024)
+            , _depth(4)
+            {}
+            
+            // the number of topics and clients reported, 0 disables the detection
+            size_t _topK;
+            // counters per row of the count-min sketch, the overestimate is below 2 * total / width with a
+            // probability of 1 - 0.5^depth
+            size_t _width;
+            size_t _depth;
+        };
+        
+        
+        /// Estimates the counts of a stream of keys in fixed memory. An estimate is never lower than the real count.
+        /// Only the rows holding the minimum are incremented (conservative update), which keeps the overestimates of
+        /// keys sharing a counter with a heavy key small.
+        class CountMinSketch
+        {
+        public:
+            CountMinSketch(size_t width, size_t depth)
+            : _width(std::max<size_t>(width, 1))
+            , _depth(std::max<size_t>(depth, 1))
+            , _counters(_width * _depth, 0)
+            {}
+            
+            /// @return The estimate of the key after adding count.
+            uint64_t add(size_t hash, uint64_t count)
+            {
+                uint64_t estimate = this->estimate(hash) + count;
+                for(size_t row = 0; row < _depth; ++row) {
+                    uint64_t& counter = _counters[index(hash, row)];
+                    counter = std::max(counter, estimate);
+                }
+                return estimate;
+            }
+            
+            uint64_t estimate(size_t hash) const
+            {
+                uint64_t result = UINT64_MAX;
+                for(size_t row = 0; row < _depth; ++row) {
+                    result = std::min(result, _counters[index(hash, row)]);
+                }
+                return result;
+            }
+            
+            /// Adds the counters of a sketch with the same dimensions.
+            void merge(const CountMinSketch& other)
+            {
+                for(size_t i = 0; i < _counters.size() && i < other._counters.size(); ++i) {
+                    _counters[i] += other._counters[i];
+                }
+            }
+            
+            void clear()
+            {
+                std::fill(_counters.begin(), _counters.end(), 0);
+            }
+            
+        private:
+            /// The rows use independent positions derived from the one hash of the key (double hashing).
+            size_t index(size_t hash, size_t row) const
+            {
+                uint64_t h1 = static_cast<uint64_t>(hash);
+                uint64_t h2 = (h1 * 0x9E3779B97F4A7C15ull) >> 17 | 1;
+                return row * _width + static_cast<size_t>((h1 + row * h2) % _width);
+            }
+            
+            size_t _width;
+            size_t _depth;
+            std::vector<uint64_t> _counters;
+        };
+        
+        
+        /// The k keys with the highest estimated counts. The candidates are kept in a min-heap, a new key replaces the
+        /// smallest candidate as soon as its estimate exceeds it.
+        class TopK
+        {
+        public:
+            struct Entry
+            {
+                std::string _key;
+                uint64_t _count;
+            };
+            
+            TopK(size_t k, size_t width, size_t depth)
+            : _k(k)
+            , _sketch(width, depth)
+            {}
+            
+            void add(const std::string& key, uint64_t count)
+            {
+                uint64_t estimate = _sketch.add(std::hash<std::string>()(key), count);
+                auto iter = _positions.find(key);
+                if(iter != _positions.end()) {
+                    _heap[iter->second]._count = estimate;
+                    siftDown(iter->second);
+                } else if(_heap.size() < _k) {
+                    _heap.push_back(Entry{key, estimate});
+                    _positions[key] = _heap.size() - 1;
+                    siftUp(_heap.size() - 1);
+                } else if(_k > 0 && estimate > _heap.front()._count) {
+                    _positions.erase(_heap.front()._key);
+                    _heap.front() = Entry{key, estimate};
+                    _positions[key] = 0;
+                    siftDown(0);
+                }
+            }
+            
+            /// Adds the counts of another TopK with the same dimensions. The candidates of both are estimated again on
+            /// the merged sketch.
+            void merge(const TopK& other)
+            {
+                _sketch.merge(other._sketch);
+                std::vector<Entry> candidates = _heap;
+                for(const auto& entry : other._heap) {
+                    if(_positions.find(entry._key) == _positions.end()) {
+                        candidates.push_back(entry);
+                    }
+                }
+                _heap.clear();
+                _positions.clear();
+                for(auto& candidate : candidates) {
+                    uint64_t estimate = _sketch.estimate(std::hash<std::string>()(candidate._key));
+                    if(_heap.size() < _k) {
+                        _heap.push_back(Entry{candidate._key, estimate});
+                        _positions[candidate._key] = _heap.size() - 1;
+                        siftUp(_heap.size() - 1);
+                    } else if(_k > 0 && estimate > _heap.front()._count) {
+                        _positions.erase(_heap.front()._key);
+                        _heap.front() = Entry{candidate._key, estimate};
+                        _positions[candidate._key] = 0;
+                        siftDown(0);
+                    }
+                }
+            }
+            
+            /// @return The candidates, highest count first.
+            std::vector<Entry> top() const
+            {
+                std::vector<Entry> result = _heap;
+                std::sort(result.begin(), result.end(), [](const Entry& lhs, const Entry& rhs) {
+                    return lhs._count > rhs._count || (lhs._count == rhs._count && lhs._key < rhs._key);
+                });
+                return result;
+            }
+            
+            void clear()
+            {
+                _sketch.clear();
+                _heap.clear();
+                _positions.clear();
+            }
+            
+        private:
+            void swap(size_t lhs, size_t rhs)
+            {
+                std::swap(_heap[lhs], _heap[rhs]);
+                _positions[_heap[lhs]._key] = lhs;
+                _positions[_heap[rhs]._key] = rhs;
+            }
+            
+            void siftUp(size_t index)
+            {
+                while(index > 0) {
+                    size_t parent = (index - 1) / 2;
+                    if(_heap[parent]._count <= _heap[index]._count) {
+                        break;
+                    }
+                    swap(parent, index);
+                    index = parent;
+                }
+            }
+            
+            void siftDown(size_t index)
+            {
+                for(;;) {
+                    size_t smallest = index;
+                    size_t left = 2 * index + 1;
+                    size_t right = left + 1;
+                    if(left < _heap.size() && _heap[left]._count < _heap[smallest]._count) {
+                        smallest = left;
+                    }
+                    if(right < _heap.size() && _heap[right]._count < _heap[smallest]._count) {
+                        smallest = right;
+                    }
+                    if(smallest == index) {
+                        break;
+                    }
+                    swap(smallest, index);
+                    index = smallest;
+                }
+            }
+            
+            size_t _k;
+            CountMinSketch _sketch;
+            std::vector<Entry> _heap;
+            std::unordered_map<std::string, size_t> _positions;
+        };
+        
+        
+        /// Finds the topics and clients publishing the most messages and bytes, in memory independent of the number
+        /// of topics and clients. Every thread records into its own sketches, which are merged for a report. The
+        /// counts cover a window that starts anew with every reset, the rates are the counts divided by the length
+        /// of the window.
+        class HeavyHitters
+        {
+        public:
+            typedef std::shared_ptr<HeavyHitters> Ptr;
+            typedef std::chrono::steady_clock Clock;
+            
+            struct Report
+            {
+                struct Entry
+                {
+                    std::string _key;
+                    uint64_t _count;
+                    double _rate;
+                };
+                
+                std::chrono::duration<double> _window;
+                std::vector<Entry> _topicsByMessages;
+                std::vector<Entry> _topicsByBytes;
+                std::vector<Entry> _clientsByMessages;
+                std::vector<Entry> _clientsByBytes;
+            };
+            
+            explicit HeavyHitters(const HeavyHitterOptions& options)
+            : _options(options)
+            , _sketches([options]() { return std::unique_ptr<Sketches>(new Sketches(options)); })
+            , _windowStart(Clock::now())
+            {}
+            
+            const HeavyHitterOptions& options() const
+            {
+                return _options;
+            }
+            
+            /// Records a publish of the client. The sketches of the calling thread are only locked against a
+            /// concurrent report, so the lock is not contended.
+            void record(const std::string& topic, const std::string& clientId, size_t bytes)
+            {
+                Sketches& sketches = _sketches.local();
+                std::unique_lock<std::mutex> guard(sketches._mutex);
+                sketches._topicMessages.add(topic, 1);
+                sketches._topicBytes.add(topic, bytes);
+                sketches._clientMessages.add(clientId, 1);
+                sketches._clientBytes.add(clientId, bytes);
+            }
+            
+            Report report(Clock::time_point now = Clock::now()) const
+            {
+                Sketches merged(_options);
+                _sketches.forEach([&merged](Sketches& sketches) {
+                    std::unique_lock<std::mutex> guard(sketches._mutex);
+                    merged._topicMessages.merge(sketches._topicMessages);
+                    merged._topicBytes.merge(sketches._topicBytes);
+                    merged._clientMessages.merge(sketches._clientMessages);
+                    merged._clientBytes.merge(sketches._clientBytes);
+                });
+                
+                Report report;
+                {
+                    std::unique_lock<std::mutex> guard(_windowMutex);
+                    report._window = now - _windowStart;
+                }
+                report._topicsByMessages = entries(merged._topicMessages, report._window);
+                report._topicsByBytes = entries(merged._topicBytes, report._window);
+                report._clientsByMessages = entries(merged._clientMessages, report._window);
+                report._clientsByBytes = entries(merged._clientBytes, report._window);
+                return report;
+            }
+            
+            /// Starts a new window.
+            void reset(Clock::time_point now = Clock::now())
+            {
+                _sketches.forEach([](Sketches& sketches) {
+                    std::unique_lock<std::mutex> guard(sketches._mutex);
+                    sketches._topicMessages.clear();
+                    sketches._topicBytes.clear();
+                    sketches._clientMessages.clear();
+                    sketches._clientBytes.clear();
+                });
+                std::unique_lock<std::mutex> guard(_windowMutex);
+                _windowStart = now;
+            }
+            
+            static json toJson(const std::vector<Report::Entry>& entries, const char* key)
+            {
+                json result = json::array();
+                for(const auto& entry : entries) {
+                    result.push_back({ { key, entry._key }, { "count", entry._count }, { "rate", entry._rate } });
+                }
+                return result;
+            }
+            
+            /// {"window":<seconds>,"topics":{"messages":[{"topic":..,"count":..,"rate":..}],"bytes":[..]},
+            ///  "clients":{"messages":[{"client":..,"count":..,"rate":..}],"bytes":[..]}}
+            static json toJson(const Report& report)
+            {
+                json result;
+                result["window"] = report._window.count();
+                result["topics"] = { { "messages", toJson(report._topicsByMessages, "topic") },
+                                     { "bytes", toJson(report._topicsByBytes, "topic") } };
+                result["clients"] = { { "messages", toJson(report._clientsByMessages, "client") },
+                                      { "bytes", toJson(report._clientsByBytes, "client") } };
+                return result;
+            }
+            
+        private:
+            struct Sketches
+            {
+                explicit Sketches(const HeavyHitterOptions& options)
+                : _topicMessages(options._topK, options._width, options._depth)
+                , _topicBytes(options._topK, options._width, options._depth)
+                , _clientMessages(options._topK, options._width, options._depth)
+                , _clientBytes(options._topK, options._width, options._depth)
+                {}
+                
+                std::mutex _mutex;
+                TopK _topicMessages;
+                TopK _topicBytes;
+                TopK _clientMessages;
+                TopK _clientBytes;
+            };
+            
+            static std::vector<Report::Entry> entries(const TopK& topK, std::chrono::duration<double> window)
+            {
+                std::vector<Report::Entry> result;
+                for(const auto& entry : topK.top()) {
+                    double rate = window.count() > 0 ? static_cast<double>(entry._count) / window.count() : 0.0;
+                    result.push_back(Report::Entry{entry._key, entry._count, rate});
+                }
+                return result;
+            }
+            
+            HeavyHitterOptions _options;
+            PerThread<Sketches> _sketches;
+            mutable std::mutex _windowMutex;
+            Clock::time_point _windowStart;
+        };
+        
+    }
+}
+
+#endif
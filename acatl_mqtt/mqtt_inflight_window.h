@@ -0,0 +1,262 @@
+//
+//  mqtt_inflight_window.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_inflight_window_h
+#define acatl_mqtt_inflight_window_h
+
+#include <acatl_mqtt/mqtt_control_packets.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// The QoS 1 and QoS 2 messages a session sent to its client that are not completely acknowledged yet. Up to
+        /// receiveMaximum messages are in flight at the same time, so a client is served at the rate it acknowledges
+        /// and not at one message per round trip.
+        ///
+        /// Packet identifiers are handed out sequentially and identifier i lives in slot i % receiveMaximum. An
+        /// identifier is only used if its slot is free, so the window needs receiveMaximum slots instead of a table of
+        /// all 65535 identifiers, and every acknowledgement is a single slot lookup.
+        ///
+        /// Not thread safe, the owning session serializes the access.
+        class InflightWindow
+        {
+        public:
+            static constexpr uint16_t defaultReceiveMaximum = 64;
+            
+            explicit InflightWindow(uint16_t receiveMaximum = defaultReceiveMaximum)
+            : _receiveMaximum(std::max<uint16_t>(receiveMaximum, 1))
+            {}
+            
+            uint16_t receiveMaximum() const
+            {
+                return _receiveMaximum;
+            }
+            
+            size_t size() const
+            {
+                return _size;
+            }
+            
+            bool empty() const
+            {
+                return _size == 0;
+            }
+            
+            bool full() const
+            {
+                return _size >= _receiveMaximum;
+            }
+            
+            size_t available() const
+            {
+                return _receiveMaximum - _size;
+            }
+            
+            /// Assigns a free packet identifier to the publish and keeps a copy of it for a retransmission after a
+            /// reconnect. Must not be called on a full window.
+            /// @return The assigned packet identifier.
+            PacketIdentifier add(PublishControlPacket& publish)
+            {
+                Slot& slot = nextFreeSlot();
+                publish._packetIdentifier = slot._packetIdentifier;
+                slot._sequence = _sequence++;
+                slot._packet.reset(new PublishControlPacket(publish));
+                // the retransmission copy must not hold back the publisher, nor show up in the latency traces
+                slot._packet->_credit.reset();
+                slot._packet->_traceTimestamp = std::chrono::steady_clock::time_point();
+                ++_size;
+                return slot._packetIdentifier;
+            }
+            
+            /// Takes a packet identifier for a packet that is not a publish, e.g. the SUBSCRIBE of a client, so no
+            /// publish in flight shares it. It occupies a slot until unreserve(). Must not be called on a full window.
+            /// @return The reserved packet identifier.
+            PacketIdentifier reserve()
+            {
+                Slot& slot = nextFreeSlot();
+                slot._reserved = true;
+                ++_size;
+                return slot._packetIdentifier;
+            }
+            
+            /// Frees an identifier of reserve(), e.g. when the SUBACK arrived.
+            /// @return false if the identifier is not reserved.
+            bool unreserve(PacketIdentifier packetIdentifier)
+            {
+                if(_slots.empty() || packetIdentifier == 0) {
+                    return false;
+                }
+                Slot& slot = _slots[packetIdentifier % _receiveMaximum];
+                if(slot._packetIdentifier != packetIdentifier || !slot._reserved) {
+                    return false;
+                }
+                release(slot);
+                return true;
+            }
+            
+            /// Handles PUBACK, which completes a QoS 1 delivery.
+            /// @return false if no QoS 1 message with this identifier is in flight.
+            bool acknowledge(PacketIdentifier packetIdentifier)
+            {
+                Slot* slot = find(packetIdentifier);
+                if(!slot || !slot->_packet || slot->_packet->qos() != QoSLevel::AtLeastOnce) {
+                    return false;
+                }
+                release(*slot);
+                return true;
+            }
+            
+            /// Handles PUBREC of a QoS 2 delivery. The message is not sent again from now on, only the PUBREL.
+            /// @return false if no QoS 2 message with this identifier waits for PUBREC.
+            bool receive(PacketIdentifier packetIdentifier)
+            {
+                Slot* slot = find(packetIdentifier);
+                if(!slot || !slot->_packet || slot->_packet->qos() != QoSLevel::ExactlyOnce) {
+                    return false;
+                }
+                slot->_packet.reset();
+                slot->_released = true;
+                return true;
+            }
+            
+            /// Handles PUBCOMP, which completes a QoS 2 delivery.
+            /// @return false if no QoS 2 message with this identifier waits for PUBCOMP.
+            bool complete(PacketIdentifier packetIdentifier)
+            {
+                Slot* slot = find(packetIdentifier);
+                if(!slot || !slot->_released) {
+                    return false;
+                }
+                release(*slot);
+                return true;
+            }
+            
+            /// Collects the packets to send again when the client reconnects, in their original order. Messages
+            /// without PUBREC are published again with the DUP flag, the others get their PUBREL again.
+            void retransmissions(std::vector<ControlPacket::Ptr>& packets) const
+            {
+                std::vector<const Slot*> inflight;
+                for(const auto& slot : _slots) {
+                    if(slot._packet || slot._released) {
+                        inflight.push_back(&slot);
+                    }
+                }
+                std::sort(inflight.begin(), inflight.end(), [](const Slot* lhs, const Slot* rhs) {
+                    return lhs->_sequence < rhs->_sequence;
+                });
+                for(const Slot* slot : inflight) {
+                    if(slot->_packet) {
+                        PublishControlPacket::Ptr publish(new PublishControlPacket(*slot->_packet));
+                        publish->_header._flags |= dupFlag;
+                        packets.push_back(std::move(publish));
+                    } else {
+                        packets.push_back(std::make_unique<PubRelControlPacket>(slot->_packetIdentifier));
+                    }
+                }
+            }
+            
+            void clear()
+            {
+                _slots.clear();
+                _size = 0;
+            }
+            
+        private:
+            static constexpr HeaderFlags dupFlag = 0x08;
+            
+            struct Slot
+            {
+                PacketIdentifier _packetIdentifier{0};
+                bool _released{false};
+                bool _reserved{false};
+                uint64_t _sequence{0};
+                PublishControlPacket::Ptr _packet;
+            };
+            
+            Slot& nextFreeSlot()
+            {
+                if(_slots.empty()) {
+                    _slots.resize(_receiveMaximum);
+                }
+                
+                PacketIdentifier packetIdentifier;
+                Slot* slot;
+                do {
+                    packetIdentifier = _nextIdentifier;
+                    _nextIdentifier = _nextIdentifier == 0xFFFF ? 1 : static_cast<PacketIdentifier>(_nextIdentifier + 1);
+                    slot = &_slots[packetIdentifier % _receiveMaximum];
+                } while(slot->_packet || slot->_released || slot->_reserved);
+                slot->_packetIdentifier = packetIdentifier;
+                return *slot;
+            }
+            
+            Slot* find(PacketIdentifier packetIdentifier)
+            {
+                if(_slots.empty() || packetIdentifier == 0) {
+                    return nullptr;
+                }
+                Slot& slot = _slots[packetIdentifier % _receiveMaximum];
+                if(slot._packetIdentifier != packetIdentifier || (!slot._packet && !slot._released)) {
+                    return nullptr;
+                }
+                return &slot;
+            }
+            
+            void release(Slot& slot)
+            {
+                slot._packet.reset();
+                slot._released = false;
+                slot._reserved = false;
+                slot._packetIdentifier = 0;
+                --_size;
+            }
+            
+            uint16_t _receiveMaximum;
+            std::vector<Slot> _slots;
+            size_t _size{0};
+            PacketIdentifier _nextIdentifier{1};
+            uint64_t _sequence{0};
+        };
+        
+    }
+}
+
+#endif
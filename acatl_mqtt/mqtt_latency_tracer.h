@@ -0,0 +1,272 @@
+//
+//  mqtt_latency_tracer.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_latency_tracer_h
+#define acatl_mqtt_latency_tracer_h
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// The stages a publish passes on its way through the broker:
+        /// Parse   from the read completing the packet until the parser returned it
+        /// Match   from the parsed packet until its subscriptions were matched
+        /// Enqueue from the match until the connection of a subscriber took the delivery from its send queue
+        /// Write   from taking the delivery from the send queue until the socket write completed
+        enum class TraceStage
+        {
+            Parse,
+            Match,
+            Enqueue,
+            Write
+        };
+        
+        constexpr size_t traceStageCount = 4;
+        
+        template<class CharT, class Traits>
+        std::basic_ostream<CharT, Traits>& operator<<(std::basic_ostream<CharT, Traits>& os, TraceStage stage)
+        {
+            switch(stage) {
+                case TraceStage::Parse:
+                    os << "parse";
+                    break;
+                case TraceStage::Match:
+                    os << "match";
+                    break;
+                case TraceStage::Enqueue:
+                    os << "enqueue";
+                    break;
+                case TraceStage::Write:
+                    os << "write";
+                    break;
+            }
+            return os;
+        }
+        
+        
+        /// A histogram of nanosecond durations with logarithmic buckets, each power of two is split into 16 linear
+        /// sub-buckets. Percentiles are therefore accurate to about 6%, from 1ns up to about 18 minutes. Recording is
+        /// a relaxed atomic increment, which is fine for sampled values.
+        class LatencyHistogram
+        {
+        public:
+            LatencyHistogram()
+            {
+                clear();
+            }
+            
+            LatencyHistogram(const LatencyHistogram&) = delete;
+            LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+            
+            void record(std::chrono::nanoseconds duration)
+            {
+                uint64_t value = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+                _buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+                _count.fetch_add(1, std::memory_order_relaxed);
+                uint64_t max = _max.load(std::memory_order_relaxed);
+                while(value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+                }
+            }
+            
+            uint64_t count() const
+            {
+                return _count.load(std::memory_order_relaxed);
+            }
+            
+            std::chrono::nanoseconds max() const
+            {
+                return std::chrono::nanoseconds(_max.load(std::memory_order_relaxed));
+            }
+            
+            /// @return The upper bound of the bucket holding the given fraction of the recorded durations, 0 if
+            /// nothing was recorded.
+            std::chrono::nanoseconds percentile(double fraction) const
+            {
+                uint64_t count = this->count();
+                if(count == 0) {
+                    return std::chrono::nanoseconds(0);
+                }
+                uint64_t rank = static_cast<uint64_t>(fraction * static_cast<double>(count) + 0.5);
+                rank = std::max<uint64_t>(rank, 1);
+                uint64_t seen = 0;
+                for(size_t i = 0; i < bucketCount; ++i) {
+                    seen += _buckets[i].load(std::memory_order_relaxed);
+                    if(seen >= rank) {
+                        return std::chrono::nanoseconds(std::min(upperBound(i), _max.load(std::memory_order_relaxed)));
+                    }
+                }
+                return max();
+            }
+            
+            void clear()
+            {
+                for(auto& bucket : _buckets) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+                _count.store(0, std::memory_order_relaxed);
+                _max.store(0, std::memory_order_relaxed);
+            }
+            
+        private:
+            static constexpr size_t subBuckets = 16;
+            static constexpr size_t maxShift = 36;
+            static constexpr size_t bucketCount = (maxShift + 2) * subBuckets;
+            
+            static size_t bucket(uint64_t value)
+            {
+                if(value < subBuckets) {
+                    return static_cast<size_t>(value);
+                }
+                size_t shift = 0;
+                while((value >> shift) >= 2 * subBuckets) {
+                    ++shift;
+                }
+                if(shift > maxShift) {
+                    return bucketCount - 1;
+                }
+                return (shift + 1) * subBuckets + static_cast<size_t>((value >> shift) & (subBuckets - 1));
+            }
+            
+            static uint64_t upperBound(size_t index)
+            {
+                if(index < subBuckets) {
+                    return index;
+                }
+                size_t shift = index / subBuckets - 1;
+                uint64_t sub = index % subBuckets;
+                return ((subBuckets + sub + 1) << shift) - 1;
+            }
+            
+            std::array<std::atomic<uint64_t>, bucketCount> _buckets;
+            std::atomic<uint64_t> _count;
+            std::atomic<uint64_t> _max;
+        };
+        
+        
+        /// Traces 1 in N publishes through the stages of the broker and keeps one latency histogram per stage. A
+        /// sampled publish carries the time its current stage started in PublishControlPacket::_traceTimestamp, the
+        /// copies handed to the subscribers inherit it. Publishes that are not sampled only cost the check of that
+        /// timestamp, and without a tracer nothing is measured at all.
+        class LatencyTracer
+        {
+        public:
+            typedef std::shared_ptr<LatencyTracer> Ptr;
+            typedef std::chrono::steady_clock Clock;
+            
+            explicit LatencyTracer(uint32_t sampleEvery)
+            : _sampleEvery(sampleEvery)
+            {}
+            
+            bool enabled() const
+            {
+                return _sampleEvery != 0;
+            }
+            
+            uint32_t sampleEvery() const
+            {
+                return _sampleEvery;
+            }
+            
+            /// Decides whether the next publish is sampled. The counter belongs to the caller, a connection for
+            /// example, so sampling needs no shared state.
+            bool sample(uint64_t& counter) const
+            {
+                return _sampleEvery != 0 && ++counter % _sampleEvery == 0;
+            }
+            
+            /// Records the duration of a stage, which started at start and ends now.
+            /// @return The current time, the start of the next stage.
+            Clock::time_point record(TraceStage stage, Clock::time_point start)
+            {
+                Clock::time_point now = Clock::now();
+                record(stage, now - start);
+                return now;
+            }
+            
+            void record(TraceStage stage, Clock::duration duration)
+            {
+                _histograms[static_cast<size_t>(stage)].record(std::chrono::duration_cast<std::chrono::nanoseconds>(duration));
+            }
+            
+            const LatencyHistogram& histogram(TraceStage stage) const
+            {
+                return _histograms[static_cast<size_t>(stage)];
+            }
+            
+            void clear()
+            {
+                for(auto& histogram : _histograms) {
+                    histogram.clear();
+                }
+            }
+            
+            /// Writes one line per stage with the number of samples and the p50, p90, p99, p99.9 and maximum latency
+            /// in microseconds.
+            template<class CharT, class Traits>
+            void dump(std::basic_ostream<CharT, Traits>& os) const
+            {
+                auto micros = [](std::chrono::nanoseconds duration) {
+                    return static_cast<double>(duration.count()) / 1000.0;
+                };
+                for(size_t i = 0; i < traceStageCount; ++i) {
+                    const LatencyHistogram& histogram = _histograms[i];
+                    os << std::setw(8) << std::left << static_cast<TraceStage>(i) << std::right
+                       << " samples=" << histogram.count() << std::fixed << std::setprecision(1)
+                       << " p50-us=" << micros(histogram.percentile(0.5))
+                       << " p90-us=" << micros(histogram.percentile(0.9))
+                       << " p99-us=" << micros(histogram.percentile(0.99))
+                       << " p999-us=" << micros(histogram.percentile(0.999))
+                       << " max-us=" << micros(histogram.max()) << "\n";
+                }
+            }
+            
+        private:
+            uint32_t _sampleEvery;
+            std::array<LatencyHistogram, traceStageCount> _histograms;
+        };
+        
+    }
+}
+
+#endif
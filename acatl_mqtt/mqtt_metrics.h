@@ -0,0 +1,122 @@
+//
+//  mqtt_metrics.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_metrics_h
+#define acatl_mqtt_metrics_h
+
+#include <acatl_mqtt/mqtt_per_thread.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        enum class Metric
+        {
+            MessagesReceived,
+            MessagesSent,
+            BytesReceived,
+            BytesSent,
+            ClientsConnected,
+            Subscriptions,
+            QueuedMessages,
+            MessagesDropped
+        };
+        
+        constexpr size_t metricCount = 8;
+        
+        
+        /// Counters of the broker, split into one block per thread. A thread only ever writes its own block, so
+        /// counting is a relaxed load and store without any read-modify-write or shared cache line. Readers sum the
+        /// blocks of all threads. Gauges may be raised on one thread and lowered on another, their blocks hold
+        /// signed deltas that only add up to the current value.
+        class Metrics
+        {
+        public:
+            typedef std::shared_ptr<Metrics> Ptr;
+            typedef std::array<int64_t, metricCount> Snapshot;
+            
+            void add(Metric metric, int64_t value = 1)
+            {
+                std::atomic<int64_t>& counter = _blocks.local()._counters[static_cast<size_t>(metric)];
+                counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+            }
+            
+            int64_t value(Metric metric) const
+            {
+                return snapshot()[static_cast<size_t>(metric)];
+            }
+            
+            /// Sums the blocks of all threads. The result is not atomic with respect to concurrent writers, each counter
+            /// is only as recent as the last store the reading thread observed.
+            Snapshot snapshot() const
+            {
+                Snapshot result;
+                result.fill(0);
+                _blocks.forEach([&result](const Block& block) {
+                    for(size_t i = 0; i < metricCount; ++i) {
+                        result[i] += block._counters[i].load(std::memory_order_relaxed);
+                    }
+                });
+                return result;
+            }
+            
+        private:
+            /// The padding keeps the counters of different threads off each others cache lines.
+            struct Block
+            {
+                Block()
+                {
+                    for(auto& counter : _counters) {
+                        counter.store(0, std::memory_order_relaxed);
+                    }
+                }
+                
+                char _leadingPadding[64];
+                std::array<std::atomic<int64_t>, metricCount> _counters;
+                char _trailingPadding[64];
+            };
+            
+            PerThread<Block> _blocks;
+        };
+        
+    }
+}
+
+#endif
@@ -0,0 +1,510 @@
+//
+//  mqtt_offline_queue.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_offline_queue_h
+#define acatl_mqtt_offline_queue_h
+
+#include <acatl_mqtt/mqtt_control_packets.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        struct OfflineQueueOptions
+        {
+            /// Bytes of offline messages all sessions together may keep in memory. Beyond that, messages are spilled
+            /// to the spool directory.
+            size_t _memoryBudget{64 * 1024 * 1024};
+            
+            /// Maximum number of messages queued for a single session, 0 means unlimited.
+            size_t _maxMessages{0};
+            
+            /// Time after which a queued message is discarded, 0 means never.
+            std::chrono::seconds _messageExpiry{0};
+            
+            /// Directory for the segment files. Without one, messages beyond the memory budget are dropped.
+            std::string _spoolDirectory;
+            
+            /// A new segment file is started once the current one reached this size.
+            size_t _segmentSize{4 * 1024 * 1024};
+        };
+        
+        
+        /// State shared by the offline queues of all sessions: the options, the memory accounting and statistics.
+        class OfflineStorage
+        {
+        public:
+            typedef std::shared_ptr<OfflineStorage> Ptr;
+            
+            explicit OfflineStorage(const OfflineQueueOptions& options)
+            : _options(options)
+            {}
+            
+            const OfflineQueueOptions& options() const
+            {
+                return _options;
+            }
+            
+            size_t memoryBytes() const
+            {
+                return _memoryBytes.load(std::memory_order_relaxed);
+            }
+            
+            size_t spilledMessages() const
+            {
+                return _spilledMessages.load(std::memory_order_relaxed);
+            }
+            
+            size_t expiredMessages() const
+            {
+                return _expiredMessages.load(std::memory_order_relaxed);
+            }
+            
+            size_t droppedMessages() const
+            {
+                return _droppedMessages.load(std::memory_order_relaxed);
+            }
+            
+        private:
+            friend class OfflineQueue;
+            
+            bool reserve(size_t bytes)
+            {
+                size_t current = _memoryBytes.load(std::memory_order_relaxed);
+                do {
+                    if(current + bytes > _options._memoryBudget) {
+                        return false;
+                    }
+                } while(!_memoryBytes.compare_exchange_weak(current, current + bytes, std::memory_order_relaxed));
+                return true;
+            }
+            
+            void release(size_t bytes)
+            {
+                _memoryBytes.fetch_sub(bytes, std::memory_order_relaxed);
+            }
+            
+            std::string segmentPath(uint64_t queueId, uint64_t segmentId) const
+            {
+                return _options._spoolDirectory + "/" + std::to_string(queueId) + "-" + std::to_string(segmentId) + ".seg";
+            }
+            
+            const OfflineQueueOptions _options;
+            std::atomic<size_t> _memoryBytes{0};
+            std::atomic<uint64_t> _nextQueueId{0};
+            std::atomic<size_t> _spilledMessages{0};
+            std::atomic<size_t> _expiredMessages{0};
+            std::atomic<size_t> _droppedMessages{0};
+        };
+        
+        
+        /// Holds the QoS>0 messages of a persistent session while its client is offline. The oldest messages are kept
+        /// in memory as long as the shared budget allows. Once the budget is exhausted, new messages are appended to
+        /// segment files, and keep going there until the files are drained again, so the order is preserved. Spilled
+        /// records are collected in a small buffer and appended to the segment in batches. Reading back walks the
+        /// segments sequentially through a large stdio buffer, and fully read segments are deleted. A file is only
+        /// open while a batch is written or read, so idle sessions do not hold file descriptors.
+        /// The queue is not synchronized, the owning session guards it.
+        class OfflineQueue
+        {
+        public:
+            typedef std::unique_ptr<OfflineQueue> Ptr;
+            typedef std::chrono::steady_clock Clock;
+            
+            explicit OfflineQueue(OfflineStorage::Ptr storage)
+            : _storage(storage)
+            , _queueId(storage->_nextQueueId++)
+            {}
+            
+            ~OfflineQueue()
+            {
+                for(const auto& message : _memory) {
+                    _storage->release(message._bytes);
+                }
+                closeSegments();
+            }
+            
+            OfflineQueue(const OfflineQueue&) = delete;
+            OfflineQueue& operator=(const OfflineQueue&) = delete;
+            
+            /// Returns false if the message had to be dropped, because the session limit is reached or it could
+            /// neither be kept in memory nor spilled to disk. ec is set on I/O errors.
+            bool push(PublishControlPacket::Ptr packet, std::error_code& ec)
+            {
+                ec.clear();
+                expireFront();
+                if(_storage->options()._maxMessages > 0 && size() >= _storage->options()._maxMessages) {
+                    ++_storage->_droppedMessages;
+                    return false;
+                }
+                
+                Clock::time_point expiry = Clock::time_point::max();
+                if(_storage->options()._messageExpiry.count() > 0) {
+                    expiry = Clock::now() + _storage->options()._messageExpiry;
+                }
+                
+                size_t bytes = estimatedPacketSize(*packet);
+                if(_diskMessages == 0 && _storage->reserve(bytes)) {
+                    _memory.push_back(Message{std::move(packet), expiry, bytes});
+                    return true;
+                }
+                
+                if(_storage->options()._spoolDirectory.empty() || !spill(*packet, expiry, ec)) {
+                    ++_storage->_droppedMessages;
+                    return false;
+                }
+                ++_storage->_spilledMessages;
+                return true;
+            }
+            
+            /// Appends up to maxMessages unexpired messages to out, oldest first. Returns the number of messages
+            /// appended.
+            size_t pop(size_t maxMessages, std::vector<PublishControlPacket::Ptr>& out, std::error_code& ec)
+            {
+                ec.clear();
+                size_t count = 0;
+                Clock::time_point now = Clock::now();
+                while(count < maxMessages && !_memory.empty()) {
+                    Message message = std::move(_memory.front());
+                    _memory.pop_front();
+                    _storage->release(message._bytes);
+                    if(message._expiry <= now) {
+                        ++_storage->_expiredMessages;
+                        continue;
+                    }
+                    out.push_back(std::move(message._packet));
+                    ++count;
+                }
+                
+                if(count < maxMessages && _diskMessages > 0) {
+                    // the records still in the write buffer may belong to the segment read next
+                    std::FILE* file = nullptr;
+                    if(!flush(ec)) {
+                        discardSegments();
+                        return count;
+                    }
+                    while(count < maxMessages && _diskMessages > 0) {
+                        PublishControlPacket::Ptr packet;
+                        Clock::time_point expiry;
+                        if(!readSegment(file, packet, expiry, ec)) {
+                            if(file) {
+                                std::fclose(file);
+                            }
+                            discardSegments();
+                            return count;
+                        }
+                        if(expiry <= now) {
+                            ++_storage->_expiredMessages;
+                            continue;
+                        }
+                        out.push_back(std::move(packet));
+                        ++count;
+                    }
+                    if(file) {
+                        _readOffset = std::ftell(file);
+                        std::fclose(file);
+                    }
+                }
+                
+                if(_diskMessages == 0 && !_segments.empty()) {
+                    closeSegments();
+                }
+                return count;
+            }
+            
+            bool empty() const
+            {
+                return _memory.empty() && _diskMessages == 0;
+            }
+            
+            size_t size() const
+            {
+                return _memory.size() + _diskMessages;
+            }
+            
+            size_t diskMessages() const
+            {
+                return _diskMessages;
+            }
+            
+        private:
+            struct Message
+            {
+                PublishControlPacket::Ptr _packet;
+                Clock::time_point _expiry;
+                size_t _bytes;
+            };
+            
+            struct Segment
+            {
+                uint64_t _id;
+                size_t _messages;
+                size_t _bytes;
+            };
+            
+            static constexpr size_t readBufferSize = 64 * 1024;
+            static constexpr size_t writeBatchSize = 4 * 1024;
+            
+            void expireFront()
+            {
+                Clock::time_point now = Clock::now();
+                while(!_memory.empty() && _memory.front()._expiry <= now) {
+                    _storage->release(_memory.front()._bytes);
+                    _memory.pop_front();
+                    ++_storage->_expiredMessages;
+                }
+            }
+            
+            // record: uint32 length | int64 expiry in ms, -1 for never | uint8 flags | uint16 packet id |
+            //         uint16 topic length | topic | uint16 topic alias | uint32 properties length | properties |
+            //         payload
+            // The properties are the encoded ones the broker does not act on, e.g. content type and user properties.
+            bool spill(const PublishControlPacket& packet, Clock::time_point expiry, std::error_code& ec)
+            {
+                if(_segments.empty() || _segments.back()._bytes >= _storage->options()._segmentSize) {
+                    // the buffered records belong to the segment being closed
+                    if(!flush(ec)) {
+                        discardSegments();
+                        return false;
+                    }
+                    _segments.push_back(Segment{_nextSegmentId++, 0, 0});
+                }
+                
+                int64_t expiryMs = -1;
+                if(expiry != Clock::time_point::max()) {
+                    expiryMs = std::chrono::duration_cast<std::chrono::milliseconds>(expiry.time_since_epoch()).count();
+                }
+                
+                size_t start = _writeBuffer.size();
+                append(static_cast<uint32_t>(0));
+                append(static_cast<uint32_t>(static_cast<uint64_t>(expiryMs) >> 32));
+                append(static_cast<uint32_t>(static_cast<uint64_t>(expiryMs)));
+                _writeBuffer.push_back(packet._header._flags);
+                append(static_cast<uint16_t>(packet._packetIdentifier));
+                append(static_cast<uint16_t>(packet._topicName._name.size()));
+                _writeBuffer.insert(_writeBuffer.end(), packet._topicName._name.begin(), packet._topicName._name.end());
+                append(packet._properties._topicAlias);
+                append(static_cast<uint32_t>(packet._properties._other.size()));
+                _writeBuffer.insert(_writeBuffer.end(), packet._properties._other.begin(), packet._properties._other.end());
+                _writeBuffer.insert(_writeBuffer.end(), packet._payload.begin(), packet._payload.end());
+                size_t size = _writeBuffer.size() - start;
+                uint32_t length = static_cast<uint32_t>(size - 4);
+                for(size_t i = 0; i < 4; ++i) {
+                    _writeBuffer[start + i] = static_cast<uint8_t>(length >> (24 - 8 * i));
+                }
+                _segments.back()._bytes += size;
+                
+                if(_writeBuffer.size() >= writeBatchSize && !flush(ec)) {
+                    discardSegments();
+                    return false;
+                }
+                ++_segments.back()._messages;
+                ++_diskMessages;
+                return true;
+            }
+            
+            /// Appends the buffered records to the last segment, the file is only open for the write.
+            bool flush(std::error_code& ec)
+            {
+                if(_writeBuffer.empty()) {
+                    return true;
+                }
+                Segment& segment = _segments.back();
+                bool created = segment._bytes == _writeBuffer.size();
+                std::FILE* file = std::fopen(_storage->segmentPath(_queueId, segment._id).c_str(), created ? "wb" : "ab");
+                if(!file) {
+                    ec = std::error_code(errno, std::generic_category());
+                    return false;
+                }
+                bool written = std::fwrite(_writeBuffer.data(), 1, _writeBuffer.size(), file) == _writeBuffer.size();
+                if(std::fclose(file) != 0 || !written) {
+                    ec = std::error_code(errno ? errno : EIO, std::generic_category());
+                    return false;
+                }
+                _writeBuffer.clear();
+                return true;
+            }
+            
+            bool readSegment(std::FILE*& file, PublishControlPacket::Ptr& packet, Clock::time_point& expiry,
+                             std::error_code& ec)
+            {
+                while(_readMessages == _segments.front()._messages) {
+                    // the front segment is exhausted, it cannot be the one still written to as there are messages left
+                    if(file) {
+                        std::fclose(file);
+                        file = nullptr;
+                    }
+                    std::remove(_storage->segmentPath(_queueId, _segments.front()._id).c_str());
+                    _segments.pop_front();
+                    _readMessages = 0;
+                    _readOffset = 0;
+                }
+                
+                if(!file) {
+                    file = std::fopen(_storage->segmentPath(_queueId, _segments.front()._id).c_str(), "rb");
+                    if(!file) {
+                        ec = std::error_code(errno, std::generic_category());
+                        return false;
+                    }
+                    std::setvbuf(file, nullptr, _IOFBF, readBufferSize);
+                    if(_readOffset > 0 && std::fseek(file, _readOffset, SEEK_SET) != 0) {
+                        ec = std::error_code(errno, std::generic_category());
+                        return false;
+                    }
+                }
+                
+                uint8_t header[4];
+                if(std::fread(header, 1, 4, file) != 4) {
+                    ec = std::error_code(errno ? errno : EIO, std::generic_category());
+                    return false;
+                }
+                uint32_t length = (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) |
+                                  (uint32_t(header[2]) << 8) | uint32_t(header[3]);
+                _readBuffer.resize(length);
+                if(length < 19 || std::fread(_readBuffer.data(), 1, length, file) != length) {
+                    ec = std::error_code(errno ? errno : EIO, std::generic_category());
+                    return false;
+                }
+                
+                size_t pos = 0;
+                uint64_t rawExpiry = (uint64_t(read32(pos)) << 32);
+                rawExpiry |= read32(pos);
+                int64_t expiryMs = static_cast<int64_t>(rawExpiry);
+                if(expiryMs < 0) {
+                    expiry = Clock::time_point::max();
+                } else {
+                    expiry = Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::milliseconds(expiryMs)));
+                }
+                
+                packet.reset(new PublishControlPacket);
+                packet->_header._flags = _readBuffer[pos++];
+                packet->_packetIdentifier = read16(pos);
+                uint16_t topicLength = read16(pos);
+                if(pos + topicLength + 6 > _readBuffer.size()) {
+                    ec = std::error_code(EIO, std::generic_category());
+                    return false;
+                }
+                packet->_topicName._name.assign(reinterpret_cast<const char*>(_readBuffer.data()) + pos, topicLength);
+                pos += topicLength;
+                packet->_properties._topicAlias = read16(pos);
+                uint32_t propertiesLength = read32(pos);
+                if(pos + propertiesLength > _readBuffer.size()) {
+                    ec = std::error_code(EIO, std::generic_category());
+                    return false;
+                }
+                auto properties = _readBuffer.begin() + static_cast<std::ptrdiff_t>(pos);
+                packet->_properties._other.assign(properties, properties + propertiesLength);
+                pos += propertiesLength;
+                packet->_payload.assign(_readBuffer.begin() + static_cast<std::ptrdiff_t>(pos), _readBuffer.end());
+                packet->_header._length = static_cast<uint32_t>(2 + topicLength + packet->_payload.size());
+                
+                ++_readMessages;
+                --_diskMessages;
+                return true;
+            }
+            
+            /// Gives up on the spilled messages after an I/O error.
+            void discardSegments()
+            {
+                _storage->_droppedMessages += _diskMessages;
+                closeSegments();
+            }
+            
+            void closeSegments()
+            {
+                for(const auto& segment : _segments) {
+                    std::remove(_storage->segmentPath(_queueId, segment._id).c_str());
+                }
+                _segments.clear();
+                _diskMessages = 0;
+                _readMessages = 0;
+                _readOffset = 0;
+                std::vector<uint8_t>().swap(_writeBuffer);
+                std::vector<uint8_t>().swap(_readBuffer);
+            }
+            
+            void append(uint16_t value)
+            {
+                _writeBuffer.push_back(static_cast<uint8_t>(value >> 8));
+                _writeBuffer.push_back(static_cast<uint8_t>(value));
+            }
+            
+            void append(uint32_t value)
+            {
+                _writeBuffer.push_back(static_cast<uint8_t>(value >> 24));
+                _writeBuffer.push_back(static_cast<uint8_t>(value >> 16));
+                _writeBuffer.push_back(static_cast<uint8_t>(value >> 8));
+                _writeBuffer.push_back(static_cast<uint8_t>(value));
+            }
+            
+            uint16_t read16(size_t& pos) const
+            {
+                uint16_t value = static_cast<uint16_t>((_readBuffer[pos] << 8) | _readBuffer[pos + 1]);
+                pos += 2;
+                return value;
+            }
+            
+            uint32_t read32(size_t& pos) const
+            {
+                uint32_t value = (uint32_t(_readBuffer[pos]) << 24) | (uint32_t(_readBuffer[pos + 1]) << 16) |
+                                 (uint32_t(_readBuffer[pos + 2]) << 8) | uint32_t(_readBuffer[pos + 3]);
+                pos += 4;
+                return value;
+            }
+            
+            OfflineStorage::Ptr _storage;
+            const uint64_t _queueId;
+            std::deque<Message> _memory;
+            std::deque<Segment> _segments;
+            uint64_t _nextSegmentId{0};
+            size_t _diskMessages{0};
+            size_t _readMessages{0};
+            long _readOffset{0};
+            std::vector<uint8_t> _writeBuffer;
+            std::vector<uint8_t> _readBuffer;
+        };
+        
+    }
+}
+
+#endif
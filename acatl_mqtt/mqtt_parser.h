@@ -37,9 +37,11 @@
 #include <acatl_mqtt/mqtt_connack_parser.h>
 #include <acatl_mqtt/mqtt_connect_parser.h>
 #include <acatl_mqtt/mqtt_fixed_header_parser.h>
+#include <acatl_mqtt/mqtt_packet_identifier_parser.h>
 #include <acatl_mqtt/mqtt_publish_parser.h>
 #include <acatl_mqtt/mqtt_subscribe_parser.h>
 #include <acatl_mqtt/mqtt_suback_parser.h>
+#include <acatl_mqtt/mqtt_topic_alias.h>
 
 
 namespace acatl
@@ -47,6 +49,17 @@ namespace acatl
     namespace mqtt
     {
         
+        /// Upper bounds for what a client may send, 0 disables a limit.
+        struct ParserLimits
+        {
+            /// Size of a whole packet, including the fixed header.
+            uint32_t _maxPacketSize{0};
+            /// Length of the topic of a PUBLISH and of every topic filter of a SUBSCRIBE.
+            uint16_t _maxTopicLength{0};
+            /// Topic filters in one SUBSCRIBE.
+            size_t _maxSubscriptions{0};
+        };
+        
         class MQTTParser
         {
         public:
@@ -56,8 +69,11 @@ namespace acatl
                 Connect,
                 ConnAck,
                 Publish,
+                Acknowledge,
                 Subscribe,
                 SubAck,
+                Stream,
+                Discard,
                 Ready
             };
             
@@ -67,14 +83,76 @@ namespace acatl
             , _publishParser(QoSLevel::AtMostOnce, 0)
             , _subscribeParser(0)
             , _subAckParser(0)
+            , _streamRemaining(0)
+            , _discardRemaining(0)
+            , _rejectedPackets(0)
+            , _protocolLevel(protocolLevel311)
             {}
             
+            ~MQTTParser()
+            {
+                if(_stream) {
+                    _stream->abort();
+                }
+            }
+            
             void reset()
             {
                 _status = Status::Start;
                 _fixedHeaderParser.reset();
             }
             
+            /// Publishes with a payload above the threshold are handed out as soon as their topic is parsed. Their
+            /// payload follows through PublishControlPacket::_stream while the parser consumes it.
+            void setStreamingOptions(const StreamingOptions& options)
+            {
+                _streamingOptions = options;
+            }
+            
+            /// The limits are checked as soon as the fixed header is decoded, so an oversized packet is rejected before
+            /// anything is allocated for it. Topic lengths and subscription counts are checked again while parsing.
+            void setLimits(const ParserLimits& limits)
+            {
+                _limits = limits;
+                _publishParser.setMaxTopicLength(limits._maxTopicLength);
+                _subscribeParser.setLimits(limits._maxTopicLength, limits._maxSubscriptions);
+            }
+            
+            /// The protocol level of the packets that follow. A server side parser switches by itself to the level of the
+            /// CONNECT it parsed, a client sets the level it connects with.
+            void setProtocolLevel(uint8_t protocolLevel)
+            {
+                _protocolLevel = protocolLevel;
+                _connAckParser.setProtocolLevel(protocolLevel);
+                _publishParser.setProtocolLevel(protocolLevel);
+                _subscribeParser.setProtocolLevel(protocolLevel);
+                _subAckParser.setProtocolLevel(protocolLevel);
+            }
+            
+            uint8_t protocolLevel() const
+            {
+                return _protocolLevel;
+            }
+            
+            /// The highest topic alias an MQTT 5.0 peer may use in its publishes, which are handed out with the topic
+            /// the alias stands for. 0 rejects every alias.
+            void setTopicAliasMaximum(uint16_t maximum)
+            {
+                _topicAliases.setMaximum(maximum);
+            }
+            
+            /// @return The number of packets rejected because they exceeded a limit.
+            uint64_t rejectedPackets() const
+            {
+                return _rejectedPackets;
+            }
+            
+            /// @return The stream the parser currently fills, nullptr if no payload is streamed.
+            const PayloadStream::Ptr& stream() const
+            {
+                return _stream;
+            }
+            
             acatl::Tribool parse(uint8_t byte, std::error_code& ec)
             {
                 switch(_status) {
@@ -83,6 +161,10 @@ namespace acatl
                         if(ret.isFalse()) {
                             return acatl::Tribool(false);
                         } else if(ret.isTrue()) {
+                            if(!admit(_fixedHeaderParser.header(), ec)) {
+                                ++_rejectedPackets;
+                                return acatl::Tribool(false);
+                            }
                             switch(_fixedHeaderParser.header()._controlPacketType) {
                                 case ControlPacketType::None:
                                     ec = mqtt_error::invalid_control_packet_type;
@@ -97,7 +179,8 @@ namespace acatl
                                     break;
                                 case ControlPacketType::Publish: {
                                     QoSLevel qos = QoSLevel((_fixedHeaderParser.header()._flags & 0x06) >> 1);
-                                    _publishParser.reset(qos, _fixedHeaderParser.header()._length);
+                                    _publishParser.reset(qos, _fixedHeaderParser.header()._length,
+                                                         static_cast<uint32_t>(_streamingOptions._threshold));
                                     _status = Status::Publish;
                                     break;
                                 }
@@ -105,8 +188,15 @@ namespace acatl
                                 case ControlPacketType::Pubrec:
                                 case ControlPacketType::Pubrel:
                                 case ControlPacketType::Pubcomp:
-                                    ec = mqtt_error::feature_not_implemented;
-                                    return acatl::Tribool(false);
+                                    // MQTT 5.0 may append a reason code and properties, which are skipped
+                                    if(_fixedHeaderParser.header()._length != 2
+                                       && (_protocolLevel != protocolLevel5 || _fixedHeaderParser.header()._length < 2)) {
+                                        ec = mqtt_error::control_packet_length;
+                                        return acatl::Tribool(false);
+                                    }
+                                    _identifierParser.reset();
+                                    _status = Status::Acknowledge;
+                                    break;
                                 case ControlPacketType::Subscribe:
                                     _subscribeParser.reset(_fixedHeaderParser.header()._length);
                                     _status = Status::Subscribe;
@@ -132,6 +222,12 @@ namespace acatl
                                 case ControlPacketType::Disconnect:
                                     _packet.reset(new DisconnectControlPacket);
                                     _packet->_header = _fixedHeaderParser.header();
+                                    if(_protocolLevel == protocolLevel5 && _packet->_header._length != 0) {
+                                        // the reason code and properties are skipped
+                                        _discardRemaining = _packet->_header._length;
+                                        _status = Status::Discard;
+                                        break;
+                                    }
                                     _status = Status::Ready;
                                     return acatl::Tribool(true);
                                 case ControlPacketType::Reserved:
@@ -148,6 +244,7 @@ namespace acatl
                         } else if(ret.isTrue()) {
                             _packet.reset(new ConnectControlPacket(_connectParser.packet()));
                             _packet->_header = _fixedHeaderParser.header();
+                            setProtocolLevel(_connectParser.packet()._protocolLevel);
                             _status = Status::Ready;
                             return acatl::Tribool(true);
                         }
@@ -168,18 +265,89 @@ namespace acatl
                     case Status::Publish: {
                         acatl::Tribool ret = _publishParser.parse(byte, ec);
                         if(ret.isFalse()) {
+                            countRejected(ec);
                             return acatl::Tribool(false);
                         } else if(ret.isTrue()) {
-                            _packet.reset(new PublishControlPacket(_publishParser.packet()));
+                            PublishControlPacket* publish = new PublishControlPacket(_publishParser.packet());
+                            _packet.reset(publish);
                             _packet->_header = _fixedHeaderParser.header();
+                            if(_protocolLevel == protocolLevel5) {
+                                if(!_topicAliases.resolve(publish->_topicName._name, publish->_properties._topicAlias, ec)) {
+                                    _packet.reset();
+                                    return acatl::Tribool(false);
+                                }
+                                // the alias is only valid on this connection
+                                publish->_properties._topicAlias = 0;
+                            }
+                            if(_publishParser.streaming()) {
+                                _streamRemaining = _publishParser.remaining();
+                                _stream = std::make_shared<PayloadStream>(_streamRemaining, _streamingOptions._budget);
+                                publish->_stream = _stream;
+                                _chunk.reserve(std::min<size_t>(_streamingOptions._chunkSize, _streamRemaining));
+                                _status = Status::Stream;
+                            } else {
+                                _status = Status::Ready;
+                            }
+                            return acatl::Tribool(true);
+                        }
+                        break;
+                    }
+                    case Status::Stream:
+                        // the packet was already handed out, the payload bytes go to its subscribers
+                        _chunk.push_back(byte);
+                        --_streamRemaining;
+                        if(_chunk.size() >= _streamingOptions._chunkSize || _streamRemaining == 0) {
+                            _stream->append(std::move(_chunk));
+                            _chunk = std::vector<uint8_t>();
+                            _chunk.reserve(std::min<size_t>(_streamingOptions._chunkSize, _streamRemaining));
+                        }
+                        if(_streamRemaining == 0) {
+                            _stream->finish();
+                            _stream.reset();
+                            reset();
+                        }
+                        break;
+                    case Status::Acknowledge: {
+                        acatl::Tribool ret = _identifierParser.parse(byte, ec);
+                        if(ret.isFalse()) {
+                            return acatl::Tribool(false);
+                        } else if(ret.isTrue()) {
+                            PacketIdentifier packetIdentifier = _identifierParser.packetIdentifier();
+                            switch(_fixedHeaderParser.header()._controlPacketType) {
+                                case ControlPacketType::Puback:
+                                    _packet.reset(new PubAckControlPacket(packetIdentifier));
+                                    break;
+                                case ControlPacketType::Pubrec:
+                                    _packet.reset(new PubRecControlPacket(packetIdentifier));
+                                    break;
+                                case ControlPacketType::Pubrel:
+                                    _packet.reset(new PubRelControlPacket(packetIdentifier));
+                                    break;
+                                default:
+                                    _packet.reset(new PubCompControlPacket(packetIdentifier));
+                                    break;
+                            }
+                            _packet->_header = _fixedHeaderParser.header();
+                            _discardRemaining = _packet->_header._length - 2;
+                            if(_discardRemaining != 0) {
+                                _status = Status::Discard;
+                                break;
+                            }
                             _status = Status::Ready;
                             return acatl::Tribool(true);
                         }
                         break;
                     }
+                    case Status::Discard:
+                        if(--_discardRemaining == 0) {
+                            _status = Status::Ready;
+                            return acatl::Tribool(true);
+                        }
+                        break;
                     case Status::Subscribe:{
                         acatl::Tribool ret = _subscribeParser.parse(byte, ec);
                         if(ret.isFalse()) {
+                            countRejected(ec);
                             return acatl::Tribool(false);
                         } else if(ret.isTrue()) {
                             _packet.reset(new SubscribeControlPacket(_subscribeParser.packet()));
@@ -210,19 +378,68 @@ namespace acatl
             
             ControlPacket::Ptr consumePacket()
             {
-                reset();
+                if(_status != Status::Stream) {
+                    reset();
+                }
                 return std::move(_packet);
             }
             
         private:
+            bool admit(const FixedHeader& header, std::error_code& ec) const
+            {
+                uint64_t length = header._length;
+                if(_limits._maxPacketSize != 0) {
+                    // fixed header byte and one to four bytes of remaining length
+                    uint64_t packetSize = 2 + length;
+                    for(uint64_t rest = length >> 7; rest != 0; rest >>= 7) {
+                        ++packetSize;
+                    }
+                    if(packetSize > _limits._maxPacketSize) {
+                        ec = mqtt_error::packet_too_large;
+                        return false;
+                    }
+                }
+                if(header._controlPacketType == ControlPacketType::Subscribe && _limits._maxSubscriptions != 0
+                   && _limits._maxTopicLength != 0) {
+                    // packet identifier, then per filter its length, the filter itself and the requested QoS
+                    uint64_t maxLength = 2 + _limits._maxSubscriptions * (2 + uint64_t(_limits._maxTopicLength) + 1);
+                    if(_protocolLevel == protocolLevel5) {
+                        // the property length and a subscription identifier
+                        maxLength += 4 + 5;
+                    }
+                    if(length > maxLength) {
+                        ec = mqtt_error::packet_too_large;
+                        return false;
+                    }
+                }
+                return true;
+            }
+            
+            void countRejected(const std::error_code& ec)
+            {
+                if(ec == mqtt_error::topic_too_long || ec == mqtt_error::too_many_subscriptions) {
+                    ++_rejectedPackets;
+                }
+            }
+            
             Status _status;
             FixedHeaderParser _fixedHeaderParser;
             ConnectParser _connectParser;
             ConnectAckParser _connAckParser;
             PublishParser _publishParser;
+            PacketIdentifierParser _identifierParser;
             SubscribeParser _subscribeParser;
             SubAckParser _subAckParser;
             ControlPacket::Ptr _packet;
+            StreamingOptions _streamingOptions;
+            PayloadStream::Ptr _stream;
+            std::vector<uint8_t> _chunk;
+            uint32_t _streamRemaining;
+            uint32_t _discardRemaining;
+            ParserLimits _limits;
+            uint64_t _rejectedPackets;
+            uint8_t _protocolLevel;
+            InboundTopicAliases _topicAliases;
         };
         
     }
@@ -0,0 +1,438 @@
+//
+//  mqtt_partitions.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_partitions_h
+#define acatl_mqtt_partitions_h
+
+#include <acatl_network/io_context_pool.h>
+
+#include <acatl_mqtt/mqtt_latency_tracer.h>
+#include <acatl_mqtt/mqtt_processor.h>
+#include <acatl_mqtt/mqtt_publish_router.h>
+#include <acatl_mqtt/mqtt_subscription_tree.h>
+
+#include <acatl/logging.h>
+
+#include <asio/post.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// Bounded lock-free queue of any number of producer threads and exactly one consumer thread. Every slot
+        /// carries a sequence number telling producers and the consumer whose turn it is, so the values of one
+        /// producer come out in the order it pushed them.
+        template<typename T>
+        class MpscQueue
+        {
+        public:
+            /// @param capacity Rounded up to a power of two.
+            explicit MpscQueue(size_t capacity)
+            : _mask(roundUp(capacity) - 1)
+            , _slots(_mask + 1)
+            {
+                for(size_t i = 0; i <= _mask; ++i) {
+                    _slots[i]._sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+            
+            MpscQueue(const MpscQueue&) = delete;
+            MpscQueue& operator=(const MpscQueue&) = delete;
+            
+            /// Moves value into the queue, leaves it untouched if the queue is full.
+            /// @return false if the queue is full.
+            bool push(T& value)
+            {
+                size_t tail = _tail.load(std::memory_order_relaxed);
+                Slot* slot = nullptr;
+                while(true) {
+                    slot = &_slots[tail & _mask];
+                    size_t sequence = slot->_sequence.load(std::memory_order_acquire);
+                    std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(tail);
+                    if(diff == 0) {
+                        if(_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if(diff < 0) {
+                        return false;
+                    } else {
+                        tail = _tail.load(std::memory_order_relaxed);
+                    }
+                }
+                slot->_value = std::move(value);
+                slot->_sequence.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+            
+            /// Only called by the consumer thread.
+            /// @return false if the queue is empty.
+            bool pop(T& value)
+            {
+                Slot& slot = _slots[_head & _mask];
+                if(slot._sequence.load(std::memory_order_acquire) != _head + 1) {
+                    return false;
+                }
+                value = std::move(slot._value);
+                slot._value = T();
+                slot._sequence.store(_head + _mask + 1, std::memory_order_release);
+                ++_head;
+                return true;
+            }
+            
+            size_t capacity() const
+            {
+                return _mask + 1;
+            }
+            
+        private:
+            struct Slot
+            {
+                std::atomic<size_t> _sequence{0};
+                T _value;
+            };
+            
+            static size_t roundUp(size_t capacity)
+            {
+                size_t result = 1;
+                while(result < capacity) {
+                    result <<= 1;
+                }
+                return result;
+            }
+            
+            const size_t _mask;
+            std::vector<Slot> _slots;
+            // the producers share the tail, the consumer owns the head, each on its own cache line
+            char _tailPadding[64];
+            std::atomic<size_t> _tail{0};
+            char _headPadding[64];
+            size_t _head = 0;
+            char _trailingPadding[64];
+        };
+        
+        
+        struct PartitionOptions
+        {
+            /// Number of leading topic levels deciding the partition of a topic.
+            size_t _levels = 1;
+            /// Capacity of the inbox of every partition.
+            size_t _queueCapacity = 4096;
+        };
+        
+        
+        /// Splits the topic space into one partition per context of an IoContextPool by hashing the leading topic
+        /// levels. Every partition has its own subscription tree, which only the context's thread touches, so
+        /// matching and fan-out need no locks. A publish or subscription arriving on another thread is handed over
+        /// through the lock-free inbox of the owning partition, so the memory for the queues grows linearly with
+        /// the number of partitions. Filters with a wildcard in the leading levels go to all partitions.
+        ///
+        /// Publishes carrying a payload stream are only delivered when they arrive on their own partition, a
+        /// stream can't be read once it is handed over.
+        class Partitions
+        {
+        public:
+            Partitions(net::IoContextPool& pool, const PartitionOptions& options = PartitionOptions())
+            : _pool(pool)
+            , _options(options)
+            {
+                if(_options._levels == 0) {
+                    _options._levels = 1;
+                }
+                const size_t count = _pool.size();
+                for(size_t i = 0; i < count; ++i) {
+                    _partitions.emplace_back(new Partition(_options._queueCapacity));
+                    _indices[&_pool.get(i)] = i;
+                }
+            }
+            
+            Partitions(const Partitions&) = delete;
+            Partitions& operator=(const Partitions&) = delete;
+            
+            void setLatencyTracer(LatencyTracer::Ptr tracer)
+            {
+                _tracer = tracer;
+            }
+            
+            size_t size() const
+            {
+                return _partitions.size();
+            }
+            
+            /// @return The partition of the given context of the pool.
+            size_t index(asio::execution_context& context) const
+            {
+                auto iter = _indices.find(&context);
+                if(iter == _indices.end()) {
+                    throw std::invalid_argument("context does not belong to the partitioned pool");
+                }
+                return iter->second;
+            }
+            
+            /// @return The partition owning the topic.
+            size_t partitionOf(const std::string& topic) const
+            {
+                return std::hash<std::string>()(prefix(topic)) % _partitions.size();
+            }
+            
+            /// @return true if the filter may match topics of more than one partition.
+            bool isBroadcast(const std::string& filter) const
+            {
+                return prefix(filter).find_first_of("+#") != std::string::npos;
+            }
+            
+            /// @return The number of routes that found the inbox of their partition full and took the slower way
+            /// through the handler queue of its context.
+            uint64_t overflows() const
+            {
+                return _overflows.load(std::memory_order_relaxed);
+            }
+            
+            /// @return A router for the processors running on the context of the given partition.
+            PublishRouter::Ptr router(size_t partition)
+            {
+                return std::make_shared<Router>(*this, partition);
+            }
+            
+        private:
+            struct Route
+            {
+                enum class Type
+                {
+                    None,
+                    Publish,
+                    Subscribe
+                };
+                
+                Type _type = Type::None;
+                PublishControlPacket::Ptr _publish;
+                FlowControl::Ptr _flowControl;
+                bool _localDelivery = false;
+                TopicFilter _filter;
+                Session::Ptr _session;
+            };
+            
+            struct Partition
+            {
+                explicit Partition(size_t capacity)
+                : _inbox(capacity)
+                {}
+                
+                MpscQueue<Route> _inbox;
+                char _leadingPadding[64];
+                std::atomic<bool> _scheduled{false};
+                SubscriptionTree _tree;
+                char _trailingPadding[64];
+            };
+            
+            class Router : public PublishRouter
+            {
+            public:
+                Router(Partitions& partitions, size_t partition)
+                : _partitions(partitions)
+                , _partition(partition)
+                {}
+                
+                void addSubscription(const TopicFilter& filter, Session::Ptr session) override
+                {
+                    _partitions.addSubscription(_partition, filter, session);
+                }
+                
+                void route(const PublishControlPacket& pub, const FlowControl::Ptr& flowControl, bool localDelivery) override
+                {
+                    _partitions.route(_partition, pub, flowControl, localDelivery);
+                }
+                
+            private:
+                Partitions& _partitions;
+                size_t _partition;
+            };
+            
+            /// Bounds the routes a drain takes before it yields to the context's other handlers.
+            static constexpr size_t drainBatch = 1024;
+            
+            /// How often a sender drains its own inbox and retries before it gives up on a full inbox.
+            static constexpr size_t sendRetries = 16;
+            
+            std::string prefix(const std::string& topic) const
+            {
+                size_t pos = 0;
+                for(size_t level = 0; level < _options._levels; ++level) {
+                    pos = topic.find('/', pos);
+                    if(pos == std::string::npos) {
+                        return topic;
+                    }
+                    ++pos;
+                }
+                return topic.substr(0, pos - 1);
+            }
+            
+            void addSubscription(size_t from, const TopicFilter& filter, Session::Ptr session)
+            {
+                if(isBroadcast(filter._filter)) {
+                    for(size_t to = 0; to < _partitions.size(); ++to) {
+                        subscribe(from, to, filter, session);
+                    }
+                } else {
+                    subscribe(from, partitionOf(filter._filter), filter, session);
+                }
+            }
+            
+            void subscribe(size_t from, size_t to, const TopicFilter& filter, const Session::Ptr& session)
+            {
+                if(from == to) {
+                    std::error_code ec;
+                    _partitions[to]->_tree.addFilter(filter, session, ec);
+                    return;
+                }
+                Route route;
+                route._type = Route::Type::Subscribe;
+                route._filter = filter;
+                route._session = session;
+                send(from, to, route);
+            }
+            
+            void route(size_t from, const PublishControlPacket& pub, const FlowControl::Ptr& flowControl, bool localDelivery)
+            {
+                size_t to = partitionOf(pub._topicName._name);
+                if(from == to) {
+                    match(to, pub, flowControl, localDelivery);
+                    return;
+                }
+                if(pub._stream) {
+                    ACATL_CLASSLOG(Partitions, 1, "Dropped streamed publish on '" << pub._topicName._name << "' of another partition");
+                    return;
+                }
+                Route route;
+                route._type = Route::Type::Publish;
+                route._publish.reset(new PublishControlPacket(pub));
+                route._flowControl = flowControl;
+                route._localDelivery = localDelivery;
+                send(from, to, route);
+            }
+            
+            void match(size_t partition, const PublishControlPacket& pub, const FlowControl::Ptr& flowControl, bool localDelivery)
+            {
+                Sessions sessions;
+                std::error_code ec;
+                bool found = _partitions[partition]->_tree.match(pub._topicName, sessions, ec);
+                LatencyTracer::Clock::time_point matched;
+                if(_tracer && pub.traced()) {
+                    matched = _tracer->record(TraceStage::Match, pub._traceTimestamp);
+                }
+                if(found) {
+                    Processor::deliver(pub, sessions, matched, flowControl, localDelivery);
+                }
+            }
+            
+            void send(size_t from, size_t to, Route& route)
+            {
+                MpscQueue<Route>& inbox = _partitions[to]->_inbox;
+                for(size_t retry = 0; !inbox.push(route); ++retry) {
+                    if(retry == sendRetries) {
+                        // The target is far behind, possibly waiting for room in our own inbox. The route is posted
+                        // to its context instead, it may overtake routes still waiting in the inbox.
+                        _overflows.fetch_add(1, std::memory_order_relaxed);
+                        auto overflow = std::make_shared<Route>(std::move(route));
+                        asio::post(_pool.get(to), [this, to, overflow]() {
+                            process(to, *overflow);
+                        });
+                        return;
+                    }
+                    drain(from);
+                    std::this_thread::yield();
+                }
+                notify(to);
+            }
+            
+            void notify(size_t partition)
+            {
+                if(!_partitions[partition]->_scheduled.exchange(true, std::memory_order_acq_rel)) {
+                    asio::post(_pool.get(partition), [this, partition]() {
+                        drain(partition);
+                    });
+                }
+            }
+            
+            void drain(size_t partition)
+            {
+                _partitions[partition]->_scheduled.store(false, std::memory_order_release);
+                MpscQueue<Route>& inbox = _partitions[partition]->_inbox;
+                Route route;
+                size_t taken = 0;
+                while(taken < drainBatch && inbox.pop(route)) {
+                    process(partition, route);
+                    ++taken;
+                }
+                if(taken == drainBatch) {
+                    notify(partition);
+                }
+            }
+            
+            void process(size_t partition, Route& route)
+            {
+                switch(route._type) {
+                    case Route::Type::Publish:
+                        match(partition, *route._publish, route._flowControl, route._localDelivery);
+                        break;
+                    case Route::Type::Subscribe: {
+                        std::error_code ec;
+                        _partitions[partition]->_tree.addFilter(route._filter, route._session, ec);
+                        break;
+                    }
+                    case Route::Type::None:
+                        break;
+                }
+                route = Route();
+            }
+            
+            net::IoContextPool& _pool;
+            PartitionOptions _options;
+            LatencyTracer::Ptr _tracer;
+            std::vector<std::unique_ptr<Partition>> _partitions;
+            std::atomic<uint64_t> _overflows{0};
+            std::unordered_map<asio::execution_context*, size_t> _indices;
+        };
+        
+    }
+}
+
+#endif
@@ -0,0 +1,350 @@
+//
+//  mqtt_payload_stream.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_payload_stream_h
+#define acatl_mqtt_payload_stream_h
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// When the payload of a publish is streamed instead of buffered.
+        struct StreamingOptions
+        {
+            /// Payloads larger than this are streamed, 0 disables streaming.
+            size_t _threshold{0};
+            /// Bytes the publisher's parser collects before handing them to the subscribers.
+            size_t _chunkSize{64 * 1024};
+            /// Bytes a stream buffers for its slowest subscriber before the publisher stops reading.
+            size_t _budget{1024 * 1024};
+        };
+        
+        /// The payload of a large publish, passed from the publisher to the subscribers in chunks while it is still
+        /// being received. Every subscriber reads the chunks through its own Reader. A chunk is released as soon as
+        /// all readers passed it, so the memory of a stream is bounded by the budget instead of the payload size. The
+        /// publisher has to pause reading while shouldPause is true, the resume handler tells it to continue.
+        ///
+        /// Readers have to be attached before the first chunk is appended, a later reader could not see the whole
+        /// payload anymore. Thread safe, the publisher and every subscriber may run on different threads.
+        class PayloadStream : public std::enable_shared_from_this<PayloadStream>
+        {
+        public:
+            typedef std::shared_ptr<PayloadStream> Ptr;
+            typedef std::shared_ptr<const std::vector<uint8_t>> Chunk;
+            typedef std::function<void()> Handler;
+            typedef std::function<void(bool)> CompletionHandler;
+            
+            enum class Result
+            {
+                Chunk,
+                Pending,
+                Finished,
+                Aborted
+            };
+            
+            class Reader
+            {
+            public:
+                typedef std::shared_ptr<Reader> Ptr;
+                
+                Reader(const Reader&) = delete;
+                Reader& operator=(const Reader&) = delete;
+                
+                ~Reader()
+                {
+                    _stream->detach(_index);
+                }
+                
+                /// The number of payload bytes, which is known up front from the packet length.
+                size_t size() const
+                {
+                    return _stream->size();
+                }
+                
+                /// Takes the next chunk. If none is available yet, Pending is returned and wakeUp is called once when
+                /// the stream made progress. wakeUp may be called on the publisher's thread.
+                Result read(Chunk& chunk, Handler wakeUp)
+                {
+                    return _stream->read(_index, chunk, std::move(wakeUp));
+                }
+                
+            private:
+                friend class PayloadStream;
+                
+                explicit Reader(PayloadStream::Ptr stream)
+                : _stream(stream)
+                , _index(0)
+                {}
+                
+                PayloadStream::Ptr _stream;
+                uint64_t _index;
+            };
+            
+            PayloadStream(size_t size, size_t budget)
+            : _size(size)
+            , _budget(budget)
+            , _bufferedBytes(0)
+            , _firstIndex(0)
+            , _readers(0)
+            , _appended(false)
+            , _finished(false)
+            , _aborted(false)
+            , _paused(false)
+            {}
+            
+            size_t size() const
+            {
+                return _size;
+            }
+            
+            size_t bufferedBytes() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _bufferedBytes;
+            }
+            
+            size_t readers() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _readers;
+            }
+            
+            /// Adds a subscriber to the stream.
+            /// @return The reader, or nullptr if the stream already started or was aborted.
+            Reader::Ptr attach()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if(_appended || _aborted) {
+                    return Reader::Ptr();
+                }
+                ++_readers;
+                guard.unlock();
+                return Reader::Ptr(new Reader(shared_from_this()));
+            }
+            
+            /// The handler is called on the thread of a reader that released enough chunks after a pause.
+            void setResumeHandler(Handler handler)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _resumeHandler = std::move(handler);
+            }
+            
+            /// The handler is called with true once the payload was completely received, with false if it was aborted.
+            void setCompletionHandler(CompletionHandler handler)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _completionHandler = std::move(handler);
+            }
+            
+            void append(std::vector<uint8_t> bytes)
+            {
+                std::vector<Handler> waiting;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _appended = true;
+                    if(_aborted) {
+                        return;
+                    }
+                    if(_readers == 0) {
+                        // nobody subscribed, the bytes are consumed right away
+                        ++_firstIndex;
+                        return;
+                    }
+                    _bufferedBytes += bytes.size();
+                    _chunks.push_back(Entry{std::make_shared<const std::vector<uint8_t>>(std::move(bytes)), _readers});
+                    waiting.swap(_waiting);
+                }
+                for(auto& handler : waiting) {
+                    handler();
+                }
+            }
+            
+            void finish()
+            {
+                complete(true);
+            }
+            
+            /// Ends the stream before the payload was complete, e.g. because the publisher disconnected. The readers
+            /// cannot finish their packets anymore and have to drop their connections.
+            void abort()
+            {
+                complete(false);
+            }
+            
+            bool finished() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _finished;
+            }
+            
+            /// Checks whether the publisher has to stop reading. If true is returned, the resume handler will be called
+            /// once the readers released half of the budget.
+            bool shouldPause()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if(_bufferedBytes <= _budget || _finished || _aborted) {
+                    return false;
+                }
+                _paused = true;
+                return true;
+            }
+            
+        private:
+            struct Entry
+            {
+                Chunk _chunk;
+                size_t _pendingReaders;
+            };
+            
+            Result read(uint64_t& index, Chunk& chunk, Handler wakeUp)
+            {
+                Handler resume;
+                Result result;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if(_aborted) {
+                        return Result::Aborted;
+                    }
+                    if(index < _firstIndex + _chunks.size()) {
+                        Entry& entry = _chunks[static_cast<size_t>(index - _firstIndex)];
+                        chunk = entry._chunk;
+                        --entry._pendingReaders;
+                        ++index;
+                        resume = release();
+                        result = Result::Chunk;
+                    } else if(_finished) {
+                        return Result::Finished;
+                    } else {
+                        _waiting.push_back(std::move(wakeUp));
+                        return Result::Pending;
+                    }
+                }
+                if(resume) {
+                    resume();
+                }
+                return result;
+            }
+            
+            void detach(uint64_t index)
+            {
+                Handler resume;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    --_readers;
+                    for(uint64_t i = std::max(index, _firstIndex); i < _firstIndex + _chunks.size(); ++i) {
+                        --_chunks[static_cast<size_t>(i - _firstIndex)]._pendingReaders;
+                    }
+                    resume = release();
+                }
+                if(resume) {
+                    resume();
+                }
+            }
+            
+            /// Drops the chunks all readers passed. Has to be called with the mutex held.
+            /// @return The resume handler, if the publisher has to be resumed.
+            Handler release()
+            {
+                while(!_chunks.empty() && _chunks.front()._pendingReaders == 0) {
+                    _bufferedBytes -= _chunks.front()._chunk->size();
+                    _chunks.pop_front();
+                    ++_firstIndex;
+                }
+                if(_paused && _bufferedBytes <= _budget / 2) {
+                    _paused = false;
+                    return _resumeHandler;
+                }
+                return Handler();
+            }
+            
+            void complete(bool finished)
+            {
+                std::vector<Handler> waiting;
+                CompletionHandler completionHandler;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if(_finished || _aborted) {
+                        return;
+                    }
+                    if(finished) {
+                        _finished = true;
+                    } else {
+                        _aborted = true;
+                        _bufferedBytes = 0;
+                        _firstIndex += _chunks.size();
+                        _chunks.clear();
+                    }
+                    waiting.swap(_waiting);
+                    completionHandler.swap(_completionHandler);
+                    // the handlers may keep the publisher alive, release them with the end of the stream
+                    _resumeHandler = Handler();
+                    _paused = false;
+                }
+                for(auto& handler : waiting) {
+                    handler();
+                }
+                if(completionHandler) {
+                    completionHandler(finished);
+                }
+            }
+            
+            const size_t _size;
+            const size_t _budget;
+            mutable std::mutex _mutex;
+            std::deque<Entry> _chunks;
+            size_t _bufferedBytes;
+            uint64_t _firstIndex;
+            size_t _readers;
+            bool _appended;
+            bool _finished;
+            bool _aborted;
+            bool _paused;
+            std::vector<Handler> _waiting;
+            Handler _resumeHandler;
+            CompletionHandler _completionHandler;
+        };
+
+    }
+}
+
+#endif
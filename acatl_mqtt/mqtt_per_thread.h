@@ -0,0 +1,120 @@
+//
+//  mqtt_per_thread.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_per_thread_h
+#define acatl_mqtt_per_thread_h
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// One instance of T per thread, for statistics every thread records on its own and readers combine. A thread
+        /// finds its instance through a thread local cache without locking. The instances stay alive until the
+        /// PerThread is destroyed, so the data of a terminated thread is kept, and a new thread with the same id
+        /// continues it.
+        template<typename T>
+        class PerThread
+        {
+        public:
+            typedef std::function<std::unique_ptr<T>()> Factory;
+            
+            explicit PerThread(Factory factory = []() { return std::unique_ptr<T>(new T); })
+            : _id(nextId())
+            , _factory(factory)
+            {}
+            
+            PerThread(const PerThread&) = delete;
+            PerThread& operator=(const PerThread&) = delete;
+            
+            /// @return The instance of the calling thread.
+            T& local()
+            {
+                // each thread remembers the instance it used last, other PerThreads of the same type fall back to
+                // the lookup under the mutex
+                static thread_local CachedInstance cached{0, nullptr};
+                if(cached._id != _id) {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    std::unique_ptr<T>& instance = _instances[std::this_thread::get_id()];
+                    if(!instance) {
+                        instance = _factory();
+                    }
+                    cached._id = _id;
+                    cached._instance = instance.get();
+                }
+                return *cached._instance;
+            }
+            
+            /// Calls function with the instance of every thread that used local() so far. Threads may keep using
+            /// their instances concurrently, T has to synchronize that itself.
+            template<typename Function>
+            void forEach(Function function) const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                for(const auto& entry : _instances) {
+                    function(*entry.second);
+                }
+            }
+            
+        private:
+            struct CachedInstance
+            {
+                uint64_t _id;
+                T* _instance;
+            };
+            
+            static uint64_t nextId()
+            {
+                static std::atomic<uint64_t> id(0);
+                return ++id;
+            }
+            
+            uint64_t _id;
+            Factory _factory;
+            mutable std::mutex _mutex;
+            std::unordered_map<std::thread::id, std::unique_ptr<T>> _instances;
+        };
+        
+    }
+}
+
+#endif
@@ -36,10 +36,19 @@
 
 #include <acatl/logging.h>
 
+#include <acatl_mqtt/mqtt_acl.h>
+#include <acatl_mqtt/mqtt_flow_control.h>
+#include <acatl_mqtt/mqtt_heavy_hitters.h>
+#include <acatl_mqtt/mqtt_latency_tracer.h>
+#include <acatl_mqtt/mqtt_metrics.h>
 #include <acatl_mqtt/mqtt_packet_sender.h>
+#include <acatl_mqtt/mqtt_publish_router.h>
+#include <acatl_mqtt/mqtt_rate_limiter.h>
+#include <acatl_mqtt/mqtt_retained_store.h>
 #include <acatl_mqtt/mqtt_session_manager.h>
 #include <acatl_mqtt/mqtt_subscription_tree_manager.h>
 #include <acatl_mqtt/mqtt_types.h>
+#include <acatl_mqtt/mqtt_worker_pool.h>
 
 
 namespace acatl
@@ -52,13 +61,19 @@ namespace acatl
         public:
             Processor(SubscriptionTreeManager& subcriptionTreeManager, SessionManager& sessionManager)
             : _status(Status::None)
+            , _keepAlive(0)
+            , _topicAliasMaximum(0)
+            , _connected(false)
+            , _localDelivery(false)
             , _currentSession(nullptr)
             , _subcriptionTreeManager(subcriptionTreeManager)
             , _sessionManager(sessionManager)
+            , _workers(nullptr)
             {}
             
             ~Processor()
             {
+                countDisconnect();
                 std::error_code ec;
                 _sessionManager.returnSession(_currentSession, ec);
             }
@@ -68,11 +83,20 @@ namespace acatl
             //      Session smart pointer in the first place
             virtual void addSubscriptions(const TopicFilters& subscriptions)
             {
-                acatl::mqtt::SubscriptionTreeManager::WritableTree writableTree = _subcriptionTreeManager.getWritableTree();
-                std::for_each(subscriptions.cbegin(), subscriptions.cend(), [this,&writableTree](const TopicFilter& filter) {
-                    std::error_code ec;
-                    writableTree.tree()->addFilter(filter, _currentSession, ec);
-                });
+                if(_router) {
+                    for(const auto& filter : subscriptions) {
+                        _router->addSubscription(filter, _currentSession);
+                    }
+                } else {
+                    acatl::mqtt::SubscriptionTreeManager::WritableTree writableTree = _subcriptionTreeManager.getWritableTree();
+                    std::for_each(subscriptions.cbegin(), subscriptions.cend(), [this,&writableTree](const TopicFilter& filter) {
+                        std::error_code ec;
+                        writableTree.tree()->addFilter(filter, _currentSession, ec);
+                    });
+                }
+                if(_metrics) {
+                    _metrics->add(Metric::Subscriptions, static_cast<int64_t>(subscriptions.size()));
+                }
             }
             
             virtual void removeSubscriptions(const TopicFilters& subscriptions)
@@ -84,6 +108,121 @@ namespace acatl
                 _packetSender = packetSender;
             }
             
+            /// Deliveries of publishes received by this processor will be accounted against the given flow control.
+            void setFlowControl(FlowControl::Ptr flowControl)
+            {
+                _flowControl = flowControl;
+            }
+            
+            /// Publishes with the RETAIN flag are kept in the given store and replayed to new matching subscriptions.
+            void setRetainedStore(RetainedStore::Ptr retainedStore)
+            {
+                _retainedStore = retainedStore;
+            }
+            
+            /// Limits the publishes of the client, checked before a publish is matched against the subscriptions.
+            void setRateLimits(const RateLimitOptions& options)
+            {
+                _rateLimiter = RateLimiter(options);
+            }
+            
+            /// Received and dropped publishes, connected clients and subscriptions are counted in the given metrics.
+            void setMetrics(Metrics::Ptr metrics)
+            {
+                _metrics = metrics;
+            }
+            
+            /// Publishes and subscriptions of the client are checked against the ACL rules of the authorizer. The rules
+            /// are compiled for the client on CONNECT and again whenever they were reloaded.
+            void setAuthorizer(Authorizer::Ptr authorizer)
+            {
+                _authorizer = authorizer;
+            }
+            
+            /// Every publish of the client is recorded in the given heavy hitter detection.
+            void setHeavyHitters(HeavyHitters::Ptr heavyHitters)
+            {
+                _heavyHitters = heavyHitters;
+            }
+            
+            /// The match stage of sampled publishes is recorded in the given tracer.
+            void setLatencyTracer(LatencyTracer::Ptr tracer)
+            {
+                _tracer = tracer;
+            }
+            
+            /// Publishes are only delivered to local clients, not to the links of other cluster nodes. Set for
+            /// processors handling publishes another node forwarded, each of them went to all interested nodes already.
+            void setLocalDelivery(bool localDelivery)
+            {
+                _localDelivery = localDelivery;
+            }
+            
+            /// Subscriptions and publishes go through the router instead of the shared subscription tree.
+            void setPublishRouter(PublishRouter::Ptr router)
+            {
+                _router = router;
+            }
+            
+            /// Client IDs starting with clusterLinkPrefix are only accepted with these credentials, without any they
+            /// are refused.
+            void setClusterCredentials(ClusterCredentials::Ptr credentials)
+            {
+                _clusterCredentials = credentials;
+            }
+            
+            /// Fan-outs larger than a chunk of the pool are delivered by its workers in parallel. The pool has to
+            /// outlive the processor, which may be destroyed on one of its threads.
+            void setWorkerPool(WorkerPool* workers)
+            {
+                _workers = workers;
+            }
+            
+            /// The highest topic alias MQTT 5.0 clients may use, announced in the CONNACK. The parser of the connection
+            /// has to accept the same maximum.
+            void setTopicAliasMaximum(uint16_t maximum)
+            {
+                _topicAliasMaximum = maximum;
+            }
+            
+            /// @return How long the connection should stop reading, because the client exceeded its rate limits.
+            RateLimiter::Clock::duration throttleDelay() const
+            {
+                if(!_rateLimiter.enabled()) {
+                    return RateLimiter::Clock::duration::zero();
+                }
+                return _rateLimiter.delay(RateLimiter::Clock::now());
+            }
+            
+            /// @return The QoS 0 publishes dropped because they exceeded a rate limit.
+            uint64_t rateLimitedPublishes() const
+            {
+                return _rateLimiter.droppedPublishes();
+            }
+            
+            /// @return The keep alive interval in seconds the client announced on CONNECT, 0 disables the check.
+            uint16_t keepAlive() const
+            {
+                return _keepAlive;
+            }
+            
+            /// Sends up to maxMessages messages that were queued while the client of the current session was offline.
+            /// The connection calls this once its send queue ran empty, so a long backlog is paced by the socket.
+            size_t drainOfflineMessages(size_t maxMessages)
+            {
+                if(!_currentSession) {
+                    return 0;
+                }
+                return _currentSession->drainOfflineMessages(maxMessages);
+            }
+            
+            /// Delivers a publish originating from the broker itself to the matching sessions, without a client
+            /// connection.
+            void publish(const PublishControlPacket& pub, std::error_code& ec)
+            {
+                forward(pub, ec);
+            }
+            
             std::tuple<ConnectionState, ControlPacket::Ptr> processPacket(ControlPacket::Ptr packet, std::error_code& ec)
             {
                 if(_packetSender.expired()) {
@@ -105,6 +244,11 @@ namespace acatl
                             ec = mqtt_error::duplicate_connect_protocol_violation;
                             return std::make_tuple(ConnectionState::Close, ControlPacket::Ptr());
                         }
+                        if(!_currentSession) {
+                            // all packets following the CONNECT work on the session of the client
+                            ec = mqtt_error::not_connected;
+                            return std::make_tuple(ConnectionState::Close, ControlPacket::Ptr());
+                        }
                         break;
                     case Status::Disconnected:
                         ec = mqtt_error::not_connected;
@@ -134,6 +278,7 @@ namespace acatl
                     case ControlPacketType::Pubrec:
                     case ControlPacketType::Pubcomp:
                     case ControlPacketType::Pubrel:
+                        return doProcess(dynamic_cast<const AcknowledgeControlPacket&>(*packet), ec);
                     case ControlPacketType::Unsubscribe:
                         ec = mqtt_error::feature_not_implemented;
                         break;
@@ -159,46 +304,317 @@ namespace acatl
                 ACATL_CLASSLOG(Processor, 3, "Connect protocol level " << std::to_string(connect._protocolLevel));
                 ACATL_CLASSLOG(Processor, 3, "Connect keep alive " << connect._keepAlive << " seconds");
                 ACATL_CLASSLOG(Processor, 1, "Connect client ID " << connect._clientId);
+                _keepAlive = connect._keepAlive;
+                _userName = connect._userNameFlag ? connect._userName : std::string();
+                
+                if(isClusterLink(connect._clientId)) {
+                    std::string password = connect._passwordFlag ? connect._password : std::string();
+                    if(!_clusterCredentials || !_clusterCredentials->accepts(_userName, password)) {
+                        ACATL_CLASSLOG(Processor, 1, "Refused client ID " << connect._clientId << ", reserved for cluster links");
+                        return refuseConnect(_clusterCredentials ? ConnectReturnCode::BadUserNameOrPassword
+                                                                 : ConnectReturnCode::IdentifierRejected);
+                    }
+                }
 
-                _currentSession = _sessionManager.getSession(connect._clientId, _packetSender, *this, ec);
+                _currentSession = _sessionManager.getSession(connect._clientId, connect._cleanSession, _packetSender, *this, ec);
+                if(!_currentSession) {
+                    ACATL_CLASSLOG(Processor, 1, "Refused client ID " << connect._clientId << ": " << ec.message());
+                    bool inUse = ec == mqtt_error::session_in_use;
+                    ec.clear();
+                    return refuseConnect(inUse ? ConnectReturnCode::IdentifierRejected : ConnectReturnCode::ServerUnavailable);
+                }
+                countConnect();
+                if(_authorizer) {
+                    _acl = _authorizer->compile(_currentSession->clientId(), _userName);
+                }
+                TopicFilters restored = _currentSession->takeRestoredSubscriptions();
+                if(!restored.empty()) {
+                    ACATL_CLASSLOG(Processor, 2, "Restored " << restored.size() << " subscriptions of " << connect._clientId);
+                    addSubscriptions(restored);
+                }
                 
                 ConnAckControlPacket::Ptr connack = std::make_unique<ConnAckControlPacket>();
                 connack->_connectAcknowledgeFlag = ConnectAcknowledgeFlags::None;
                 connack->_connectReturnCode = ConnectReturnCode::ConnectionAccepted;
-                return std::make_tuple(ConnectionState::Keep, std::move(connack));
+                if(connect._protocolLevel == protocolLevel5) {
+                    connack->_properties._topicAliasMaximum = _topicAliasMaximum;
+                }
+                
+                PacketSender::Ptr sender = _packetSender.lock();
+                if(!sender || _currentSession->inflightMessages() == 0) {
+                    return std::make_tuple(ConnectionState::Keep, std::move(connack));
+                }
+                // unacknowledged messages of the previous connection are sent again right after the CONNACK
+                sender->addSendPacket(std::move(connack));
+                size_t resent = _currentSession->resendInflight();
+                ACATL_CLASSLOG(Processor, 2, "Resent " << resent << " unacknowledged packets to " << connect._clientId);
+                return std::make_tuple(ConnectionState::Keep, ControlPacket::Ptr());
+            }
+            
+            /// Answers a CONNECT that is not accepted. No further packet is processed, the connection is closed once
+            /// the CONNACK was sent.
+            std::tuple<ConnectionState, ControlPacket::Ptr> refuseConnect(ConnectReturnCode returnCode)
+            {
+                _status = Status::Disconnected;
+                ConnAckControlPacket::Ptr connack = std::make_unique<ConnAckControlPacket>();
+                connack->_connectAcknowledgeFlag = ConnectAcknowledgeFlags::None;
+                connack->_connectReturnCode = returnCode;
+                return std::make_tuple(ConnectionState::Close, std::move(connack));
             }
             
             std::tuple<ConnectionState, ControlPacket::Ptr> doProcess(const PublishControlPacket& pub, std::error_code& ec)
             {
                 ACATL_CLASSLOG(Processor, 2, "Published on topic '" << pub._topicName._name << "'");
+                if(_metrics) {
+                    _metrics->add(Metric::MessagesReceived);
+                }
+                if(_heavyHitters && _currentSession) {
+                    _heavyHitters->record(pub._topicName._name, _currentSession->clientId(), pub.payloadSize());
+                }
+                
+                if(_authorizer && !authorized(pub._topicName._name, AclAccess::Write)) {
+                    // as with MQTT 3.1.1 there is no way to tell the client, the publish is acknowledged and dropped
+                    ACATL_CLASSLOG(Processor, 2, "Not authorized to publish on '" << pub._topicName._name << "'");
+                    if(_metrics) {
+                        _metrics->add(Metric::MessagesDropped);
+                    }
+                    switch(pub.qos()) {
+                        case QoSLevel::AtLeastOnce:
+                            return std::make_tuple(ConnectionState::Keep, std::make_unique<PubAckControlPacket>(pub._packetIdentifier));
+                        case QoSLevel::ExactlyOnce:
+                            return std::make_tuple(ConnectionState::Keep, std::make_unique<PubRecControlPacket>(pub._packetIdentifier));
+                        default:
+                            return std::make_tuple(ConnectionState::Keep, ControlPacket::Ptr());
+                    }
+                }
+                
+                if(_rateLimiter.enabled() && !_rateLimiter.admit(pub._topicName._name, pub.qos(), RateLimiter::Clock::now())) {
+                    ACATL_CLASSLOG(Processor, 3, "Rate limit exceeded, dropped publish on '" << pub._topicName._name << "'");
+                    if(_metrics) {
+                        _metrics->add(Metric::MessagesDropped);
+                    }
+                    return std::make_tuple(ConnectionState::Keep, ControlPacket::Ptr());
+                }
+                
+                if(pub._stream) {
+                    return processStream(pub, ec);
+                }
+                
+                switch(pub.qos()) {
+                    case QoSLevel::AtMostOnce:
+                        forward(pub, ec);
+                        return std::make_tuple(ConnectionState::Keep, ControlPacket::Ptr());
+                    case QoSLevel::AtLeastOnce:
+                        forward(pub, ec);
+                        return std::make_tuple(ConnectionState::Keep, std::make_unique<PubAckControlPacket>(pub._packetIdentifier));
+                    default:
+                        // a retransmission of a publish that was not released yet is only acknowledged again
+                        if(_currentSession->receiveExactlyOnce(pub._packetIdentifier)) {
+                            forward(pub, ec);
+                        }
+                        return std::make_tuple(ConnectionState::Keep, std::make_unique<PubRecControlPacket>(pub._packetIdentifier));
+                }
+            }
+            
+            /// The subscribers of a streamed publish are resolved before its payload arrived. The publisher is only
+            /// acknowledged once the whole payload was received.
+            std::tuple<ConnectionState, ControlPacket::Ptr> processStream(const PublishControlPacket& pub, std::error_code& ec)
+            {
+                ACATL_CLASSLOG(Processor, 2, "Streaming " << pub._stream->size() << " payload bytes");
+                QoSLevel qos = pub.qos();
+                if(qos != QoSLevel::ExactlyOnce || _currentSession->receiveExactlyOnce(pub._packetIdentifier)) {
+                    forward(pub, ec);
+                }
+                if(qos == QoSLevel::AtMostOnce) {
+                    return std::make_tuple(ConnectionState::Keep, ControlPacket::Ptr());
+                }
+                
+                PacketSender::WeakPtr weakSender = _packetSender;
+                PacketIdentifier packetIdentifier = pub._packetIdentifier;
+                pub._stream->setCompletionHandler([weakSender, packetIdentifier, qos](bool complete) {
+                    PacketSender::Ptr sender = weakSender.lock();
+                    if(!complete || !sender) {
+                        return;
+                    }
+                    if(qos == QoSLevel::AtLeastOnce) {
+                        sender->addSendPacket(std::make_unique<PubAckControlPacket>(packetIdentifier));
+                    } else {
+                        sender->addSendPacket(std::make_unique<PubRecControlPacket>(packetIdentifier));
+                    }
+                });
+                return std::make_tuple(ConnectionState::Keep, ControlPacket::Ptr());
+            }
+            
+            std::tuple<ConnectionState, ControlPacket::Ptr> doProcess(const AcknowledgeControlPacket& ack, std::error_code& ec)
+            {
+                switch(ack._header._controlPacketType) {
+                    case ControlPacketType::Puback:
+                        if(!_currentSession->acknowledge(ack._packetIdentifier)) {
+                            ACATL_CLASSLOG(Processor, 2, "PUBACK for unknown packet " << ack._packetIdentifier);
+                        }
+                        break;
+                    case ControlPacketType::Pubrec:
+                        if(!_currentSession->receive(ack._packetIdentifier)) {
+                            ACATL_CLASSLOG(Processor, 2, "PUBREC for unknown packet " << ack._packetIdentifier);
+                        }
+                        return std::make_tuple(ConnectionState::Keep, std::make_unique<PubRelControlPacket>(ack._packetIdentifier));
+                    case ControlPacketType::Pubrel:
+                        _currentSession->releaseExactlyOnce(ack._packetIdentifier);
+                        return std::make_tuple(ConnectionState::Keep, std::make_unique<PubCompControlPacket>(ack._packetIdentifier));
+                    default:
+                        if(!_currentSession->complete(ack._packetIdentifier)) {
+                            ACATL_CLASSLOG(Processor, 2, "PUBCOMP for unknown packet " << ack._packetIdentifier);
+                        }
+                        break;
+                }
+                return std::make_tuple(ConnectionState::Keep, ControlPacket::Ptr());
+            }
+            
+            /// Hands the publish to all matching sessions, each with the lower of the published and the granted QoS.
+            /// A streamed payload cannot be queued or sent again, so its deliveries are at most once and it is not
+            /// retained.
+            void forward(const PublishControlPacket& pub, std::error_code& ec)
+            {
+                if(_retainedStore && (pub._header._flags & retainFlag)) {
+                    if(pub._stream) {
+                        ACATL_CLASSLOG(Processor, 1, "Streamed payload on '" << pub._topicName._name << "' is not retained");
+                    } else {
+                        _retainedStore->retain(pub);
+                    }
+                }
+                
+                if(_router) {
+                    _router->route(pub, _flowControl, _localDelivery);
+                    return;
+                }
                 
                 SubscriptionTree::ConstPtr tree = _subcriptionTreeManager.getCurrentSubscriptionTree();
                 Sessions sessions;
-                if(tree->match(pub._topicName, sessions, ec)) {
+                bool found = tree->match(pub._topicName, sessions, ec);
+                LatencyTracer::Clock::time_point matched;
+                if(_tracer && pub.traced()) {
+                    matched = _tracer->record(TraceStage::Match, pub._traceTimestamp);
+                }
+                if(found) {
                     ACATL_CLASSLOG(Processor, 2, "Found a match for topic '" << pub._topicName._name << "'");
-                    std::for_each(sessions.begin(), sessions.end(), [&pub](Session::Ptr session) {
-                        PacketSender::Ptr sender = session->currentSender();
-                        if(sender) {
-                            ACATL_CLASSLOG(Processor, 2, "Sending for session '" << session->clientId() << "'");
-                            sender->addSendPacket(PublishControlPacket::Ptr(new PublishControlPacket(pub)));
+                    if(_workers && sessions.size() > _workers->chunkSize()) {
+                        deliverInChunks(pub, sessions, matched);
+                    } else {
+                        deliver(pub, sessions, matched, _flowControl, _localDelivery);
+                    }
+                }
+            }
+            
+        public:
+            /// Hands the publish to the matched sessions, each with the lower of the published and the granted QoS.
+            /// Also used by routers that match on a different thread.
+            static void deliver(const PublishControlPacket& pub,
+                                const Sessions& sessions,
+                                LatencyTracer::Clock::time_point matched,
+                                const FlowControl::Ptr& flowControl,
+                                bool localDelivery)
+            {
+                deliver(pub, sessions.begin(), sessions.end(), matched, flowControl, localDelivery);
+            }
+            
+            template<typename Iterator>
+            static void deliver(const PublishControlPacket& pub,
+                                Iterator begin,
+                                Iterator end,
+                                LatencyTracer::Clock::time_point matched,
+                                const FlowControl::Ptr& flowControl,
+                                bool localDelivery)
+            {
+                for(; begin != end; ++begin) {
+                    const auto& match = *begin;
+                    if(localDelivery && isClusterLink(match.first->clientId())) {
+                        continue;
+                    }
+                    ACATL_CLASSLOG(Processor, 2, "Delivering for session '" << match.first->clientId() << "'");
+                    PublishControlPacket::Ptr delivery(new PublishControlPacket(pub));
+                    // RETAIN is only set on messages sent because of a new subscription
+                    delivery->_header._flags &= static_cast<HeaderFlags>(~retainFlag);
+                    // the packet identifier is assigned by the receiving session
+                    delivery->setQoS(std::min(pub.qos(), match.second));
+                    delivery->_packetIdentifier = 0;
+                    delivery->_traceTimestamp = matched;
+                    if(pub._stream) {
+                        delivery->_stream.reset();
+                        delivery->_streamReader = pub._stream->attach();
+                        delivery->setQoS(QoSLevel::AtMostOnce);
+                        if(!delivery->_streamReader) {
+                            continue;
                         }
-                    });
+                    }
+                    if(flowControl && flowControl->enabled()) {
+                        delivery->_credit = flowControl->acquire(estimatedPacketSize(*delivery));
+                    }
+                    match.first->deliver(std::move(delivery));
                 }
-                
-                return std::make_tuple(ConnectionState::Keep, ControlPacket::Ptr());
+            }
+            
+        private:
+            /// Each session still gets the publishes of this client in order, the next fan-out only starts after
+            /// all chunks of this one are done.
+            void deliverInChunks(const PublishControlPacket& pub, const Sessions& sessions, LatencyTracer::Clock::time_point matched)
+            {
+                std::vector<Sessions::value_type> matches(sessions.begin(), sessions.end());
+                _workers->forEachChunk(matches.size(), [this, &pub, &matches, matched](size_t begin, size_t end) {
+                    deliver(pub, matches.cbegin() + static_cast<std::ptrdiff_t>(begin),
+                            matches.cbegin() + static_cast<std::ptrdiff_t>(end), matched, _flowControl, _localDelivery);
+                });
             }
             
             std::tuple<ConnectionState, ControlPacket::Ptr> doProcess(const SubscribeControlPacket& subs, std::error_code& ec)
             {
-                _currentSession->addSubscriptions(subs._topicFilters);
-                
                 SubAckControlPacket::Ptr suback = std::make_unique<SubAckControlPacket>();
                 suback->_packetIdentifier = subs._packetIdentifier;
+                TopicFilters granted;
                 for(const auto& filter : subs._topicFilters) {
+                    if(_authorizer && !authorized(filter, AclAccess::Read)) {
+                        ACATL_CLASSLOG(Processor, 2, "Not authorized to subscribe to '" << filter._filter << "'");
+                        suback->_qosLevels.push_back(QoSLevel::Error);
+                        continue;
+                    }
                     suback->_qosLevels.push_back(filter._qos);
+                    granted.push_back(filter);
+                }
+                
+                _currentSession->addSubscriptions(granted);
+                std::error_code errc;
+                if(!_sessionManager.persistSession(*_currentSession, errc)) {
+                    ACATL_CLASSLOG(Processor, 1,
+                                   "Could not persist session " << _currentSession->clientId() << ": " << errc.message());
+                }
+                
+                PacketSender::Ptr sender = _packetSender.lock();
+                if(!_retainedStore || !sender) {
+                    return std::make_tuple(ConnectionState::Keep, std::move(suback));
+                }
+                
+                std::vector<std::pair<RetainedStore::MessagePtr, QoSLevel>> retained;
+                for(const auto& filter : granted) {
+                    RetainedStore::Messages messages;
+                    _retainedStore->match(filter, messages);
+                    for(auto& message : messages) {
+                        retained.emplace_back(std::move(message), filter._qos);
+                    }
+                }
+                if(retained.empty()) {
+                    return std::make_tuple(ConnectionState::Keep, std::move(suback));
+                }
+                
+                // the retained messages have to follow the SUBACK, so it cannot be returned to the caller
+                ACATL_CLASSLOG(Processor, 2, "Sending " << retained.size() << " retained messages");
+                sender->addSendPacket(std::move(suback));
+                for(const auto& entry : retained) {
+                    PublishControlPacket::Ptr delivery(new PublishControlPacket(*entry.first));
+                    delivery->setQoS(std::min(delivery->qos(), entry.second));
+                    delivery->_header._flags |= retainFlag;
+                    _currentSession->deliver(std::move(delivery));
                 }
                 
-                return std::make_tuple(ConnectionState::Keep, std::move(suback));
+                return std::make_tuple(ConnectionState::Keep, ControlPacket::Ptr());
             }
             
             std::tuple<ConnectionState, ControlPacket::Ptr> doProcess(const PingReqControlPacket& pingreq, std::error_code& ec)
@@ -208,6 +624,7 @@ namespace acatl
             
             std::tuple<ConnectionState, ControlPacket::Ptr> doProcess(const DisconnectControlPacket& disconnect, std::error_code& ec)
             {
+                countDisconnect();
                 std::error_code errc;
                 _sessionManager.returnSession(_currentSession, errc);
                 _currentSession.reset();
@@ -215,11 +632,64 @@ namespace acatl
                 return std::make_tuple(ConnectionState::Close, ControlPacket::Ptr());
             }
             
+            /// Compiles the rules again, if they were reloaded since the last check.
+            const AclTrie& acl()
+            {
+                if(!_acl || _acl->generation() != _authorizer->generation()) {
+                    _acl = _authorizer->compile(_currentSession ? _currentSession->clientId() : std::string(), _userName);
+                }
+                return *_acl;
+            }
+            
+            bool authorized(const std::string& topic, AclAccess access)
+            {
+                return allows(acl().access(topic), access);
+            }
+            
+            bool authorized(const TopicFilter& filter, AclAccess access)
+            {
+                return allows(acl().filterAccess(filter._filter), access);
+            }
+            
+            void countConnect()
+            {
+                if(_metrics && !_connected) {
+                    _metrics->add(Metric::ClientsConnected);
+                }
+                _connected = true;
+            }
+            
+            void countDisconnect()
+            {
+                if(_metrics && _connected) {
+                    _metrics->add(Metric::ClientsConnected, -1);
+                }
+                _connected = false;
+            }
+            
+            static constexpr HeaderFlags retainFlag = 0x01;
+            
             Status _status;
+            uint16_t _keepAlive;
+            uint16_t _topicAliasMaximum;
+            bool _connected;
+            bool _localDelivery;
             Session::Ptr _currentSession;
             SubscriptionTreeManager& _subcriptionTreeManager;
             SessionManager& _sessionManager;
             PacketSender::WeakPtr _packetSender;
+            FlowControl::Ptr _flowControl;
+            RetainedStore::Ptr _retainedStore;
+            RateLimiter _rateLimiter;
+            Metrics::Ptr _metrics;
+            LatencyTracer::Ptr _tracer;
+            HeavyHitters::Ptr _heavyHitters;
+            Authorizer::Ptr _authorizer;
+            ClusterCredentials::Ptr _clusterCredentials;
+            AclTrie::ConstPtr _acl;
+            PublishRouter::Ptr _router;
+            WorkerPool* _workers;
+            std::string _userName;
         };
         
     }
@@ -0,0 +1,394 @@
+//
+//  mqtt_properties.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_properties_h
+#define acatl_mqtt_properties_h
+
+#include <acatl_mqtt/mqtt_error.h>
+#include <acatl_mqtt/mqtt_utils.h>
+
+#include <acatl/tribool.h>
+
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// MQTT 5.0 property identifiers.
+        enum class PropertyIdentifier : uint8_t
+        {
+            PayloadFormatIndicator = 0x01,
+            MessageExpiryInterval = 0x02,
+            ContentType = 0x03,
+            ResponseTopic = 0x08,
+            CorrelationData = 0x09,
+            SubscriptionIdentifier = 0x0B,
+            SessionExpiryInterval = 0x11,
+            AssignedClientIdentifier = 0x12,
+            ServerKeepAlive = 0x13,
+            AuthenticationMethod = 0x15,
+            AuthenticationData = 0x16,
+            RequestProblemInformation = 0x17,
+            WillDelayInterval = 0x18,
+            RequestResponseInformation = 0x19,
+            ResponseInformation = 0x1A,
+            ServerReference = 0x1C,
+            ReasonString = 0x1F,
+            ReceiveMaximum = 0x21,
+            TopicAliasMaximum = 0x22,
+            TopicAlias = 0x23,
+            MaximumQoS = 0x24,
+            RetainAvailable = 0x25,
+            UserProperty = 0x26,
+            MaximumPacketSize = 0x27,
+            WildcardSubscriptionAvailable = 0x28,
+            SubscriptionIdentifierAvailable = 0x29,
+            SharedSubscriptionAvailable = 0x2A
+        };
+        
+        /// The properties of an MQTT 5.0 packet. Those the broker acts on are decoded, 0 meaning absent. All others
+        /// are kept encoded in _other, so a PUBLISH is forwarded with the properties of its publisher.
+        struct Properties
+        {
+            uint32_t _sessionExpiryInterval{0};
+            uint16_t _receiveMaximum{0};
+            uint32_t _maximumPacketSize{0};
+            uint16_t _topicAliasMaximum{0};
+            uint16_t _topicAlias{0};
+            std::vector<uint8_t> _other;
+            
+            /// @return The size of the encoded properties, without the property length in front of them.
+            uint32_t length() const
+            {
+                uint32_t length = static_cast<uint32_t>(_other.size());
+                if(_sessionExpiryInterval != 0) {
+                    length += 5;
+                }
+                if(_receiveMaximum != 0) {
+                    length += 3;
+                }
+                if(_maximumPacketSize != 0) {
+                    length += 5;
+                }
+                if(_topicAliasMaximum != 0) {
+                    length += 3;
+                }
+                if(_topicAlias != 0) {
+                    length += 3;
+                }
+                return length;
+            }
+            
+            /// Writes the properties, the caller writes the property length in front of them.
+            void encode(std::vector<uint8_t>& buffer, size_t& index) const
+            {
+                if(_sessionExpiryInterval != 0) {
+                    encodeFourByteInteger(PropertyIdentifier::SessionExpiryInterval, _sessionExpiryInterval, buffer, index);
+                }
+                if(_receiveMaximum != 0) {
+                    encodeTwoByteInteger(PropertyIdentifier::ReceiveMaximum, _receiveMaximum, buffer, index);
+                }
+                if(_maximumPacketSize != 0) {
+                    encodeFourByteInteger(PropertyIdentifier::MaximumPacketSize, _maximumPacketSize, buffer, index);
+                }
+                if(_topicAliasMaximum != 0) {
+                    encodeTwoByteInteger(PropertyIdentifier::TopicAliasMaximum, _topicAliasMaximum, buffer, index);
+                }
+                if(_topicAlias != 0) {
+                    encodeTwoByteInteger(PropertyIdentifier::TopicAlias, _topicAlias, buffer, index);
+                }
+                std::copy(_other.begin(), _other.end(), &buffer[index]);
+                index += _other.size();
+            }
+            
+            static void encodeTwoByteInteger(PropertyIdentifier identifier, uint16_t value, std::vector<uint8_t>& buffer,
+                                             size_t& index)
+            {
+                buffer[index++] = static_cast<uint8_t>(identifier);
+                buffer[index++] = static_cast<uint8_t>(value >> 8);
+                buffer[index++] = static_cast<uint8_t>(value);
+            }
+            
+            static void encodeFourByteInteger(PropertyIdentifier identifier, uint32_t value, std::vector<uint8_t>& buffer,
+                                              size_t& index)
+            {
+                buffer[index++] = static_cast<uint8_t>(identifier);
+                buffer[index++] = static_cast<uint8_t>(value >> 24);
+                buffer[index++] = static_cast<uint8_t>(value >> 16);
+                buffer[index++] = static_cast<uint8_t>(value >> 8);
+                buffer[index++] = static_cast<uint8_t>(value);
+            }
+        };
+        
+        /// Parses the property length and the properties following it.
+        class PropertiesParser
+        {
+        public:
+            enum class Status
+            {
+                Length,
+                Identifier,
+                Value,
+                Ready
+            };
+            
+            PropertiesParser()
+            : _status(Status::Length)
+            , _remaining(0)
+            , _identifier(0)
+            , _type(Type::Invalid)
+            , _needed(0)
+            , _strings(0)
+            , _prefix(false)
+            {}
+            
+            void reset()
+            {
+                _status = Status::Length;
+                _decoder.reset();
+                _remaining = 0;
+                _properties = Properties();
+            }
+            
+            acatl::Tribool parse(uint8_t byte, std::error_code& ec)
+            {
+                switch(_status) {
+                    case Status::Length: {
+                        int ret;
+                        std::tie(ret, _remaining) = _decoder.decode(byte, ec);
+                        if(ret < 0) {
+                            ec = mqtt_error::malformed_properties;
+                            _status = Status::Ready;
+                            return acatl::Tribool(false);
+                        } else if(ret > 0) {
+                            if(_remaining == 0) {
+                                _status = Status::Ready;
+                                return acatl::Tribool(true);
+                            }
+                            _status = Status::Identifier;
+                        }
+                        break;
+                    }
+                    case Status::Identifier:
+                        --_remaining;
+                        _identifier = byte;
+                        _type = propertyType(byte);
+                        _value.clear();
+                        _strings = _type == Type::StringPair ? 2 : 1;
+                        _prefix = _type == Type::StringPair || _type == Type::BinaryData;
+                        _needed = _type == Type::Byte ? 1 : _type == Type::FourByteInteger ? 4 : 2;
+                        if(_type == Type::Invalid || _remaining == 0) {
+                            ec = mqtt_error::malformed_properties;
+                            _status = Status::Ready;
+                            return acatl::Tribool(false);
+                        }
+                        _status = Status::Value;
+                        break;
+                    case Status::Value:
+                        --_remaining;
+                        _value.push_back(byte);
+                        if(valueComplete(byte)) {
+                            if(!store(ec)) {
+                                _status = Status::Ready;
+                                return acatl::Tribool(false);
+                            }
+                            if(_remaining == 0) {
+                                _status = Status::Ready;
+                                return acatl::Tribool(true);
+                            }
+                            _status = Status::Identifier;
+                        } else if(_remaining == 0) {
+                            // the property length ends within a property
+                            ec = mqtt_error::malformed_properties;
+                            _status = Status::Ready;
+                            return acatl::Tribool(false);
+                        }
+                        break;
+                    case Status::Ready:
+                        ec = mqtt_error::malformed_properties;
+                        return acatl::Tribool(false);
+                }
+                
+                return acatl::Tribool();
+            }
+            
+            const Properties& properties() const
+            {
+                return _properties;
+            }
+            
+        private:
+            enum class Type
+            {
+                Byte,
+                TwoByteInteger,
+                FourByteInteger,
+                VariableByteInteger,
+                // UTF-8 strings have the same encoding
+                BinaryData,
+                StringPair,
+                Invalid
+            };
+            
+            static Type propertyType(uint8_t identifier)
+            {
+                switch(PropertyIdentifier(identifier)) {
+                    case PropertyIdentifier::PayloadFormatIndicator:
+                    case PropertyIdentifier::RequestProblemInformation:
+                    case PropertyIdentifier::RequestResponseInformation:
+                    case PropertyIdentifier::MaximumQoS:
+                    case PropertyIdentifier::RetainAvailable:
+                    case PropertyIdentifier::WildcardSubscriptionAvailable:
+                    case PropertyIdentifier::SubscriptionIdentifierAvailable:
+                    case PropertyIdentifier::SharedSubscriptionAvailable:
+                        return Type::Byte;
+                    case PropertyIdentifier::ServerKeepAlive:
+                    case PropertyIdentifier::ReceiveMaximum:
+                    case PropertyIdentifier::TopicAliasMaximum:
+                    case PropertyIdentifier::TopicAlias:
+                        return Type::TwoByteInteger;
+                    case PropertyIdentifier::MessageExpiryInterval:
+                    case PropertyIdentifier::SessionExpiryInterval:
+                    case PropertyIdentifier::WillDelayInterval:
+                    case PropertyIdentifier::MaximumPacketSize:
+                        return Type::FourByteInteger;
+                    case PropertyIdentifier::SubscriptionIdentifier:
+                        return Type::VariableByteInteger;
+                    case PropertyIdentifier::ContentType:
+                    case PropertyIdentifier::ResponseTopic:
+                    case PropertyIdentifier::CorrelationData:
+                    case PropertyIdentifier::AssignedClientIdentifier:
+                    case PropertyIdentifier::AuthenticationMethod:
+                    case PropertyIdentifier::AuthenticationData:
+                    case PropertyIdentifier::ResponseInformation:
+                    case PropertyIdentifier::ServerReference:
+                    case PropertyIdentifier::ReasonString:
+                        return Type::BinaryData;
+                    case PropertyIdentifier::UserProperty:
+                        return Type::StringPair;
+                }
+                return Type::Invalid;
+            }
+            
+            bool valueComplete(uint8_t byte)
+            {
+                if(_type == Type::VariableByteInteger) {
+                    return (byte & 0x80) == 0 || _value.size() > 4;
+                }
+                if(--_needed != 0) {
+                    return false;
+                }
+                if(_prefix) {
+                    // the two byte length of a string or binary data was read, its data follows
+                    _needed = static_cast<uint32_t>((_value[_value.size() - 2] << 8) | _value.back());
+                    _prefix = false;
+                }
+                if(_needed == 0) {
+                    if(--_strings == 0) {
+                        return true;
+                    }
+                    _needed = 2;
+                    _prefix = true;
+                }
+                return false;
+            }
+            
+            bool store(std::error_code& ec)
+            {
+                switch(PropertyIdentifier(_identifier)) {
+                    case PropertyIdentifier::SessionExpiryInterval:
+                        _properties._sessionExpiryInterval = fourByteInteger();
+                        return true;
+                    case PropertyIdentifier::ReceiveMaximum:
+                        _properties._receiveMaximum = twoByteInteger();
+                        return validate(_properties._receiveMaximum != 0, mqtt_error::malformed_properties, ec);
+                    case PropertyIdentifier::MaximumPacketSize:
+                        _properties._maximumPacketSize = fourByteInteger();
+                        return validate(_properties._maximumPacketSize != 0, mqtt_error::malformed_properties, ec);
+                    case PropertyIdentifier::TopicAliasMaximum:
+                        _properties._topicAliasMaximum = twoByteInteger();
+                        return true;
+                    case PropertyIdentifier::TopicAlias:
+                        _properties._topicAlias = twoByteInteger();
+                        return validate(_properties._topicAlias != 0, mqtt_error::invalid_topic_alias, ec);
+                    case PropertyIdentifier::SubscriptionIdentifier:
+                        if(_value.size() > 4) {
+                            ec = mqtt_error::malformed_properties;
+                            return false;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                _properties._other.push_back(_identifier);
+                _properties._other.insert(_properties._other.end(), _value.begin(), _value.end());
+                return true;
+            }
+            
+            static bool validate(bool valid, mqtt_error error, std::error_code& ec)
+            {
+                if(!valid) {
+                    ec = error;
+                }
+                return valid;
+            }
+            
+            uint16_t twoByteInteger() const
+            {
+                return static_cast<uint16_t>((_value[0] << 8) | _value[1]);
+            }
+            
+            uint32_t fourByteInteger() const
+            {
+                return (uint32_t(_value[0]) << 24) | (uint32_t(_value[1]) << 16) | (uint32_t(_value[2]) << 8) | _value[3];
+            }
+            
+            Status _status;
+            RunlengthDecoder _decoder;
+            uint32_t _remaining;
+            uint8_t _identifier;
+            Type _type;
+            uint32_t _needed;
+            uint32_t _strings;
+            bool _prefix;
+            std::vector<uint8_t> _value;
+            Properties _properties;
+        };
+        
+    }
+}
+
+#endif
@@ -36,6 +36,7 @@
 
 #include <acatl_mqtt/mqtt_control_packets.h>
 #include <acatl_mqtt/mqtt_packet_identifier_parser.h>
+#include <acatl_mqtt/mqtt_properties.h>
 #include <acatl_mqtt/mqtt_string_parser.h>
 
 #include <acatl/tribool.h>
@@ -53,6 +54,7 @@ namespace acatl
             {
                 TopicName,
                 PacketIdentifier,
+                Properties,
                 Payload,
                 Ready
             };
@@ -61,16 +63,37 @@ namespace acatl
             : _status(Status::TopicName)
             , _qos(qos)
             , _length(length)
+            , _streamThreshold(0)
+            , _streaming(false)
+            , _protocolLevel(protocolLevel311)
             {}
             
-            void reset(QoSLevel qos, uint32_t length)
+            /// MQTT 5.0 publishes carry properties after the packet identifier and may replace the topic by an alias,
+            /// which the caller resolves. Survives reset.
+            void setProtocolLevel(uint8_t protocolLevel)
+            {
+                _protocolLevel = protocolLevel;
+            }
+            
+            void setMaxTopicLength(uint16_t maxTopicLength)
+            {
+                _stringParser.setMaxLength(maxTopicLength);
+            }
+            
+            /// A payload larger than streamThreshold is not parsed, the parser is ready as soon as the variable header
+            /// is complete. The caller has to stream the remaining() bytes. A streamThreshold of 0 parses every payload.
+            void reset(QoSLevel qos, uint32_t length, uint32_t streamThreshold = 0)
             {
                 _ret = acatl::Tribool();
                 _status = Status::TopicName;
                 _qos = qos;
                 _length = length;
+                _streamThreshold = streamThreshold;
+                _streaming = false;
                 _stringParser.reset();
                 _identifierParser.reset();
+                _packet._packetIdentifier = 0;
+                _packet._properties = acatl::mqtt::Properties();
                 _packet._payload.clear();
             }
             
@@ -98,8 +121,10 @@ namespace acatl
                                 } else {
                                     if(_qos > QoSLevel::AtMostOnce) {
                                         _status = Status::PacketIdentifier;
+                                    } else if(_protocolLevel == protocolLevel5) {
+                                        startProperties(ec);
                                     } else {
-                                        _status = Status::Payload;
+                                        finishVariableHeader();
                                     }
                                     _stringParser.reset();
                                 }
@@ -114,15 +139,30 @@ namespace acatl
                             _ret.set(false);
                         } else if(ret.isTrue()){
                             _packet._packetIdentifier = _identifierParser.packetIdentifier();
-                            if(_length) {
-                                _status = Status::Payload;
-                            } else {
+                            if(_packet._packetIdentifier == 0) {
+                                // QoS 1 and 2 publishes require a non-zero packet identifier
+                                ec = mqtt_error::publish_protocol_violation;
                                 _status = Status::Ready;
-                                _ret.set(true);
+                                _ret.set(false);
+                            } else if(_protocolLevel == protocolLevel5) {
+                                startProperties(ec);
+                            } else {
+                                finishVariableHeader();
                             }
                         }
                         break;
                     }
+                    case Status::Properties: {
+                        acatl::Tribool ret = _propertiesParser.parse(byte, ec);
+                        if(ret.isFalse()) {
+                            _status = Status::Ready;
+                            _ret.set(false);
+                        } else if(ret.isTrue()) {
+                            _packet._properties = _propertiesParser.properties();
+                            finishVariableHeader();
+                        }
+                        break;
+                    }
                     case Status::Payload:
                         _packet._payload.push_back(byte);
                         if(_length == 0) {
@@ -135,7 +175,7 @@ namespace acatl
                         break;
                 }
                 
-                if(_ret && _length != 0) {
+                if(_ret && _length != 0 && !_streaming) {
                     _ret.set(false);
                     ec = mqtt_error::control_packet_length;
                 }
@@ -147,14 +187,67 @@ namespace acatl
                 return _packet;
             }
             
+            /// True if the packet is complete except for the payload, which the caller streams.
+            bool streaming() const
+            {
+                return _streaming;
+            }
+            
+            /// The payload bytes that were not parsed yet.
+            uint32_t remaining() const
+            {
+                return _length;
+            }
+            
         private:
+            void startProperties(std::error_code& ec)
+            {
+                if(_length == 0) {
+                    // the property length is mandatory
+                    ec = mqtt_error::control_packet_length;
+                    _status = Status::Ready;
+                    _ret.set(false);
+                } else {
+                    _propertiesParser.reset();
+                    _status = Status::Properties;
+                }
+            }
+            
+            void finishVariableHeader()
+            {
+                if(_length) {
+                    startPayload();
+                } else {
+                    // a zero length payload, e.g. to delete a retained message
+                    _status = Status::Ready;
+                    _ret.set(true);
+                }
+            }
+            
+            void startPayload()
+            {
+                if(_streamThreshold != 0 && _length > _streamThreshold) {
+                    _streaming = true;
+                    _status = Status::Ready;
+                    _ret.set(true);
+                } else {
+                    _status = Status::Payload;
+                    _packet._payload.reserve(_length);
+                }
+            }
+            
+
             Status _status;
             PublishControlPacket _packet;
             acatl::Tribool _ret;
             QoSLevel _qos;
             uint32_t _length;
+            uint32_t _streamThreshold;
+            bool _streaming;
+            uint8_t _protocolLevel;
             StringParser _stringParser;
             PacketIdentifierParser _identifierParser;
+            PropertiesParser _propertiesParser;
         };
         
     }
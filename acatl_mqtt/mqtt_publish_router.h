@@ -0,0 +1,69 @@
+//
+//  mqtt_publish_router.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_publish_router_h
+#define acatl_mqtt_publish_router_h
+
+#include <acatl_mqtt/mqtt_control_packets.h>
+#include <acatl_mqtt/mqtt_flow_control.h>
+#include <acatl_mqtt/mqtt_session.h>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// Takes the subscriptions and the matching of publishes off a processor, e.g. to the thread owning the
+        /// topic. Every processor has its own router, which is only called from the processor's thread.
+        class PublishRouter
+        {
+        public:
+            virtual ~PublishRouter() {}
+            
+            typedef std::shared_ptr<PublishRouter> Ptr;
+            
+            virtual void addSubscription(const TopicFilter& filter, Session::Ptr session) = 0;
+            
+            /// Delivers the publish to the matching sessions, right away or later on another thread. The deliveries
+            /// are accounted against the flow control, if given.
+            virtual void route(const PublishControlPacket& pub, const FlowControl::Ptr& flowControl, bool localDelivery) = 0;
+            
+        protected:
+            PublishRouter() = default;
+        };
+
+    }
+}
+
+#endif
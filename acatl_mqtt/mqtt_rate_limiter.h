@@ -0,0 +1,229 @@
+//
+//  mqtt_rate_limiter.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_rate_limiter_h
+#define acatl_mqtt_rate_limiter_h
+
+#include <acatl_mqtt/mqtt_types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// A token bucket kept as the time at which the bucket is full again (generic cell rate algorithm). Taking a
+        /// token is a comparison and an addition, the bucket never has to be refilled.
+        class TokenBucket
+        {
+        public:
+            typedef std::chrono::steady_clock Clock;
+            
+            TokenBucket()
+            : _interval(0)
+            , _tolerance(0)
+            {}
+            
+            /// @param rate Tokens per second, 0 disables the bucket.
+            /// @param burst Tokens that can be taken at once from a full bucket.
+            TokenBucket(double rate, uint32_t burst)
+            : _interval(rate > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / rate))
+                                 : Clock::duration::zero())
+            , _tolerance(_interval * (std::max<uint32_t>(burst, 1) - 1))
+            {}
+            
+            bool enabled() const
+            {
+                return _interval.count() != 0;
+            }
+            
+            /// @return True if a token is available at now.
+            bool available(Clock::time_point now) const
+            {
+                return now >= _arrival - _tolerance;
+            }
+            
+            /// Takes a token, even if none is available. The debt delays the next available token.
+            void take(Clock::time_point now)
+            {
+                _arrival = std::max(_arrival, now) + _interval;
+            }
+            
+            /// @return The time until the next token is available, zero if it is available now.
+            Clock::duration wait(Clock::time_point now) const
+            {
+                Clock::time_point next = _arrival - _tolerance;
+                return next > now ? next - now : Clock::duration::zero();
+            }
+            
+        private:
+            Clock::duration _interval;
+            Clock::duration _tolerance;
+            Clock::time_point _arrival;
+        };
+        
+        struct RateLimit
+        {
+            /// Publishes per second, 0 is unlimited.
+            double _rate{0};
+            /// Publishes accepted at once after an idle period.
+            uint32_t _burst{1};
+        };
+        
+        /// Limits the publishes of one client to topics starting with the prefix.
+        struct TopicRateLimit
+        {
+            std::string _prefix;
+            RateLimit _limit;
+        };
+        
+        enum class RateLimitPolicy
+        {
+            /// The client's connection stops reading until it is back within its limits.
+            Throttle,
+            /// QoS 0 publishes exceeding a limit are dropped. QoS 1 and 2 publishes are throttled, as they are
+            /// acknowledged to the client.
+            Drop
+        };
+        
+        struct RateLimitOptions
+        {
+            RateLimit _client;
+            std::vector<TopicRateLimit> _topics;
+            RateLimitPolicy _policy{RateLimitPolicy::Throttle};
+        };
+        
+        /// The publish rate limits of one client. Only accessed by the connection of the client, so the state is a
+        /// handful of time points without any synchronization.
+        class RateLimiter
+        {
+        public:
+            typedef TokenBucket::Clock Clock;
+            
+            RateLimiter()
+            : _enabled(false)
+            , _policy(RateLimitPolicy::Throttle)
+            , _droppedPublishes(0)
+            {}
+            
+            explicit RateLimiter(const RateLimitOptions& options)
+            : _client(options._client._rate, options._client._burst)
+            , _policy(options._policy)
+            , _droppedPublishes(0)
+            {
+                for(const auto& topic : options._topics) {
+                    if(topic._limit._rate > 0) {
+                        _topics.push_back(Topic{topic._prefix, TokenBucket(topic._limit._rate, topic._limit._burst)});
+                    }
+                }
+                // the most specific prefix applies
+                std::stable_sort(_topics.begin(), _topics.end(), [](const Topic& lhs, const Topic& rhs) {
+                    return lhs._prefix.size() > rhs._prefix.size();
+                });
+                _enabled = _client.enabled() || !_topics.empty();
+            }
+            
+            bool enabled() const
+            {
+                return _enabled;
+            }
+            
+            /// Accounts a publish of the client.
+            /// @return False if the publish exceeds a limit and has to be dropped.
+            bool admit(const std::string& topic, QoSLevel qos, Clock::time_point now)
+            {
+                TokenBucket* topicBucket = find(topic);
+                if(_policy == RateLimitPolicy::Drop && qos == QoSLevel::AtMostOnce) {
+                    if(!_client.available(now) || (topicBucket && !topicBucket->available(now))) {
+                        ++_droppedPublishes;
+                        return false;
+                    }
+                }
+                if(_client.enabled()) {
+                    _client.take(now);
+                }
+                if(topicBucket) {
+                    topicBucket->take(now);
+                }
+                return true;
+            }
+            
+            /// @return How long the client has to wait until it is within all of its limits again.
+            Clock::duration delay(Clock::time_point now) const
+            {
+                Clock::duration delay = _client.wait(now);
+                for(const auto& topic : _topics) {
+                    delay = std::max(delay, topic._bucket.wait(now));
+                }
+                return delay;
+            }
+            
+            uint64_t droppedPublishes() const
+            {
+                return _droppedPublishes;
+            }
+            
+        private:
+            struct Topic
+            {
+                std::string _prefix;
+                TokenBucket _bucket;
+            };
+            
+            TokenBucket* find(const std::string& topic)
+            {
+                for(auto& entry : _topics) {
+                    if(topic.compare(0, entry._prefix.size(), entry._prefix) == 0) {
+                        return &entry._bucket;
+                    }
+                }
+                return nullptr;
+            }
+            
+            TokenBucket _client;
+            std::vector<Topic> _topics;
+            bool _enabled;
+            RateLimitPolicy _policy;
+            uint64_t _droppedPublishes;
+        };
+
+    }
+}
+
+#endif
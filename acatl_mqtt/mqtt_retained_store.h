@@ -0,0 +1,208 @@
+//
+//  mqtt_retained_store.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_retained_store_h
+#define acatl_mqtt_retained_store_h
+
+#include <acatl_mqtt/mqtt_control_packets.h>
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// Keeps the last retained message of every topic. The messages are organized as a trie with one node per
+        /// topic level, like the subscription tree, so matching a new subscription only walks the branches its filter
+        /// can reach instead of testing every retained topic. Stored messages are immutable and handed out as shared
+        /// pointers, deliveries copy the packet but share the payload bytes.
+        class RetainedStore
+        {
+        public:
+            typedef std::shared_ptr<RetainedStore> Ptr;
+            typedef std::shared_ptr<const PublishControlPacket> MessagePtr;
+            typedef std::vector<MessagePtr> Messages;
+            
+            /// Stores the publish as the retained message of its topic. A publish with an empty payload removes the
+            /// retained message of its topic.
+            void retain(const PublishControlPacket& publish)
+            {
+                std::vector<std::string> levels = split(publish._topicName.begin(), publish._topicName.end());
+                
+                std::unique_lock<std::shared_timed_mutex> guard(_mutex);
+                if(publish._payload.empty()) {
+                    if(remove(_root, levels, 0)) {
+                        --_size;
+                    }
+                    return;
+                }
+                
+                Node* node = &_root;
+                for(const auto& level : levels) {
+                    std::unique_ptr<Node>& child = node->_children[level];
+                    if(!child) {
+                        child.reset(new Node);
+                    }
+                    node = child.get();
+                }
+                
+                auto message = std::make_shared<PublishControlPacket>();
+                message->_header = publish._header;
+                message->_topicName = publish._topicName;
+                message->_payload = publish._payload;
+                if(!node->_message) {
+                    ++_size;
+                }
+                node->_message = std::move(message);
+            }
+            
+            /// Appends the retained messages matching the filter to messages and returns their number.
+            size_t match(const TopicFilter& filter, Messages& messages) const
+            {
+                std::vector<std::string> levels = split(filter.begin(), filter.end());
+                size_t count = messages.size();
+                
+                std::shared_lock<std::shared_timed_mutex> guard(_mutex);
+                match(_root, levels, 0, messages);
+                
+                return messages.size() - count;
+            }
+            
+            size_t size() const
+            {
+                std::shared_lock<std::shared_timed_mutex> guard(_mutex);
+                return _size;
+            }
+            
+        private:
+            struct Node
+            {
+                std::unordered_map<std::string, std::unique_ptr<Node>> _children;
+                MessagePtr _message;
+            };
+            
+            static std::vector<std::string> split(TopicHierarchyIterator cur, const TopicHierarchyIterator& end)
+            {
+                std::vector<std::string> levels;
+                for(; cur != end; ++cur) {
+                    levels.push_back(*cur);
+                }
+                return levels;
+            }
+            
+            // topics starting with '$' are not matched by wildcards on the first level
+            static bool isSystemTopic(size_t index, const std::string& level)
+            {
+                return index == 0 && !level.empty() && level[0] == '$';
+            }
+            
+            void match(const Node& node, const std::vector<std::string>& levels, size_t index, Messages& messages) const
+            {
+                if(index == levels.size()) {
+                    if(node._message) {
+                        messages.push_back(node._message);
+                    }
+                    return;
+                }
+                
+                const std::string& level = levels[index];
+                if(level == "#") {
+                    // the multi level wildcard also matches the parent level
+                    if(node._message) {
+                        messages.push_back(node._message);
+                    }
+                    for(const auto& child : node._children) {
+                        if(!isSystemTopic(index, child.first)) {
+                            collect(*child.second, messages);
+                        }
+                    }
+                } else if(level == "+") {
+                    for(const auto& child : node._children) {
+                        if(!isSystemTopic(index, child.first)) {
+                            match(*child.second, levels, index + 1, messages);
+                        }
+                    }
+                } else {
+                    auto iter = node._children.find(level);
+                    if(iter != node._children.end()) {
+                        match(*iter->second, levels, index + 1, messages);
+                    }
+                }
+            }
+            
+            void collect(const Node& node, Messages& messages) const
+            {
+                if(node._message) {
+                    messages.push_back(node._message);
+                }
+                for(const auto& child : node._children) {
+                    collect(*child.second, messages);
+                }
+            }
+            
+            /// Removes the message of the topic and prunes the nodes left empty. Returns true if there was a message.
+            bool remove(Node& node, const std::vector<std::string>& levels, size_t index)
+            {
+                if(index == levels.size()) {
+                    bool removed = node._message != nullptr;
+                    node._message.reset();
+                    return removed;
+                }
+                
+                auto iter = node._children.find(levels[index]);
+                if(iter == node._children.end()) {
+                    return false;
+                }
+                bool removed = remove(*iter->second, levels, index + 1);
+                if(!iter->second->_message && iter->second->_children.empty()) {
+                    node._children.erase(iter);
+                }
+                return removed;
+            }
+            
+            mutable std::shared_timed_mutex _mutex;
+            Node _root;
+            size_t _size{0};
+        };
+        
+    }
+}
+
+#endif
@@ -0,0 +1,353 @@
+//
+//  mqtt_send_queue.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_send_queue_h
+#define acatl_mqtt_send_queue_h
+
+#include <acatl_mqtt/mqtt_control_packets.h>
+#include <acatl_mqtt/mqtt_metrics.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// What a send queue does with a QoS 0 publish exceeding its limits. Pause holds such publishes until the
+        /// queue reaches twice its limits, a consumer falling further behind is disconnected. All other packets are
+        /// queued beyond the limits, up to twice the limits regardless of the policy.
+        enum class SlowConsumerPolicy
+        {
+            DropOldest,
+            DropNewest,
+            Disconnect,
+            Pause
+        };
+        
+        template<class CharT, class Traits>
+        std::basic_ostream<CharT,Traits>&
+        operator<<(std::basic_ostream<CharT,Traits>& os, const SlowConsumerPolicy& policy)
+        {
+            switch(policy) {
+                case SlowConsumerPolicy::DropOldest:
+                    os << "drop-oldest";
+                    break;
+                case SlowConsumerPolicy::DropNewest:
+                    os << "drop-newest";
+                    break;
+                case SlowConsumerPolicy::Disconnect:
+                    os << "disconnect";
+                    break;
+                case SlowConsumerPolicy::Pause:
+                    os << "pause";
+                    break;
+            }
+            return os;
+        }
+        
+        
+        /// Limits of a per connection send queue. A limit of 0 means unlimited.
+        struct SendQueueLimits
+        {
+            SendQueueLimits()
+            : _maxPackets(0)
+            , _maxBytes(0)
+            , _policy(SlowConsumerPolicy::DropOldest)
+            {}
+            
+            SendQueueLimits(size_t maxPackets, size_t maxBytes, SlowConsumerPolicy policy)
+            : _maxPackets(maxPackets)
+            , _maxBytes(maxBytes)
+            , _policy(policy)
+            {}
+            
+            size_t _maxPackets;
+            size_t _maxBytes;
+            SlowConsumerPolicy _policy;
+        };
+        
+        
+        /// Accounts the bytes pending in all send queues of the broker. As soon as the watermark is exceeded, the
+        /// queues start shedding load by dropping new QoS 0 publishes. A watermark of 0 disables load shedding.
+        class SendQueueMemory
+        {
+        public:
+            SendQueueMemory(size_t watermark = 0)
+            : _watermark(watermark)
+            , _bytes(0)
+            , _droppedPackets(0)
+            {}
+            
+            void setWatermark(size_t watermark)
+            {
+                _watermark = watermark;
+            }
+            
+            bool exceeded() const
+            {
+                return _watermark != 0 && _bytes.load(std::memory_order_relaxed) > _watermark;
+            }
+            
+            size_t bytes() const
+            {
+                return _bytes.load(std::memory_order_relaxed);
+            }
+            
+            uint64_t droppedPackets() const
+            {
+                return _droppedPackets.load(std::memory_order_relaxed);
+            }
+            
+        private:
+            friend class SendQueue;
+            
+            size_t _watermark;
+            std::atomic<size_t> _bytes;
+            std::atomic<uint64_t> _droppedPackets;
+        };
+        
+        
+        /// The queue of packets waiting to be written to a connection. The queue enforces the configured limits
+        /// according to its slow consumer policy. Packets that cannot be dropped, e.g. QoS 1 publishes and
+        /// acknowledgements, overflow the queue once it holds twice its limits, so a peer that stops reading is
+        /// disconnected instead of growing the queue without bound. It is not synchronized, the owning connection has
+        /// to guard it.
+        class SendQueue
+        {
+        public:
+            enum class Result
+            {
+                Queued,
+                Dropped,
+                Overflow,
+                Paused
+            };
+            
+            SendQueue(const SendQueueLimits& limits = SendQueueLimits(), SendQueueMemory* memory = nullptr)
+            : _limits(limits)
+            , _memory(memory)
+            , _metrics(nullptr)
+            , _bytes(0)
+            , _highWaterPackets(0)
+            , _highWaterBytes(0)
+            , _droppedPackets(0)
+            {}
+            
+            SendQueue(const SendQueue&) = delete;
+            SendQueue& operator=(const SendQueue&) = delete;
+            
+            ~SendQueue()
+            {
+                release(_bytes);
+                count(Metric::QueuedMessages, -static_cast<int64_t>(_packets.size()));
+            }
+            
+            /// Queued and dropped packets are counted in the given metrics, which have to outlive the queue.
+            void setMetrics(Metrics* metrics)
+            {
+                _metrics = metrics;
+            }
+            
+            Result push(ControlPacket::Ptr packet)
+            {
+                size_t size = estimatedPacketSize(*packet);
+                bool sheddable = isSheddable(*packet);
+                
+                if(sheddable && _memory && _memory->exceeded()) {
+                    drop();
+                    return Result::Dropped;
+                }
+                
+                if(!sheddable && exceedsLimits(size, hardLimitFactor)) {
+                    return Result::Overflow;
+                }
+                
+                Result result = Result::Queued;
+                if(sheddable && exceedsLimits(size)) {
+                    switch(_limits._policy) {
+                        case SlowConsumerPolicy::DropOldest:
+                            while(exceedsLimits(size) && dropOldestSheddable()) {
+                            }
+                            if(exceedsLimits(size)) {
+                                drop();
+                                return Result::Dropped;
+                            }
+                            break;
+                        case SlowConsumerPolicy::DropNewest:
+                            drop();
+                            return Result::Dropped;
+                        case SlowConsumerPolicy::Disconnect:
+                            return Result::Overflow;
+                        case SlowConsumerPolicy::Pause:
+                            if(exceedsLimits(size, hardLimitFactor)) {
+                                return Result::Overflow;
+                            }
+                            result = Result::Paused;
+                            break;
+                    }
+                }
+                
+                _packets.push_back(Entry{std::move(packet), size});
+                _bytes += size;
+                acquire(size);
+                count(Metric::QueuedMessages, 1);
+                _highWaterPackets = std::max(_highWaterPackets, _packets.size());
+                _highWaterBytes = std::max(_highWaterBytes, _bytes);
+                return result;
+            }
+            
+            ControlPacket::Ptr pop()
+            {
+                Entry entry = std::move(_packets.front());
+                _packets.pop_front();
+                _bytes -= entry._size;
+                release(entry._size);
+                count(Metric::QueuedMessages, -1);
+                return std::move(entry._packet);
+            }
+            
+            bool empty() const
+            {
+                return _packets.empty();
+            }
+            
+            size_t size() const
+            {
+                return _packets.size();
+            }
+            
+            size_t bytes() const
+            {
+                return _bytes;
+            }
+            
+            size_t highWaterPackets() const
+            {
+                return _highWaterPackets;
+            }
+            
+            size_t highWaterBytes() const
+            {
+                return _highWaterBytes;
+            }
+            
+            uint64_t droppedPackets() const
+            {
+                return _droppedPackets;
+            }
+            
+        private:
+            struct Entry
+            {
+                ControlPacket::Ptr _packet;
+                size_t _size;
+            };
+            
+            static constexpr size_t hardLimitFactor = 2;
+            
+            // Only QoS 0 publishes may be dropped, all other packets are part of a protocol exchange
+            static bool isSheddable(const ControlPacket& packet)
+            {
+                return packet._header._controlPacketType == ControlPacketType::Publish && (packet._header._flags & 0x06) == 0;
+            }
+            
+            bool exceedsLimits(size_t size, size_t factor = 1) const
+            {
+                return (_limits._maxPackets != 0 && _packets.size() + 1 > factor * _limits._maxPackets)
+                    || (_limits._maxBytes != 0 && _bytes + size > factor * _limits._maxBytes);
+            }
+            
+            bool dropOldestSheddable()
+            {
+                auto iter = std::find_if(_packets.begin(), _packets.end(), [](const Entry& entry) {
+                    return isSheddable(*entry._packet);
+                });
+                if(iter == _packets.end()) {
+                    return false;
+                }
+                _bytes -= iter->_size;
+                release(iter->_size);
+                count(Metric::QueuedMessages, -1);
+                _packets.erase(iter);
+                drop();
+                return true;
+            }
+            
+            void drop()
+            {
+                ++_droppedPackets;
+                if(_memory) {
+                    _memory->_droppedPackets.fetch_add(1, std::memory_order_relaxed);
+                }
+                count(Metric::MessagesDropped, 1);
+            }
+            
+            void count(Metric metric, int64_t value)
+            {
+                if(_metrics && value != 0) {
+                    _metrics->add(metric, value);
+                }
+            }
+            
+            void acquire(size_t size)
+            {
+                if(_memory) {
+                    _memory->_bytes.fetch_add(size, std::memory_order_relaxed);
+                }
+            }
+            
+            void release(size_t size)
+            {
+                if(_memory) {
+                    _memory->_bytes.fetch_sub(size, std::memory_order_relaxed);
+                }
+            }
+            
+            SendQueueLimits _limits;
+            SendQueueMemory* _memory;
+            Metrics* _metrics;
+            std::deque<Entry> _packets;
+            size_t _bytes;
+            size_t _highWaterPackets;
+            size_t _highWaterBytes;
+            uint64_t _droppedPackets;
+        };
+
+    }
+}
+
+#endif
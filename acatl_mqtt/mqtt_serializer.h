@@ -36,6 +36,7 @@
 
 #include <acatl_mqtt/mqtt_control_packets.h>
 #include <acatl_mqtt/mqtt_error.h>
+#include <acatl_mqtt/mqtt_topic_alias.h>
 #include <acatl_mqtt/mqtt_utils.h>
 
 
@@ -47,33 +48,63 @@ namespace acatl
         class Serializer
         {
         public:
+            Serializer()
+            : _protocolLevel(protocolLevel311)
+            {}
+            
+            /// The protocol level of the peer, as announced in its CONNECT. Serializing a CONNECT sets the level of
+            /// that CONNECT.
+            void setProtocolLevel(uint8_t protocolLevel)
+            {
+                _protocolLevel = protocolLevel;
+            }
+            
+            uint8_t protocolLevel() const
+            {
+                return _protocolLevel;
+            }
+            
+            /// The Topic Alias Maximum the MQTT 5.0 peer announced. Publishes to the peer replace topics that were sent
+            /// before by an alias. 0 disables aliases.
+            void setTopicAliasMaximum(uint16_t maximum)
+            {
+                _topicAliases.setMaximum(maximum);
+            }
+            
             bool serialize(ControlPacket::Ptr packet, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
             {
-                switch(packet->_header._controlPacketType) {
+                return serialize(*packet, buffer, length, ec);
+            }
+            
+            /// Leaves the packet to the caller, e.g. a client that keeps a publish for its retransmission.
+            bool serialize(const ControlPacket& packet, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
+            {
+                switch(packet._header._controlPacketType) {
                     case ControlPacketType::Connect:
-                        return doSerialize(*dynamic_cast<const ConnectControlPacket*>(packet.get()), buffer, length, ec);
+                        return doSerialize(dynamic_cast<const ConnectControlPacket&>(packet), buffer, length, ec);
                     case ControlPacketType::Connack:
-                        return doSerialize(*dynamic_cast<const ConnAckControlPacket*>(packet.get()), buffer, length, ec);
+                        return doSerialize(dynamic_cast<const ConnAckControlPacket&>(packet), buffer, length, ec);
                     case ControlPacketType::Subscribe:
-                        return doSerialize(*dynamic_cast<const SubscribeControlPacket*>(packet.get()), buffer, length, ec);
+                        return doSerialize(dynamic_cast<const SubscribeControlPacket&>(packet), buffer, length, ec);
                     case ControlPacketType::Unsubscribe:
                         break;
                     case ControlPacketType::Suback:
-                        return doSerialize(*dynamic_cast<const SubAckControlPacket*>(packet.get()), buffer, length, ec);
+                        return doSerialize(dynamic_cast<const SubAckControlPacket&>(packet), buffer, length, ec);
                     case ControlPacketType::Unsuback:
-                    case ControlPacketType::Pingreq:
                         break;
+                    case ControlPacketType::Pingreq:
+                        return doSerialize(dynamic_cast<const PingReqControlPacket&>(packet), buffer, length, ec);
                     case ControlPacketType::Pingresp:
-                        return doSerialize(*dynamic_cast<const PingRespControlPacket*>(packet.get()), buffer, length, ec);
+                        return doSerialize(dynamic_cast<const PingRespControlPacket&>(packet), buffer, length, ec);
                     case ControlPacketType::Disconnect:
-                        return doSerialize(*dynamic_cast<const DisconnectControlPacket*>(packet.get()), buffer, length, ec);
+                        return doSerialize(dynamic_cast<const DisconnectControlPacket&>(packet), buffer, length, ec);
                     case ControlPacketType::Publish:
-                        return doSerialize(*dynamic_cast<const PublishControlPacket*>(packet.get()), buffer, length, ec);
+                        return doSerialize(dynamic_cast<const PublishControlPacket&>(packet), buffer, length, ec);
                     case ControlPacketType::Puback:
                     case ControlPacketType::Pubrec:
                     case ControlPacketType::Pubcomp:
                     case ControlPacketType::Pubrel:
-                        break;
+                        return doSerialize(dynamic_cast<const AcknowledgeControlPacket&>(packet), buffer, length, ec);
                     default:
                         ec = mqtt_error::invalid_control_packet_type;
                         return false;
@@ -85,10 +116,21 @@ namespace acatl
         private:
             bool doSerialize(const ConnectControlPacket& connect, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
             {
+                _protocolLevel = connect._protocolLevel == protocolLevel5 ? protocolLevel5 : protocolLevel311;
+                bool mqtt5 = _protocolLevel == protocolLevel5;
+                uint32_t propertiesLength = connect._properties.length();
+                
                 uint32_t dataLength = 10 + 2 + static_cast<uint32_t>(connect._clientId.size());
+                if(mqtt5) {
+                    dataLength += static_cast<uint32_t>(RunlengthEncoder::encodedSize(propertiesLength) + propertiesLength);
+                }
                 if(connect._willFlag) {
                     dataLength += 2 + connect._willTopic.size();
                     dataLength += 2 + connect._willMessage.size();
+                    if(mqtt5) {
+                        // no will properties
+                        dataLength += 1;
+                    }
                 }
                 if(connect._userNameFlag) {
                     dataLength += 2 + connect._userName.size();
@@ -97,8 +139,8 @@ namespace acatl
                     dataLength += 2 + connect._password.size();
                 }
                 
-                if(buffer.size() < dataLength+2) {
-                    buffer.resize(dataLength+2);
+                if(buffer.size() < dataLength+5) {
+                    buffer.resize(dataLength+5);
                 }
                 
                 length = 0;
@@ -114,7 +156,7 @@ namespace acatl
                 buffer[length++] = 'T';
                 buffer[length++] = 'T';
                 // Protocol level
-                buffer[length++] = 0x04;
+                buffer[length++] = _protocolLevel;
                 // Connect flag
                 buffer[length] = 0;
                 if(connect._userNameFlag) {
@@ -136,8 +178,15 @@ namespace acatl
                 length++;
                 buffer[length++] = (connect._keepAlive & 0xFF00) >> 8;
                 buffer[length++] = (connect._keepAlive & 0x00FF);
+                if(mqtt5) {
+                    _lengthEncoder.encode(propertiesLength, buffer, length);
+                    connect._properties.encode(buffer, length);
+                }
                 _stringEncoder.encode(connect._clientId, buffer, length);
                 if(connect._willFlag) {
+                    if(mqtt5) {
+                        buffer[length++] = 0x00;
+                    }
                     _stringEncoder.encode(connect._willTopic, buffer, length);
                     _stringEncoder.encode(connect._willMessage, buffer, length);
                 }
@@ -153,16 +202,25 @@ namespace acatl
             
             bool doSerialize(const ConnAckControlPacket& connack, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
             {
-                if(buffer.size() < 4) {
-                    buffer.resize(4);
+                uint32_t dataLength = 2;
+                uint32_t propertiesLength = connack._properties.length();
+                if(_protocolLevel == protocolLevel5) {
+                    dataLength += static_cast<uint32_t>(RunlengthEncoder::encodedSize(propertiesLength) + propertiesLength);
+                }
+                if(buffer.size() < dataLength+5) {
+                    buffer.resize(dataLength+5);
                 }
                 
-                buffer[0] = static_cast<uint8_t>(acatl::mqtt::ControlPacketType::Connack);
-                buffer[1] = 0x02;
-                buffer[2] = static_cast<uint8_t>(connack._connectAcknowledgeFlag);
-                buffer[3] = static_cast<uint8_t>(connack._connectReturnCode);
+                length = 0;
+                buffer[length++] = static_cast<uint8_t>(acatl::mqtt::ControlPacketType::Connack);
+                _lengthEncoder.encode(dataLength, buffer, length);
+                buffer[length++] = static_cast<uint8_t>(connack._connectAcknowledgeFlag);
+                buffer[length++] = static_cast<uint8_t>(connack._connectReturnCode);
+                if(_protocolLevel == protocolLevel5) {
+                    _lengthEncoder.encode(propertiesLength, buffer, length);
+                    connack._properties.encode(buffer, length);
+                }
                 
-                length = 4;
                 return true;
             }
             
@@ -181,27 +239,79 @@ namespace acatl
             
             bool doSerialize(const PublishControlPacket& publish, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
             {
-                uint32_t dataLength = 2 + static_cast<uint32_t>(publish._topicName._name.size() + publish._payload.size());
-                // if QoS > 0, add length of packetidentifier
+                static const std::string aliasedTopic;
+                bool mqtt5 = _protocolLevel == protocolLevel5;
+                bool hasIdentifier = publish.qos() != QoSLevel::AtMostOnce;
+                const std::string* topic = &publish._topicName._name;
+                uint16_t alias = 0;
+                uint32_t propertiesLength = 0;
+                if(mqtt5) {
+                    bool sendTopic = true;
+                    std::tie(alias, sendTopic) = _topicAliases.assign(publish._topicName._name);
+                    if(!sendTopic) {
+                        topic = &aliasedTopic;
+                    }
+                    propertiesLength = publish._properties.length() + (alias != 0 ? 3 : 0);
+                }
+                
+                uint32_t dataLength = 2 + static_cast<uint32_t>(topic->size() + publish.payloadSize());
+                if(hasIdentifier) {
+                    dataLength += 2;
+                }
+                if(mqtt5) {
+                    dataLength += static_cast<uint32_t>(RunlengthEncoder::encodedSize(propertiesLength) + propertiesLength);
+                }
                 
-                if(buffer.size() < dataLength+2) {
-                    buffer.resize(dataLength+2);
+                // fixed header byte, one to four bytes of remaining length and the data, without a streamed payload,
+                // which the caller writes from the stream reader after the serialized part
+                size_t packetLength = 1 + RunlengthEncoder::encodedSize(dataLength) + dataLength
+                                      - (publish.payloadSize() - publish._payload.size());
+                if(buffer.size() < packetLength) {
+                    buffer.resize(packetLength);
                 }
 
                 length = 0;
                 
-                buffer[length] = static_cast<uint8_t>(acatl::mqtt::ControlPacketType::Publish);
-                // TODO set DUP, QoS level and RETAIN flags
+                // DUP, QoS level and RETAIN
+                buffer[length] = static_cast<uint8_t>(acatl::mqtt::ControlPacketType::Publish) | (publish._header._flags & 0x0F);
                 ++length;
                 _lengthEncoder.encode(dataLength, buffer, length);
-                _stringEncoder.encode(publish._topicName._name, buffer, length);
-                // if QoS > 0, add packetidentifier
+                _stringEncoder.encode(*topic, buffer, length);
+                if(hasIdentifier) {
+                    buffer[length++] = (0xFF00 & publish._packetIdentifier) >> 8;
+                    buffer[length++] = (0x00FF & publish._packetIdentifier);
+                }
+                if(mqtt5) {
+                    _lengthEncoder.encode(propertiesLength, buffer, length);
+                    if(alias != 0) {
+                        Properties::encodeTwoByteInteger(PropertyIdentifier::TopicAlias, alias, buffer, length);
+                    }
+                    publish._properties.encode(buffer, length);
+                }
                 std::copy(std::begin(publish._payload), std::end(publish._payload), &buffer[length]);
                 length += publish._payload.size();
                 
                 return true;
             }
             
+            bool doSerialize(const AcknowledgeControlPacket& ack, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
+            {
+                if(buffer.size() < 4) {
+                    buffer.resize(4);
+                }
+                
+                buffer[0] = static_cast<uint8_t>(ack._header._controlPacketType);
+                if(ack._header._controlPacketType == ControlPacketType::Pubrel) {
+                    buffer[0] |= 0x02;
+                }
+                buffer[1] = 0x02;
+                buffer[2] = (0xFF00 & ack._packetIdentifier) >> 8;
+                buffer[3] = (0x00FF & ack._packetIdentifier);
+                
+                length = 4;
+                return true;
+            }
+            
             bool doSerialize(const SubscribeControlPacket& subscribe, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
             {
                 uint32_t dataLength = 2;
@@ -209,9 +319,13 @@ namespace acatl
                     dataLength += 3;
                     dataLength += filter._filter.size();
                 }
+                uint32_t propertiesLength = subscribe._properties.length();
+                if(_protocolLevel == protocolLevel5) {
+                    dataLength += static_cast<uint32_t>(RunlengthEncoder::encodedSize(propertiesLength) + propertiesLength);
+                }
                 
-                if(buffer.size() < dataLength+2) {
-                    buffer.resize(dataLength+2);
+                if(buffer.size() < dataLength+5) {
+                    buffer.resize(dataLength+5);
                 }
 
                 length = 0;
@@ -222,6 +336,10 @@ namespace acatl
                 _lengthEncoder.encode(dataLength, buffer, length);
                 buffer[length++] = (0xFF00 & subscribe._packetIdentifier) >> 8;
                 buffer[length++] = (0x00FF & subscribe._packetIdentifier);
+                if(_protocolLevel == protocolLevel5) {
+                    _lengthEncoder.encode(propertiesLength, buffer, length);
+                    subscribe._properties.encode(buffer, length);
+                }
                 for(const auto& filter : subscribe._topicFilters) {
                     _stringEncoder.encode(filter._filter, buffer, length);
                     buffer[length++] = static_cast<uint8_t>(filter._qos);
@@ -232,16 +350,25 @@ namespace acatl
 
             bool doSerialize(const SubAckControlPacket& suback, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
             {
-                if(buffer.size() < suback._qosLevels.size()+2) {
-                    buffer.resize(suback._qosLevels.size()+2);
+                uint32_t dataLength = 2 + static_cast<uint32_t>(suback._qosLevels.size());
+                uint32_t propertiesLength = suback._properties.length();
+                if(_protocolLevel == protocolLevel5) {
+                    dataLength += static_cast<uint32_t>(RunlengthEncoder::encodedSize(propertiesLength) + propertiesLength);
+                }
+                if(buffer.size() < dataLength+5) {
+                    buffer.resize(dataLength+5);
                 }
 
                 length = 0;
                 
                 buffer[length++] = static_cast<uint8_t>(acatl::mqtt::ControlPacketType::Suback);
-                buffer[length++] = 0x02 + static_cast<uint8_t>(suback._qosLevels.size());
+                _lengthEncoder.encode(dataLength, buffer, length);
                 buffer[length++] = (0xFF00 & suback._packetIdentifier) >> 8;
                 buffer[length++] = (0x00FF & suback._packetIdentifier);
+                if(_protocolLevel == protocolLevel5) {
+                    _lengthEncoder.encode(propertiesLength, buffer, length);
+                    suback._properties.encode(buffer, length);
+                }
                 for(const auto& level : suback._qosLevels) {
                     buffer[length++] = static_cast<uint8_t>(level);
                 }
@@ -249,6 +376,18 @@ namespace acatl
                 return true;
             }
             
+            bool doSerialize(const PingReqControlPacket& pingreq, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
+            {
+                if(buffer.size() < 2) {
+                    buffer.resize(2);
+                }
+                
+                buffer[0] = static_cast<uint8_t>(acatl::mqtt::ControlPacketType::Pingreq);
+                buffer[1] = 0x00;
+                length = 2;
+                return true;
+            }
+            
             bool doSerialize(const PingRespControlPacket& pingresp, std::vector<uint8_t>& buffer, size_t& length, std::error_code& ec)
             {
                 if(buffer.size() < 2) {
@@ -263,6 +402,8 @@ namespace acatl
             
             acatl::mqtt::RunlengthEncoder _lengthEncoder;
             acatl::mqtt::StringEncoder _stringEncoder;
+            uint8_t _protocolLevel;
+            OutboundTopicAliases _topicAliases;
         };
         
     }
@@ -35,10 +35,16 @@
 #define acatl_mqtt_session_h
 
 #include <acatl_mqtt/mqtt_error.h>
+#include <acatl_mqtt/mqtt_inflight_window.h>
+#include <acatl_mqtt/mqtt_offline_queue.h>
 #include <acatl_mqtt/mqtt_packet_sender.h>
 #include <acatl_mqtt/mqtt_subscription_handler.h>
+#include <acatl_mqtt/mqtt_subscription_index.h>
 
+#include <atomic>
+#include <deque>
 #include <mutex>
+#include <unordered_set>
 
 
 namespace acatl
@@ -46,6 +52,48 @@ namespace acatl
     namespace mqtt
     {
         
+        /// Limits of the outgoing QoS 1 and QoS 2 messages of a session.
+        struct InflightOptions
+        {
+            /// Messages sent without waiting for their acknowledgement.
+            uint16_t _receiveMaximum{InflightWindow::defaultReceiveMaximum};
+            /// Messages held while the window is full and no offline queue takes them. Further ones are dropped.
+            size_t _maxPending{10000};
+        };
+        
+        /// Client ID prefix of the links between the nodes of a cluster. Their sessions only get the publishes of
+        /// local clients, and their subscriptions are not part of the interest a node announces to its peers.
+        constexpr char clusterLinkPrefix[] = "$cluster/";
+        
+        inline bool isClusterLink(const std::string& clientId)
+        {
+            return clientId.compare(0, sizeof(clusterLinkPrefix) - 1, clusterLinkPrefix) == 0;
+        }
+        
+        /// What a client has to present to connect with a client ID starting with clusterLinkPrefix, so that no
+        /// ordinary client can take the place of a link.
+        struct ClusterCredentials
+        {
+            typedef std::shared_ptr<const ClusterCredentials> Ptr;
+            
+            bool accepts(const std::string& userName, const std::string& password) const
+            {
+                return !_password.empty() && userName == _userName && password == _password;
+            }
+            
+            std::string _userName;
+            std::string _password;
+        };
+        
+        /// A copy of the part of a session that is persisted. The revision grows with every change of the
+        /// subscriptions and is unique across all sessions, so a store can tell an outdated copy from a newer one.
+        struct SessionState
+        {
+            std::string _clientId;
+            TopicFilters _subscriptions;
+            uint64_t _revision{0};
+        };
+        
         class Session
         {
         public:
@@ -53,7 +101,8 @@ namespace acatl
             
             Session(const std::string& clientId, SubscriptionHandler& subscriptionHandler)
             : _clientId(clientId)
-            , _subscriptionHandler(subscriptionHandler)
+            , _subscriptionHandler(&subscriptionHandler)
+            , _revision(nextRevision())
             {}
             
             Session(Session&& rhs)
@@ -61,6 +110,15 @@ namespace acatl
             , _subscriptionHandler(rhs._subscriptionHandler)
             , _sender(std::move(rhs._sender))
             , _subscriptions(std::move(rhs._subscriptions))
+            , _restoredSubscriptions(std::move(rhs._restoredSubscriptions))
+            , _revision(rhs._revision)
+            , _cleanSession(rhs._cleanSession.load())
+            , _offlineStorage(std::move(rhs._offlineStorage))
+            , _offlineQueue(std::move(rhs._offlineQueue))
+            , _inflightOptions(rhs._inflightOptions)
+            , _inflight(std::move(rhs._inflight))
+            , _pending(std::move(rhs._pending))
+            , _receivedExactlyOnce(std::move(rhs._receivedExactlyOnce))
             {
             }
             
@@ -71,30 +129,329 @@ namespace acatl
             
             void setSender(PacketSender::WeakPtr sender)
             {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
                 _sender = sender;
             }
             
             PacketSender::Ptr currentSender()
             {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
                 return _sender.lock();
             }
             
+            /// Enables offline queueing of QoS>0 messages for this session, if it is not clean.
+            void setOfflineStorage(OfflineStorage::Ptr offlineStorage)
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                _offlineStorage = offlineStorage;
+            }
+            
+            /// Applies to the messages sent from now on. The window size only changes while nothing is in flight.
+            void setInflightOptions(const InflightOptions& options)
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                _inflightOptions = options;
+                if(_inflight.empty()) {
+                    _inflight = InflightWindow(options._receiveMaximum);
+                }
+            }
+            
+            /// Sends the packet to the connected client. QoS>0 messages get a packet identifier and stay in the
+            /// in-flight window until they are acknowledged. If the window is full, or older messages still wait,
+            /// they queue up in order: in the offline queue of a persistent session, otherwise in memory. The
+            /// offline queue also takes them while the client of a persistent session is offline.
+            /// Returns false if the packet was dropped.
+            bool deliver(PublishControlPacket::Ptr packet)
+            {
+                // declared before the guard, so a closed connection is destroyed after the unlock: returning its
+                // session locks the delivery mutex again
+                PacketSender::Ptr sender;
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                sender = _sender.lock();
+                if(packet->qos() == QoSLevel::AtMostOnce) {
+                    if(sender) {
+                        sender->addSendPacket(std::move(packet));
+                        return true;
+                    }
+                    return false;
+                }
+                
+                bool backlog = !_pending.empty() || (_offlineQueue && !_offlineQueue->empty());
+                if(sender && !backlog && !_inflight.full()) {
+                    sendInflight(*sender, std::move(packet));
+                    return true;
+                }
+                if(!_cleanSession && _offlineStorage) {
+                    if(!_offlineQueue) {
+                        _offlineQueue.reset(new OfflineQueue(_offlineStorage));
+                    }
+                    // a queued message must not hold back its publisher, its wait for the client is not traced
+                    packet->_credit.reset();
+                    packet->_traceTimestamp = std::chrono::steady_clock::time_point();
+                    std::error_code ec;
+                    return _offlineQueue->push(std::move(packet), ec);
+                }
+                if(!sender || _pending.size() >= _inflightOptions._maxPending) {
+                    return false;
+                }
+                _pending.push_back(std::move(packet));
+                return true;
+            }
+            
+            /// Moves up to maxMessages queued messages into the in-flight window of the connected client, as far as
+            /// the window has room. Returns the number of messages sent.
+            size_t drainOfflineMessages(size_t maxMessages)
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                PacketSender::Ptr sender = _sender.lock();
+                if(!sender) {
+                    return 0;
+                }
+                return refill(*sender, maxMessages);
+            }
+            
+            size_t offlineMessages()
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                return _offlineQueue ? _offlineQueue->size() : 0;
+            }
+            
+            size_t inflightMessages()
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                return _inflight.size();
+            }
+            
+            size_t pendingMessages()
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                return _pending.size();
+            }
+            
+            /// PUBACK from the client. The freed slot is refilled from the queued messages right away, so the
+            /// acknowledgements of one read are answered with one batch of messages.
+            bool acknowledge(PacketIdentifier packetIdentifier)
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                if(!_inflight.acknowledge(packetIdentifier)) {
+                    return false;
+                }
+                refillConnected();
+                return true;
+            }
+            
+            /// PUBREC from the client. The caller answers with PUBREL.
+            bool receive(PacketIdentifier packetIdentifier)
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                return _inflight.receive(packetIdentifier);
+            }
+            
+            /// PUBCOMP from the client.
+            bool complete(PacketIdentifier packetIdentifier)
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                if(!_inflight.complete(packetIdentifier)) {
+                    return false;
+                }
+                refillConnected();
+                return true;
+            }
+            
+            /// Records a QoS 2 publish received from the client. Returns false if the publish with this identifier was
+            /// already received and not yet released, in which case it must not be forwarded again.
+            bool receiveExactlyOnce(PacketIdentifier packetIdentifier)
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                return _receivedExactlyOnce.insert(packetIdentifier).second;
+            }
+            
+            /// PUBREL from the client, the identifier may be used for a new QoS 2 publish afterwards.
+            bool releaseExactlyOnce(PacketIdentifier packetIdentifier)
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                return _receivedExactlyOnce.erase(packetIdentifier) > 0;
+            }
+            
+            /// Sends the unacknowledged messages of a previous connection again. Called once a persistent session is
+            /// resumed, before any new message is delivered. Returns the number of packets sent.
+            size_t resendInflight()
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                PacketSender::Ptr sender = _sender.lock();
+                if(!sender) {
+                    return 0;
+                }
+                std::vector<ControlPacket::Ptr> packets;
+                _inflight.retransmissions(packets);
+                for(auto& packet : packets) {
+                    sender->addSendPacket(std::move(packet));
+                }
+                return packets.size();
+            }
+            
+            /// Called when the session is replaced by a clean one or removed. Stops queueing and drops queued messages.
+            void discard()
+            {
+                std::unique_lock<std::mutex> guard(_deliveryMutex);
+                _cleanSession = true;
+                _offlineQueue.reset();
+                _inflight.clear();
+                _pending.clear();
+                _receivedExactlyOnce.clear();
+            }
+            
+            /// Only new filters and those subscribed again with another QoS are passed to the subscription handler.
             void addSubscriptions(const TopicFilters& subscriptions)
             {
                 std::unique_lock<std::mutex> guard(_subscriptionMutex);
                 
-                acatl::mqtt::TopicFilters result = acatl::mqtt::TopicFilterHelper::findDifference(subscriptions, _subscriptions);
-                _subscriptions.insert(std::end(_subscriptions), std::begin(result), std::end(result));
+                TopicFilters result;
+                for(const auto& filter : subscriptions) {
+                    if(_subscriptions.add(filter)) {
+                        result.push_back(filter);
+                    }
+                }
+                
+                if(!result.empty()) {
+                    _revision = nextRevision();
+                    _subscriptionHandler->addSubscriptions(result);
+                }
+            }
+            
+            /// Passes the filters that were subscribed to the subscription handler.
+            void removeSubscriptions(const TopicFilters& subscriptions)
+            {
+                std::unique_lock<std::mutex> guard(_subscriptionMutex);
+                
+                TopicFilters result;
+                for(const auto& filter : subscriptions) {
+                    if(_subscriptions.remove(filter._filter)) {
+                        result.push_back(filter);
+                    }
+                }
                 
-                _subscriptionHandler.addSubscriptions(result);
+                if(!result.empty()) {
+                    _revision = nextRevision();
+                    _subscriptionHandler->removeSubscriptions(result);
+                }
+            }
+            
+            /// A resumed session passes its new subscriptions to the handler of the connection resuming it.
+            void setSubscriptionHandler(SubscriptionHandler& subscriptionHandler)
+            {
+                std::unique_lock<std::mutex> guard(_subscriptionMutex);
+                _subscriptionHandler = &subscriptionHandler;
+            }
+            
+            TopicFilters subscriptions()
+            {
+                std::unique_lock<std::mutex> guard(_subscriptionMutex);
+                return _subscriptions.filters();
+            }
+            
+            SessionState state()
+            {
+                std::unique_lock<std::mutex> guard(_subscriptionMutex);
+                return SessionState{_clientId, _subscriptions.filters(), _revision};
+            }
+            
+            /// Sets the subscriptions of a session that was loaded from a session store. They are not passed to the
+            /// subscription handler here, because the session is not yet attached to a connection. The owner of the
+            /// connection collects them with takeRestoredSubscriptions once it got hold of the session.
+            void restoreSubscriptions(const TopicFilters& subscriptions)
+            {
+                std::unique_lock<std::mutex> guard(_subscriptionMutex);
+                _subscriptions.assign(subscriptions);
+                _restoredSubscriptions = _subscriptions.filters();
+            }
+            
+            TopicFilters takeRestoredSubscriptions()
+            {
+                std::unique_lock<std::mutex> guard(_subscriptionMutex);
+                TopicFilters result;
+                result.swap(_restoredSubscriptions);
+                return result;
+            }
+            
+            bool cleanSession() const
+            {
+                return _cleanSession;
+            }
+            
+            /// The latest revision handed out to any session. Every state copied before the call has a revision
+            /// that is not newer.
+            static uint64_t lastRevision()
+            {
+                return revisionCounter().load(std::memory_order_relaxed);
+            }
+            
+            void setCleanSession(bool cleanSession)
+            {
+                _cleanSession = cleanSession;
             }
             
         private:
+            static std::atomic<uint64_t>& revisionCounter()
+            {
+                static std::atomic<uint64_t> revision{0};
+                return revision;
+            }
+            
+            static uint64_t nextRevision()
+            {
+                return revisionCounter().fetch_add(1, std::memory_order_relaxed) + 1;
+            }
+            
+            void sendInflight(PacketSender& sender, PublishControlPacket::Ptr packet)
+            {
+                _inflight.add(*packet);
+                sender.addSendPacket(std::move(packet));
+            }
+            
+            size_t refill(PacketSender& sender, size_t maxMessages)
+            {
+                size_t sent = 0;
+                while(sent < maxMessages && !_pending.empty() && !_inflight.full()) {
+                    sendInflight(sender, std::move(_pending.front()));
+                    _pending.pop_front();
+                    ++sent;
+                }
+                if(sent < maxMessages && _offlineQueue && !_offlineQueue->empty() && !_inflight.full()) {
+                    std::vector<PublishControlPacket::Ptr> batch;
+                    std::error_code ec;
+                    _offlineQueue->pop(std::min(maxMessages - sent, _inflight.available()), batch, ec);
+                    for(auto& packet : batch) {
+                        sendInflight(sender, std::move(packet));
+                        ++sent;
+                    }
+                }
+                return sent;
+            }
+            
+            void refillConnected()
+            {
+                PacketSender::Ptr sender = _sender.lock();
+                if(sender) {
+                    refill(*sender, _inflight.available());
+                }
+            }
+            
             std::string _clientId;
-            SubscriptionHandler& _subscriptionHandler;
+            SubscriptionHandler* _subscriptionHandler;
+            std::mutex _deliveryMutex;
             PacketSender::WeakPtr _sender;
             std::mutex _subscriptionMutex;
-            TopicFilters _subscriptions;
+            SubscriptionIndex _subscriptions;
+            TopicFilters _restoredSubscriptions;
+            uint64_t _revision;
+            std::atomic<bool> _cleanSession{false};
+            OfflineStorage::Ptr _offlineStorage;
+            OfflineQueue::Ptr _offlineQueue;
+            InflightOptions _inflightOptions;
+            InflightWindow _inflight;
+            std::deque<PublishControlPacket::Ptr> _pending;
+            std::unordered_set<PacketIdentifier> _receivedExactlyOnce;
         };
 
     }
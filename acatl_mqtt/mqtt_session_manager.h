@@ -36,8 +36,13 @@
 
 #include <acatl_mqtt/mqtt_packet_sender.h>
 #include <acatl_mqtt/mqtt_session.h>
+#include <acatl_mqtt/mqtt_session_store.h>
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 
 namespace acatl
@@ -45,20 +50,114 @@ namespace acatl
     namespace mqtt
     {
         
+        /// Holds the sessions of all clients. The session table is split into independently locked shards that are
+        /// selected by the hash of the client id, so connects and disconnects of different clients running on
+        /// different io threads rarely contend for the same mutex.
+        /// If a session store is set, sessions that are not clean are loaded from it on their first connect and
+        /// written to it whenever their subscriptions change or their connection goes away.
         class SessionManager
         {
         public:
-            SessionManager()
-            {}
+            static constexpr size_t defaultShardCount = 64;
+            
+            explicit SessionManager(size_t shardCount = defaultShardCount)
+            {
+                _shards.reserve(std::max<size_t>(shardCount, 1));
+                for(size_t i = 0; i < std::max<size_t>(shardCount, 1); ++i) {
+                    _shards.emplace_back(new Shard);
+                }
+            }
+            
+            void setSessionStore(SessionStore::Ptr sessionStore)
+            {
+                _sessionStore = sessionStore;
+            }
+            
+            /// Sessions created from now on queue QoS>0 messages while their client is offline.
+            void setOfflineStorage(OfflineStorage::Ptr offlineStorage)
+            {
+                _offlineStorage = offlineStorage;
+            }
+            
+            /// Sessions created from now on use these in-flight limits for their QoS 1 and QoS 2 messages.
+            void setInflightOptions(const InflightOptions& inflightOptions)
+            {
+                _inflightOptions = inflightOptions;
+            }
             
             Session::Ptr getSession(const std::string& clientId,
                                     PacketSender::WeakPtr sender,
                                     SubscriptionHandler& subscriptionHandler,
                                     std::error_code& ec)
             {
-                std::unique_lock<std::mutex> guard(_sessionsMutex);
+                return getSession(clientId, false, sender, subscriptionHandler, ec);
+            }
+            
+            /// A clean session discards any state left by a previous connection of the same client, otherwise the
+            /// previous session is resumed, either from memory or from the session store.
+            /// The session store is accessed without the shard lock. The new session is marked in use before, so
+            /// another connect of the same client fails with session_in_use instead of waiting for the file I/O.
+            Session::Ptr getSession(const std::string& clientId,
+                                    bool cleanSession,
+                                    PacketSender::WeakPtr sender,
+                                    SubscriptionHandler& subscriptionHandler,
+                                    std::error_code& ec)
+            {
+                Shard& shard = shardFor(clientId);
+                Session::Ptr session;
+                {
+                    std::unique_lock<std::mutex> guard(shard._mutex);
+                    auto iter = shard._sessions.find(clientId);
+                    if(iter != shard._sessions.end()) {
+                        if(iter->second._inUse) {
+                            ec = mqtt_error::session_in_use;
+                            return nullptr;
+                        }
+                        if(!cleanSession) {
+                            iter->second._session->setSubscriptionHandler(subscriptionHandler);
+                            iter->second._session->setSender(sender);
+                            iter->second._inUse = true;
+                            ec.clear();
+                            return iter->second._session;
+                        }
+                        iter->second._session->discard();
+                        shard._sessions.erase(iter);
+                    }
+                    
+                    auto result = shard._sessions.emplace(clientId, SessionWrapper(clientId, subscriptionHandler));
+                    session = result.first->second._session;
+                    session->setCleanSession(cleanSession);
+                    session->setOfflineStorage(_offlineStorage);
+                    session->setInflightOptions(_inflightOptions);
+                    result.first->second._inUse = true;
+                    if(!_sessionStore) {
+                        session->setSender(sender);
+                        ec.clear();
+                        return session;
+                    }
+                }
                 
-                return unlockedGetSession(clientId, sender, subscriptionHandler, ec);
+                TopicFilters storedSubscriptions;
+                bool stored = false;
+                if(cleanSession) {
+                    _sessionStore->removeSession(clientId, ec);
+                } else {
+                    stored = _sessionStore->loadSession(clientId, storedSubscriptions, ec);
+                }
+                if(ec) {
+                    std::unique_lock<std::mutex> guard(shard._mutex);
+                    auto iter = shard._sessions.find(clientId);
+                    if(iter != shard._sessions.end() && iter->second._session == session) {
+                        shard._sessions.erase(iter);
+                    }
+                    return nullptr;
+                }
+                
+                if(stored) {
+                    session->restoreSubscriptions(storedSubscriptions);
+                }
+                session->setSender(sender);
+                return session;
             }
             
             bool returnSession(const Session::Ptr session, std::error_code& ec)
@@ -68,23 +167,49 @@ namespace acatl
                     return false;
                 }
                 
-                std::unique_lock<std::mutex> guard(_sessionsMutex);
-                auto iter = _sessions.find(session->clientId());
-                if(iter == _sessions.end()) {
-                    ec = mqtt_error::session_not_found;
-                    return false;
+                SessionState state;
+                {
+                    Shard& shard = shardFor(session->clientId());
+                    std::unique_lock<std::mutex> guard(shard._mutex);
+                    auto iter = shard._sessions.find(session->clientId());
+                    if(iter == shard._sessions.end()) {
+                        ec = mqtt_error::session_not_found;
+                        return false;
+                    }
+                    iter->second._session->setSender(PacketSender::Ptr());
+                    iter->second._inUse = false;
+                    ec.clear();
+                    if(session->cleanSession()) {
+                        shard._sessions.erase(iter);
+                        return true;
+                    }
+                    if(!_sessionStore) {
+                        return true;
+                    }
+                    state = session->state();
                 }
-                iter->second._session->setSender(PacketSender::Ptr());
-                iter->second._inUse = false;
-                ec.clear();
-                return true;
+                
+                // The file I/O runs without the shard lock. Should the client reconnect and change its
+                // subscriptions in the meantime, the store keeps the newer state by its revision.
+                return _sessionStore->persistSession(state, ec);
+            }
+            
+            /// Writes the session to the session store, if there is one and the session is not clean.
+            bool persistSession(Session& session, std::error_code& ec)
+            {
+                if(!_sessionStore || session.cleanSession()) {
+                    ec.clear();
+                    return true;
+                }
+                return _sessionStore->persistSession(session, ec);
             }
             
             bool removeSession(const std::string& clientId, std::error_code& ec)
             {
-                std::unique_lock<std::mutex> guard(_sessionsMutex);
-                auto iter = _sessions.find(clientId);
-                if(iter == _sessions.end()) {
+                Shard& shard = shardFor(clientId);
+                std::unique_lock<std::mutex> guard(shard._mutex);
+                auto iter = shard._sessions.find(clientId);
+                if(iter == shard._sessions.end()) {
                     ec = mqtt_error::session_not_found;
                     return false;
                 }
@@ -92,41 +217,35 @@ namespace acatl
                     ec = mqtt_error::session_in_use;
                     return false;
                 }
-                _sessions.erase(iter);
+                iter->second._session->discard();
+                shard._sessions.erase(iter);
+                guard.unlock();
                 
+                if(_sessionStore) {
+                    return _sessionStore->removeSession(clientId, ec);
+                }
+                ec.clear();
                 return true;
             }
             
+            /// The sum of the shard sizes. Every shard is locked on its own, so the result is only a snapshot while
+            /// other threads are connecting or disconnecting.
             size_t count() const
             {
-                std::unique_lock<std::mutex> guard(_sessionsMutex);
-                return _sessions.size();
+                size_t result = 0;
+                for(const auto& shard : _shards) {
+                    std::unique_lock<std::mutex> guard(shard->_mutex);
+                    result += shard->_sessions.size();
+                }
+                return result;
             }
             
-        private:
-            Session::Ptr unlockedGetSession(const std::string& clientId,
-                                            PacketSender::WeakPtr sender,
-                                            SubscriptionHandler& subscriptionHandler,
-                                            std::error_code& ec)
+            size_t shardCount() const
             {
-                auto iter = _sessions.find(clientId);
-                if(iter != _sessions.end()) {
-                    if(iter->second._inUse) {
-                        ec = mqtt_error::session_in_use;
-                        return nullptr;
-                    }
-                    iter->second._session->setSender(sender);
-                    iter->second._inUse = true;
-                    ec.clear();
-                    return iter->second._session;
-                }
-                auto result = _sessions.emplace(clientId, SessionWrapper(clientId, subscriptionHandler));
-                result.first->second._session->setSender(sender);
-                result.first->second._inUse = true;
-                ec.clear();
-                return result.first->second._session;
+                return _shards.size();
             }
             
+        private:
             struct SessionWrapper
             {
                 SessionWrapper(const std::string& clientId, SubscriptionHandler& subscriptionHandler)
@@ -138,8 +257,21 @@ namespace acatl
                 bool _inUse;
             };
             
-            mutable std::mutex _sessionsMutex;
-            std::unordered_map<std::string, SessionWrapper> _sessions;
+            struct Shard
+            {
+                mutable std::mutex _mutex;
+                std::unordered_map<std::string, SessionWrapper> _sessions;
+            };
+            
+            Shard& shardFor(const std::string& clientId) const
+            {
+                return *_shards[std::hash<std::string>()(clientId) % _shards.size()];
+            }
+            
+            std::vector<std::unique_ptr<Shard>> _shards;
+            SessionStore::Ptr _sessionStore;
+            OfflineStorage::Ptr _offlineStorage;
+            InflightOptions _inflightOptions;
         };
 
     }
@@ -42,11 +42,36 @@ namespace acatl
     namespace mqtt
     {
         
+        /// Persists the state of sessions that were not connected with the clean session flag, so it survives a
+        /// broker restart. Implementations have to be thread safe, as sessions are persisted from all io threads.
         class SessionStore
         {
         public:
-            virtual void persistSession(const Session& session) = 0;
-            virtual Session loadSession(const std::string& clientId) = 0;
+            typedef std::shared_ptr<SessionStore> Ptr;
+            
+            virtual ~SessionStore() {}
+            
+            /// Stores the subscriptions of the state, replacing any previously stored state of the client. A state
+            /// whose revision is not newer than the stored one is either unchanged or outdated, and is not written.
+            virtual bool persistSession(const SessionState& state, std::error_code& ec) = 0;
+            
+            /// Stores the current subscriptions of the session.
+            bool persistSession(Session& session, std::error_code& ec)
+            {
+                return persistSession(session.state(), ec);
+            }
+            
+            /// Loads the stored subscriptions of the given client. Returns false without setting ec if nothing was
+            /// stored for this client.
+            virtual bool loadSession(const std::string& clientId, TopicFilters& subscriptions, std::error_code& ec) = 0;
+            
+            virtual bool removeSession(const std::string& clientId, std::error_code& ec) = 0;
+            
+            /// Forces all pending writes to stable storage.
+            virtual bool flush(std::error_code& ec) = 0;
+            
+        protected:
+            SessionStore() = default;
         };
 
     }
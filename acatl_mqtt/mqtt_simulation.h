@@ -0,0 +1,514 @@
+//
+//  mqtt_simulation.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_simulation_h
+#define acatl_mqtt_simulation_h
+
+#include <acatl_mqtt/mqtt_processor.h>
+#include <acatl_mqtt/mqtt_session_manager.h>
+#include <acatl_mqtt/mqtt_subscription_tree_manager.h>
+
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// Time of a simulation in microseconds since its start, which only moves when the simulation advances it.
+        class VirtualClock
+        {
+        public:
+            uint64_t now() const
+            {
+                return _now;
+            }
+            
+            void advanceTo(uint64_t time)
+            {
+                if(time > _now) {
+                    _now = time;
+                }
+            }
+            
+        private:
+            uint64_t _now{0};
+        };
+        
+        
+        enum class ClientAction
+        {
+            Connect,
+            Subscribe,
+            Publish,
+            Disconnect
+        };
+        
+        /// One step of a scripted client. "%i" in the topic is replaced by the index of the client in its group.
+        struct ClientStep
+        {
+            ClientAction _action;
+            /// Microseconds after the previous step, or between the repeats of this step.
+            uint64_t _delay = 0;
+            std::string _topic;
+            QoSLevel _qos = QoSLevel::AtMostOnce;
+            size_t _count = 1;
+        };
+        
+        /// The behaviour of a group of clients. A client runs the steps once per cycle and stays in the state of its
+        /// last step, so a script without a final Disconnect keeps its clients connected until the simulation ends.
+        struct ClientScript
+        {
+            std::vector<ClientStep> _steps;
+            size_t _cycles = 1;
+            bool _cleanSession = false;
+            size_t _payloadSize = 64;
+            /// Microseconds until a client acknowledges the publishes delivered to it.
+            uint64_t _acknowledgeDelay = 0;
+        };
+        
+        
+        struct SimulationStats
+        {
+            /// Packets handed to the Processor for one kind of operation and the time it spent on them.
+            struct Operation
+            {
+                uint64_t _count = 0;
+                uint64_t _nanoseconds = 0;
+                
+                double nanosecondsPerOperation() const
+                {
+                    return _count == 0 ? 0.0 : static_cast<double>(_nanoseconds) / static_cast<double>(_count);
+                }
+            };
+            
+            Operation _connects;
+            Operation _subscribes;
+            Operation _publishes;
+            Operation _acknowledgements;
+            Operation _disconnects;
+            uint64_t _connacks = 0;
+            uint64_t _subacks = 0;
+            uint64_t _deliveries = 0;
+            uint64_t _errors = 0;
+        };
+        
+        
+        /// Drives scripted clients through Processor, SessionManager and SubscriptionTreeManager without sockets on
+        /// the calling thread. Every client gets an in-memory PacketSender, the steps and acknowledgements are events
+        /// ordered by a VirtualClock, so only the broker code is measured. Rate limits and offline message expiry
+        /// still use the real clock.
+        class Simulation
+        {
+        public:
+            Simulation(SubscriptionTreeManager& subscriptionTreeManager, SessionManager& sessionManager)
+            : _subscriptionTreeManager(subscriptionTreeManager)
+            , _sessionManager(sessionManager)
+            {}
+            
+            Simulation(const Simulation&) = delete;
+            Simulation& operator=(const Simulation&) = delete;
+            
+            ~Simulation()
+            {
+                // the processors return their sessions to the session manager
+                for(auto& client : _clients) {
+                    client._processor.reset();
+                }
+            }
+            
+            /// Called for every new Processor, to set up rate limits, metrics or a retained store as a broker would.
+            void setProcessorSetup(std::function<void(Processor&)> setup)
+            {
+                _setup = std::move(setup);
+            }
+            
+            /// Adds count clients running the script, their start spread evenly over the next spread microseconds.
+            /// Returns the index of the first of them; client ids are "sim-" followed by the index.
+            size_t addClients(size_t count, const ClientScript& script, uint64_t spread = 0)
+            {
+                _scripts.push_back(script);
+                size_t first = _clients.size();
+                _clients.reserve(first + count);
+                for(size_t i = 0; i < count; ++i) {
+                    _clients.emplace_back(*this, first + i, _scripts.size() - 1, i);
+                    if(!script._steps.empty()) {
+                        uint64_t start = count > 1 ? spread * i / count : 0;
+                        schedule(_clock.now() + start + script._steps.front()._delay, first + i, EventType::Step);
+                    }
+                }
+                return first;
+            }
+            
+            /// Processes the events up to the given virtual time and returns how many there were.
+            size_t run(uint64_t until = std::numeric_limits<uint64_t>::max())
+            {
+                size_t processed = 0;
+                while(!_events.empty() && _events.top()._time <= until) {
+                    Event event = _events.top();
+                    _events.pop();
+                    _clock.advanceTo(event._time);
+                    switch(event._type) {
+                        case EventType::Step:
+                            step(_clients[event._client]);
+                            break;
+                        case EventType::Respond:
+                            respond(_clients[event._client]);
+                            break;
+                    }
+                    ++processed;
+                }
+                if(until != std::numeric_limits<uint64_t>::max()) {
+                    _clock.advanceTo(until);
+                }
+                return processed;
+            }
+            
+            const VirtualClock& clock() const
+            {
+                return _clock;
+            }
+            
+            const SimulationStats& stats() const
+            {
+                return _stats;
+            }
+            
+            size_t clients() const
+            {
+                return _clients.size();
+            }
+            
+            size_t connected() const
+            {
+                return _connected;
+            }
+            
+        private:
+            struct Client;
+            
+            /// Queues what the client answers to the packets the broker sends it.
+            class Sender : public PacketSender
+            {
+            public:
+                Sender(Simulation& simulation, size_t client)
+                : _simulation(simulation)
+                , _client(client)
+                {}
+                
+                void addSendPacket(ControlPacket::Ptr packet) override
+                {
+                    _simulation.received(_simulation._clients[_client], std::move(packet));
+                }
+                
+            private:
+                Simulation& _simulation;
+                size_t _client;
+            };
+            
+            struct Client
+            {
+                Client(Simulation& simulation, size_t client, size_t script, size_t index)
+                : _sender(std::make_shared<Sender>(simulation, client))
+                , _script(script)
+                , _index(index)
+                {}
+                
+                std::unique_ptr<Processor> _processor;
+                std::shared_ptr<Sender> _sender;
+                std::vector<ControlPacket::Ptr> _responses;
+                size_t _script;
+                size_t _index;
+                size_t _step = 0;
+                size_t _repeat = 0;
+                size_t _cycle = 0;
+                PacketIdentifier _packetIdentifier = 0;
+                bool _responding = false;
+            };
+            
+            enum class EventType : uint8_t
+            {
+                Step,
+                Respond
+            };
+            
+            struct Event
+            {
+                uint64_t _time;
+                uint64_t _sequence;
+                size_t _client;
+                EventType _type;
+                
+                bool operator>(const Event& rhs) const
+                {
+                    return _time != rhs._time ? _time > rhs._time : _sequence > rhs._sequence;
+                }
+            };
+            
+            void schedule(uint64_t time, size_t client, EventType type)
+            {
+                _events.push(Event{time, _sequence++, client, type});
+            }
+            
+            size_t indexOf(const Client& client) const
+            {
+                return static_cast<size_t>(&client - _clients.data());
+            }
+            
+            void step(Client& client)
+            {
+                const ClientScript& script = _scripts[client._script];
+                const ClientStep& current = script._steps[client._step];
+                switch(current._action) {
+                    case ClientAction::Connect:
+                        connect(client, script);
+                        break;
+                    case ClientAction::Subscribe:
+                        subscribe(client, current);
+                        break;
+                    case ClientAction::Publish:
+                        publish(client, script, current);
+                        break;
+                    case ClientAction::Disconnect:
+                        disconnect(client);
+                        break;
+                }
+                
+                uint64_t delay = current._delay;
+                if(++client._repeat >= current._count) {
+                    client._repeat = 0;
+                    if(++client._step == script._steps.size()) {
+                        client._step = 0;
+                        if(++client._cycle == script._cycles) {
+                            return;
+                        }
+                    }
+                    delay = script._steps[client._step]._delay;
+                }
+                schedule(_clock.now() + delay, indexOf(client), EventType::Step);
+            }
+            
+            void connect(Client& client, const ClientScript& script)
+            {
+                if(client._processor) {
+                    ++_stats._errors;
+                    return;
+                }
+                client._processor.reset(new Processor(_subscriptionTreeManager, _sessionManager));
+                client._processor->setPacketSender(client._sender);
+                ++_connected;
+                if(_setup) {
+                    _setup(*client._processor);
+                }
+                
+                ConnectControlPacket::Ptr connect = std::make_unique<ConnectControlPacket>();
+                connect->_protocolLevel = 0x04;
+                connect->_cleanSession = script._cleanSession;
+                connect->_willFlag = false;
+                connect->_willQoSLevel = QoSLevel::AtMostOnce;
+                connect->_willRetain = false;
+                connect->_passwordFlag = false;
+                connect->_userNameFlag = false;
+                connect->_keepAlive = 0;
+                connect->_clientId = "sim-" + std::to_string(indexOf(client));
+                process(client, std::move(connect), _stats._connects);
+            }
+            
+            void subscribe(Client& client, const ClientStep& current)
+            {
+                SubscribeControlPacket::Ptr subscribe = std::make_unique<SubscribeControlPacket>();
+                subscribe->_packetIdentifier = nextPacketIdentifier(client);
+                subscribe->_topicFilters.push_back(TopicFilter(topic(client, current), current._qos));
+                process(client, std::move(subscribe), _stats._subscribes);
+            }
+            
+            void publish(Client& client, const ClientScript& script, const ClientStep& current)
+            {
+                PublishControlPacket::Ptr pub = std::make_unique<PublishControlPacket>();
+                pub->_topicName = topic(client, current);
+                pub->setQoS(current._qos);
+                if(current._qos != QoSLevel::AtMostOnce) {
+                    pub->_packetIdentifier = nextPacketIdentifier(client);
+                }
+                pub->_payload.assign(script._payloadSize, 'x');
+                process(client, std::move(pub), _stats._publishes);
+            }
+            
+            void disconnect(Client& client)
+            {
+                if(!client._processor) {
+                    ++_stats._errors;
+                    return;
+                }
+                auto start = std::chrono::steady_clock::now();
+                std::error_code ec;
+                client._processor->processPacket(std::make_unique<DisconnectControlPacket>(), ec);
+                close(client);
+                measure(_stats._disconnects, start);
+            }
+            
+            /// Hands a packet of the client to its processor and queues the client's answer to the broker's response.
+            /// Returns false and closes the client if the processor failed.
+            bool process(Client& client, ControlPacket::Ptr packet, SimulationStats::Operation& operation)
+            {
+                if(!client._processor) {
+                    ++_stats._errors;
+                    return false;
+                }
+                auto start = std::chrono::steady_clock::now();
+                std::error_code ec;
+                auto result = client._processor->processPacket(std::move(packet), ec);
+                measure(operation, start);
+                if(ec || std::get<0>(result) == ConnectionState::Close) {
+                    ++_stats._errors;
+                    close(client);
+                    return false;
+                }
+                if(std::get<1>(result)) {
+                    received(client, std::move(std::get<1>(result)));
+                }
+                return true;
+            }
+            
+            /// A packet the broker sent to the client. This may be called while a session delivers, so the answer is
+            /// only queued and processed as a later event.
+            void received(Client& client, ControlPacket::Ptr packet)
+            {
+                ControlPacket::Ptr answer;
+                switch(packet->_header._controlPacketType) {
+                    case ControlPacketType::Connack:
+                        ++_stats._connacks;
+                        break;
+                    case ControlPacketType::Suback:
+                        ++_stats._subacks;
+                        break;
+                    case ControlPacketType::Publish: {
+                        ++_stats._deliveries;
+                        const PublishControlPacket& pub = static_cast<const PublishControlPacket&>(*packet);
+                        if(pub.qos() == QoSLevel::AtLeastOnce) {
+                            answer = std::make_unique<PubAckControlPacket>(pub._packetIdentifier);
+                        } else if(pub.qos() == QoSLevel::ExactlyOnce) {
+                            answer = std::make_unique<PubRecControlPacket>(pub._packetIdentifier);
+                        }
+                        break;
+                    }
+                    case ControlPacketType::Pubrec:
+                        answer = std::make_unique<PubRelControlPacket>(
+                            static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier);
+                        break;
+                    case ControlPacketType::Pubrel:
+                        answer = std::make_unique<PubCompControlPacket>(
+                            static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier);
+                        break;
+                    default:
+                        break;
+                }
+                if(!answer) {
+                    return;
+                }
+                client._responses.push_back(std::move(answer));
+                if(!client._responding) {
+                    client._responding = true;
+                    schedule(_clock.now() + _scripts[client._script]._acknowledgeDelay, indexOf(client), EventType::Respond);
+                }
+            }
+            
+            void respond(Client& client)
+            {
+                client._responding = false;
+                std::vector<ControlPacket::Ptr> responses;
+                responses.swap(client._responses);
+                for(auto& response : responses) {
+                    if(!process(client, std::move(response), _stats._acknowledgements)) {
+                        break;
+                    }
+                }
+            }
+            
+            void close(Client& client)
+            {
+                if(client._processor) {
+                    client._processor.reset();
+                    client._responses.clear();
+                    --_connected;
+                }
+            }
+            
+            std::string topic(const Client& client, const ClientStep& current) const
+            {
+                std::string topic = current._topic;
+                auto pos = topic.find("%i");
+                if(pos != std::string::npos) {
+                    topic.replace(pos, 2, std::to_string(client._index));
+                }
+                return topic;
+            }
+            
+            PacketIdentifier nextPacketIdentifier(Client& client)
+            {
+                if(++client._packetIdentifier == 0) {
+                    client._packetIdentifier = 1;
+                }
+                return client._packetIdentifier;
+            }
+            
+            void measure(SimulationStats::Operation& operation, std::chrono::steady_clock::time_point start)
+            {
+                ++operation._count;
+                operation._nanoseconds += static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+            
+            SubscriptionTreeManager& _subscriptionTreeManager;
+            SessionManager& _sessionManager;
+            std::function<void(Processor&)> _setup;
+            std::vector<ClientScript> _scripts;
+            std::vector<Client> _clients;
+            std::priority_queue<Event, std::vector<Event>, std::greater<Event>> _events;
+            VirtualClock _clock;
+            SimulationStats _stats;
+            uint64_t _sequence = 0;
+            size_t _connected = 0;
+        };
+        
+    }
+}
+
+#endif
@@ -57,8 +57,16 @@ namespace acatl
 
             StringParser()
             : _status(Status::Start)
+            , _maxLength(0)
             {}
             
+            /// Strings longer than maxLength are rejected with topic_too_long before their data is read. 0 accepts
+            /// every length. Survives reset.
+            void setMaxLength(uint16_t maxLength)
+            {
+                _maxLength = maxLength;
+            }
+            
             void reset()
             {
                 _status = Status::Start;
@@ -76,7 +84,11 @@ namespace acatl
                         break;
                     case Status::ReadLength:
                         _length |= static_cast<uint32_t>(byte);
-                        if(_length == 0) {
+                        if(_maxLength != 0 && _length > _maxLength) {
+                            ec = mqtt_error::topic_too_long;
+                            _status = Status::Ready;
+                            return acatl::Tribool(false);
+                        } else if(_length == 0) {
                             _status = Status::Ready;
                             return acatl::Tribool(true);
                         } else {
@@ -104,6 +116,7 @@ namespace acatl
         private:
             Status _status;
             uint32_t _length;
+            uint16_t _maxLength;
             std::stringstream _ss;
         };
         
@@ -36,6 +36,7 @@
 
 #include <acatl_mqtt/mqtt_control_packets.h>
 #include <acatl_mqtt/mqtt_packet_identifier_parser.h>
+#include <acatl_mqtt/mqtt_properties.h>
 
 #include <acatl/tribool.h>
 
@@ -51,6 +52,7 @@ namespace acatl
             enum class Status
             {
                 PacketIdentifier,
+                Properties,
                 QoS,
                 Ready
             };
@@ -58,14 +60,24 @@ namespace acatl
             SubAckParser(uint32_t length)
             : _status(Status::PacketIdentifier)
             , _length(length)
+            , _protocolLevel(protocolLevel311)
             {}
             
+            /// An MQTT 5.0 SUBACK carries properties and reason codes, failures are reported as QoSLevel::Error.
+            /// Survives reset.
+            void setProtocolLevel(uint8_t protocolLevel)
+            {
+                _protocolLevel = protocolLevel;
+            }
+            
             void reset(uint32_t length)
             {
                 _ret = acatl::Tribool();
                 _status = Status::PacketIdentifier;
                 _length = length;
                 _identifierParser.reset();
+                _packet._qosLevels.clear();
+                _packet._properties = acatl::mqtt::Properties();
             }
             
             acatl::Tribool parse(uint8_t byte, std::error_code& ec)
@@ -85,7 +97,10 @@ namespace acatl
                             _ret.set(false);
                         } else if(ret.isTrue()){
                             _packet._packetIdentifier = _identifierParser.packetIdentifier();
-                            if(_length) {
+                            if(_length && _protocolLevel == protocolLevel5) {
+                                _propertiesParser.reset();
+                                _status = Status::Properties;
+                            } else if(_length) {
                                 _status = Status::QoS;
                             } else {
                                 _status = Status::Ready;
@@ -94,8 +109,30 @@ namespace acatl
                         }
                         break;
                     }
+                    case Status::Properties: {
+                        acatl::Tribool ret = _propertiesParser.parse(byte, ec);
+                        if(ret.isFalse()) {
+                            _status = Status::Ready;
+                            _ret.set(false);
+                        } else if(ret.isTrue() && _length == 0) {
+                            // at least one reason code has to follow
+                            ec = mqtt_error::control_packet_length;
+                            _status = Status::Ready;
+                            _ret.set(false);
+                        } else if(ret.isTrue()) {
+                            _packet._properties = _propertiesParser.properties();
+                            _status = Status::QoS;
+                        }
+                        break;
+                    }
                     case Status::QoS:
-                        if(byte > 0x02) {
+                        if(_protocolLevel == protocolLevel5 && byte >= 0x80) {
+                            _packet._qosLevels.push_back(QoSLevel::Error);
+                            if(_length == 0) {
+                                _status = Status::Ready;
+                                _ret.set(true);
+                            }
+                        } else if(byte > 0x02) {
                             _status = Status::Ready;
                             ec = mqtt_error::invalid_qos_level;
                             _ret.set(false);
@@ -129,7 +166,9 @@ namespace acatl
             SubAckControlPacket _packet;
             acatl::Tribool _ret;
             uint32_t _length;
+            uint8_t _protocolLevel;
             PacketIdentifierParser _identifierParser;
+            PropertiesParser _propertiesParser;
         };
         
     }
@@ -36,6 +36,7 @@
 
 #include <acatl_mqtt/mqtt_control_packets.h>
 #include <acatl_mqtt/mqtt_packet_identifier_parser.h>
+#include <acatl_mqtt/mqtt_properties.h>
 #include <acatl_mqtt/mqtt_string_parser.h>
 
 #include <acatl/tribool.h>
@@ -52,6 +53,7 @@ namespace acatl
             enum class Status
             {
                 PacketIdentifier,
+                Properties,
                 TopicFilter,
                 QoS,
                 Ready
@@ -61,8 +63,25 @@ namespace acatl
             : _status(Status::PacketIdentifier)
             , _length(length)
             , _topicFilter("")
+            , _maxSubscriptions(0)
+            , _protocolLevel(protocolLevel311)
             {}
             
+            /// MQTT 5.0 subscribes carry properties and subscription options next to the QoS. The options are
+            /// accepted but not applied. Survives reset.
+            void setProtocolLevel(uint8_t protocolLevel)
+            {
+                _protocolLevel = protocolLevel;
+            }
+            
+            /// Rejects topic filters longer than maxTopicLength and packets with more than maxSubscriptions filters,
+            /// 0 disables the respective limit.
+            void setLimits(uint16_t maxTopicLength, size_t maxSubscriptions)
+            {
+                _stringParser.setMaxLength(maxTopicLength);
+                _maxSubscriptions = maxSubscriptions;
+            }
+            
             void reset(uint32_t length)
             {
                 _ret = acatl::Tribool();
@@ -70,6 +89,8 @@ namespace acatl
                 _length = length;
                 _identifierParser.reset();
                 _stringParser.reset();
+                _packet._topicFilters.clear();
+                _packet._properties = acatl::mqtt::Properties();
             }
             
             acatl::Tribool parse(uint8_t byte, std::error_code& ec)
@@ -89,11 +110,32 @@ namespace acatl
                             _ret.set(false);
                         } else if(ret.isTrue()){
                             _packet._packetIdentifier = _identifierParser.packetIdentifier();
-                            _status = Status::TopicFilter;
+                            if(_protocolLevel == protocolLevel5) {
+                                _propertiesParser.reset();
+                                _status = Status::Properties;
+                            } else {
+                                _status = Status::TopicFilter;
+                            }
                             _stringParser.reset();
                         }
                         break;
                     }
+                    case Status::Properties: {
+                        acatl::Tribool ret = _propertiesParser.parse(byte, ec);
+                        if(ret.isFalse()) {
+                            _status = Status::Ready;
+                            _ret.set(false);
+                        } else if(ret.isTrue() && _length == 0) {
+                            // at least one topic filter has to follow
+                            ec = mqtt_error::subscribe_protocol_violation;
+                            _status = Status::Ready;
+                            _ret.set(false);
+                        } else if(ret.isTrue()) {
+                            _packet._properties = _propertiesParser.properties();
+                            _status = Status::TopicFilter;
+                        }
+                        break;
+                    }
                     case Status::TopicFilter:{
                         acatl::Tribool ret = _stringParser.parse(byte, ec);
                         if(ret.isFalse() || ec) {
@@ -107,9 +149,9 @@ namespace acatl
                         break;
                     }
                     case Status::QoS:
-                        if(byte & 0xFC || (byte & 0x03) > 2) {
-                            // bits from 2 to 7 have to be set to 0
-                            // and the qos has to be in the range [0..2]
+                        if(byte & reservedOptions() || (byte & 0x03) > 2 || (byte & 0x30) == 0x30) {
+                            // bits from 2 to 7 have to be set to 0, MQTT 5.0 only reserves the bits 6 and 7,
+                            // the qos has to be in the range [0..2] and the retain handling in the range [0..2]
                             ec = mqtt_error::invalid_qos_level;
                             _status = Status::Ready;
                             _ret.set(false);
@@ -119,14 +161,17 @@ namespace acatl
                                 ec = mqtt_error::invalid_topic_filter;
                                 _status = Status::Ready;
                                 _ret.set(false);
+                            } else if(_maxSubscriptions != 0 && _packet._topicFilters.size() >= _maxSubscriptions) {
+                                ec = mqtt_error::too_many_subscriptions;
+                                _status = Status::Ready;
+                                _ret.set(false);
                             } else {
                                 _packet._topicFilters.push_back(_topicFilter);
                                 if(_length > 0) {
                                     _status = Status::TopicFilter;
                                 } else {
-                                    // remove duplicate topics
-                                    std::sort(_packet._topicFilters.begin(), _packet._topicFilters.end());
-                                    _packet._topicFilters.erase(std::unique(_packet._topicFilters.begin(), _packet._topicFilters.end()), _packet._topicFilters.end());
+                                    // remove duplicate topics, the SUBACK has to keep the order of the request
+                                    _packet._topicFilters = TopicFilterHelper::findDifference(_packet._topicFilters, TopicFilters());
                                     _status = Status::Ready;
                                     _ret.set(true);
                                 }
@@ -152,6 +197,11 @@ namespace acatl
             }
             
         private:
+            uint8_t reservedOptions() const
+            {
+                return _protocolLevel == protocolLevel5 ? 0xC0 : 0xFC;
+            }
+            
             Status _status;
             SubscribeControlPacket _packet;
             acatl::Tribool _ret;
@@ -159,6 +209,9 @@ namespace acatl
             PacketIdentifierParser _identifierParser;
             StringParser _stringParser;
             TopicFilter _topicFilter;
+            size_t _maxSubscriptions;
+            uint8_t _protocolLevel;
+            PropertiesParser _propertiesParser;
         };
         
     }
@@ -0,0 +1,225 @@
+//
+//  mqtt_subscription_index.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_subscription_index_h
+#define acatl_mqtt_subscription_index_h
+
+#include <acatl_mqtt/mqtt_topic.h>
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// The subscriptions of one session, keyed by filter, each with its maximum QoS. The filters are kept in one
+        /// dense vector and found through an open addressing table of 8 byte slots, so adding, replacing and removing
+        /// a filter take constant time, also for gateways subscribing to tens of thousands of filters.
+        class SubscriptionIndex
+        {
+        public:
+            SubscriptionIndex() = default;
+            
+            /// Subscribes the filter or replaces the QoS of its existing subscription. Returns false if the filter is
+            /// already subscribed with this QoS.
+            bool add(const TopicFilter& filter)
+            {
+                uint32_t hash = hashOf(filter._filter);
+                size_t slot = findSlot(filter._filter, hash);
+                if(slot != notFound()) {
+                    TopicFilter& existing = _filters[_slots[slot]._index];
+                    if(existing._qos == filter._qos) {
+                        return false;
+                    }
+                    existing._qos = filter._qos;
+                    return true;
+                }
+                
+                if((_filters.size() + 1) * 4 > _slots.size() * 3) {
+                    grow();
+                }
+                _filters.push_back(filter);
+                insertSlot(static_cast<uint32_t>(_filters.size() - 1), hash);
+                return true;
+            }
+            
+            /// Returns false if the filter was not subscribed.
+            bool remove(const std::string& filter)
+            {
+                size_t slot = findSlot(filter, hashOf(filter));
+                if(slot == notFound()) {
+                    return false;
+                }
+                uint32_t index = _slots[slot]._index;
+                eraseSlot(slot);
+                
+                // the last filter takes the place of the removed one
+                uint32_t last = static_cast<uint32_t>(_filters.size() - 1);
+                if(index != last) {
+                    size_t lastSlot = findSlot(_filters[last]._filter, hashOf(_filters[last]._filter));
+                    _slots[lastSlot]._index = index;
+                    _filters[index] = std::move(_filters[last]);
+                }
+                _filters.pop_back();
+                return true;
+            }
+            
+            /// The subscription of the filter, nullptr if it is not subscribed.
+            const TopicFilter* find(const std::string& filter) const
+            {
+                size_t slot = findSlot(filter, hashOf(filter));
+                return slot == notFound() ? nullptr : &_filters[_slots[slot]._index];
+            }
+            
+            /// Replaces all subscriptions, a filter given twice keeps the QoS it was given last.
+            void assign(const TopicFilters& filters)
+            {
+                clear();
+                for(const auto& filter : filters) {
+                    add(filter);
+                }
+            }
+            
+            void clear()
+            {
+                _filters.clear();
+                _slots.clear();
+            }
+            
+            /// All subscriptions, in the order they were added as long as none was removed.
+            const TopicFilters& filters() const
+            {
+                return _filters;
+            }
+            
+            size_t size() const
+            {
+                return _filters.size();
+            }
+            
+            bool empty() const
+            {
+                return _filters.empty();
+            }
+            
+        private:
+            struct Slot
+            {
+                uint32_t _index;
+                uint32_t _hash;
+            };
+            
+            static uint32_t emptySlot()
+            {
+                return std::numeric_limits<uint32_t>::max();
+            }
+            
+            static size_t notFound()
+            {
+                return std::numeric_limits<size_t>::max();
+            }
+            
+            static uint32_t hashOf(const std::string& filter)
+            {
+                return static_cast<uint32_t>(std::hash<std::string>()(filter));
+            }
+            
+            size_t mask() const
+            {
+                return _slots.size() - 1;
+            }
+            
+            size_t findSlot(const std::string& filter, uint32_t hash) const
+            {
+                if(_slots.empty()) {
+                    return notFound();
+                }
+                for(size_t slot = hash & mask(); _slots[slot]._index != emptySlot(); slot = (slot + 1) & mask()) {
+                    if(_slots[slot]._hash == hash && _filters[_slots[slot]._index]._filter == filter) {
+                        return slot;
+                    }
+                }
+                return notFound();
+            }
+            
+            void insertSlot(uint32_t index, uint32_t hash)
+            {
+                size_t slot = hash & mask();
+                while(_slots[slot]._index != emptySlot()) {
+                    slot = (slot + 1) & mask();
+                }
+                _slots[slot] = Slot{index, hash};
+            }
+            
+            /// Shifts the following slots of the probe sequence back, so that lookups need no tombstones.
+            void eraseSlot(size_t slot)
+            {
+                size_t next = (slot + 1) & mask();
+                while(_slots[next]._index != emptySlot()) {
+                    size_t home = _slots[next]._hash & mask();
+                    // the entry may move to the free slot unless its home lies cyclically in (slot, next]
+                    if(((next - home) & mask()) >= ((next - slot) & mask())) {
+                        _slots[slot] = _slots[next];
+                        slot = next;
+                    }
+                    next = (next + 1) & mask();
+                }
+                _slots[slot]._index = emptySlot();
+            }
+            
+            void grow()
+            {
+                std::vector<Slot> slots;
+                slots.swap(_slots);
+                _slots.assign(slots.empty() ? 8 : slots.size() * 2, Slot{emptySlot(), 0});
+                for(const auto& slot : slots) {
+                    if(slot._index != emptySlot()) {
+                        insertSlot(slot._index, slot._hash);
+                    }
+                }
+            }
+            
+            TopicFilters _filters;
+            std::vector<Slot> _slots;
+        };
+        
+    }
+}
+
+#endif
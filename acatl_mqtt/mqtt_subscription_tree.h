@@ -37,8 +37,11 @@
 #include <acatl_mqtt/mqtt_session.h>
 #include <acatl_mqtt/mqtt_topic.h>
 
-#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <map>
 #include <set>
+#include <unordered_map>
 
 
 namespace acatl
@@ -46,7 +49,22 @@ namespace acatl
     namespace mqtt
     {
 
-        typedef std::set<Session::Ptr> Sessions;
+        /// The subscribed sessions with the QoS level they were granted. A session matching through several filters
+        /// gets the highest of their QoS levels.
+        typedef std::map<Session::Ptr, QoSLevel> Sessions;
+        
+        inline void mergeSessions(Sessions& sessions, const Sessions& matches)
+        {
+            for(const auto& match : matches) {
+                auto result = sessions.emplace(match);
+                if(!result.second) {
+                    result.first->second = std::max(result.first->second, match.second);
+                }
+            }
+        }
+        
+        /// Selects the sessions whose subscriptions are summarized.
+        typedef std::function<bool(const Session&)> SessionPredicate;
         
         class SubscriptionNodeBase
         {
@@ -54,6 +72,7 @@ namespace acatl
             virtual ~SubscriptionNodeBase() {}
             
             typedef std::unique_ptr<SubscriptionNodeBase> Ptr;
+            typedef std::function<void(const std::string&, const SubscriptionNodeBase&)> ChildVisitor;
             
             bool match(TopicHierarchyIterator cur, const TopicHierarchyIterator& end, Sessions& sessions, std::error_code& ec) const
             {
@@ -61,22 +80,53 @@ namespace acatl
                 if(cur != end) {
                     result = doMatch(cur, end, sessions, ec);
                 } else {
-                    sessions.insert(std::begin(_sessions), std::end(_sessions));
+                    mergeSessions(sessions, _sessions);
                 }
                 return result;
             }
             
-            bool addFilter(TopicHierarchyIterator cur, const TopicHierarchyIterator& end, Session::Ptr session, std::error_code& ec)
+            bool addFilter(TopicHierarchyIterator cur,
+                           const TopicHierarchyIterator& end,
+                           Session::Ptr session,
+                           QoSLevel qos,
+                           std::error_code& ec)
             {
                 bool result = true;
                 if(cur != end) {
-                    result = doAddFilter(cur, end, session, ec);
+                    result = doAddFilter(cur, end, session, qos, ec);
                 } else {
-                    _sessions.emplace(session);
+                    // subscribing to the same filter again replaces the QoS level
+                    _sessions[session] = qos;
                 }
                 return result;
             }
             
+            /// Adds the filters below this node, which is reached through path, that have a session accepted by
+            /// include. After depth further levels the filters are cut to their prefix followed by '#', a depth of 0
+            /// keeps them whole.
+            void summarize(const std::string& path,
+                           size_t depth,
+                           const SessionPredicate& include,
+                           std::set<std::string>& filters) const
+            {
+                if(subscribed(include)) {
+                    filters.insert(path);
+                }
+                forEachChild([&path, depth, &include, &filters](const std::string& level, const SubscriptionNodeBase& child) {
+                    std::string childPath = path.empty() ? level : path + "/" + level;
+                    if(depth != 1 || level == "#") {
+                        child.summarize(childPath, depth == 0 ? 0 : depth - 1, include, filters);
+                        return;
+                    }
+                    if(child.subscribed(include)) {
+                        filters.insert(childPath);
+                    }
+                    if(child.subscribedBelow(include)) {
+                        filters.insert(childPath + "/#");
+                    }
+                });
+            }
+            
             virtual void dump(std::ostream& stream, size_t indent) const = 0;
             
             virtual SubscriptionNodeBase::Ptr clone() const = 0;
@@ -86,8 +136,32 @@ namespace acatl
             Sessions _sessions;
             
         private:
+            bool subscribed(const SessionPredicate& include) const
+            {
+                return std::any_of(_sessions.begin(), _sessions.end(), [&include](const Sessions::value_type& session) {
+                    return include(*session.first);
+                });
+            }
+            
+            bool subscribedBelow(const SessionPredicate& include) const
+            {
+                bool found = false;
+                forEachChild([&include, &found](const std::string& /*level*/, const SubscriptionNodeBase& child) {
+                    found = found || child.subscribed(include) || child.subscribedBelow(include);
+                });
+                return found;
+            }
+            
+            virtual void forEachChild(const ChildVisitor& visitor) const
+            {
+            }
+            
             virtual bool doMatch(TopicHierarchyIterator cur, const TopicHierarchyIterator& end, Sessions& sessions, std::error_code& ec) const = 0;
-            virtual bool doAddFilter(TopicHierarchyIterator cur, const TopicHierarchyIterator& end, Session::Ptr session, std::error_code& ec) = 0;
+            virtual bool doAddFilter(TopicHierarchyIterator cur,
+                                     const TopicHierarchyIterator& end,
+                                     Session::Ptr session,
+                                     QoSLevel qos,
+                                     std::error_code& ec) = 0;
         };
         
         
@@ -107,7 +181,6 @@ namespace acatl
             
             std::unordered_map<std::string, SubscriptionNodeBase::Ptr> _nodes;
             
-        private:
             bool doMatch(TopicHierarchyIterator cur, const TopicHierarchyIterator& end, Sessions& sessions, std::error_code& ec) const override
             {
                 bool result = false;
@@ -128,20 +201,32 @@ namespace acatl
                 
                 return result;
             }
+            
+            void forEachChild(const ChildVisitor& visitor) const override
+            {
+                for(const auto& node : _nodes) {
+                    visitor(node.first, *node.second);
+                }
+            }
 
-            bool doAddFilter(TopicHierarchyIterator cur, const TopicHierarchyIterator& end, Session::Ptr session, std::error_code& ec) override
+        private:
+            bool doAddFilter(TopicHierarchyIterator cur,
+                             const TopicHierarchyIterator& end,
+                             Session::Ptr session,
+                             QoSLevel qos,
+                             std::error_code& ec) override
             {
                 bool ret = true;
                 
                 if(*cur == "#") {
                     auto result = _nodes.emplace(*cur, NodeCreator<SubscriptionNodeBase>::createMulitLevelWildCardNode(cur));
-                    ret = result.first->second->addFilter(++cur, end, session, ec);
+                    ret = result.first->second->addFilter(++cur, end, session, qos, ec);
                 } else if(*cur == "+") {
                     auto result = _nodes.emplace(*cur, NodeCreator<SubscriptionNodeBase>::createSingleLevelWildCardNode(cur));
-                    ret = result.first->second->addFilter(++cur, end, session, ec);
+                    ret = result.first->second->addFilter(++cur, end, session, qos, ec);
                 } else {
                     auto result = _nodes.emplace(*cur, NodeCreator<SubscriptionNodeBase>::createTopicNode(cur));
-                    ret = result.first->second->addFilter(++cur, end, session, ec);
+                    ret = result.first->second->addFilter(++cur, end, session, qos, ec);
                 }
                 
                 return ret;
@@ -164,6 +249,18 @@ namespace acatl
             }
             
         private:
+            /// Topics starting with '$' are reserved for the broker, wildcards on the first level do not match them.
+            bool doMatch(TopicHierarchyIterator cur, const TopicHierarchyIterator& end, Sessions& sessions, std::error_code& ec) const override
+            {
+                const std::string& level = *cur;
+                if(level.empty() || level[0] != '$') {
+                    return IntermediateSubscriptionNode::doMatch(cur, end, sessions, ec);
+                }
+                auto it = _nodes.find(level);
+                ++cur;
+                return it != _nodes.end() && it->second->match(cur, end, sessions, ec);
+            }
+            
             void dump(std::ostream& stream, size_t indent) const override
             {
                 for(const auto& node : _nodes) {
@@ -187,9 +284,7 @@ namespace acatl
                 for(const auto& node : _nodes) {
                     topicNode->_nodes.emplace(node.first, node.second->clone());
                 }
-                for(const auto& session : _sessions) {
-                    topicNode->_sessions.emplace(session);
-                }
+                topicNode->_sessions = _sessions;
                 
                 return std::move(topicNode);
             }
@@ -201,7 +296,7 @@ namespace acatl
                 if(!_sessions.empty()) {
                     stream << " -> ";
                     for(const auto& session : _sessions) {
-                        stream << session->clientId() << ",";
+                        stream << session.first->clientId() << ",";
                     }
                 }
                 stream << "\n";
@@ -221,9 +316,7 @@ namespace acatl
             SubscriptionNodeBase::Ptr clone() const override
             {
                 std::unique_ptr<MultiLevelWildCardSubscriptionNode> multiNode(new MultiLevelWildCardSubscriptionNode);
-                for(const auto& session : _sessions) {
-                    multiNode->_sessions.emplace(session);
-                }
+                multiNode->_sessions = _sessions;
 
                 return std::move(multiNode);
             }
@@ -231,11 +324,15 @@ namespace acatl
         private:
             bool doMatch(TopicHierarchyIterator cur, const TopicHierarchyIterator& end, Sessions& sessions, std::error_code& ec) const override
             {
-                sessions.insert(std::begin(_sessions), std::end(_sessions));
+                mergeSessions(sessions, _sessions);
                 return true;
             }
             
-            bool doAddFilter(TopicHierarchyIterator cur, const TopicHierarchyIterator& end, Session::Ptr session, std::error_code& ec) override
+            bool doAddFilter(TopicHierarchyIterator cur,
+                             const TopicHierarchyIterator& end,
+                             Session::Ptr session,
+                             QoSLevel qos,
+                             std::error_code& ec) override
             {
                 ec = mqtt_error::invalid_topic_filter;
                 return false;
@@ -247,7 +344,7 @@ namespace acatl
                 if(!_sessions.empty()) {
                     stream << " -> ";
                     for(const auto& session : _sessions) {
-                        stream << session->clientId() << ",";
+                        stream << session.first->clientId() << ",";
                     }
                 }
                 stream << "\n";
@@ -265,9 +362,7 @@ namespace acatl
                 for(const auto& node : _nodes) {
                     singleNode->_nodes.emplace(node.first, node.second->clone());
                 }
-                for(const auto& session : _sessions) {
-                    singleNode->_sessions.emplace(session);
-                }
+                singleNode->_sessions = _sessions;
 
                 return std::move(singleNode);
             }
@@ -279,7 +374,7 @@ namespace acatl
                 if(!_sessions.empty()) {
                     stream << " -> ";
                     for(const auto& session : _sessions) {
-                        stream << session->clientId() << ",";
+                        stream << session.first->clientId() << ",";
                     }
                 }
                 stream << "\n";
@@ -327,7 +422,14 @@ namespace acatl
             
             bool addFilter(const TopicFilter& filter, Session::Ptr session, std::error_code& ec)
             {
-                return _rootNode->addFilter(filter.begin(), filter.end(), session, ec);
+                return _rootNode->addFilter(filter.begin(), filter.end(), session, filter._qos, ec);
+            }
+            
+            /// Collects the filters subscribed by the sessions accepted by include, cut after depth levels to a
+            /// prefix followed by '#'. The result matches every topic the sessions would receive, and possibly more.
+            void summarize(size_t depth, const SessionPredicate& include, std::set<std::string>& filters) const
+            {
+                _rootNode->summarize(std::string(), depth, include, filters);
             }
             
             void dump(std::ostream& stream, size_t indent) const
@@ -0,0 +1,156 @@
+//
+//  mqtt_sys_publisher.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_sys_publisher_h
+#define acatl_mqtt_sys_publisher_h
+
+#include <acatl_mqtt/mqtt_heavy_hitters.h>
+#include <acatl_mqtt/mqtt_metrics.h>
+#include <acatl_mqtt/mqtt_processor.h>
+#include <acatl_mqtt/mqtt_send_queue.h>
+
+#include <string>
+#include <unordered_map>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// Publishes the broker metrics as retained QoS 0 messages below $SYS/broker. The messages take the same path
+        /// through a processor as publishes of clients, so subscribers, retained messages and flow control behave
+        /// alike. Only values that changed since the last call are published again.
+        class SysPublisher
+        {
+        public:
+            typedef std::shared_ptr<SysPublisher> Ptr;
+            
+            SysPublisher(Metrics::Ptr metrics, SubscriptionTreeManager& subscriptionTreeManager, SessionManager& sessionManager)
+            : _metrics(metrics)
+            , _sessionManager(sessionManager)
+            , _processor(subscriptionTreeManager, sessionManager)
+            , _sendQueueMemory(nullptr)
+            {}
+            
+            void setRetainedStore(RetainedStore::Ptr retainedStore)
+            {
+                _processor.setRetainedStore(retainedStore);
+            }
+            
+            /// Routes the publishes like those of the clients on the thread calling publish().
+            void setPublishRouter(PublishRouter::Ptr router)
+            {
+                _processor.setPublishRouter(router);
+            }
+            
+            /// The bytes pending in all send queues are published as well, if the memory accounting is given.
+            void setSendQueueMemory(const SendQueueMemory* sendQueueMemory)
+            {
+                _sendQueueMemory = sendQueueMemory;
+            }
+            
+            /// The heaviest topics and clients of each interval are published as JSON to
+            /// $SYS/broker/heavy-hitters, the detection starts a new window with every publish.
+            void setHeavyHitters(HeavyHitters::Ptr heavyHitters)
+            {
+                _heavyHitters = heavyHitters;
+            }
+            
+            /// Not synchronized, has to be called from one thread at a time.
+            /// @return The number of topics published.
+            size_t publish(std::error_code& ec)
+            {
+                Metrics::Snapshot snapshot = _metrics->snapshot();
+                auto metric = [&snapshot](Metric metric) {
+                    return snapshot[static_cast<size_t>(metric)];
+                };
+                
+                size_t published = 0;
+                published += publish("$SYS/broker/messages/received", metric(Metric::MessagesReceived), ec);
+                published += publish("$SYS/broker/messages/sent", metric(Metric::MessagesSent), ec);
+                published += publish("$SYS/broker/messages/dropped", metric(Metric::MessagesDropped), ec);
+                published += publish("$SYS/broker/bytes/received", metric(Metric::BytesReceived), ec);
+                published += publish("$SYS/broker/bytes/sent", metric(Metric::BytesSent), ec);
+                published += publish("$SYS/broker/clients/connected", metric(Metric::ClientsConnected), ec);
+                published += publish("$SYS/broker/sessions/count", static_cast<int64_t>(_sessionManager.count()), ec);
+                published += publish("$SYS/broker/subscriptions/count", metric(Metric::Subscriptions), ec);
+                published += publish("$SYS/broker/send-queue/messages", metric(Metric::QueuedMessages), ec);
+                if(_sendQueueMemory) {
+                    published += publish("$SYS/broker/send-queue/bytes", static_cast<int64_t>(_sendQueueMemory->bytes()), ec);
+                }
+                if(_heavyHitters) {
+                    HeavyHitters::Clock::time_point now = HeavyHitters::Clock::now();
+                    json report = HeavyHitters::toJson(_heavyHitters->report(now));
+                    _heavyHitters->reset(now);
+                    published += publish("$SYS/broker/heavy-hitters", report.dump(), ec);
+                }
+                return published;
+            }
+            
+        private:
+            size_t publish(const std::string& topic, int64_t value, std::error_code& ec)
+            {
+                return publish(topic, std::to_string(value), ec);
+            }
+            
+            size_t publish(const std::string& topic, const std::string& value, std::error_code& ec)
+            {
+                auto iter = _published.find(topic);
+                if(iter != _published.end() && iter->second == value) {
+                    return 0;
+                }
+                _published[topic] = value;
+                
+                PublishControlPacket pub;
+                pub._header._flags = retainFlag;
+                pub._topicName = topic;
+                pub._payload.assign(value.begin(), value.end());
+                _processor.publish(pub, ec);
+                return 1;
+            }
+            
+            static constexpr HeaderFlags retainFlag = 0x01;
+            
+            Metrics::Ptr _metrics;
+            SessionManager& _sessionManager;
+            Processor _processor;
+            const SendQueueMemory* _sendQueueMemory;
+            HeavyHitters::Ptr _heavyHitters;
+            std::unordered_map<std::string, std::string> _published;
+        };
+        
+    }
+}
+
+#endif
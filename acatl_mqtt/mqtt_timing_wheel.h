@@ -0,0 +1,305 @@
+//
+//  mqtt_timing_wheel.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_timing_wheel_h
+#define acatl_mqtt_timing_wheel_h
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// Hierarchical timing wheel with a resolution of one tick. Timers live in a slab and are linked into the
+        /// slot of their deadline, so scheduling, resetting and cancelling are O(1) and no timer needs its own
+        /// allocation or system timer. Level 0 covers the next 64 ticks, every further level 64 times the range of
+        /// the previous one. Entries of a higher level cascade down whenever the level below wraps.
+        ///
+        /// Pushing a deadline out, as a keep-alive does on every received packet, only updates the stored deadline.
+        /// The entry is moved once its old slot comes up, which keeps frequent resets free of list operations.
+        ///
+        /// The wheel is not thread safe. It is meant to be owned and advanced by exactly one thread, which is also
+        /// the only one scheduling and cancelling timers on it.
+        class TimingWheel
+        {
+        public:
+            typedef std::function<void()> Callback;
+            
+            /// Refers to a scheduled timer. A handle turns stale once its timer expired or was cancelled, any
+            /// further operation with it is ignored.
+            class Handle
+            {
+            public:
+                Handle() = default;
+                
+            private:
+                friend class TimingWheel;
+                
+                uint32_t _index{npos};
+                uint32_t _generation{0};
+            };
+            
+            static constexpr size_t slotBits = 6;
+            static constexpr size_t slotCount = size_t(1) << slotBits;
+            static constexpr size_t levelCount = 4;
+            
+            TimingWheel()
+            {
+                _heads.fill(uint32_t(npos));
+            }
+            
+            /// Schedules callback to run after the given number of ticks, at least one. An armed handle is
+            /// cancelled before.
+            void schedule(Handle& handle, uint64_t ticks, Callback callback)
+            {
+                cancel(handle);
+                
+                uint32_t index;
+                if(_free != npos) {
+                    index = _free;
+                    _free = _entries[index]._next;
+                } else {
+                    index = static_cast<uint32_t>(_entries.size());
+                    _entries.emplace_back();
+                }
+                Entry& entry = _entries[index];
+                entry._deadline = _now + std::max(ticks, uint64_t(1));
+                entry._callback = std::move(callback);
+                entry._armed = true;
+                place(index);
+                ++_size;
+                
+                handle._index = index;
+                handle._generation = entry._generation;
+            }
+            
+            /// Moves the deadline of a still armed timer to the given number of ticks from now.
+            /// @return false if the handle is stale.
+            bool reset(const Handle& handle, uint64_t ticks)
+            {
+                if(!armed(handle)) {
+                    return false;
+                }
+                Entry& entry = _entries[handle._index];
+                uint64_t deadline = _now + std::max(ticks, uint64_t(1));
+                if(deadline < entry._deadline) {
+                    // an earlier deadline could be missed in the current slot, so relink the entry
+                    unlink(handle._index);
+                    entry._deadline = deadline;
+                    place(handle._index);
+                } else {
+                    entry._deadline = deadline;
+                }
+                return true;
+            }
+            
+            /// Cancels the timer without running its callback.
+            /// @return false if the handle is stale.
+            bool cancel(Handle& handle)
+            {
+                if(!armed(handle)) {
+                    handle._index = npos;
+                    return false;
+                }
+                unlink(handle._index);
+                release(handle._index);
+                handle._index = npos;
+                return true;
+            }
+            
+            bool armed(const Handle& handle) const
+            {
+                return handle._index < _entries.size() && _entries[handle._index]._armed &&
+                       _entries[handle._index]._generation == handle._generation;
+            }
+            
+            /// Advances the wheel by the given number of ticks and runs the callbacks of all expired timers. The
+            /// callbacks may schedule and cancel timers on this wheel.
+            /// @return The number of expired timers.
+            size_t advance(uint64_t ticks)
+            {
+                size_t expired = 0;
+                for(uint64_t i = 0; i < ticks; ++i) {
+                    ++_now;
+                    for(size_t level = 1; level < levelCount; ++level) {
+                        if((_now & ((uint64_t(1) << (slotBits * level)) - 1)) != 0) {
+                            break;
+                        }
+                        cascade(level, static_cast<size_t>(_now >> (slotBits * level)) & (slotCount - 1));
+                    }
+                    expired += expire(static_cast<size_t>(_now) & (slotCount - 1));
+                }
+                return expired;
+            }
+            
+            /// @return The number of ticks the wheel has been advanced so far.
+            uint64_t now() const
+            {
+                return _now;
+            }
+            
+            /// @return The number of armed timers.
+            size_t size() const
+            {
+                return _size;
+            }
+            
+        private:
+            static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+            static constexpr size_t pending = slotCount * levelCount;
+            
+            struct Entry
+            {
+                uint64_t _deadline{0};
+                uint32_t _prev{npos};
+                uint32_t _next{npos};
+                uint32_t _generation{0};
+                uint16_t _slot{0};
+                bool _armed{false};
+                Callback _callback;
+            };
+            
+            void place(uint32_t index)
+            {
+                Entry& entry = _entries[index];
+                uint64_t deadline = std::max(entry._deadline, _now + 1);
+                uint64_t delta = deadline - _now;
+                size_t level = 0;
+                while(level < levelCount - 1 && delta >= (uint64_t(1) << (slotBits * (level + 1)))) {
+                    ++level;
+                }
+                if(delta >= (uint64_t(1) << (slotBits * levelCount))) {
+                    // beyond the range of the wheel, park in the last slot of the top level and retry from there
+                    deadline = _now + (uint64_t(1) << (slotBits * levelCount)) - 1;
+                }
+                size_t slot = level * slotCount + (static_cast<size_t>(deadline >> (slotBits * level)) & (slotCount - 1));
+                link(index, slot);
+            }
+            
+            void link(uint32_t index, size_t slot)
+            {
+                Entry& entry = _entries[index];
+                entry._slot = static_cast<uint16_t>(slot);
+                entry._prev = npos;
+                entry._next = _heads[slot];
+                if(entry._next != npos) {
+                    _entries[entry._next]._prev = index;
+                }
+                _heads[slot] = index;
+            }
+            
+            void unlink(uint32_t index)
+            {
+                Entry& entry = _entries[index];
+                if(entry._prev != npos) {
+                    _entries[entry._prev]._next = entry._next;
+                } else {
+                    _heads[entry._slot] = entry._next;
+                }
+                if(entry._next != npos) {
+                    _entries[entry._next]._prev = entry._prev;
+                }
+            }
+            
+            void release(uint32_t index)
+            {
+                Entry& entry = _entries[index];
+                entry._armed = false;
+                entry._callback = nullptr;
+                ++entry._generation;
+                entry._next = _free;
+                _free = index;
+                --_size;
+            }
+            
+            /// Moves the slot to the pending list, so callbacks can safely cancel any entry while it is processed.
+            void detach(size_t slot)
+            {
+                _heads[pending] = _heads[slot];
+                _heads[slot] = npos;
+                for(uint32_t index = _heads[pending]; index != npos; index = _entries[index]._next) {
+                    _entries[index]._slot = static_cast<uint16_t>(pending);
+                }
+            }
+            
+            void cascade(size_t level, size_t slot)
+            {
+                detach(level * slotCount + slot);
+                while(_heads[pending] != npos) {
+                    uint32_t index = _heads[pending];
+                    unlink(index);
+                    place(index);
+                }
+            }
+            
+            size_t expire(size_t slot)
+            {
+                size_t expired = 0;
+                detach(slot);
+                while(_heads[pending] != npos) {
+                    uint32_t index = _heads[pending];
+                    unlink(index);
+                    if(_entries[index]._deadline > _now) {
+                        // the deadline was pushed out since the entry was placed
+                        place(index);
+                        continue;
+                    }
+                    Callback callback = std::move(_entries[index]._callback);
+                    release(index);
+                    ++expired;
+                    if(callback) {
+                        callback();
+                    }
+                }
+                return expired;
+            }
+            
+            std::vector<Entry> _entries;
+            std::array<uint32_t, slotCount * levelCount + 1> _heads;
+            uint32_t _free{npos};
+            uint64_t _now{0};
+            size_t _size{0};
+        };
+        
+    }
+}
+
+#endif
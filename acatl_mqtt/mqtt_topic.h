@@ -36,6 +36,9 @@
 
 #include <acatl_mqtt/mqtt_types.h>
 
+#include <functional>
+#include <unordered_set>
+
 
 namespace acatl
 {
@@ -206,7 +209,7 @@ namespace acatl
             
             bool operator<(const TopicFilter& rhs) const
             {
-                return _filter < rhs._filter || _qos < rhs._qos;
+                return _filter < rhs._filter || (_filter == rhs._filter && _qos < rhs._qos);
             }
             
             bool validate(std::error_code& ec)
@@ -255,15 +258,28 @@ namespace acatl
         
         typedef std::vector<TopicFilter> TopicFilters;
         
+        struct TopicFilterHash
+        {
+            size_t operator()(const TopicFilter& filter) const
+            {
+                return std::hash<std::string>()(filter._filter) ^ static_cast<size_t>(filter._qos);
+            }
+        };
+        
         
         struct TopicFilterHelper
         {
+            /// The filters to add that are not current, with the same QoS, in the order they are given. Neither
+            /// list has to be sorted.
             static TopicFilters findDifference(const TopicFilters& filtersToAdd, const TopicFilters& currentFilters)
             {
+                std::unordered_set<TopicFilter, TopicFilterHash> seen(currentFilters.begin(), currentFilters.end());
                 TopicFilters result;
-                
-                std::set_difference(filtersToAdd.begin(), filtersToAdd.end(), currentFilters.begin(), currentFilters.end(), std::inserter(result, result.begin()));
-                result.shrink_to_fit();
+                for(const auto& filter : filtersToAdd) {
+                    if(seen.insert(filter).second) {
+                        result.push_back(filter);
+                    }
+                }
                 return result;
             }
         };
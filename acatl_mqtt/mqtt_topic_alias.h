@@ -0,0 +1,154 @@
+//
+//  mqtt_topic_alias.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_topic_alias_h
+#define acatl_mqtt_topic_alias_h
+
+#include <acatl_mqtt/mqtt_error.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        /// The topic aliases a client established for the PUBLISH packets it sends on one network connection.
+        class InboundTopicAliases
+        {
+        public:
+            InboundTopicAliases()
+            : _maximum(0)
+            {}
+            
+            /// The highest alias the client may use, as announced in CONNACK. 0 rejects every alias.
+            void setMaximum(uint16_t maximum)
+            {
+                _maximum = maximum;
+                _topics.clear();
+            }
+            
+            uint16_t maximum() const
+            {
+                return _maximum;
+            }
+            
+            /// A topic sent together with an alias (re)defines the alias, an empty topic is replaced by the topic the
+            /// alias stands for.
+            bool resolve(std::string& topic, uint16_t alias, std::error_code& ec)
+            {
+                if(alias == 0) {
+                    if(topic.empty()) {
+                        ec = mqtt_error::invalid_topic_alias;
+                        return false;
+                    }
+                    return true;
+                }
+                if(alias > _maximum) {
+                    ec = mqtt_error::invalid_topic_alias;
+                    return false;
+                }
+                // the table grows with the aliases in use, a client rarely uses all it may
+                if(_topics.size() < alias) {
+                    _topics.resize(alias);
+                }
+                if(topic.empty()) {
+                    if(_topics[alias - 1].empty()) {
+                        ec = mqtt_error::invalid_topic_alias;
+                        return false;
+                    }
+                    topic = _topics[alias - 1];
+                } else {
+                    _topics[alias - 1] = topic;
+                }
+                return true;
+            }
+            
+        private:
+            uint16_t _maximum;
+            std::vector<std::string> _topics;
+        };
+        
+        
+        /// The topic aliases used for the PUBLISH packets sent to a client on one network connection. Topics get an
+        /// alias on first use until the client's maximum is reached, later topics are sent without an alias. Replacing
+        /// aliases would make a device fleet larger than the maximum send topic and alias on every publish.
+        class OutboundTopicAliases
+        {
+        public:
+            OutboundTopicAliases()
+            : _maximum(0)
+            {}
+            
+            /// The Topic Alias Maximum of the client's CONNECT. 0 disables aliases.
+            void setMaximum(uint16_t maximum)
+            {
+                _maximum = maximum;
+                _aliases.clear();
+            }
+            
+            uint16_t maximum() const
+            {
+                return _maximum;
+            }
+            
+            /// @return The alias for topic, 0 if the topic has none, and whether the topic has to be sent along.
+            std::pair<uint16_t, bool> assign(const std::string& topic)
+            {
+                if(_maximum == 0) {
+                    return std::make_pair(uint16_t(0), true);
+                }
+                auto iter = _aliases.find(topic);
+                if(iter != _aliases.end()) {
+                    return std::make_pair(iter->second, false);
+                }
+                if(_aliases.size() >= _maximum) {
+                    return std::make_pair(uint16_t(0), true);
+                }
+                uint16_t alias = static_cast<uint16_t>(_aliases.size() + 1);
+                _aliases.emplace(topic, alias);
+                return std::make_pair(alias, true);
+            }
+            
+        private:
+            uint16_t _maximum;
+            std::unordered_map<std::string, uint16_t> _aliases;
+        };
+        
+    }
+}
+
+#endif
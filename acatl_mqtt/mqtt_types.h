@@ -129,6 +129,11 @@ namespace acatl
         }
         
         
+        /// Protocol levels of the CONNECT variable header.
+        constexpr uint8_t protocolLevel311 = 0x04;
+        constexpr uint8_t protocolLevel5 = 0x05;
+        
+        
         enum class ConnectAcknowledgeFlags
         {
             None = 0x00,
@@ -81,6 +81,16 @@ namespace acatl
         class RunlengthEncoder
         {
         public:
+            /// @return The number of bytes encode() writes for value.
+            static size_t encodedSize(uint32_t value)
+            {
+                size_t size = 1;
+                for(uint32_t rest = value >> 7; rest != 0; rest >>= 7) {
+                    ++size;
+                }
+                return size;
+            }
+            
             void encode(uint32_t value, std::vector<uint8_t>& buffer, size_t& index)
             {
                 uint8_t encodedByte = 0;
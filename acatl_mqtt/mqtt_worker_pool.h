@@ -0,0 +1,163 @@
+//
+//  mqtt_worker_pool.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_worker_pool_h
+#define acatl_mqtt_worker_pool_h
+
+#include <acatl/thread_pool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+
+namespace acatl
+{
+    namespace mqtt
+    {
+        
+        struct WorkerOptions
+        {
+            /// Number of worker threads, 0 starts one per hardware thread.
+            size_t _threads = 0;
+            /// Fan-outs to more sessions are split into chunks of this many sessions, delivered in parallel.
+            size_t _fanOutChunk = 256;
+        };
+        
+        
+        /// The threads processing packets off the io_context threads, which then only parse and write. Tasks of
+        /// one connection have to be posted one after the other to keep its packets in order.
+        class WorkerPool
+        {
+        public:
+            typedef std::shared_ptr<WorkerPool> Ptr;
+            
+            explicit WorkerPool(const WorkerOptions& options = WorkerOptions())
+            : _options(options)
+            , _pool(options._threads)
+            {
+                if(_options._fanOutChunk == 0) {
+                    _options._fanOutChunk = 1;
+                }
+            }
+            
+            size_t size() const
+            {
+                return _pool.numThreads();
+            }
+            
+            size_t chunkSize() const
+            {
+                return _options._fanOutChunk;
+            }
+            
+            template<typename Task>
+            void post(Task&& task)
+            {
+                _pool.enqueue(std::forward<Task>(task));
+            }
+            
+            /// Calls function for the ranges [begin, end) of the chunks of [0, count) and returns once all are done.
+            /// Idle workers help, the calling thread works through the chunks nobody picked up yet. So it only ever
+            /// waits for chunks already running, and may be a worker itself.
+            void forEachChunk(size_t count, const std::function<void(size_t, size_t)>& function)
+            {
+                size_t chunks = (count + _options._fanOutChunk - 1) / _options._fanOutChunk;
+                if(chunks <= 1) {
+                    function(0, count);
+                    return;
+                }
+                auto state = std::make_shared<ChunkState>(count, _options._fanOutChunk, chunks, function);
+                size_t helpers = std::min(chunks - 1, _pool.numThreads());
+                try {
+                    for(size_t n = 0; n < helpers; ++n) {
+                        _pool.enqueue([state]() { runChunks(*state); });
+                    }
+                } catch(const ThreadpoolException&) {
+                    // the pool drains its last tasks while shutting down, the caller does the chunks on its own
+                }
+                runChunks(*state);
+                
+                std::unique_lock<std::mutex> guard(state->_mutex);
+                state->_finished.wait(guard, [&state]() { return state->_done.load() == state->_chunks; });
+            }
+            
+        private:
+            struct ChunkState
+            {
+                ChunkState(size_t count, size_t chunkSize, size_t chunks, const std::function<void(size_t, size_t)>& function)
+                : _count(count)
+                , _chunkSize(chunkSize)
+                , _chunks(chunks)
+                , _function(function)
+                , _next(0)
+                , _done(0)
+                {}
+                
+                const size_t _count;
+                const size_t _chunkSize;
+                const size_t _chunks;
+                // only called for claimed chunks, which the caller waits for
+                const std::function<void(size_t, size_t)>& _function;
+                std::atomic<size_t> _next;
+                std::atomic<size_t> _done;
+                std::mutex _mutex;
+                std::condition_variable _finished;
+            };
+            
+            static void runChunks(ChunkState& state)
+            {
+                size_t finished = 0;
+                size_t chunk;
+                while((chunk = state._next.fetch_add(1)) < state._chunks) {
+                    size_t begin = chunk * state._chunkSize;
+                    state._function(begin, std::min(begin + state._chunkSize, state._count));
+                    ++finished;
+                }
+                if(finished != 0 && state._done.fetch_add(finished) + finished == state._chunks) {
+                    std::lock_guard<std::mutex> guard(state._mutex);
+                    state._finished.notify_all();
+                }
+            }
+            
+            WorkerOptions _options;
+            Threadpool _pool;
+        };
+        
+    }
+}
+
+#endif
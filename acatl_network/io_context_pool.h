@@ -109,6 +109,21 @@ namespace acatl
         return _ioContextPool[(_nextContext++ % _ioContextPool.size())];
       }
 
+      /// Retrieves the context with the given index. Use this to set up per
+      /// context state, e.g. one timer per thread.
+      /// @param index Index of the context, less than size().
+      /// @return Returns the asio::io_context instance with the given index.
+      asio::io_context& get(std::size_t index)
+      {
+        return _ioContextPool[index];
+      }
+
+      /// @return Returns the number of contexts in the pool.
+      std::size_t size() const
+      {
+        return _ioContextPool.size();
+      }
+
     private:
       std::atomic<std::size_t> _nextContext{0};
       std::vector<asio::io_context> _ioContextPool;
@@ -64,6 +64,11 @@ namespace acatl
         completionFunc(ec);
       }
 
+      void clientHandshake(HandshakeCompletionFunc completionFunc)
+      {
+        handshake(completionFunc);
+      }
+
       asio::ip::tcp::socket& operator()()
       {
         return _socket;
@@ -99,6 +104,13 @@ namespace acatl
                                  [completionFunc](const asio::error_code& ec) { completionFunc(ec); });
       }
 
+      /// Handshake of the connecting side, e.g. of a client connected to a server.
+      void clientHandshake(HandshakeCompletionFunc completionFunc)
+      {
+        _socket->async_handshake(asio::ssl::stream_base::client,
+                                 [completionFunc](const asio::error_code& ec) { completionFunc(ec); });
+      }
+
       asio::ssl::stream<asio::ip::tcp::socket>& operator()()
       {
         return *_socket;
@@ -0,0 +1,737 @@
+//
+//  main.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <acatl_application/application.h>
+#include <acatl_application/command_line_options.h>
+
+#include <acatl_mqtt/mqtt_client.h>
+#include <acatl_mqtt/mqtt_file_session_store.h>
+#include <acatl_mqtt/mqtt_parser.h>
+#include <acatl_mqtt/mqtt_partitions.h>
+#include <acatl_mqtt/mqtt_rate_limiter.h>
+#include <acatl_mqtt/mqtt_retained_store.h>
+#include <acatl_mqtt/mqtt_serializer.h>
+#include <acatl_mqtt/mqtt_session_manager.h>
+#include <acatl_mqtt/mqtt_simulation.h>
+#include <acatl_mqtt/mqtt_subscription_tree_manager.h>
+#include <acatl_mqtt/mqtt_timing_wheel.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+  class NullSender : public acatl::mqtt::PacketSender
+  {
+  public:
+    void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet) override
+    {
+    }
+  };
+
+  /// Counts the deliveries to one session.
+  class CountingSender : public acatl::mqtt::PacketSender
+  {
+  public:
+    void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet) override
+    {
+      _count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+      return _count.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> _count{0};
+  };
+
+  class NullSubscriptionHandler : public acatl::mqtt::SubscriptionHandler
+  {
+  public:
+    void addSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+    {
+    }
+
+    void removeSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+    {
+    }
+  };
+
+  /// Runs the given function on threadCount threads at once and returns the wall clock time in seconds.
+  double runParallel(size_t threadCount, const std::function<void(size_t)>& func)
+  {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t t = 0; t < threadCount; ++t) {
+      threads.emplace_back(func, t);
+    }
+    for(auto& thread : threads) {
+      thread.join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  /// The broker end of the client benchmark: accepts the connection, acknowledges CONNECT and the QoS 1 publishes
+  /// and drops everything else.
+  class SinkConnection : public std::enable_shared_from_this<SinkConnection>
+  {
+  public:
+    SinkConnection(asio::ip::tcp::socket socket)
+    : _socket(std::move(socket))
+    {
+      _readBuf.resize(64 * 1024);
+    }
+
+    void read()
+    {
+      auto self(shared_from_this());
+      _socket.async_read_some(asio::buffer(_readBuf), [self](const std::error_code& ec, std::size_t length) {
+        if(ec) {
+          return;
+        }
+        for(size_t index = 0; index < length; ++index) {
+          std::error_code errc;
+          if(self->_parser.parse(self->_readBuf[index], errc).isTrue()) {
+            self->handle(self->_parser.consumePacket());
+          }
+        }
+        self->flush();
+        self->read();
+      });
+    }
+
+  private:
+    void handle(acatl::mqtt::ControlPacket::Ptr packet)
+    {
+      if(packet->_header._controlPacketType == acatl::mqtt::ControlPacketType::Connect) {
+        auto connAck = std::make_unique<acatl::mqtt::ConnAckControlPacket>();
+        connAck->_connectAcknowledgeFlag = acatl::mqtt::ConnectAcknowledgeFlags::None;
+        connAck->_connectReturnCode = acatl::mqtt::ConnectReturnCode::ConnectionAccepted;
+        append(std::move(connAck));
+      } else if(packet->_header._controlPacketType == acatl::mqtt::ControlPacketType::Publish) {
+        const auto& publish = static_cast<const acatl::mqtt::PublishControlPacket&>(*packet);
+        if(publish.qos() == acatl::mqtt::QoSLevel::AtLeastOnce) {
+          append(std::make_unique<acatl::mqtt::PubAckControlPacket>(publish._packetIdentifier));
+        }
+      }
+    }
+
+    void append(acatl::mqtt::ControlPacket::Ptr packet)
+    {
+      std::error_code ec;
+      size_t length = 0;
+      _serializer.serialize(std::move(packet), _serializeBuf, length, ec);
+      _outBuf.insert(_outBuf.end(), _serializeBuf.begin(), _serializeBuf.begin() + static_cast<std::ptrdiff_t>(length));
+    }
+
+    void flush()
+    {
+      if(_writing || _outBuf.empty()) {
+        return;
+      }
+      _writing = true;
+      std::swap(_outBuf, _writeBuf);
+      _outBuf.clear();
+      auto self(shared_from_this());
+      asio::async_write(_socket, asio::buffer(_writeBuf), [self](const std::error_code& ec, std::size_t /*length*/) {
+        self->_writing = false;
+        if(!ec) {
+          self->flush();
+        }
+      });
+    }
+
+    asio::ip::tcp::socket _socket;
+    acatl::mqtt::MQTTParser _parser;
+    acatl::mqtt::Serializer _serializer;
+    std::vector<uint8_t> _readBuf;
+    std::vector<uint8_t> _serializeBuf;
+    std::vector<uint8_t> _outBuf;
+    std::vector<uint8_t> _writeBuf;
+    bool _writing{false};
+  };
+
+  class Sink
+  {
+  public:
+    Sink(asio::io_context& context)
+    : _acceptor(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+    {
+      accept();
+    }
+
+    uint16_t port() const
+    {
+      return _acceptor.local_endpoint().port();
+    }
+
+  private:
+    void accept()
+    {
+      _acceptor.async_accept([this](const std::error_code& ec, asio::ip::tcp::socket socket) {
+        if(!ec) {
+          std::make_shared<SinkConnection>(std::move(socket))->read();
+          accept();
+        }
+      });
+    }
+
+    asio::ip::tcp::acceptor _acceptor;
+  };
+}
+
+
+/// Micro benchmarks for the broker building blocks. Every benchmark prints one line per measured configuration.
+class MQTTBench : public acatl::Application
+{
+public:
+  MQTTBench(int argc, char** argv)
+  : acatl::Application(argc, argv)
+  {
+    _benchmarks["client"] = [this]() { client(); };
+    _benchmarks["connect-storm"] = [this]() { connectStorm(); };
+    _benchmarks["keep-alive"] = [this]() { keepAlive(); };
+    _benchmarks["partitions"] = [this]() { partitions(); };
+    _benchmarks["rate-limit"] = [this]() { rateLimit(); };
+    _benchmarks["retained"] = [this]() { retained(); };
+    _benchmarks["session-store"] = [this]() { sessionStore(); };
+    _benchmarks["simulation"] = [this]() { simulation(); };
+    _benchmarks["subscriptions"] = [this]() { subscriptions(); };
+    _benchmarks["topic-alias"] = [this]() { topicAlias(); };
+  }
+
+private:
+  bool setUp(const acatl::StringVector& args) override
+  {
+    // clang-format off
+    acatl::CommandLineOptions options("mqtt_bench", {
+      {
+        "help", {
+          {"", "help", 1, 1, "display this help and exit"}
+        }
+      },
+      {
+        "benchmark options", {
+          {"b", "benchmark", "<NAME>", 0, 10, "run only the named benchmark "
+                                                "(client, connect-storm, keep-alive, partitions, rate-limit, retained, "
+                                                "session-store, simulation, subscriptions, topic-alias)"},
+          {"c", "clients", "<COUNT>", 0, 1, "number of simulated clients"},
+          {"t", "threads", "<COUNT>", 0, 1, "maximum number of threads"}
+        }
+      }
+    });
+    // clang-format on
+
+    std::stringstream ss;
+    auto ret = options.parse(args, ss);
+
+    if(!ret) {
+      std::cerr << ss.str() << std::endl;
+      options.usage(std::cerr);
+      return false;
+    }
+
+    if(options.count("help") > 0) {
+      options.usage(std::cerr);
+      return false;
+    }
+
+    for(int i = 0; i < options.count("benchmark"); ++i) {
+      auto name = options.option("benchmark").value<std::string>(i);
+      if(_benchmarks.find(name) == _benchmarks.end()) {
+        std::cerr << "unknown benchmark " << name << std::endl;
+        return false;
+      }
+      _selected.push_back(name);
+    }
+    if(options.count("clients") > 0) {
+      _clients = options.option("clients").value<uint32_t>();
+    }
+    if(options.count("threads") > 0) {
+      _maxThreads = options.option("threads").value<uint32_t>();
+    }
+
+    return true;
+  }
+
+  int doRun() override
+  {
+    for(const auto& benchmark : _benchmarks) {
+      if(_selected.empty() || std::find(_selected.begin(), _selected.end(), benchmark.first) != _selected.end()) {
+        benchmark.second();
+      }
+    }
+    return 0;
+  }
+
+  /// One client on one thread publishes 64 byte messages over loopback to a sink that runs on a second thread. The
+  /// publisher keeps up to 1024 publishes queued, so the client pipelines and coalesces them into large writes.
+  void client()
+  {
+    asio::io_context sinkContext;
+    Sink sink(sinkContext);
+    std::thread sinkThread([&sinkContext]() { sinkContext.run(); });
+
+    const size_t publishes = 10 * _clients;
+    acatl::mqtt::Payload payload;
+    payload.assign(64, 'x');
+    for(auto qos : {acatl::mqtt::QoSLevel::AtMostOnce, acatl::mqtt::QoSLevel::AtLeastOnce}) {
+      asio::io_context context;
+      acatl::net::NullContext nullContext;
+      acatl::mqtt::ClientOptions options;
+      options._port = sink.port();
+      options._clientId = "bench";
+      options._keepAlive = 0;
+      options._receiveMaximum = 1024;
+      auto client = acatl::mqtt::make_client<acatl::net::Socket>(context, options, nullContext);
+      bool connected = false;
+      client->setConnectionHandler([&connected](const std::error_code& ec) { connected = !ec; });
+      client->connect();
+      while(!connected) {
+        context.run_one();
+      }
+
+      size_t sent = 0;
+      size_t completed = 0;
+      auto start = std::chrono::steady_clock::now();
+      while(completed < publishes) {
+        while(sent < publishes && client->queued() < 1024) {
+          client->publish("bench/client", payload, qos, false, [&completed](const std::error_code& /*ec*/) { ++completed; });
+          ++sent;
+        }
+        context.run_one();
+      }
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      client->disconnect();
+      context.run_for(std::chrono::milliseconds(100));
+
+      std::cout << "client qos=" << static_cast<int>(qos) << " publishes=" << publishes
+                << " publishes/s=" << static_cast<uint64_t>(static_cast<double>(publishes) / seconds) << std::endl;
+    }
+
+    sinkContext.stop();
+    sinkThread.join();
+  }
+
+  /// Every thread connects, disconnects and reconnects its share of the clients, which takes the session table
+  /// lock three times per client. A single shard behaves like the former globally locked session table.
+  void connectStorm()
+  {
+    NullSubscriptionHandler handler;
+    auto sender = std::make_shared<NullSender>();
+    for(size_t shards : {size_t(1), acatl::mqtt::SessionManager::defaultShardCount}) {
+      for(size_t threads = 1; threads <= _maxThreads; threads *= 2) {
+        acatl::mqtt::SessionManager manager(shards);
+        const size_t clientsPerThread = _clients / threads;
+        double seconds = runParallel(threads, [&](size_t t) {
+          std::error_code ec;
+          for(size_t i = 0; i < clientsPerThread; ++i) {
+            std::string clientId = "client-" + std::to_string(t) + "-" + std::to_string(i);
+            auto session = manager.getSession(clientId, sender, handler, ec);
+            manager.returnSession(session, ec);
+            manager.getSession(clientId, sender, handler, ec);
+          }
+        });
+        std::cout << "connect-storm shards=" << std::setw(2) << shards << " threads=" << std::setw(3) << threads
+                  << " clients=" << clientsPerThread * threads << " connects/s="
+                  << static_cast<uint64_t>(static_cast<double>(clientsPerThread * threads) / seconds) << std::endl;
+      }
+    }
+  }
+
+  /// Arms a 90 s keep alive for every client on one wheel with a 100 ms tick, resets each of them as if a packet
+  /// arrived and then lets all of them expire, as it happens when a whole fleet of devices drops off the network.
+  void keepAlive()
+  {
+    const uint64_t keepAliveTicks = 900;
+    acatl::mqtt::TimingWheel wheel;
+    std::vector<acatl::mqtt::TimingWheel::Handle> handles(_clients);
+    size_t closed = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < _clients; ++i) {
+      // spread the connects over the first keep alive period
+      wheel.advance(i % 64 == 0 ? 1 : 0);
+      wheel.schedule(handles[i], keepAliveTicks, [&closed]() { ++closed; });
+    }
+    double armSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < _clients; ++i) {
+      wheel.reset(handles[i], keepAliveTicks);
+    }
+    double resetSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    wheel.advance(keepAliveTicks * 2);
+    double expireSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "keep-alive connections=" << _clients << " closed=" << closed
+              << " arms/s=" << static_cast<uint64_t>(static_cast<double>(_clients) / armSeconds)
+              << " resets/s=" << static_cast<uint64_t>(static_cast<double>(_clients) / resetSeconds)
+              << " expire-ms=" << static_cast<uint64_t>(expireSeconds * 1000) << std::endl;
+  }
+
+  /// Every thread publishes to all topics, each with one exact subscriber, first through the subscription tree all
+  /// threads share, then through one topic partition per thread. With partitions all but 1 in threads publishes are
+  /// handed to the thread owning the topic, which matches and delivers without sharing anything.
+  void partitions()
+  {
+    const size_t topics = std::max(size_t(1), std::min(_clients, size_t(10000)));
+    const size_t publishesPerThread = _clients;
+    NullSubscriptionHandler handler;
+    for(size_t threads = 1; threads <= _maxThreads; threads *= 2) {
+      for(bool partitioned : {false, true}) {
+        acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+        acatl::mqtt::SessionManager sessionManager;
+        acatl::net::IoContextPool pool(static_cast<uint32_t>(threads));
+        acatl::mqtt::Partitions partitions(pool);
+        std::vector<std::string> topicNames;
+        std::vector<std::shared_ptr<CountingSender>> senders;
+        std::vector<acatl::mqtt::Session::Ptr> sessions;
+        std::error_code ec;
+        for(size_t i = 0; i < topics; ++i) {
+          topicNames.push_back("devices/" + std::to_string(i) + "/state");
+          senders.push_back(std::make_shared<CountingSender>());
+          sessions.push_back(sessionManager.getSession("client-" + std::to_string(i), senders.back(), handler, ec));
+        }
+        if(partitioned) {
+          // the pool does not run yet, so the owning partitions may be filled from here
+          for(size_t i = 0; i < topics; ++i) {
+            acatl::mqtt::TopicFilter filter(topicNames[i], acatl::mqtt::QoSLevel::AtMostOnce);
+            partitions.router(partitions.partitionOf(topicNames[i]))->addSubscription(filter, sessions[i]);
+          }
+        } else {
+          acatl::mqtt::SubscriptionTreeManager::WritableTree writableTree = subscriptionTreeManager.getWritableTree();
+          for(size_t i = 0; i < topics; ++i) {
+            writableTree.tree()->addFilter(acatl::mqtt::TopicFilter(topicNames[i], acatl::mqtt::QoSLevel::AtMostOnce), sessions[i], ec);
+          }
+        }
+        std::vector<std::unique_ptr<acatl::mqtt::Processor>> processors;
+        for(size_t t = 0; t < threads; ++t) {
+          processors.emplace_back(new acatl::mqtt::Processor(subscriptionTreeManager, sessionManager));
+          if(partitioned) {
+            processors.back()->setPublishRouter(partitions.router(t));
+          }
+        }
+        auto publish = [&](size_t t) {
+          acatl::mqtt::PublishControlPacket pub;
+          pub._payload.assign(64, 0x2a);
+          std::error_code ec;
+          for(size_t i = 0; i < publishesPerThread; ++i) {
+            pub._topicName = topicNames[(i + t) % topics];
+            processors[t]->publish(pub, ec);
+          }
+        };
+
+        const uint64_t publishes = publishesPerThread * threads;
+        double seconds = 0;
+        if(partitioned) {
+          auto start = std::chrono::steady_clock::now();
+          std::thread runner([&pool]() { pool.run(); });
+          for(size_t t = 0; t < threads; ++t) {
+            asio::post(pool.get(t), [&publish, t]() { publish(t); });
+          }
+          uint64_t delivered = 0;
+          while(delivered < publishes) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            delivered = 0;
+            for(const auto& sender : senders) {
+              delivered += sender->count();
+            }
+          }
+          seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          pool.stop();
+          runner.join();
+        } else {
+          seconds = runParallel(threads, publish);
+        }
+        std::cout << "partitions mode=" << (partitioned ? "partitioned" : "shared     ") << " threads=" << std::setw(3)
+                  << threads << " topics=" << topics << " publishes/s="
+                  << static_cast<uint64_t>(static_cast<double>(publishes) / seconds) << std::endl;
+      }
+    }
+  }
+
+  /// Admits publishes of one client with a client limit and three topic prefix limits, including the clock read
+  /// the processor does per publish.
+  void rateLimit()
+  {
+    acatl::mqtt::RateLimitOptions options;
+    options._client = acatl::mqtt::RateLimit{1e9, 1000};
+    options._topics = {{"devices/", {1e9, 1000}}, {"devices/camera/", {1e9, 1000}}, {"$SYS/", {10, 10}}};
+    acatl::mqtt::RateLimiter limiter(options);
+    const std::vector<std::string> topics = {"devices/thermostat/1/state", "devices/camera/1/frame", "actors/light/1"};
+    const size_t publishes = _clients * 100;
+    size_t admitted = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < publishes; ++i) {
+      admitted += limiter.admit(topics[i % topics.size()], acatl::mqtt::QoSLevel::AtMostOnce,
+                                acatl::mqtt::RateLimiter::Clock::now()) ? 1 : 0;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "rate-limit publishes=" << publishes << " admitted=" << admitted
+              << " ns/publish=" << std::fixed << std::setprecision(1) << seconds * 1e9 / static_cast<double>(publishes)
+              << std::defaultfloat << std::endl;
+  }
+
+  /// Retains one message per client below devices/<group>/<client>/state with a payload shared by all of them and
+  /// measures exact and wildcard lookups as they happen on SUBSCRIBE.
+  void retained()
+  {
+    acatl::mqtt::RetainedStore store;
+    acatl::mqtt::PublishControlPacket publish;
+    publish._header._flags = 0x01;
+    publish._payload.assign(64, 0x2a);
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < _clients; ++i) {
+      publish._topicName = "devices/" + std::to_string(i / 1000) + "/" + std::to_string(i) + "/state";
+      store.retain(publish);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "retained topics=" << store.size()
+              << " retains/s=" << static_cast<uint64_t>(static_cast<double>(_clients) / seconds) << std::endl;
+
+    const size_t groups = std::max(size_t(1), _clients / 1000);
+    const std::vector<std::pair<std::string, std::function<std::string(size_t)>>> patterns = {
+      {"exact", [](size_t i) { return "devices/" + std::to_string(i / 1000) + "/" + std::to_string(i) + "/state"; }},
+      {"group-plus", [groups](size_t i) { return "devices/" + std::to_string(i % groups) + "/+/state"; }},
+      {"group-hash", [groups](size_t i) { return "devices/" + std::to_string(i % groups) + "/#"; }}};
+    for(const auto& pattern : patterns) {
+      const size_t lookups = pattern.first == "exact" ? _clients : std::min(_clients, size_t(1000));
+      acatl::mqtt::RetainedStore::Messages messages;
+      size_t matched = 0;
+      start = std::chrono::steady_clock::now();
+      for(size_t i = 0; i < lookups; ++i) {
+        messages.clear();
+        matched += store.match(acatl::mqtt::TopicFilter{pattern.second(i)}, messages);
+      }
+      seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << "retained filter=" << pattern.first << " lookups=" << lookups << " matched=" << matched
+                << " lookups/s=" << static_cast<uint64_t>(static_cast<double>(lookups) / seconds) << std::endl;
+    }
+  }
+
+  /// Writes one persistent session with two subscriptions per client, then measures the time to reopen the store,
+  /// which only indexes the client ids, and the time to lazily load every client on its first connect.
+  void sessionStore()
+  {
+    const std::string path = "./mqtt_bench_sessions.log";
+    std::remove(path.c_str());
+    NullSubscriptionHandler handler;
+    std::error_code ec;
+    {
+      acatl::mqtt::FileSessionStore store(path);
+      store.open(ec);
+      auto start = std::chrono::steady_clock::now();
+      for(size_t i = 0; i < _clients; ++i) {
+        acatl::mqtt::Session session("client-" + std::to_string(i), handler);
+        session.restoreSubscriptions({{"devices/" + std::to_string(i) + "/#"}, {"broadcast/+"}});
+        store.persistSession(session, ec);
+      }
+      store.flush(ec);
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << "session-store sessions=" << _clients << " bytes=" << store.fileSize()
+                << " writes/s=" << static_cast<uint64_t>(static_cast<double>(_clients) / seconds) << std::endl;
+    }
+
+    acatl::mqtt::FileSessionStore store(path);
+    auto start = std::chrono::steady_clock::now();
+    store.open(ec);
+    double openSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    acatl::mqtt::TopicFilters subscriptions;
+    for(size_t i = 0; i < _clients; ++i) {
+      store.loadSession("client-" + std::to_string(i), subscriptions, ec);
+    }
+    double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "session-store sessions=" << store.count() << " open-ms=" << static_cast<uint64_t>(openSeconds * 1000)
+              << " loads/s=" << static_cast<uint64_t>(static_cast<double>(_clients) / loadSeconds) << std::endl;
+
+    store.close(ec);
+    std::remove(path.c_str());
+  }
+
+  /// Every client connects with a clean session, publishes two QoS 1 messages on its own topic and disconnects, twice,
+  /// the clients starting spread over one virtual second, while four subscribers receive and acknowledge every
+  /// publish. The simulation runs the processor without sockets on one thread and reports its time per packet.
+  void simulation()
+  {
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    acatl::mqtt::Simulation simulation(subscriptionTreeManager, sessionManager);
+
+    acatl::mqtt::ClientScript subscriber;
+    subscriber._steps.push_back({acatl::mqtt::ClientAction::Connect});
+    subscriber._steps.push_back({acatl::mqtt::ClientAction::Subscribe, 0, "sim/+", acatl::mqtt::QoSLevel::AtLeastOnce});
+    simulation.addClients(4, subscriber);
+
+    acatl::mqtt::ClientScript publisher;
+    publisher._steps.push_back({acatl::mqtt::ClientAction::Connect, 1000});
+    publisher._steps.push_back({acatl::mqtt::ClientAction::Publish, 1000, "sim/%i", acatl::mqtt::QoSLevel::AtLeastOnce, 2});
+    publisher._steps.push_back({acatl::mqtt::ClientAction::Disconnect, 1000});
+    publisher._cycles = 2;
+    publisher._cleanSession = true;
+    publisher._acknowledgeDelay = 100;
+    simulation.addClients(_clients, publisher, 1000000);
+
+    auto start = std::chrono::steady_clock::now();
+    simulation.run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const acatl::mqtt::SimulationStats& stats = simulation.stats();
+    std::cout << "simulation clients=" << simulation.clients() << " deliveries=" << stats._deliveries
+              << " errors=" << stats._errors << std::fixed << std::setprecision(1)
+              << " connect-ns=" << stats._connects.nanosecondsPerOperation()
+              << " subscribe-ns=" << stats._subscribes.nanosecondsPerOperation()
+              << " publish-ns=" << stats._publishes.nanosecondsPerOperation()
+              << " ack-ns=" << stats._acknowledgements.nanosecondsPerOperation()
+              << " disconnect-ns=" << stats._disconnects.nanosecondsPerOperation()
+              << " virtual-s=" << static_cast<double>(simulation.clock().now()) / 1e6 << " wall-s=" << seconds
+              << std::defaultfloat << std::endl;
+  }
+
+  /// One gateway session subscribes to one filter per client with SUBSCRIBEs of 100 filters each, subscribes to all
+  /// of them again, which only finds them in its subscription index, and finally unsubscribes from them.
+  void subscriptions()
+  {
+    NullSubscriptionHandler handler;
+    acatl::mqtt::Session session("gateway", handler);
+    std::vector<acatl::mqtt::TopicFilters> requests((_clients + 99) / 100);
+    for(size_t i = 0; i < _clients; ++i) {
+      requests[i / 100].push_back({"gateway/" + std::to_string(i) + "/command/#", acatl::mqtt::QoSLevel::AtLeastOnce});
+    }
+
+    auto measure = [this, &requests](const std::function<void(const acatl::mqtt::TopicFilters&)>& func) {
+      auto start = std::chrono::steady_clock::now();
+      for(const auto& request : requests) {
+        func(request);
+      }
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9
+             / static_cast<double>(_clients);
+    };
+    double subscribeNs = measure([&session](const acatl::mqtt::TopicFilters& request) { session.addSubscriptions(request); });
+    size_t subscribed = session.subscriptions().size();
+    double resubscribeNs = measure([&session](const acatl::mqtt::TopicFilters& request) { session.addSubscriptions(request); });
+    double unsubscribeNs = measure([&session](const acatl::mqtt::TopicFilters& request) { session.removeSubscriptions(request); });
+
+    std::cout << "subscriptions filters=" << subscribed << std::fixed << std::setprecision(1)
+              << " subscribe-ns/filter=" << subscribeNs << " resubscribe-ns/filter=" << resubscribeNs
+              << " unsubscribe-ns/filter=" << unsubscribeNs << std::defaultfloat << std::endl;
+  }
+
+  /// Serializes telemetry of one device per 100 clients for a single subscriber and parses it again as the subscriber
+  /// would, once as MQTT 3.1.1 and as MQTT 5.0 with topic aliases. With an alias maximum below the device count the
+  /// devices beyond it keep sending their topics.
+  void topicAlias()
+  {
+    const size_t devices = std::max(size_t(2), std::min(_clients / 100, size_t(65535)));
+    std::vector<std::string> topics;
+    for(size_t i = 0; i < devices; ++i) {
+      topics.push_back("telemetry/site-" + std::to_string(i % 16) + "/device-" + std::to_string(i) + "/temperature");
+    }
+    acatl::mqtt::Payload payload;
+    payload.assign(16, 0x2a);
+    const size_t publishes = _clients * 10;
+
+    const std::vector<std::pair<uint8_t, uint16_t>> configurations = {
+      {acatl::mqtt::protocolLevel311, 0},
+      {acatl::mqtt::protocolLevel5, 0},
+      {acatl::mqtt::protocolLevel5, static_cast<uint16_t>(devices)},
+      {acatl::mqtt::protocolLevel5, static_cast<uint16_t>(devices / 2)}};
+    for(const auto& configuration : configurations) {
+      acatl::mqtt::Serializer serializer;
+      serializer.setProtocolLevel(configuration.first);
+      serializer.setTopicAliasMaximum(configuration.second);
+      std::vector<uint8_t> wire;
+      wire.reserve(publishes * (topics.back().size() + payload.size() + 8));
+      std::vector<uint8_t> buffer;
+      std::error_code ec;
+
+      auto start = std::chrono::steady_clock::now();
+      for(size_t i = 0; i < publishes; ++i) {
+        acatl::mqtt::PublishControlPacket::Ptr publish(new acatl::mqtt::PublishControlPacket);
+        publish->_topicName = topics[i % devices];
+        publish->_payload = payload;
+        size_t length = 0;
+        serializer.serialize(std::move(publish), buffer, length, ec);
+        wire.insert(wire.end(), buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(length));
+      }
+      double serializeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      acatl::mqtt::MQTTParser parser;
+      parser.setProtocolLevel(configuration.first);
+      parser.setTopicAliasMaximum(configuration.second);
+      size_t parsed = 0;
+      start = std::chrono::steady_clock::now();
+      for(uint8_t byte : wire) {
+        if(parser.parse(byte, ec).isTrue()) {
+          parser.consumePacket();
+          ++parsed;
+        }
+      }
+      double parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      std::cout << "topic-alias protocol=" << (configuration.first == acatl::mqtt::protocolLevel5 ? "5.0" : "3.1.1")
+                << " devices=" << devices << " alias-maximum=" << configuration.second << " publishes=" << parsed
+                << std::fixed << std::setprecision(1)
+                << " bytes/publish=" << static_cast<double>(wire.size()) / static_cast<double>(publishes)
+                << " serialize-ns/publish=" << serializeSeconds * 1e9 / static_cast<double>(publishes)
+                << " parse-ns/publish=" << parseSeconds * 1e9 / static_cast<double>(publishes)
+                << std::defaultfloat << std::endl;
+    }
+  }
+
+  std::map<std::string, std::function<void()>> _benchmarks;
+  std::vector<std::string> _selected;
+  size_t _clients{100000};
+  size_t _maxThreads{std::max(1u, std::thread::hardware_concurrency())};
+};
+
+int main(int argc, char** argv)
+{
+  return MQTTBench{argc, argv}.run();
+}
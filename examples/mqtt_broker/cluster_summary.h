@@ -0,0 +1,90 @@
+//
+//  cluster_summary.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_cluster_summary_h
+#define acatl_mqtt_cluster_summary_h
+
+#include <acatl/logging.h>
+
+#include "acatl_mqtt/mqtt_cluster.h"
+
+#include <asio/steady_timer.hpp>
+
+#include <chrono>
+
+
+/// Announces new interest of the local clients to the peers once per interval, so a burst of subscriptions ends up
+/// in a single update. The timer runs on a single io_context, so the cluster is never updated concurrently.
+template<typename ClusterType>
+class ClusterSummary
+{
+public:
+  ClusterSummary(asio::io_context& context, ClusterType& cluster, std::chrono::milliseconds interval)
+  : _timer(context)
+  , _cluster(cluster)
+  , _interval(interval)
+  {}
+
+  void start()
+  {
+    schedule();
+  }
+
+  void stop()
+  {
+    asio::error_code ec;
+    _timer.cancel(ec);
+  }
+
+private:
+  void schedule()
+  {
+    _timer.expires_after(_interval);
+    _timer.async_wait([this](const asio::error_code& ec) {
+      if(ec) {
+        return;
+      }
+      size_t announced = _cluster.updateSummary();
+      if(announced != 0) {
+        ACATL_CLASSLOG(ClusterSummary, 2, "Announced " << announced << " filters, " << _cluster.summary().size() << " in total");
+      }
+      schedule();
+    });
+  }
+
+  asio::steady_timer _timer;
+  ClusterType& _cluster;
+  std::chrono::milliseconds _interval;
+};
+
+#endif
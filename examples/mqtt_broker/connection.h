@@ -41,26 +41,77 @@
 #include <acatl_network/http_url_parser.h>
 #include <acatl_network/socket_type.h>
 
+#include "acatl_mqtt/mqtt_acl.h"
+#include "acatl_mqtt/mqtt_capture.h"
+#include "acatl_mqtt/mqtt_flow_control.h"
+#include "acatl_mqtt/mqtt_heavy_hitters.h"
+#include "acatl_mqtt/mqtt_latency_tracer.h"
+#include "acatl_mqtt/mqtt_metrics.h"
 #include "acatl_mqtt/mqtt_processor.h"
+#include "acatl_mqtt/mqtt_retained_store.h"
 #include "acatl_mqtt/mqtt_packet_sender.h"
 #include "acatl_mqtt/mqtt_parser.h"
+#include "acatl_mqtt/mqtt_partitions.h"
+#include "acatl_mqtt/mqtt_send_queue.h"
 #include "acatl_mqtt/mqtt_serializer.h"
 #include "acatl_mqtt/mqtt_utils.h"
+#include "acatl_mqtt/mqtt_worker_pool.h"
 
-#include <queue>
+#include "keep_alive.h"
 
 
 class MQTTContext
 {
 public:
   MQTTContext(acatl::mqtt::SubscriptionTreeManager& subscriptionTreeManager,
-              acatl::mqtt::SessionManager& sessionManager)
+              acatl::mqtt::SessionManager& sessionManager,
+              acatl::mqtt::SendQueueMemory& sendQueueMemory)
   : _subscriptionTreeManager{subscriptionTreeManager}
   , _sessionManager{sessionManager}
+  , _sendQueueMemory{sendQueueMemory}
+  , _flowControlHighWatermark{0}
+  , _flowControlLowWatermark{0}
+  , _keepAliveMonitor{nullptr}
+  , _partitions{nullptr}
+  , _connectTimeout{0}
+  , _topicAliasMaximum{0}
+  , _rejectedPackets{std::make_shared<std::atomic<uint64_t>>(0)}
+  , _metrics{std::make_shared<acatl::mqtt::Metrics>()}
+  , _workers{nullptr}
   {}
 
   acatl::mqtt::SubscriptionTreeManager& _subscriptionTreeManager;
   acatl::mqtt::SessionManager& _sessionManager;
+  acatl::mqtt::SendQueueMemory& _sendQueueMemory;
+  acatl::mqtt::SendQueueLimits _sendQueueLimits;
+  acatl::mqtt::RetainedStore::Ptr _retainedStore;
+  acatl::mqtt::StreamingOptions _streamingOptions;
+  acatl::mqtt::ParserLimits _parserLimits;
+  acatl::mqtt::RateLimitOptions _rateLimits;
+  size_t _flowControlHighWatermark;
+  size_t _flowControlLowWatermark;
+  KeepAliveMonitor* _keepAliveMonitor;
+  // the topic partitions of the io_contexts, not set if all threads share one subscription tree
+  acatl::mqtt::Partitions* _partitions;
+  std::chrono::seconds _connectTimeout;
+  // highest topic alias MQTT 5.0 clients may use
+  uint16_t _topicAliasMaximum;
+  // packets of all connections that exceeded the parser limits
+  std::shared_ptr<std::atomic<uint64_t>> _rejectedPackets;
+  // counters of all connections, published below $SYS
+  acatl::mqtt::Metrics::Ptr _metrics;
+  // samples publishes through the stages of the broker, not set if tracing is off
+  acatl::mqtt::LatencyTracer::Ptr _latencyTracer;
+  // the topics and clients publishing the most, not set if the detection is off
+  acatl::mqtt::HeavyHitters::Ptr _heavyHitters;
+  // checks publishes and subscriptions against the ACL rules, not set if every client may do everything
+  acatl::mqtt::Authorizer::Ptr _authorizer;
+  // what cluster links have to present, not set if the broker is no cluster node and refuses their client IDs
+  acatl::mqtt::ClusterCredentials::Ptr _clusterCredentials;
+  // processes the packets of all connections, not set if the io_context threads process them inline
+  acatl::mqtt::WorkerPool* _workers;
+  // records the packets of all connections for a later replay, not set if capturing is off
+  acatl::mqtt::CaptureWriter::Ptr _capture;
 };
 
 
@@ -73,44 +124,141 @@ public:
 
     Connection(SocketType&& socket, const MQTTContext& context)
     : _isSending(false)
+    , _processing(false)
+    , _closeAfterProcessing(false)
+    , _drainAfterProcessing(false)
+    , _sendPackets(context._sendQueueLimits, &context._sendQueueMemory)
     , _socket(std::move(socket))
     , _subscriptionTreeManager(context._subscriptionTreeManager)
     , _sessionManager(context._sessionManager)
     , _mqttProcessor(_subscriptionTreeManager, _sessionManager)
+    , _flowControl(std::make_shared<acatl::mqtt::FlowControl>(context._flowControlHighWatermark,
+                                                              context._flowControlLowWatermark))
+    , _keepAliveMonitor(context._keepAliveMonitor)
+    , _keepAliveWheel(nullptr)
+    , _keepAliveTicks(0)
+    , _connectTimeout(context._connectTimeout)
+    , _rejectedPackets(context._rejectedPackets)
+    , _metrics(context._metrics)
+    , _latencyTracer(context._latencyTracer)
+    , _workers(context._workers)
+    , _capture(context._capture)
+    , _captureConnection(_capture ? _capture->newConnection() : 0)
+    , _traceCounter(0)
+    , _tracedWrites(0)
     {
+        _sendPackets.setMetrics(_metrics.get());
+        _mqttProcessor.setMetrics(_metrics);
+        _mqttProcessor.setLatencyTracer(_latencyTracer);
+        _mqttProcessor.setHeavyHitters(context._heavyHitters);
+        _mqttProcessor.setAuthorizer(context._authorizer);
+        _mqttProcessor.setClusterCredentials(context._clusterCredentials);
+        _mqttProcessor.setRetainedStore(context._retainedStore);
+        _mqttProcessor.setRateLimits(context._rateLimits);
+        _mqttProcessor.setTopicAliasMaximum(context._topicAliasMaximum);
+        _mqttProcessor.setWorkerPool(context._workers);
+        if(context._partitions) {
+            acatl::mqtt::Partitions& partitions = *context._partitions;
+            _mqttProcessor.setPublishRouter(partitions.router(partitions.index(_socket.lowest_layer().get_executor().context())));
+        }
+        _mqttParser.setStreamingOptions(context._streamingOptions);
+        _mqttParser.setLimits(context._parserLimits);
+        _mqttParser.setTopicAliasMaximum(context._topicAliasMaximum);
         _readBuf.resize(64);
         _writeBuf.resize(64);
+        _packetBuf.resize(64);
     }
     
     ~Connection()
     {
         ACATL_CLASSLOG(Connection, 1, "Terminating connection");
+        ACATL_CLASSLOG(Connection, 2, "Dropped " << _sendPackets.droppedPackets() << " packets, send queue high-water mark "
+                                      << _sendPackets.highWaterPackets() << " packets/" << _sendPackets.highWaterBytes() << " bytes");
+        if(_mqttProcessor.rateLimitedPublishes() != 0) {
+          ACATL_CLASSLOG(Connection, 2, "Dropped " << _mqttProcessor.rateLimitedPublishes() << " publishes exceeding the rate limits");
+        }
+        endCapture();
     }
     
     void start()
     {
         ACATL_CLASSLOG(Connection, 1, "Start connection");
         _mqttProcessor.setPacketSender(this->shared_from_this());
-      do_read();
+        _mqttProcessor.setFlowControl(_flowControl);
+      std::weak_ptr<Connection> weakSelf(this->shared_from_this());
+      _flowControl->setResumeHandler([weakSelf]() {
+        if(auto self = weakSelf.lock()) {
+          asio::post(self->_socket.lowest_layer().get_executor(), [self]() {
+            ACATL_CLASSLOG(Connection, 2, "Subscribers drained, resume reading");
+            self->do_read();
+          });
+        }
+      });
+      // the connection may have been accepted on a different io_context, so hop over to the one owning the socket
+      auto self(this->shared_from_this());
+      asio::post(_socket.lowest_layer().get_executor(), [self]() {
+        self->startKeepAlive();
+        self->do_read();
+      });
     }
 
 private:
   void do_read()
   {
+    if(_flowControl->shouldPause()) {
+      // the resume handler restarts reading once the deliveries of this publisher drained
+      ACATL_CLASSLOG(Connection, 2, "Subscribers cannot keep up, pause reading");
+      return;
+    }
+    std::chrono::steady_clock::duration delay = _mqttProcessor.throttleDelay();
+    if(delay > std::chrono::steady_clock::duration::zero()) {
+      ACATL_CLASSLOG(Connection, 3, "Client exceeds its rate limits, pause reading");
+      throttle(delay);
+      return;
+    }
+    const acatl::mqtt::PayloadStream::Ptr& stream = _mqttParser.stream();
+    if(stream && stream->shouldPause()) {
+      // the resume handler of the stream restarts reading once the subscribers caught up
+      ACATL_CLASSLOG(Connection, 2, "Streaming subscribers cannot keep up, pause reading");
+      return;
+    }
     auto self(this->shared_from_this());
     _socket().async_read_some(asio::buffer(_readBuf, _readBuf.size()), [self](std::error_code ec, std::size_t length) {
       if(!ec) {
         self->handle_read(length);
       } else {
         ACATL_ERRORLOG("Read error: " << ec.message());
+        self->stopReading();
       }
     });
   }
 
+  /// Resumes reading after the delay, rounded up to the tick of the keep alive wheel. A coarse tick only makes the
+  /// pauses longer and the bursts larger, the rate stays the same. The scheduled callback keeps the connection alive.
+  void throttle(std::chrono::steady_clock::duration delay)
+  {
+    if(!_keepAliveWheel) {
+      do_read();
+      return;
+    }
+    auto self(this->shared_from_this());
+    std::chrono::milliseconds timeout = std::chrono::duration_cast<std::chrono::milliseconds>(delay) + std::chrono::milliseconds(1);
+    _keepAliveWheel->schedule(_throttleTimer, _keepAliveMonitor->ticks(timeout), [self]() { self->do_read(); });
+  }
+
   void handle_read(size_t length)
   {
       ACATL_CLASSLOG(Connection, 4, "Client sends " << length << " bytes of data");
+      _metrics->add(acatl::mqtt::Metric::BytesReceived, static_cast<int64_t>(length));
+      acatl::mqtt::LatencyTracer::Clock::time_point readTime;
+      if(_latencyTracer) {
+        readTime = acatl::mqtt::LatencyTracer::Clock::now();
+      }
       uint16_t index = 0;
+      touchKeepAlive();
+      if(_capture) {
+        capture(length);
+      }
 
       while(index < length) {
         std::error_code errc;
@@ -124,11 +272,39 @@ private:
         //      with a CONNACK return code 0x02 (Identifier rejected) and then close the connection
         if(ret.isFalse() || errc) {
           ACATL_ERRORLOG("Error: " << errc.message());
+          if(_mqttParser.rejectedPackets() != 0) {
+            _rejectedPackets->fetch_add(1, std::memory_order_relaxed);
+          }
+          if(!_pendingPackets.empty()) {
+            // the packets before the broken one are still processed
+            _closeAfterProcessing = true;
+            break;
+          }
           // close the connection
+          stopReading();
           return;
         } else if(ret.isTrue()) {
           acatl::mqtt::ControlPacket::Ptr packet = _mqttParser.consumePacket();
           ACATL_CLASSLOG(Connection, 1, "Client sends " << packet->_header._controlPacketType);
+          bool isConnect = packet->_header._controlPacketType == acatl::mqtt::ControlPacketType::Connect;
+          if(_latencyTracer && packet->_header._controlPacketType == acatl::mqtt::ControlPacketType::Publish
+             && _latencyTracer->sample(_traceCounter)) {
+            auto& pub = static_cast<acatl::mqtt::PublishControlPacket&>(*packet);
+            pub._traceTimestamp = _latencyTracer->record(acatl::mqtt::TraceStage::Parse, readTime);
+          }
+          if(_mqttParser.stream()) {
+            watchStream(_mqttParser.stream());
+          }
+          if(isConnect) {
+            // responses follow the protocol level of the client, publishes to it use the aliases it allows
+            const auto& connect = static_cast<const acatl::mqtt::ConnectControlPacket&>(*packet);
+            _serializer.setProtocolLevel(connect._protocolLevel);
+            _serializer.setTopicAliasMaximum(connect._properties._topicAliasMaximum);
+          }
+          if(_workers) {
+            _pendingPackets.push_back(std::move(packet));
+            continue;
+          }
 
           std::tuple<acatl::mqtt::ConnectionState, acatl::mqtt::ControlPacket::Ptr> result = _mqttProcessor.processPacket(std::move(packet), errc);
           if(std::get<1>(result)) {
@@ -138,65 +314,272 @@ private:
           if(errc) {
             ACATL_ERRORLOG("Processor error: " << errc.message());
             // close the connection
+            stopReading();
             return;
           }
           if(std::get<0>(result) == acatl::mqtt::ConnectionState::Close) {
+            stopReading();
             return;
           }
+          if(isConnect) {
+            // the client has to send a packet within one and a half times its keep alive
+            armKeepAlive(std::chrono::milliseconds(_mqttProcessor.keepAlive() * 1500), true);
+          }
         }
       }
+    if(!_pendingPackets.empty()) {
+      processOnWorker();
+      return;
+    }
+    do_read();
+  }
+
+  /// Hands the packets of one read to the workers. The next read only starts once they are processed, which keeps
+  /// the packets of the connection in order and bounds what it can pile up on the workers to one read buffer.
+  void processOnWorker()
+  {
+    _processing = true;
+    auto self(this->shared_from_this());
+    _workers->post([self]() { self->processPending(); });
+  }
+
+  /// Runs on a worker. Only the processor and the thread safe send queue are touched, the rest of the connection
+  /// belongs to the io_context owning the socket.
+  void processPending()
+  {
+    bool close = false;
+    bool connected = false;
+    for(auto& packet : _pendingPackets) {
+      bool isConnect = packet->_header._controlPacketType == acatl::mqtt::ControlPacketType::Connect;
+      std::error_code errc;
+      std::tuple<acatl::mqtt::ConnectionState, acatl::mqtt::ControlPacket::Ptr> result = _mqttProcessor.processPacket(std::move(packet), errc);
+      if(std::get<1>(result)) {
+        addSendPacket(std::move(std::get<1>(result)));
+      }
+      if(errc) {
+        ACATL_ERRORLOG("Processor error: " << errc.message());
+        close = true;
+        break;
+      }
+      if(std::get<0>(result) == acatl::mqtt::ConnectionState::Close) {
+        close = true;
+        break;
+      }
+      connected = connected || isConnect;
+    }
+    _pendingPackets.clear();
+
+    auto self(this->shared_from_this());
+    asio::post(_socket.lowest_layer().get_executor(), [self, close, connected]() { self->processed(close, connected); });
+  }
+
+  void processed(bool close, bool connected)
+  {
+    _processing = false;
+    if(_drainAfterProcessing) {
+      _drainAfterProcessing = false;
+      _mqttProcessor.drainOfflineMessages(maxBatchSize);
+    }
+    if(close || _closeAfterProcessing) {
+      stopReading();
+      return;
+    }
+    if(connected) {
+      armKeepAlive(std::chrono::milliseconds(_mqttProcessor.keepAlive() * 1500), true);
+    }
     do_read();
   }
 
+  /// Hands a packet over to the io_context owning the socket. This is called from whatever thread processes the
+  /// publish, so only the pending queue is touched here. Serialization and writing happen on the owning io_context,
+  /// which drains everything that piled up in the meantime as one batch.
   void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet) override
   {
     ACATL_CLASSLOG(Connection, 3, "Server enqueues " << packet->_header._controlPacketType);
+    bool schedule = false;
+    acatl::mqtt::SendQueue::Result result;
     {
       std::unique_lock<std::mutex> guard(_sendMutex);
-      _sendPackets.push(std::move(packet));
+      result = _sendPackets.push(std::move(packet));
+      if(!_isSending && !_sendPackets.empty()) {
+        _isSending = true;
+        schedule = true;
+      }
+    }
+
+    auto self(this->shared_from_this());
+    switch(result) {
+      case acatl::mqtt::SendQueue::Result::Queued:
+        break;
+      case acatl::mqtt::SendQueue::Result::Dropped:
+        ACATL_CLASSLOG(Connection, 2, "Send queue is full, dropped packet");
+        break;
+      case acatl::mqtt::SendQueue::Result::Paused:
+        ACATL_CLASSLOG(Connection, 2, "Send queue is full, holding packets for slow consumer");
+        break;
+      case acatl::mqtt::SendQueue::Result::Overflow:
+        ACATL_ERRORLOG("Send queue is full, disconnecting slow consumer");
+        asio::post(_socket.lowest_layer().get_executor(), [self]() { self->do_close(); });
+        return;
+    }
+    if(schedule) {
+      asio::post(_socket.lowest_layer().get_executor(), [self]() { self->doSendPackages(); });
     }
-    sendPackages();
   }
 
-    void sendPackages()
-    {
-        {
-            std::unique_lock<std::mutex> guard(_sendMutex);
-            if(_isSending) {
-                return;
-            }
-            
-            _isSending = true;
-        }
-        doSendPackages();
+  void doSendPackages()
+  {
+    if(_streamReader) {
+      doSendStream();
+      return;
     }
-    
-    void doSendPackages()
-    {
-        ACATL_CLASSLOG(Connection, 3, "Server starts to send pending packets");
+    ACATL_CLASSLOG(Connection, 3, "Server starts to send pending packets");
+    size_t length = 0;
+    int64_t publishes = 0;
+    while(length == 0) {
+      {
         std::unique_lock<std::mutex> guard(_sendMutex);
         if(_sendPackets.empty()) {
-            ACATL_CLASSLOG(Connection, 3, "No more pending packets");
-            _isSending = false;
-            return;
+          ACATL_CLASSLOG(Connection, 3, "No more pending packets");
+          _isSending = false;
+          guard.unlock();
+          // refill from the offline queue of a resumed session, one batch per emptied send queue
+          if(_processing) {
+            // the processor belongs to a worker right now
+            _drainAfterProcessing = true;
+          } else {
+            _mqttProcessor.drainOfflineMessages(maxBatchSize);
+          }
+          return;
         }
-        
-        acatl::mqtt::ControlPacket::Ptr nextPacket = std::move(_sendPackets.front());
-        _sendPackets.pop();
-        
+        while(!_sendPackets.empty() && _sendBatch.size() < maxBatchSize) {
+          _sendBatch.push_back(_sendPackets.pop());
+          if(_latencyTracer) {
+            traceDequeued(*_sendBatch.back());
+          }
+          if(streamReader(*_sendBatch.back())) {
+            // the packets after a streamed payload have to wait until it was written completely
+            break;
+          }
+        }
+      }
+
+      for(auto& nextPacket : _sendBatch) {
         ACATL_CLASSLOG(Connection, 3, "Server sends packet " << nextPacket->_header._controlPacketType);
-        
+        if(nextPacket->_header._controlPacketType == acatl::mqtt::ControlPacketType::Publish) {
+          ++publishes;
+        }
+        // only the topic of a streamed publish is serialized, doSendStream writes the payload afterwards
+        _streamReader = streamReader(*nextPacket);
+
         std::error_code ec;
-        size_t length = 0;
-        if(!_serializer.serialize(std::move(nextPacket), _writeBuf, length, ec)) {
-            ACATL_ERRORLOG("Cannot serialize packet: " << ec.message());
-            // TODO should terminate connection here
-            _isSending = false;
-            return;
+        size_t packetLength = 0;
+        if(!_serializer.serialize(std::move(nextPacket), _packetBuf, packetLength, ec)) {
+          ACATL_ERRORLOG("Cannot serialize packet: " << ec.message());
+          _streamReader.reset();
+          // TODO should terminate connection here
+          continue;
         }
+        if(_writeBuf.size() < length + packetLength) {
+          _writeBuf.resize(length + packetLength);
+        }
+        std::copy_n(_packetBuf.begin(), packetLength, _writeBuf.begin() + static_cast<std::ptrdiff_t>(length));
+        length += packetLength;
+      }
+      _sendBatch.clear();
+    }
+
+    _metrics->add(acatl::mqtt::Metric::MessagesSent, publishes);
+    _metrics->add(acatl::mqtt::Metric::BytesSent, static_cast<int64_t>(length));
+    do_write(length);
+  }
 
-      do_write(length);
+  static acatl::mqtt::PayloadStream::Reader::Ptr streamReader(const acatl::mqtt::ControlPacket& packet)
+  {
+    if(packet._header._controlPacketType != acatl::mqtt::ControlPacketType::Publish) {
+      return acatl::mqtt::PayloadStream::Reader::Ptr();
+    }
+    return static_cast<const acatl::mqtt::PublishControlPacket&>(packet)._streamReader;
+  }
+
+  /// Writes the payload of a streamed publish chunk by chunk, as the publisher receives it. The send queue waits
+  /// meanwhile, because nothing may be written in the middle of the packet.
+  void doSendStream()
+  {
+    std::weak_ptr<Connection> weakSelf(this->shared_from_this());
+    acatl::mqtt::PayloadStream::Result result = _streamReader->read(_streamChunk, [weakSelf]() {
+      if(auto self = weakSelf.lock()) {
+        asio::post(self->_socket.lowest_layer().get_executor(), [self]() { self->doSendPackages(); });
+      }
+    });
+    switch(result) {
+      case acatl::mqtt::PayloadStream::Result::Chunk: {
+        _metrics->add(acatl::mqtt::Metric::BytesSent, static_cast<int64_t>(_streamChunk->size()));
+        auto self(this->shared_from_this());
+        asio::async_write(_socket(), asio::buffer(*_streamChunk), [self](std::error_code ec, std::size_t /*length*/) {
+          self->_streamChunk.reset();
+          if(!ec) {
+            self->doSendPackages();
+          } else {
+            ACATL_ERRORLOG("Write error: " << ec.message());
+            self->_streamReader.reset();
+          }
+        });
+        break;
+      }
+      case acatl::mqtt::PayloadStream::Result::Pending:
+        break;
+      case acatl::mqtt::PayloadStream::Result::Finished:
+        ACATL_CLASSLOG(Connection, 3, "Streamed payload sent");
+        _streamReader.reset();
+        doSendPackages();
+        break;
+      case acatl::mqtt::PayloadStream::Result::Aborted:
+        // the packet cannot be completed anymore, so the client has to drop it together with the connection
+        ACATL_ERRORLOG("Publisher aborted streamed payload, closing connection");
+        _streamReader.reset();
+        do_close();
+        break;
     }
+  }
+
+  /// Resumes reading once the subscribers of the stream caught up. The handler keeps the connection alive while it
+  /// waits without an outstanding read, the stream releases it when it ends.
+  void watchStream(const acatl::mqtt::PayloadStream::Ptr& stream)
+  {
+    auto self(this->shared_from_this());
+    stream->setResumeHandler([self]() {
+      asio::post(self->_socket.lowest_layer().get_executor(), [self]() {
+        ACATL_CLASSLOG(Connection, 2, "Streaming subscribers drained, resume reading");
+        self->do_read();
+      });
+    });
+  }
+
+  /// Ends the enqueue stage of a sampled delivery. Its write stage ends with the write of the batch, all sampled
+  /// deliveries of a batch share the start of the earliest.
+  void traceDequeued(const acatl::mqtt::ControlPacket& packet)
+  {
+    if(packet._header._controlPacketType != acatl::mqtt::ControlPacketType::Publish) {
+      return;
+    }
+    const auto& pub = static_cast<const acatl::mqtt::PublishControlPacket&>(packet);
+    if(!pub.traced()) {
+      return;
+    }
+    acatl::mqtt::LatencyTracer::Clock::time_point dequeued = _latencyTracer->record(acatl::mqtt::TraceStage::Enqueue,
+                                                                                    pub._traceTimestamp);
+    if(_tracedWrites++ == 0) {
+      _writeTraceStart = dequeued;
+    }
+  }
+
+  void traceWritten()
+  {
+    for(; _tracedWrites > 0; --_tracedWrites) {
+      _latencyTracer->record(acatl::mqtt::TraceStage::Write, _writeTraceStart);
+    }
+  }
 
   void do_write(std::size_t length)
   {
@@ -205,6 +588,9 @@ private:
       asio::async_write(_socket(), asio::buffer(_writeBuf, length), [self](std::error_code ec, std::size_t /*length*/) {
         if(!ec) {
           ACATL_CLASSLOG(Connection, 3, "Packet sending ready");
+          if(self->_tracedWrites > 0) {
+            self->traceWritten();
+          }
           self->doSendPackages();
         } else {
           ACATL_ERRORLOG("Write error: " << ec.message());
@@ -213,11 +599,113 @@ private:
     }
   }
 
+  void do_close()
+  {
+    stopReading();
+    asio::error_code ec;
+    _socket.lowest_layer().close(ec);
+  }
+
+  /// Picks the timing wheel of the io_context owning the socket and gives the client the connect timeout to send
+  /// its CONNECT. Has to run on that io_context, as every other keep alive operation.
+  void startKeepAlive()
+  {
+    if(!_keepAliveMonitor) {
+      return;
+    }
+    _keepAliveWheel = _keepAliveMonitor->wheel(_socket.lowest_layer().get_executor().context());
+    armKeepAlive(_connectTimeout, false);
+  }
+
+  /// Schedules the connection to be closed after timeout. With resetOnRead every received chunk of data restarts
+  /// the timeout, otherwise it is a hard deadline. A timeout of 0 disables the check.
+  void armKeepAlive(std::chrono::milliseconds timeout, bool resetOnRead)
+  {
+    if(!_keepAliveWheel) {
+      return;
+    }
+    if(timeout.count() == 0) {
+      stopKeepAlive();
+      return;
+    }
+    _keepAliveTicks = resetOnRead ? _keepAliveMonitor->ticks(timeout) : 0;
+    std::weak_ptr<Connection> weakSelf(this->shared_from_this());
+    _keepAliveWheel->schedule(_keepAliveTimer, _keepAliveMonitor->ticks(timeout), [weakSelf]() {
+      if(auto self = weakSelf.lock()) {
+        ACATL_CLASSLOG(Connection, 1, "Keep alive expired, closing connection");
+        self->do_close();
+      }
+    });
+  }
+
+  void touchKeepAlive()
+  {
+    if(_keepAliveWheel && _keepAliveTicks != 0) {
+      _keepAliveWheel->reset(_keepAliveTimer, _keepAliveTicks);
+    }
+  }
+
+  void stopKeepAlive()
+  {
+    if(_keepAliveWheel) {
+      _keepAliveWheel->cancel(_keepAliveTimer);
+    }
+  }
+
+  /// Records the packets the read completes. The capture has its own framing, so it also gets the packets the parser
+  /// rejects, and the streamed payloads in one piece.
+  void capture(size_t length)
+  {
+    std::error_code ec;
+    bool framed = _captureFramer.feed(_readBuf.data(), length, [this, &ec](const std::vector<uint8_t>& packet) {
+      if(!ec) {
+        _capture->write(_captureConnection, packet, ec);
+      }
+    }, ec);
+    if(!framed || ec) {
+      ACATL_ERRORLOG("Stop capturing connection " << _captureConnection << ": " << ec.message());
+      endCapture();
+    }
+  }
+
+  void endCapture()
+  {
+    if(_capture) {
+      std::error_code ec;
+      _capture->end(_captureConnection, ec);
+      _capture.reset();
+    }
+  }
+
+  /// Called whenever no more packets will be read. The subscribers of a half received payload cannot complete it.
+  void stopReading()
+  {
+    endCapture();
+    stopKeepAlive();
+    if(_keepAliveWheel) {
+      _keepAliveWheel->cancel(_throttleTimer);
+    }
+    if(_mqttParser.stream()) {
+      _mqttParser.stream()->abort();
+    }
+  }
+
+    static constexpr size_t maxBatchSize = 64;
+
     std::vector<uint8_t> _readBuf;
     std::vector<uint8_t> _writeBuf;
+    std::vector<uint8_t> _packetBuf;
+    std::vector<acatl::mqtt::ControlPacket::Ptr> _sendBatch;
+    acatl::mqtt::PayloadStream::Reader::Ptr _streamReader;
+    acatl::mqtt::PayloadStream::Chunk _streamChunk;
     std::mutex _sendMutex;
     bool _isSending;
-    std::queue<acatl::mqtt::ControlPacket::Ptr> _sendPackets;
+    // parsed packets of the current read, owned by a worker while _processing is set
+    std::vector<acatl::mqtt::ControlPacket::Ptr> _pendingPackets;
+    bool _processing;
+    bool _closeAfterProcessing;
+    bool _drainAfterProcessing;
+    acatl::mqtt::SendQueue _sendPackets;
     
     acatl::mqtt::MQTTParser _mqttParser;
   SocketType _socket;
@@ -225,6 +713,23 @@ private:
     acatl::mqtt::SubscriptionTreeManager& _subscriptionTreeManager;
     acatl::mqtt::SessionManager& _sessionManager;
     acatl::mqtt::Processor _mqttProcessor;
+    acatl::mqtt::FlowControl::Ptr _flowControl;
+  KeepAliveMonitor* _keepAliveMonitor;
+  acatl::mqtt::TimingWheel* _keepAliveWheel;
+  acatl::mqtt::TimingWheel::Handle _keepAliveTimer;
+  uint64_t _keepAliveTicks;
+  std::chrono::milliseconds _connectTimeout;
+  std::shared_ptr<std::atomic<uint64_t>> _rejectedPackets;
+  acatl::mqtt::Metrics::Ptr _metrics;
+  acatl::mqtt::LatencyTracer::Ptr _latencyTracer;
+  acatl::mqtt::WorkerPool* _workers;
+  acatl::mqtt::CaptureWriter::Ptr _capture;
+  uint32_t _captureConnection;
+  acatl::mqtt::PacketFramer _captureFramer;
+  uint64_t _traceCounter;
+  size_t _tracedWrites;
+  acatl::mqtt::LatencyTracer::Clock::time_point _writeTraceStart;
+  acatl::mqtt::TimingWheel::Handle _throttleTimer;
 };
 
 #endif
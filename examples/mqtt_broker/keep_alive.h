@@ -0,0 +1,129 @@
+//
+//  keep_alive.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_keep_alive_h
+#define acatl_mqtt_keep_alive_h
+
+#include <acatl/logging.h>
+
+#include <acatl_network/io_context_pool.h>
+
+#include "acatl_mqtt/mqtt_timing_wheel.h"
+
+#include <asio/steady_timer.hpp>
+
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+
+/// Tracks the keep alive of all connections. Every io_context of the pool owns one timing wheel, which is only
+/// touched by the thread running that context, and one steady_timer advancing the wheel once per tick. Arming and
+/// resetting the keep alive of a connection is therefore an O(1) operation without locks or a timer per connection.
+class KeepAliveMonitor
+{
+public:
+  KeepAliveMonitor(acatl::net::IoContextPool& ioContextPool, std::chrono::milliseconds tick)
+  : _tick(tick)
+  {
+    for(size_t i = 0; i < ioContextPool.size(); ++i) {
+      asio::io_context& context = ioContextPool.get(i);
+      _workers.emplace(&context, std::make_unique<Worker>(context));
+    }
+  }
+
+  void start()
+  {
+    for(auto& worker : _workers) {
+      worker.second->_start = std::chrono::steady_clock::now();
+      scheduleTick(*worker.second);
+    }
+  }
+
+  void stop()
+  {
+    for(auto& worker : _workers) {
+      asio::error_code ec;
+      worker.second->_timer.cancel(ec);
+    }
+  }
+
+  /// @return The wheel of the given context, which must only be used from the thread running that context.
+  acatl::mqtt::TimingWheel* wheel(asio::execution_context& context)
+  {
+    auto iter = _workers.find(&context);
+    return iter != _workers.end() ? &iter->second->_wheel : nullptr;
+  }
+
+  /// @return The number of ticks covering the given duration, rounded up.
+  uint64_t ticks(std::chrono::milliseconds duration) const
+  {
+    return static_cast<uint64_t>((duration.count() + _tick.count() - 1) / _tick.count());
+  }
+
+private:
+  struct Worker
+  {
+    explicit Worker(asio::io_context& context)
+    : _timer(context)
+    {}
+
+    asio::steady_timer _timer;
+    acatl::mqtt::TimingWheel _wheel;
+    std::chrono::steady_clock::time_point _start;
+  };
+
+  void scheduleTick(Worker& worker)
+  {
+    worker._timer.expires_after(_tick);
+    worker._timer.async_wait([this, &worker](const asio::error_code& ec) {
+      if(ec) {
+        return;
+      }
+      // catch up with the ticks missed while the thread was busy, so deadlines do not drift under load
+      uint64_t elapsed = static_cast<uint64_t>((std::chrono::steady_clock::now() - worker._start) / _tick);
+      if(elapsed > worker._wheel.now()) {
+        size_t expired = worker._wheel.advance(elapsed - worker._wheel.now());
+        if(expired > 0) {
+          ACATL_CLASSLOG(KeepAliveMonitor, 2, "Keep alive expired for " << expired << " connections");
+        }
+      }
+      scheduleTick(worker);
+    });
+  }
+
+  std::chrono::milliseconds _tick;
+  std::unordered_map<asio::execution_context*, std::unique_ptr<Worker>> _workers;
+};
+
+#endif
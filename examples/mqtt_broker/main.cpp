@@ -43,12 +43,20 @@
 
 #include <acatl_application/application.h>
 
+#include <acatl_mqtt/mqtt_cluster.h>
+#include <acatl_mqtt/mqtt_file_session_store.h>
+#include <acatl_mqtt/mqtt_offline_queue.h>
+#include <acatl_mqtt/mqtt_send_queue.h>
 #include <acatl_mqtt/mqtt_session_manager.h>
 #include <acatl_mqtt/mqtt_subscription_tree_manager.h>
 
+#include "cluster_summary.h"
 #include "connection.h"
+#include "sys_topics.h"
 
 #include <fstream>
+#include <functional>
+#include <sstream>
 #include <vector>
 
 ACATL_DECLARE_EXCEPTION(ConfigurationException, acatl::Exception);
@@ -67,6 +75,8 @@ public:
   typedef acatl::net::AsyncServer<ConnectionType, acatl::net::NullContext, MQTTContext> ServerType;
   typedef std::shared_ptr<ServerType> ServerTypePtr;
 
+  typedef acatl::mqtt::Cluster<acatl::net::Socket> ClusterType;
+
   MQTTBroker(int argc, char **argv)
   : acatl::Application(argc, argv)
   {}
@@ -79,6 +89,59 @@ public:
   {
     acatl::net::IoContextPool ioContextPool(std::thread::hardware_concurrency());
 
+    KeepAliveMonitor keepAliveMonitor(ioContextPool, _configuration._keepAliveTick);
+    _mqttContext._keepAliveMonitor = &keepAliveMonitor;
+    keepAliveMonitor.start();
+
+    // every io_context owns the subscriptions and publishes of a share of the topics
+    std::unique_ptr<acatl::mqtt::Partitions> partitions;
+    if(_configuration._hasPartitions) {
+      partitions.reset(new acatl::mqtt::Partitions(ioContextPool, _configuration._partitionOptions));
+      partitions->setLatencyTracer(_mqttContext._latencyTracer);
+      _mqttContext._partitions = partitions.get();
+      ACATL_CLASSLOG(MQTTBroker, 1, partitions->size() << " topic partitions by the first "
+                                    << _configuration._partitionOptions._levels << " levels");
+    }
+
+    // the io_context threads only parse and write, the workers process the packets. Destroyed before the pool, the
+    // tasks it still runs while shutting down post into the stopped io_contexts
+    std::unique_ptr<acatl::mqtt::WorkerPool> workers;
+    if(_configuration._hasWorkers) {
+      workers.reset(new acatl::mqtt::WorkerPool(_configuration._workerOptions));
+      _mqttContext._workers = workers.get();
+      ACATL_CLASSLOG(MQTTBroker, 1, workers->size() << " workers process the packets, fan-outs are split into chunks of "
+                                    << workers->chunkSize() << " sessions");
+    }
+
+    acatl::mqtt::SysPublisher::Ptr sysPublisher = std::make_shared<acatl::mqtt::SysPublisher>(_mqttContext._metrics,
+                                                                                               _subscriptionTreeManager,
+                                                                                               _sessionManager);
+    sysPublisher->setRetainedStore(_mqttContext._retainedStore);
+    sysPublisher->setSendQueueMemory(&_sendQueueMemory);
+    sysPublisher->setHeavyHitters(_mqttContext._heavyHitters);
+    asio::io_context& sysContext = ioContextPool.get();
+    if(partitions) {
+      sysPublisher->setPublishRouter(partitions->router(partitions->index(sysContext)));
+    }
+    SysTopics sysTopics(sysContext, sysPublisher, _configuration._sysInterval);
+    sysTopics.start();
+
+    // links to the other nodes of the cluster, spread over the io_contexts of the pool
+    acatl::net::NullContext context;
+    std::unique_ptr<ClusterType> cluster;
+    std::unique_ptr<ClusterSummary<ClusterType>> clusterSummary;
+    if(_configuration._hasCluster) {
+      cluster.reset(new ClusterType(_configuration._clusterOptions, _subscriptionTreeManager, _sessionManager));
+      for(const auto& peer : _configuration._clusterOptions._peers) {
+        cluster->addLink(ioContextPool.get(), peer, context);
+      }
+      clusterSummary.reset(new ClusterSummary<ClusterType>(ioContextPool.get(), *cluster, _configuration._clusterSummaryInterval));
+      cluster->start();
+      clusterSummary->start();
+      ACATL_CLASSLOG(MQTTBroker, 1, "Cluster node '" << _configuration._clusterOptions._nodeId << "' with "
+                                    << _configuration._clusterOptions._peers.size() << " peers");
+    }
+
     asio::signal_set signals(ioContextPool.get(), SIGINT, SIGTERM);
     signals.async_wait([&ioContextPool](const std::error_code& ec, int signal_number) {
       if(signal_number == SIGINT || signal_number == SIGTERM) {
@@ -86,6 +149,30 @@ public:
       }
     });
 
+    // kill -USR1 dumps the latency histograms of the sampled publishes and the heavy hitters, kill -HUP reloads the
+    // ACL rules from the configuration file
+    asio::signal_set controlSignals(ioContextPool.get());
+    std::function<void()> waitForControlSignal = [this, &controlSignals, &waitForControlSignal]() {
+      controlSignals.async_wait([this, &waitForControlSignal](const std::error_code& ec, int signal_number) {
+        if(ec) {
+          return;
+        }
+        if(signal_number == SIGUSR1) {
+          dumpStatistics();
+        } else if(signal_number == SIGHUP) {
+          reloadAcl();
+        }
+        waitForControlSignal();
+      });
+    };
+    if(_mqttContext._latencyTracer || _mqttContext._heavyHitters) {
+      controlSignals.add(SIGUSR1);
+    }
+    if(_mqttContext._authorizer) {
+      controlSignals.add(SIGHUP);
+    }
+    waitForControlSignal();
+
     SecureServerTypePtr secureServer;
     asio::ssl::context sslContext{asio::ssl::context::tlsv12_server};
     if(_configuration.hasSecureMQTT()) {
@@ -96,7 +183,6 @@ public:
     }
 
     ServerTypePtr server;
-    acatl::net::NullContext context;
     if(_configuration.hasMQTT()) {
       server = std::make_shared<ServerType>(ioContextPool, context, _configuration._host, _configuration._port, _mqttContext);
     }
@@ -106,13 +192,21 @@ public:
     }
 
     ioContextPool.run();
+    _mqttContext._keepAliveMonitor = nullptr;
+    _mqttContext._partitions = nullptr;
+    _mqttContext._workers = nullptr;
 
     return 0;
   }
 
+  /// mqtt_broker [CONFIGURATION], by default mqtt_broker.json next to the executable. Cluster mode is off unless the
+  /// configuration has a cluster section, mqtt_broker_cluster.json shows one node of three. Several nodes of a cluster
+  /// on one host need a configuration each. Likewise every client may publish and subscribe to all topics unless there
+  /// is an acl section, mqtt_broker_acl.json confines devices to their own topics.
   virtual bool setUp(const acatl::StringVector& args)
   {
-    fs::path path = fs::absolute(args[0]).parent_path() / "mqtt_broker.json";
+    fs::path path = args.size() > 1 ? fs::absolute(args[1]) : fs::absolute(args[0]).parent_path() / "mqtt_broker.json";
+    _configurationPath = path;
     std::error_code ec;
     if(fs::exists(path, ec) && !ec) {
       json jsonConfiguration;
@@ -131,15 +225,133 @@ public:
       _configuration.setDefaults();
     }
 
+    _mqttContext._sendQueueLimits = _configuration._sendQueueLimits;
+    _mqttContext._flowControlHighWatermark = _configuration._flowControlHighWatermark;
+    _mqttContext._flowControlLowWatermark = _configuration._flowControlLowWatermark;
+    _mqttContext._retainedStore = std::make_shared<acatl::mqtt::RetainedStore>();
+    _mqttContext._connectTimeout = _configuration._connectTimeout;
+    _mqttContext._streamingOptions = _configuration._streamingOptions;
+    _mqttContext._parserLimits = _configuration._parserLimits;
+    _mqttContext._rateLimits = _configuration._rateLimits;
+    _mqttContext._topicAliasMaximum = _configuration._topicAliasMaximum;
+    if(_configuration._traceSampleEvery != 0) {
+      _mqttContext._latencyTracer = std::make_shared<acatl::mqtt::LatencyTracer>(_configuration._traceSampleEvery);
+    }
+    if(_configuration._hasAcl) {
+      _mqttContext._authorizer = std::make_shared<acatl::mqtt::Authorizer>(_configuration._aclRules);
+      ACATL_CLASSLOG(MQTTBroker, 1, "Loaded " << _configuration._aclRules.size() << " ACL rules");
+    }
+    if(_configuration._hasCluster) {
+      // client IDs of cluster links are refused, unless a client presents the credentials of the cluster
+      _mqttContext._clusterCredentials = std::make_shared<acatl::mqtt::ClusterCredentials>(
+        acatl::mqtt::ClusterCredentials{_configuration._clusterOptions._userName, _configuration._clusterOptions._password});
+    }
+    if(_configuration._heavyHitterOptions._topK != 0) {
+      _mqttContext._heavyHitters = std::make_shared<acatl::mqtt::HeavyHitters>(_configuration._heavyHitterOptions);
+    }
+    _sendQueueMemory.setWatermark(_configuration._memoryWatermark);
+    _sessionManager.setInflightOptions(_configuration._inflightOptions);
+
+    if(!_configuration._sessionStorePath.empty()) {
+      _sessionStore = std::make_shared<acatl::mqtt::FileSessionStore>(_configuration._sessionStorePath,
+                                                                       _configuration._sessionStoreOptions);
+      if(!_sessionStore->open(ec)) {
+        ACATL_THROW(ConfigurationException,
+                    "Session store '" << _configuration._sessionStorePath << "' cannot be opened: " << ec.message());
+      }
+      ACATL_CLASSLOG(MQTTBroker, 1, "Session store contains " << _sessionStore->count() << " sessions");
+      _sessionManager.setSessionStore(_sessionStore);
+    }
+
+    if(!_configuration._capturePath.empty()) {
+      _mqttContext._capture = std::make_shared<acatl::mqtt::CaptureWriter>(_configuration._capturePath);
+      if(!_mqttContext._capture->open(ec)) {
+        ACATL_THROW(ConfigurationException,
+                    "Capture file '" << _configuration._capturePath << "' cannot be created: " << ec.message());
+      }
+      ACATL_CLASSLOG(MQTTBroker, 1, "Capturing the received packets to '" << _configuration._capturePath << "'");
+    }
+
+    if(_configuration._hasOfflineQueue) {
+      const std::string& spoolDirectory = _configuration._offlineQueueOptions._spoolDirectory;
+      if(!spoolDirectory.empty()) {
+        if(!fs::create_directories(spoolDirectory, ec) && ec) {
+          ACATL_THROW(ConfigurationException, "Spool directory '" << spoolDirectory << "' cannot be created: " << ec.message());
+        }
+        removeSegments(spoolDirectory);
+      }
+      _sessionManager.setOfflineStorage(std::make_shared<acatl::mqtt::OfflineStorage>(_configuration._offlineQueueOptions));
+    }
+
     return true;
   }
 
+  /// Spilled messages do not survive a restart, so the segment files of the last run are deleted. The directory
+  /// is not owned by the broker, all other files in it are left alone.
+  static void removeSegments(const std::string& spoolDirectory)
+  {
+    std::error_code ec;
+    std::vector<fs::path> segments;
+    for(fs::directory_iterator iter(spoolDirectory, ec), end; !ec && iter != end; iter.increment(ec)) {
+      if(iter->path().extension().string() == ".seg" && fs::is_regular_file(iter->status(ec))) {
+        segments.push_back(iter->path());
+      }
+    }
+    for(const auto& segment : segments) {
+      if(!fs::remove(segment, ec)) {
+        ACATL_ERRORLOG("Spool segment '" << segment.string() << "' cannot be removed: " << ec.message());
+      }
+    }
+  }
+
   virtual void tearDown(int exitCode)
   {
     ACATL_CLASSLOG(MQTTBroker, 1, "exit code: " << exitCode);
+    ACATL_CLASSLOG(MQTTBroker, 1, "Rejected " << _mqttContext._rejectedPackets->load() << " packets exceeding the limits");
+    dumpStatistics();
+    if(_sessionStore) {
+      std::error_code ec;
+      _sessionStore->close(ec);
+    }
+    if(_mqttContext._capture) {
+      std::error_code ec;
+      _mqttContext._capture->close(ec);
+      ACATL_CLASSLOG(MQTTBroker, 1, "Captured " << _mqttContext._capture->records() << " packets");
+    }
   }
 
 private:
+  void dumpStatistics() const
+  {
+    if(_mqttContext._latencyTracer) {
+      std::ostringstream dump;
+      _mqttContext._latencyTracer->dump(dump);
+      ACATL_CLASSLOG(MQTTBroker, 1, "Latency of 1 in " << _mqttContext._latencyTracer->sampleEvery() << " publishes:\n" << dump.str());
+    }
+    if(_mqttContext._heavyHitters) {
+      json report = acatl::mqtt::HeavyHitters::toJson(_mqttContext._heavyHitters->report());
+      ACATL_CLASSLOG(MQTTBroker, 1, "Heavy hitters: " << report.dump());
+    }
+  }
+
+  /// Reads the ACL rules again. Connections compile them anew with their next publish or subscribe, a broken
+  /// configuration keeps the current rules.
+  void reloadAcl()
+  {
+    try {
+      std::ifstream config{_configurationPath};
+      json jsonConfiguration = json::parse(config);
+      if(jsonConfiguration.find("acl") == jsonConfiguration.end()) {
+        ACATL_ERRORLOG("Configuration has no ACL anymore, keeping the current rules");
+        return;
+      }
+      acatl::mqtt::AclRules rules = Configuration::parseAclRules(jsonConfiguration["acl"]);
+      _mqttContext._authorizer->reload(rules);
+      ACATL_CLASSLOG(MQTTBroker, 1, "Reloaded " << rules.size() << " ACL rules");
+    } catch(const std::exception& ex) {
+      ACATL_ERRORLOG("Cannot reload the ACL rules: " << ex.what());
+    }
+  }
 
   class Configuration
   {
@@ -147,6 +359,20 @@ private:
     Configuration()
     : _port(0)
     , _securePort(0)
+    , _memoryWatermark(0)
+    , _flowControlHighWatermark(0)
+    , _flowControlLowWatermark(0)
+    , _hasOfflineQueue(false)
+    , _keepAliveTick(100)
+    , _connectTimeout(10)
+    , _topicAliasMaximum(0)
+    , _sysInterval(10)
+    , _traceSampleEvery(0)
+    , _hasAcl(false)
+    , _hasCluster(false)
+    , _clusterSummaryInterval(1000)
+    , _hasPartitions(false)
+    , _hasWorkers(false)
     {
     }
 
@@ -180,6 +406,254 @@ private:
         _host = mqtt.value("host", "127.0.0.1");
         _port = mqtt.value("port", static_cast<acatl::net::Port>(1883));
       }
+
+      if(config.find("send-queue") != config.end()) {
+        const json& sendQueue = config["send-queue"];
+        _sendQueueLimits._maxPackets = sendQueue.value("max-packets", static_cast<size_t>(0));
+        _sendQueueLimits._maxBytes = sendQueue.value("max-bytes", static_cast<size_t>(0));
+        _sendQueueLimits._policy = parsePolicy(sendQueue.value("policy", "drop-oldest"));
+        _memoryWatermark = sendQueue.value("memory-watermark", static_cast<size_t>(0));
+      }
+
+      if(config.find("flow-control") != config.end()) {
+        const json& flowControl = config["flow-control"];
+        _flowControlHighWatermark = flowControl.value("high-watermark", static_cast<size_t>(0));
+        _flowControlLowWatermark = flowControl.value("low-watermark", _flowControlHighWatermark / 2);
+      }
+
+      if(config.find("session-store") != config.end()) {
+        const json& sessionStore = config["session-store"];
+        _sessionStorePath = sessionStore.value("path", "");
+        _sessionStoreOptions._syncEvery = sessionStore.value("sync-every", _sessionStoreOptions._syncEvery);
+        _sessionStoreOptions._compactionRatio = sessionStore.value("compaction-ratio", _sessionStoreOptions._compactionRatio);
+      }
+
+      if(config.find("capture") != config.end()) {
+        _capturePath = config["capture"].value("path", "");
+      }
+
+      if(config.find("offline-queue") != config.end()) {
+        const json& offlineQueue = config["offline-queue"];
+        _hasOfflineQueue = true;
+        _offlineQueueOptions._memoryBudget = offlineQueue.value("memory-budget", _offlineQueueOptions._memoryBudget);
+        _offlineQueueOptions._maxMessages = offlineQueue.value("max-messages", _offlineQueueOptions._maxMessages);
+        _offlineQueueOptions._messageExpiry = std::chrono::seconds(offlineQueue.value("message-expiry", 0));
+        _offlineQueueOptions._spoolDirectory = offlineQueue.value("spool-directory", "");
+        _offlineQueueOptions._segmentSize = offlineQueue.value("segment-size", _offlineQueueOptions._segmentSize);
+      }
+
+      if(config.find("keep-alive") != config.end()) {
+        const json& keepAlive = config["keep-alive"];
+        _keepAliveTick = std::chrono::milliseconds(keepAlive.value("tick", _keepAliveTick.count()));
+        _connectTimeout = std::chrono::seconds(keepAlive.value("connect-timeout", _connectTimeout.count()));
+        if(_keepAliveTick.count() <= 0) {
+          ACATL_THROW(ConfigurationException, "Keep alive tick has to be positive");
+        }
+      }
+
+      if(config.find("limits") != config.end()) {
+        const json& limits = config["limits"];
+        _parserLimits._maxPacketSize = limits.value("max-packet-size", _parserLimits._maxPacketSize);
+        _parserLimits._maxTopicLength = limits.value("max-topic-length", _parserLimits._maxTopicLength);
+        _parserLimits._maxSubscriptions = limits.value("max-subscriptions", _parserLimits._maxSubscriptions);
+      }
+
+      // Without a client rate and topic limits the rate limiter stays off, as in the shipped configuration.
+      // "client" : { "rate" : 10000, "burst" : 1000 } caps every client, a topic limit such as
+      // { "prefix" : "$SYS/", "rate" : 10, "burst" : 10 } applies to publishes below its prefix.
+      if(config.find("rate-limit") != config.end()) {
+        const json& rateLimit = config["rate-limit"];
+        std::string policy = rateLimit.value("policy", "throttle");
+        if(policy == "throttle") {
+          _rateLimits._policy = acatl::mqtt::RateLimitPolicy::Throttle;
+        } else if(policy == "drop") {
+          _rateLimits._policy = acatl::mqtt::RateLimitPolicy::Drop;
+        } else {
+          ACATL_THROW(ConfigurationException, "Unknown rate limit policy '" << policy << "'");
+        }
+        if(rateLimit.find("client") != rateLimit.end()) {
+          _rateLimits._client = parseRateLimit(rateLimit["client"]);
+        }
+        if(rateLimit.find("topics") != rateLimit.end()) {
+          for(const json& topic : rateLimit["topics"]) {
+            acatl::mqtt::TopicRateLimit topicRateLimit;
+            topicRateLimit._prefix = topic.value("prefix", "");
+            topicRateLimit._limit = parseRateLimit(topic);
+            _rateLimits._topics.push_back(topicRateLimit);
+          }
+        }
+      }
+
+      if(config.find("streaming") != config.end()) {
+        const json& streaming = config["streaming"];
+        _streamingOptions._threshold = streaming.value("threshold", _streamingOptions._threshold);
+        _streamingOptions._chunkSize = streaming.value("chunk-size", _streamingOptions._chunkSize);
+        _streamingOptions._budget = streaming.value("budget", _streamingOptions._budget);
+        if(_streamingOptions._chunkSize == 0 || _streamingOptions._budget < _streamingOptions._chunkSize) {
+          ACATL_THROW(ConfigurationException, "Streaming chunk size has to be positive and must not exceed the budget");
+        }
+      }
+
+      if(config.find("inflight") != config.end()) {
+        const json& inflight = config["inflight"];
+        _inflightOptions._receiveMaximum = inflight.value("receive-maximum", _inflightOptions._receiveMaximum);
+        _inflightOptions._maxPending = inflight.value("max-pending", _inflightOptions._maxPending);
+        if(_inflightOptions._receiveMaximum == 0) {
+          ACATL_THROW(ConfigurationException, "In-flight receive maximum has to be positive");
+        }
+      }
+
+      if(config.find("mqtt5") != config.end()) {
+        const json& mqtt5 = config["mqtt5"];
+        _topicAliasMaximum = mqtt5.value("topic-alias-maximum", _topicAliasMaximum);
+      }
+
+      if(config.find("tracing") != config.end()) {
+        const json& tracing = config["tracing"];
+        _traceSampleEvery = tracing.value("sample-every", _traceSampleEvery);
+      }
+
+      if(config.find("acl") != config.end()) {
+        _hasAcl = true;
+        _aclRules = parseAclRules(config["acl"]);
+      }
+
+      if(config.find("heavy-hitters") != config.end()) {
+        const json& heavyHitters = config["heavy-hitters"];
+        _heavyHitterOptions._topK = heavyHitters.value("top-k", _heavyHitterOptions._topK);
+        _heavyHitterOptions._width = heavyHitters.value("width", _heavyHitterOptions._width);
+        _heavyHitterOptions._depth = heavyHitters.value("depth", _heavyHitterOptions._depth);
+        if(_heavyHitterOptions._width == 0 || _heavyHitterOptions._depth == 0) {
+          ACATL_THROW(ConfigurationException, "Heavy hitter sketch width and depth have to be positive");
+        }
+      }
+
+      if(config.find("cluster") != config.end()) {
+        const json& cluster = config["cluster"];
+        _hasCluster = true;
+        _clusterOptions._nodeId = cluster.value("node-id", "");
+        if(_clusterOptions._nodeId.empty()) {
+          ACATL_THROW(ConfigurationException, "Cluster node id must not be empty");
+        }
+        if(cluster.find("peers") != cluster.end()) {
+          for(const json& peer : cluster["peers"]) {
+            acatl::mqtt::ClusterPeer clusterPeer;
+            clusterPeer._host = peer.value("host", "127.0.0.1");
+            clusterPeer._port = peer.value("port", clusterPeer._port);
+            _clusterOptions._peers.push_back(clusterPeer);
+          }
+        }
+        _clusterOptions._summaryDepth = cluster.value("summary-depth", _clusterOptions._summaryDepth);
+        _clusterSummaryInterval = std::chrono::milliseconds(cluster.value("summary-interval", _clusterSummaryInterval.count()));
+        if(_clusterSummaryInterval.count() <= 0) {
+          ACATL_THROW(ConfigurationException, "Cluster summary interval has to be positive");
+        }
+        uint32_t qos = cluster.value("qos", static_cast<uint32_t>(_clusterOptions._qos));
+        if(qos > 2) {
+          ACATL_THROW(ConfigurationException, "Cluster QoS has to be 0, 1 or 2");
+        }
+        _clusterOptions._qos = static_cast<acatl::mqtt::QoSLevel>(qos);
+        _clusterOptions._userName = cluster.value("user", "");
+        _clusterOptions._password = cluster.value("password", "");
+        if(_clusterOptions._password.empty()) {
+          ACATL_THROW(ConfigurationException, "Cluster password must not be empty, it authenticates the links of the nodes");
+        }
+      }
+
+      if(config.find("partitions") != config.end()) {
+        const json& partitions = config["partitions"];
+        _partitionOptions._levels = partitions.value("levels", _partitionOptions._levels);
+        _partitionOptions._queueCapacity = partitions.value("queue-capacity", _partitionOptions._queueCapacity);
+        _hasPartitions = _partitionOptions._levels != 0;
+        if(_hasPartitions) {
+          if(_partitionOptions._queueCapacity == 0) {
+            ACATL_THROW(ConfigurationException, "Partition queue capacity has to be positive");
+          }
+          // a payload stream can't be handed to another thread, the cluster announces the shared subscription tree
+          if(_streamingOptions._threshold != 0) {
+            ACATL_THROW(ConfigurationException, "Partitions cannot be combined with streaming");
+          }
+          if(_hasCluster) {
+            ACATL_THROW(ConfigurationException, "Partitions cannot be combined with a cluster");
+          }
+        }
+      }
+
+      if(config.find("workers") != config.end()) {
+        const json& workers = config["workers"];
+        _workerOptions._threads = workers.value("threads", _workerOptions._threads);
+        _workerOptions._fanOutChunk = workers.value("fan-out-chunk", _workerOptions._fanOutChunk);
+        _hasWorkers = _workerOptions._threads != 0;
+        if(_hasWorkers) {
+          if(_workerOptions._fanOutChunk == 0) {
+            ACATL_THROW(ConfigurationException, "Worker fan-out chunk has to be positive");
+          }
+          // stream readers have to attach before the next chunk is parsed, the routers of the partitions belong to
+          // the io_context threads
+          if(_streamingOptions._threshold != 0) {
+            ACATL_THROW(ConfigurationException, "Workers cannot be combined with streaming");
+          }
+          if(_hasPartitions) {
+            ACATL_THROW(ConfigurationException, "Workers cannot be combined with partitions");
+          }
+        }
+      }
+
+      if(config.find("sys") != config.end()) {
+        const json& sys = config["sys"];
+        _sysInterval = std::chrono::seconds(sys.value("interval", _sysInterval.count()));
+        if(_sysInterval.count() < 0) {
+          ACATL_THROW(ConfigurationException, "$SYS interval must not be negative");
+        }
+      }
+    }
+
+    static acatl::mqtt::AclRules parseAclRules(const json& config)
+    {
+      acatl::mqtt::AclRules rules;
+      if(config.find("rules") == config.end()) {
+        return rules;
+      }
+      for(const json& rule : config["rules"]) {
+        std::string access = rule.value("access", "readwrite");
+        acatl::mqtt::AclAccess aclAccess;
+        if(access == "read") {
+          aclAccess = acatl::mqtt::AclAccess::Read;
+        } else if(access == "write") {
+          aclAccess = acatl::mqtt::AclAccess::Write;
+        } else if(access == "readwrite") {
+          aclAccess = acatl::mqtt::AclAccess::ReadWrite;
+        } else {
+          ACATL_THROW(ConfigurationException, "Unknown ACL access '" << access << "'");
+        }
+        rules.emplace_back(rule.value("topic", ""), aclAccess, rule.value("user", ""));
+      }
+      return rules;
+    }
+
+    static acatl::mqtt::RateLimit parseRateLimit(const json& config)
+    {
+      acatl::mqtt::RateLimit limit;
+      limit._rate = config.value("rate", limit._rate);
+      limit._burst = config.value("burst", limit._burst);
+      if(limit._rate < 0) {
+        ACATL_THROW(ConfigurationException, "Rate limit has to be positive");
+      }
+      return limit;
+    }
+
+    static acatl::mqtt::SlowConsumerPolicy parsePolicy(const std::string& policy)
+    {
+      if(policy == "drop-oldest") {
+        return acatl::mqtt::SlowConsumerPolicy::DropOldest;
+      } else if(policy == "drop-newest") {
+        return acatl::mqtt::SlowConsumerPolicy::DropNewest;
+      } else if(policy == "disconnect") {
+        return acatl::mqtt::SlowConsumerPolicy::Disconnect;
+      } else if(policy == "pause") {
+        return acatl::mqtt::SlowConsumerPolicy::Pause;
+      }
+      ACATL_THROW(ConfigurationException, "Unknown send queue policy '" << policy << "'");
     }
 
     bool hasSecureMQTT() const
@@ -201,12 +675,50 @@ private:
     fs::path _keyFilePath;
     fs::path _caCertFilePath;
     bool _noVerify;
+
+    acatl::mqtt::SendQueueLimits _sendQueueLimits;
+    size_t _memoryWatermark;
+    size_t _flowControlHighWatermark;
+    size_t _flowControlLowWatermark;
+    std::string _sessionStorePath;
+    acatl::mqtt::FileSessionStoreOptions _sessionStoreOptions;
+    // an empty path disables the capture
+    std::string _capturePath;
+    bool _hasOfflineQueue;
+    acatl::mqtt::OfflineQueueOptions _offlineQueueOptions;
+    std::chrono::milliseconds _keepAliveTick;
+    std::chrono::seconds _connectTimeout;
+    acatl::mqtt::InflightOptions _inflightOptions;
+    acatl::mqtt::StreamingOptions _streamingOptions;
+    acatl::mqtt::ParserLimits _parserLimits;
+    acatl::mqtt::RateLimitOptions _rateLimits;
+    uint16_t _topicAliasMaximum;
+    // 0 disables the $SYS topics
+    std::chrono::seconds _sysInterval;
+    // traces 1 in N publishes, 0 disables tracing
+    uint32_t _traceSampleEvery;
+    acatl::mqtt::HeavyHitterOptions _heavyHitterOptions;
+    bool _hasAcl;
+    acatl::mqtt::AclRules _aclRules;
+    bool _hasCluster;
+    acatl::mqtt::ClusterOptions _clusterOptions;
+    // how often new interest of the local clients is announced to the peers
+    std::chrono::milliseconds _clusterSummaryInterval;
+    // 0 levels keep one subscription tree for all threads
+    bool _hasPartitions;
+    acatl::mqtt::PartitionOptions _partitionOptions;
+    // 0 threads process the packets on the io_context threads
+    bool _hasWorkers;
+    acatl::mqtt::WorkerOptions _workerOptions;
   };
 
   Configuration _configuration;
   acatl::mqtt::SubscriptionTreeManager _subscriptionTreeManager;
   acatl::mqtt::SessionManager _sessionManager;
-  MQTTContext _mqttContext{_subscriptionTreeManager, _sessionManager};
+  acatl::mqtt::SendQueueMemory _sendQueueMemory;
+  acatl::mqtt::FileSessionStore::Ptr _sessionStore;
+  fs::path _configurationPath;
+  MQTTContext _mqttContext{_subscriptionTreeManager, _sessionManager, _sendQueueMemory};
 };
 
 
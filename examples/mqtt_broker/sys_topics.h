@@ -0,0 +1,94 @@
+//
+//  sys_topics.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_sys_topics_h
+#define acatl_mqtt_sys_topics_h
+
+#include <acatl/logging.h>
+
+#include "acatl_mqtt/mqtt_sys_publisher.h"
+
+#include <asio/steady_timer.hpp>
+
+#include <chrono>
+
+
+/// Publishes the $SYS topics of the broker once per interval. The timer runs on a single io_context, so the
+/// publisher is never called concurrently.
+class SysTopics
+{
+public:
+  SysTopics(asio::io_context& context, acatl::mqtt::SysPublisher::Ptr publisher, std::chrono::seconds interval)
+  : _timer(context)
+  , _publisher(publisher)
+  , _interval(interval)
+  {}
+
+  void start()
+  {
+    if(_interval.count() == 0) {
+      return;
+    }
+    schedule();
+  }
+
+  void stop()
+  {
+    asio::error_code ec;
+    _timer.cancel(ec);
+  }
+
+private:
+  void schedule()
+  {
+    _timer.expires_after(_interval);
+    _timer.async_wait([this](const asio::error_code& ec) {
+      if(ec) {
+        return;
+      }
+      std::error_code errc;
+      size_t published = _publisher->publish(errc);
+      if(errc) {
+        ACATL_ERRORLOG("Cannot publish $SYS topics: " << errc.message());
+      }
+      ACATL_CLASSLOG(SysTopics, 3, "Published " << published << " $SYS topics");
+      schedule();
+    });
+  }
+
+  asio::steady_timer _timer;
+  acatl::mqtt::SysPublisher::Ptr _publisher;
+  std::chrono::seconds _interval;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Runs clusters of 1 to MAX_NODES mqtt_broker processes on loopback and measures their aggregate throughput with
+# mqtt_loadgen. Every node links to all others. Clients grow with the nodes, publisher i and subscriber i sit on
+# neighbouring nodes, so every message crosses a cluster link.
+#
+# usage: cluster_bench.sh <mqtt_broker> <mqtt_loadgen> [MAX_NODES] [further mqtt_loadgen options]
+#
+# CLIENTS_PER_NODE (default 4) publishers and subscribers connect to each node, BASE_PORT (default 18830) is the port
+# of the first node.
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 <mqtt_broker> <mqtt_loadgen> [MAX_NODES] [further mqtt_loadgen options]" >&2
+  exit 1
+fi
+
+BROKER=$1
+LOADGEN=$2
+MAX_NODES=${3:-3}
+shift 2
+[ $# -gt 0 ] && shift
+CLIENTS_PER_NODE=${CLIENTS_PER_NODE:-4}
+BASE_PORT=${BASE_PORT:-18830}
+
+WORK=$(mktemp -d)
+PIDS=""
+trap 'kill $PIDS 2>/dev/null; rm -rf "$WORK"' EXIT INT TERM
+
+for NODES in $(seq 1 "$MAX_NODES"); do
+  PORTS=""
+  for I in $(seq 0 $((NODES - 1))); do
+    PORTS="$PORTS${PORTS:+,}$((BASE_PORT + I))"
+  done
+
+  for I in $(seq 0 $((NODES - 1))); do
+    PEERS=""
+    for J in $(seq 0 $((NODES - 1))); do
+      if [ "$J" != "$I" ]; then
+        PEERS="$PEERS${PEERS:+, }{ \"host\" : \"127.0.0.1\", \"port\" : $((BASE_PORT + J)) }"
+      fi
+    done
+    cat > "$WORK/node$I.json" <<EOF
+{
+    "mqtt" : { "host" : "127.0.0.1", "port" : $((BASE_PORT + I)) },
+    "sys" : { "interval" : 0 },
+    "cluster" : {
+        "node-id" : "node$I",
+        "peers" : [ $PEERS ],
+        "user" : "cluster",
+        "password" : "cluster-bench",
+        "summary-interval" : 100
+    }
+}
+EOF
+    "$BROKER" "$WORK/node$I.json" > "$WORK/node$I.log" 2>&1 &
+    PIDS="$PIDS $!"
+  done
+  sleep 1
+
+  CLIENTS=$((NODES * CLIENTS_PER_NODE))
+  "$LOADGEN" --nodes "$PORTS" --publishers $CLIENTS --subscribers $CLIENTS --topic 'bench/%i' --filter 'bench/%i' \
+             --settle 500 "$@"
+
+  kill $PIDS 2>/dev/null
+  wait $PIDS 2>/dev/null
+  PIDS=""
+done
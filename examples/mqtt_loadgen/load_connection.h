@@ -0,0 +1,456 @@
+//
+//  load_connection.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_load_connection_h
+#define acatl_mqtt_load_connection_h
+
+#include <acatl_network/socket_type.h>
+
+#include <acatl_mqtt/mqtt_parser.h>
+#include <acatl_mqtt/mqtt_serializer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+struct LoadOptions
+{
+  std::string _clientIdPrefix{"loadgen"};
+  // %i is replaced by the index of the publisher or subscriber
+  std::string _topic{"loadgen/%i"};
+  std::string _filter{"loadgen/#"};
+  size_t _payloadSize{64};
+  acatl::mqtt::QoSLevel _qos{acatl::mqtt::QoSLevel::AtMostOnce};
+  // publishes per second and publisher, 0 publishes as fast as the window allows
+  double _rate{0};
+  // unacknowledged publishes per publisher with QoS 1 and 2, publishes per write with QoS 0
+  size_t _window{64};
+};
+
+
+/// Counters of one connection, merged after the run.
+struct LoadStats
+{
+  void merge(const LoadStats& other)
+  {
+    if(other._received != 0) {
+      if(_received == 0 || other._firstReceive < _firstReceive) {
+        _firstReceive = other._firstReceive;
+      }
+      _lastReceive = std::max(_lastReceive, other._lastReceive);
+    }
+    _published += other._published;
+    _acknowledged += other._acknowledged;
+    _received += other._received;
+    _bytesOut += other._bytesOut;
+    _bytesIn += other._bytesIn;
+    _latencies.insert(_latencies.end(), other._latencies.begin(), other._latencies.end());
+  }
+
+  uint64_t _published{0};
+  uint64_t _acknowledged{0};
+  uint64_t _received{0};
+  uint64_t _bytesOut{0};
+  uint64_t _bytesIn{0};
+  // publish to receive in nanoseconds, one sample per received publish
+  std::vector<uint64_t> _latencies;
+  std::chrono::steady_clock::time_point _firstReceive;
+  std::chrono::steady_clock::time_point _lastReceive;
+};
+
+
+/// Connections of a run report to the run once they are subscribed or ready to publish, or when they fail.
+struct LoadRun
+{
+  std::atomic<size_t> _ready{0};
+  std::atomic<size_t> _failed{0};
+};
+
+
+/// A publisher or subscriber of the load generator. Publishers embed the send time in the first eight bytes of the
+/// payload, subscribers take the difference to the receive time. Both run on a single io_context, the methods
+/// other than stats() have to be called on it.
+template<typename Socket>
+class LoadConnection : public std::enable_shared_from_this<LoadConnection<Socket>>
+{
+public:
+  typedef Socket SocketType;
+  typedef std::shared_ptr<LoadConnection> Ptr;
+
+  LoadConnection(SocketType&& socket, asio::io_context& context, bool publisher, size_t index,
+                 const LoadOptions& options, LoadRun& run)
+  : _socket(std::move(socket))
+  , _context(context)
+  , _timer(context)
+  , _publisher(publisher)
+  , _index(index)
+  , _options(options)
+  , _run(run)
+  {
+    _readBuf.resize(64 * 1024);
+  }
+
+  void start(const asio::ip::tcp::endpoint& endpoint)
+  {
+    auto self(this->shared_from_this());
+    _socket.lowest_layer().async_connect(endpoint, [self](const std::error_code& ec) {
+      if(ec) {
+        self->fail(ec);
+        return;
+      }
+      asio::error_code ignored;
+      self->_socket.lowest_layer().set_option(asio::ip::tcp::no_delay(true), ignored);
+      self->_socket.clientHandshake([self](const std::error_code& ec) {
+        if(ec) {
+          self->fail(ec);
+          return;
+        }
+        self->connect();
+      });
+    });
+  }
+
+  void startPublishing()
+  {
+    _publishing = true;
+    _publishStart = std::chrono::steady_clock::now();
+    pump();
+  }
+
+  void stopPublishing()
+  {
+    _publishing = false;
+    asio::error_code ignored;
+    _timer.cancel(ignored);
+  }
+
+  void close()
+  {
+    stopPublishing();
+    _closed = true;
+    asio::error_code ignored;
+    _socket.lowest_layer().close(ignored);
+  }
+
+  asio::io_context& context()
+  {
+    return _context;
+  }
+
+  const LoadStats& stats() const
+  {
+    return _stats;
+  }
+
+private:
+  std::string substitute(const std::string& pattern) const
+  {
+    std::string result = pattern;
+    std::string index = std::to_string(_index);
+    for(size_t pos = result.find("%i"); pos != std::string::npos; pos = result.find("%i", pos + index.size())) {
+      result.replace(pos, 2, index);
+    }
+    return result;
+  }
+
+  void connect()
+  {
+    auto connect = std::make_unique<acatl::mqtt::ConnectControlPacket>();
+    connect->_protocolLevel = acatl::mqtt::protocolLevel311;
+    connect->_cleanSession = true;
+    // no PINGREQ is sent, so the broker must not expect one
+    connect->_keepAlive = 0;
+    connect->_clientId = _options._clientIdPrefix + (_publisher ? "-pub-" : "-sub-") + std::to_string(_index);
+    queue(std::move(connect));
+    flush();
+    read();
+  }
+
+  void ready()
+  {
+    if(_publisher) {
+      prepareTemplate();
+    }
+    _run._ready.fetch_add(1);
+  }
+
+  void fail(const std::error_code& ec)
+  {
+    if(_closed) {
+      return;
+    }
+    std::cerr << (_publisher ? "publisher " : "subscriber ") << _index << ": " << ec.message() << std::endl;
+    _run._failed.fetch_add(1);
+    close();
+  }
+
+  /// Serializes the publish once, publishes copy it and only patch the packet identifier and the send time.
+  void prepareTemplate()
+  {
+    acatl::mqtt::PublishControlPacket publish;
+    publish._topicName = substitute(_options._topic);
+    publish.setQoS(_options._qos);
+    publish._packetIdentifier = 1;
+    publish._payload.assign(_options._payloadSize, 0);
+
+    std::error_code ec;
+    size_t length = 0;
+    auto packet = std::make_unique<acatl::mqtt::PublishControlPacket>(publish);
+    _serializer.serialize(std::move(packet), _template, length, ec);
+    _template.resize(length);
+    _payloadOffset = length - _options._payloadSize;
+  }
+
+  /// Appends as many publishes as the window and the rate allow and writes them with one write.
+  void pump()
+  {
+    if(_publishing && !_writing) {
+      size_t count = _options._window;
+      if(_options._qos != acatl::mqtt::QoSLevel::AtMostOnce) {
+        count = _options._window > _inflight ? _options._window - _inflight : 0;
+      }
+      if(_options._rate > 0) {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _publishStart).count();
+        uint64_t due = static_cast<uint64_t>(elapsed * _options._rate) + 1;
+        count = std::min<uint64_t>(count, due > _stats._published ? due - _stats._published : 0);
+        if(count == 0 && !_timerArmed) {
+          scheduleNext();
+        }
+      }
+      for(size_t i = 0; i < count; ++i) {
+        appendPublish();
+      }
+    }
+    flush();
+  }
+
+  void scheduleNext()
+  {
+    _timerArmed = true;
+    auto next = std::chrono::duration<double>(static_cast<double>(_stats._published) / _options._rate);
+    _timer.expires_at(_publishStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(next));
+    auto self(this->shared_from_this());
+    _timer.async_wait([self](const std::error_code& ec) {
+      self->_timerArmed = false;
+      if(!ec) {
+        self->pump();
+      }
+    });
+  }
+
+  void appendPublish()
+  {
+    size_t offset = _outBuf.size();
+    _outBuf.insert(_outBuf.end(), _template.begin(), _template.end());
+    if(_options._qos != acatl::mqtt::QoSLevel::AtMostOnce) {
+      if(++_packetIdentifier == 0) {
+        _packetIdentifier = 1;
+      }
+      _outBuf[offset + _payloadOffset - 2] = static_cast<uint8_t>(_packetIdentifier >> 8);
+      _outBuf[offset + _payloadOffset - 1] = static_cast<uint8_t>(_packetIdentifier & 0xFF);
+      ++_inflight;
+    }
+    uint64_t now = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    for(size_t i = 0; i < 8; ++i) {
+      _outBuf[offset + _payloadOffset + i] = static_cast<uint8_t>(now >> (56 - 8 * i));
+    }
+    ++_stats._published;
+  }
+
+  void queue(acatl::mqtt::ControlPacket::Ptr packet)
+  {
+    std::error_code ec;
+    size_t length = 0;
+    if(!_serializer.serialize(std::move(packet), _serializeBuf, length, ec)) {
+      fail(ec);
+      return;
+    }
+    _outBuf.insert(_outBuf.end(), _serializeBuf.begin(), _serializeBuf.begin() + static_cast<std::ptrdiff_t>(length));
+  }
+
+  void flush()
+  {
+    if(_writing || _closed || _outBuf.empty()) {
+      return;
+    }
+    _writing = true;
+    std::swap(_outBuf, _writeBuf);
+    _outBuf.clear();
+    _stats._bytesOut += _writeBuf.size();
+    auto self(this->shared_from_this());
+    asio::async_write(_socket(), asio::buffer(_writeBuf), [self](const std::error_code& ec, std::size_t /*length*/) {
+      self->_writing = false;
+      if(ec) {
+        self->fail(ec);
+        return;
+      }
+      self->pump();
+    });
+  }
+
+  void read()
+  {
+    auto self(this->shared_from_this());
+    _socket().async_read_some(asio::buffer(_readBuf), [self](const std::error_code& ec, std::size_t length) {
+      if(ec) {
+        self->fail(ec);
+        return;
+      }
+      self->handleRead(length);
+    });
+  }
+
+  void handleRead(size_t length)
+  {
+    _stats._bytesIn += length;
+    size_t index = 0;
+    while(index < length) {
+      std::error_code ec;
+      acatl::Tribool ret;
+      while(ret.isIndeterminate() && index < length) {
+        ret = _parser.parse(_readBuf[index++], ec);
+      }
+      if(ret.isFalse() || ec) {
+        fail(ec);
+        return;
+      } else if(ret.isTrue()) {
+        handlePacket(_parser.consumePacket());
+        if(_closed) {
+          return;
+        }
+      }
+    }
+    pump();
+    read();
+  }
+
+  void handlePacket(acatl::mqtt::ControlPacket::Ptr packet)
+  {
+    using namespace acatl::mqtt;
+    switch(packet->_header._controlPacketType) {
+      case ControlPacketType::Connack: {
+        const auto& connAck = static_cast<const ConnAckControlPacket&>(*packet);
+        if(connAck._connectReturnCode != ConnectReturnCode::ConnectionAccepted) {
+          fail(mqtt_error::invalid_connect_return_code);
+        } else if(_publisher) {
+          ready();
+        } else {
+          auto subscribe = std::make_unique<SubscribeControlPacket>();
+          subscribe->_packetIdentifier = 1;
+          subscribe->_topicFilters.emplace_back(substitute(_options._filter), _options._qos);
+          queue(std::move(subscribe));
+        }
+        break;
+      }
+      case ControlPacketType::Suback: {
+        const auto& subAck = static_cast<const SubAckControlPacket&>(*packet);
+        if(subAck._qosLevels.empty() || subAck._qosLevels.front() == QoSLevel::Error) {
+          fail(mqtt_error::invalid_qos_level);
+        } else {
+          ready();
+        }
+        break;
+      }
+      case ControlPacketType::Publish: {
+        const auto& publish = static_cast<const PublishControlPacket&>(*packet);
+        auto now = std::chrono::steady_clock::now();
+        if(publish._payload.size() >= 8) {
+          uint64_t sent = 0;
+          for(size_t i = 0; i < 8; ++i) {
+            sent = (sent << 8) | publish._payload[i];
+          }
+          uint64_t received = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+          _stats._latencies.push_back(received > sent ? received - sent : 0);
+        }
+        if(_stats._received++ == 0) {
+          _stats._firstReceive = now;
+        }
+        _stats._lastReceive = now;
+        if(publish.qos() == QoSLevel::AtLeastOnce) {
+          queue(std::make_unique<PubAckControlPacket>(publish._packetIdentifier));
+        } else if(publish.qos() == QoSLevel::ExactlyOnce) {
+          queue(std::make_unique<PubRecControlPacket>(publish._packetIdentifier));
+        }
+        break;
+      }
+      case ControlPacketType::Pubrec:
+        queue(std::make_unique<PubRelControlPacket>(static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier));
+        break;
+      case ControlPacketType::Pubrel:
+        queue(std::make_unique<PubCompControlPacket>(static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier));
+        break;
+      case ControlPacketType::Puback:
+      case ControlPacketType::Pubcomp:
+        if(_inflight > 0) {
+          --_inflight;
+        }
+        ++_stats._acknowledged;
+        break;
+      default:
+        break;
+    }
+  }
+
+  SocketType _socket;
+  asio::io_context& _context;
+  asio::steady_timer _timer;
+  bool _publisher;
+  size_t _index;
+  const LoadOptions& _options;
+  LoadRun& _run;
+  acatl::mqtt::MQTTParser _parser;
+  acatl::mqtt::Serializer _serializer;
+  std::vector<uint8_t> _readBuf;
+  std::vector<uint8_t> _serializeBuf;
+  std::vector<uint8_t> _outBuf;
+  std::vector<uint8_t> _writeBuf;
+  std::vector<uint8_t> _template;
+  size_t _payloadOffset{0};
+  acatl::mqtt::PacketIdentifier _packetIdentifier{0};
+  size_t _inflight{0};
+  bool _publishing{false};
+  bool _writing{false};
+  bool _timerArmed{false};
+  bool _closed{false};
+  std::chrono::steady_clock::time_point _publishStart;
+  LoadStats _stats;
+};
+
+#endif
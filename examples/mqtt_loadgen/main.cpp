@@ -0,0 +1,332 @@
+//
+//  main.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <acatl/string_helper.h>
+
+#include <acatl_application/application.h>
+#include <acatl_application/command_line_options.h>
+
+#include <acatl_network/io_context_pool.h>
+
+#include "load_connection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+
+/// Load generator for a running broker. Publishers send for the configured duration, subscribers measure the
+/// publish to receive latency of every message. Prints one line with throughput and latency percentiles.
+class MQTTLoadgen : public acatl::Application
+{
+public:
+  MQTTLoadgen(int argc, char** argv)
+  : acatl::Application(argc, argv)
+  {
+  }
+
+private:
+  bool setUp(const acatl::StringVector& args) override
+  {
+    // clang-format off
+    acatl::CommandLineOptions options("mqtt_loadgen", {
+      {
+        "help", {
+          {"", "help", 1, 1, "display this help and exit"}
+        }
+      },
+      {
+        "load options", {
+          {"H", "host", "<HOST>", 0, 1, "broker host (default 127.0.0.1)"},
+          {"p", "port", "<PORT>", 0, 1, "broker port (default 1883, 8883 with --tls)"},
+          {"", "nodes", "<PORTS>", 0, 1, "comma separated ports of cluster nodes on the host, replaces --port. Subscriber i connects to node i, publisher i to the next node"},
+          {"", "tls", 0, 1, "connect with TLS"},
+          {"", "ca-file", "<PATH>", 0, 1, "verify the broker certificate against this CA file"},
+          {"P", "publishers", "<COUNT>", 0, 1, "number of publishing connections (default 1)"},
+          {"S", "subscribers", "<COUNT>", 0, 1, "number of subscribing connections (default 1)"},
+          {"", "topic", "<PATTERN>", 0, 1, "publish topic, %i is the publisher index (default loadgen/%i)"},
+          {"", "filter", "<PATTERN>", 0, 1, "subscription filter, %i is the subscriber index (default loadgen/#)"},
+          {"s", "payload-size", "<BYTES>", 0, 1, "payload size, at least 8 (default 64)"},
+          {"q", "qos", "<LEVEL>", 0, 1, "QoS of publishes and subscriptions (default 0)"},
+          {"r", "rate", "<COUNT>", 0, 1, "publishes per second and publisher (default unlimited, which measures saturation rather than latency)"},
+          {"w", "window", "<COUNT>", 0, 1, "publishes in flight per publisher (default 64)"},
+          {"d", "duration", "<SECONDS>", 0, 1, "publish duration (default 10)"},
+          {"", "drain", "<SECONDS>", 0, 1, "time to receive outstanding publishes (default 2)"},
+          {"", "settle", "<MILLISECONDS>", 0, 1, "wait between the subscriptions and the first publish, e.g. until a cluster announced them (default 0)"},
+          {"t", "threads", "<COUNT>", 0, 1, "number of io threads (default all cores)"}
+        }
+      }
+    });
+    // clang-format on
+
+    std::stringstream ss;
+    auto ret = options.parse(args, ss);
+
+    if(!ret) {
+      std::cerr << ss.str() << std::endl;
+      options.usage(std::cerr);
+      return false;
+    }
+
+    if(options.count("help") > 0) {
+      options.usage(std::cerr);
+      return false;
+    }
+
+    _tls = options.count("tls") > 0;
+    _port = _tls ? 8883 : 1883;
+    if(options.count("host") > 0) {
+      _host = options.option("host").value<std::string>();
+    }
+    if(options.count("port") > 0) {
+      _port = options.option("port").value<uint16_t>();
+    }
+    if(options.count("nodes") > 0) {
+      std::vector<std::string> ports;
+      acatl::split(options.option("nodes").value<std::string>(), ',', ports, false);
+      for(const auto& port : ports) {
+        _nodes.push_back(static_cast<uint16_t>(std::stoul(port)));
+      }
+    }
+    if(_nodes.empty()) {
+      _nodes.push_back(_port);
+    }
+    if(options.count("ca-file") > 0) {
+      _caFile = options.option("ca-file").value<std::string>();
+    }
+    if(options.count("publishers") > 0) {
+      _publishers = options.option("publishers").value<uint32_t>();
+    }
+    if(options.count("subscribers") > 0) {
+      _subscribers = options.option("subscribers").value<uint32_t>();
+    }
+    if(options.count("topic") > 0) {
+      _options._topic = options.option("topic").value<std::string>();
+    }
+    if(options.count("filter") > 0) {
+      _options._filter = options.option("filter").value<std::string>();
+    }
+    if(options.count("payload-size") > 0) {
+      _options._payloadSize = std::max<size_t>(8, options.option("payload-size").value<uint32_t>());
+    }
+    if(options.count("qos") > 0) {
+      uint32_t qos = options.option("qos").value<uint32_t>();
+      if(qos > 2) {
+        std::cerr << "invalid QoS " << qos << std::endl;
+        return false;
+      }
+      _options._qos = acatl::mqtt::QoSLevel(qos);
+    }
+    if(options.count("rate") > 0) {
+      _options._rate = options.option("rate").value<double>();
+    }
+    if(options.count("window") > 0) {
+      // packet identifiers of unacknowledged publishes have to stay unique
+      _options._window = std::min<size_t>(65535, std::max<size_t>(1, options.option("window").value<uint32_t>()));
+    }
+    if(options.count("duration") > 0) {
+      _duration = std::chrono::seconds(options.option("duration").value<uint32_t>());
+    }
+    if(options.count("drain") > 0) {
+      _drain = std::chrono::seconds(options.option("drain").value<uint32_t>());
+    }
+    if(options.count("settle") > 0) {
+      _settle = std::chrono::milliseconds(options.option("settle").value<uint32_t>());
+    }
+    if(options.count("threads") > 0) {
+      _threads = std::max(1u, options.option("threads").value<uint32_t>());
+    }
+
+    return true;
+  }
+
+  int doRun() override
+  {
+    if(_tls) {
+      asio::ssl::context sslContext{asio::ssl::context::tlsv12_client};
+      if(_caFile.empty()) {
+        sslContext.set_verify_mode(asio::ssl::verify_none);
+      } else {
+        sslContext.load_verify_file(_caFile);
+        sslContext.set_verify_mode(asio::ssl::verify_peer);
+      }
+      return runLoad<acatl::net::SecureSocket>(sslContext);
+    }
+    acatl::net::NullContext nullContext;
+    return runLoad<acatl::net::Socket>(nullContext);
+  }
+
+  template<typename SocketType, typename ContextType>
+  int runLoad(ContextType& sslContext)
+  {
+    typedef LoadConnection<SocketType> ConnectionType;
+
+    acatl::net::IoContextPool ioContextPool(_threads);
+    asio::ip::tcp::resolver resolver(ioContextPool.get(0));
+    std::vector<asio::ip::tcp::endpoint> nodes;
+    for(uint16_t port : _nodes) {
+      asio::error_code ec;
+      auto endpoints = resolver.resolve(_host, std::to_string(port), ec);
+      if(ec || endpoints.empty()) {
+        std::cerr << "cannot resolve " << _host << ": " << ec.message() << std::endl;
+        return 1;
+      }
+      nodes.push_back(*endpoints.begin());
+    }
+
+    LoadRun loadRun;
+    std::vector<typename ConnectionType::Ptr> subscribers;
+    std::vector<typename ConnectionType::Ptr> publishers;
+    auto create = [&](bool publisher, size_t index) {
+      // with per index topics and filters every message of a cluster crosses a link between two nodes
+      asio::ip::tcp::endpoint endpoint = nodes[(index + (publisher ? 1 : 0)) % nodes.size()];
+      asio::io_context& context = ioContextPool.get();
+      auto connection = std::make_shared<ConnectionType>(acatl::net::make_socket<SocketType>(context, sslContext),
+                                                         context, publisher, index, _options, loadRun);
+      asio::post(context, [connection, endpoint]() { connection->start(endpoint); });
+      return connection;
+    };
+    auto forEach = [](std::vector<typename ConnectionType::Ptr>& connections, void (ConnectionType::*func)()) {
+      for(auto& connection : connections) {
+        asio::post(connection->context(), [connection, func]() { (connection.get()->*func)(); });
+      }
+    };
+
+    std::thread runner([&ioContextPool]() { ioContextPool.run(); });
+
+    // publishers start after all subscriptions are in place, otherwise the first publishes are lost
+    for(size_t i = 0; i < _subscribers; ++i) {
+      subscribers.push_back(create(false, i));
+    }
+    bool connected = waitForConnections(loadRun, _subscribers);
+    std::this_thread::sleep_for(_settle);
+    for(size_t i = 0; connected && i < _publishers; ++i) {
+      publishers.push_back(create(true, i));
+    }
+    connected = connected && waitForConnections(loadRun, _subscribers + _publishers);
+
+    if(connected) {
+      forEach(publishers, &ConnectionType::startPublishing);
+      std::this_thread::sleep_for(_duration);
+      forEach(publishers, &ConnectionType::stopPublishing);
+      std::this_thread::sleep_for(_drain);
+    }
+    forEach(subscribers, &ConnectionType::close);
+    forEach(publishers, &ConnectionType::close);
+    ioContextPool.stop();
+    runner.join();
+
+    if(!connected) {
+      std::cerr << "connections failed=" << loadRun._failed.load() << " of " << _subscribers + _publishers << std::endl;
+      return 1;
+    }
+
+    LoadStats stats;
+    for(const auto& connection : publishers) {
+      stats.merge(connection->stats());
+    }
+    for(const auto& connection : subscribers) {
+      stats.merge(connection->stats());
+    }
+    report(stats, loadRun);
+    return loadRun._failed.load() == 0 ? 0 : 1;
+  }
+
+  bool waitForConnections(const LoadRun& loadRun, size_t count)
+  {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while(loadRun._ready.load() < count) {
+      if(loadRun._failed.load() != 0 || std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+  }
+
+  void report(LoadStats& stats, const LoadRun& loadRun)
+  {
+    double seconds = std::chrono::duration<double>(_duration).count();
+    double receiveSeconds = std::chrono::duration<double>(stats._lastReceive - stats._firstReceive).count();
+
+    std::vector<uint64_t>& latencies = stats._latencies;
+    auto percentile = [&latencies](double fraction) {
+      if(latencies.empty()) {
+        return 0.0;
+      }
+      size_t index = std::min(latencies.size() - 1, static_cast<size_t>(fraction * static_cast<double>(latencies.size())));
+      std::nth_element(latencies.begin(), latencies.begin() + static_cast<std::ptrdiff_t>(index), latencies.end());
+      return static_cast<double>(latencies[index]) / 1000.0;
+    };
+    double p50 = percentile(0.5);
+    double p99 = percentile(0.99);
+    double p999 = percentile(0.999);
+    double max = latencies.empty() ? 0.0 : static_cast<double>(*std::max_element(latencies.begin(), latencies.end())) / 1000.0;
+
+    std::cout << "loadgen transport=" << (_tls ? "tls" : "tcp") << " nodes=" << _nodes.size() << " publishers=" << _publishers
+              << " subscribers=" << _subscribers << " qos=" << static_cast<int>(_options._qos)
+              << " payload=" << _options._payloadSize << " published=" << stats._published
+              << " acknowledged=" << stats._acknowledged << " received=" << stats._received
+              << " failed=" << loadRun._failed.load()
+              << " publishes/s=" << static_cast<uint64_t>(static_cast<double>(stats._published) / seconds)
+              << " receives/s="
+              << (receiveSeconds > 0 ? static_cast<uint64_t>(static_cast<double>(stats._received) / receiveSeconds) : 0)
+              << std::fixed << std::setprecision(1)
+              << " MB/s-out=" << static_cast<double>(stats._bytesOut) / seconds / 1e6
+              << " MB/s-in=" << (receiveSeconds > 0 ? static_cast<double>(stats._bytesIn) / receiveSeconds / 1e6 : 0.0)
+              << " p50-us=" << p50 << " p99-us=" << p99 << " p999-us=" << p999 << " max-us=" << max
+              << std::defaultfloat << std::endl;
+  }
+
+  std::string _host{"127.0.0.1"};
+  uint16_t _port{1883};
+  std::vector<uint16_t> _nodes;
+  bool _tls{false};
+  std::string _caFile;
+  size_t _publishers{1};
+  size_t _subscribers{1};
+  LoadOptions _options;
+  std::chrono::seconds _duration{10};
+  std::chrono::seconds _drain{2};
+  std::chrono::milliseconds _settle{0};
+  uint32_t _threads{std::max(1u, std::thread::hardware_concurrency())};
+};
+
+int main(int argc, char** argv)
+{
+  return MQTTLoadgen{argc, argv}.run();
+}
@@ -0,0 +1,263 @@
+//
+//  main.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <acatl_application/application.h>
+#include <acatl_application/command_line_options.h>
+
+#include <acatl_network/io_context_pool.h>
+
+#include <acatl_mqtt/mqtt_capture.h>
+
+#include "replay_connection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+/// Replays a capture file of mqtt_broker against a running broker. Every captured connection gets a connection of
+/// its own, which sends the packets of the client with the timing of the capture, scaled by the speed. Prints one
+/// line with the achieved rates and how far the replay fell behind the capture.
+class MQTTReplay : public acatl::Application
+{
+public:
+  MQTTReplay(int argc, char** argv)
+  : acatl::Application(argc, argv)
+  {
+  }
+
+private:
+  bool setUp(const acatl::StringVector& args) override
+  {
+    // clang-format off
+    acatl::CommandLineOptions options("mqtt_replay", {
+      {
+        "help", {
+          {"", "help", 1, 1, "display this help and exit"}
+        }
+      },
+      {
+        "replay options", {
+          {"f", "file", "<PATH>", 1, 1, "capture file written by mqtt_broker"},
+          {"H", "host", "<HOST>", 0, 1, "broker host (default 127.0.0.1)"},
+          {"p", "port", "<PORT>", 0, 1, "broker port (default 1883, 8883 with --tls)"},
+          {"", "tls", 0, 1, "connect with TLS"},
+          {"", "ca-file", "<PATH>", 0, 1, "verify the broker certificate against this CA file"},
+          {"x", "speed", "<FACTOR>", 0, 1, "replay speed relative to the capture, 0 sends as fast as possible, without keeping the order across connections (default 1)"},
+          {"", "drain", "<SECONDS>", 0, 1, "time to receive outstanding deliveries after the last packet (default 2)"},
+          {"t", "threads", "<COUNT>", 0, 1, "number of io threads (default all cores)"}
+        }
+      }
+    });
+    // clang-format on
+
+    std::stringstream ss;
+    auto ret = options.parse(args, ss);
+
+    if(!ret) {
+      std::cerr << ss.str() << std::endl;
+      options.usage(std::cerr);
+      return false;
+    }
+
+    if(options.count("help") > 0) {
+      options.usage(std::cerr);
+      return false;
+    }
+
+    _file = options.option("file").value<std::string>();
+    _tls = options.count("tls") > 0;
+    _port = _tls ? 8883 : 1883;
+    if(options.count("host") > 0) {
+      _host = options.option("host").value<std::string>();
+    }
+    if(options.count("port") > 0) {
+      _port = options.option("port").value<uint16_t>();
+    }
+    if(options.count("ca-file") > 0) {
+      _caFile = options.option("ca-file").value<std::string>();
+    }
+    if(options.count("speed") > 0) {
+      _speed = std::max(0.0, options.option("speed").value<double>());
+    }
+    if(options.count("drain") > 0) {
+      _drain = std::chrono::seconds(options.option("drain").value<uint32_t>());
+    }
+    if(options.count("threads") > 0) {
+      _threads = std::max(1u, options.option("threads").value<uint32_t>());
+    }
+
+    return true;
+  }
+
+  int doRun() override
+  {
+    if(!load()) {
+      return 1;
+    }
+    if(_tls) {
+      asio::ssl::context sslContext{asio::ssl::context::tlsv12_client};
+      if(_caFile.empty()) {
+        sslContext.set_verify_mode(asio::ssl::verify_none);
+      } else {
+        sslContext.load_verify_file(_caFile);
+        sslContext.set_verify_mode(asio::ssl::verify_peer);
+      }
+      return runReplay<acatl::net::SecureSocket>(sslContext);
+    }
+    acatl::net::NullContext nullContext;
+    return runReplay<acatl::net::Socket>(nullContext);
+  }
+
+  /// Splits the capture into the scripts of its connections. The whole capture is held in memory, so the replay
+  /// does not have to read the file while it keeps the schedule.
+  bool load()
+  {
+    acatl::mqtt::CaptureReader reader(_file);
+    std::error_code ec;
+    if(!reader.open(ec)) {
+      std::cerr << "cannot open " << _file << ": " << ec.message() << std::endl;
+      return false;
+    }
+    std::unordered_map<uint32_t, size_t> scripts;
+    acatl::mqtt::CaptureRecord record;
+    while(reader.next(record, ec)) {
+      // the end of a connection is when its last packet was sent
+      if(record._packet.empty()) {
+        continue;
+      }
+      auto it = scripts.find(record._connection);
+      if(it == scripts.end()) {
+        it = scripts.emplace(record._connection, _scripts.size()).first;
+        _scripts.emplace_back();
+        _scripts.back()._connection = record._connection;
+      }
+      ReplayScript& script = _scripts[it->second];
+      script._times.push_back(record._time);
+      script._packets.push_back(std::move(record._packet));
+      _captureDuration = record._time;
+      ++_packets;
+    }
+    if(ec) {
+      std::cerr << "cannot read " << _file << ": " << ec.message() << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  template<typename SocketType, typename ContextType>
+  int runReplay(ContextType& sslContext)
+  {
+    typedef ReplayConnection<SocketType> ConnectionType;
+
+    acatl::net::IoContextPool ioContextPool(_threads);
+    asio::ip::tcp::resolver resolver(ioContextPool.get(0));
+    asio::error_code resolveError;
+    auto endpoints = resolver.resolve(_host, std::to_string(_port), resolveError);
+    if(resolveError || endpoints.empty()) {
+      std::cerr << "cannot resolve " << _host << ": " << resolveError.message() << std::endl;
+      return 1;
+    }
+    asio::ip::tcp::endpoint endpoint = *endpoints.begin();
+
+    ReplayRun replayRun;
+    std::vector<typename ConnectionType::Ptr> connections;
+    // leave the connections time to be posted before the first packet is due
+    auto start = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+    for(const ReplayScript& script : _scripts) {
+      asio::io_context& context = ioContextPool.get();
+      connections.push_back(std::make_shared<ConnectionType>(acatl::net::make_socket<SocketType>(context, sslContext),
+                                                             context, script, _speed, replayRun));
+      auto connection = connections.back();
+      asio::post(context, [connection, endpoint, start]() { connection->start(endpoint, start); });
+    }
+
+    std::thread runner([&ioContextPool]() { ioContextPool.run(); });
+    while(replayRun._finished.load() + replayRun._failed.load() < connections.size()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(_drain);
+    for(auto& connection : connections) {
+      asio::post(connection->context(), [connection]() { connection->close(); });
+    }
+    ioContextPool.stop();
+    runner.join();
+
+    ReplayStats stats;
+    for(const auto& connection : connections) {
+      stats.merge(connection->stats());
+    }
+    report(stats, replayRun, std::chrono::duration<double>(end - start).count());
+    return replayRun._failed.load() == 0 ? 0 : 1;
+  }
+
+  void report(const ReplayStats& stats, const ReplayRun& replayRun, double seconds)
+  {
+    seconds = std::max(seconds, 1e-6);
+    std::cout << "replay transport=" << (_tls ? "tls" : "tcp") << " connections=" << _scripts.size()
+              << " packets=" << _packets << " speed=" << _speed
+              << " capture-s=" << std::chrono::duration<double>(_captureDuration).count()
+              << " sent=" << stats._sent << " skipped-acks=" << stats._skipped << " received=" << stats._received
+              << " failed=" << replayRun._failed.load()
+              << std::fixed << std::setprecision(1)
+              << " replay-s=" << seconds
+              << " packets/s=" << static_cast<double>(stats._sent) / seconds
+              << " MB/s-out=" << static_cast<double>(stats._bytesOut) / seconds / 1e6
+              << " MB/s-in=" << static_cast<double>(stats._bytesIn) / seconds / 1e6
+              << " max-lag-ms=" << std::chrono::duration<double, std::milli>(stats._maxLag).count()
+              << std::defaultfloat << std::endl;
+  }
+
+  std::string _file;
+  std::string _host{"127.0.0.1"};
+  uint16_t _port{1883};
+  bool _tls{false};
+  std::string _caFile;
+  double _speed{1.0};
+  std::chrono::seconds _drain{2};
+  uint32_t _threads{std::max(1u, std::thread::hardware_concurrency())};
+  std::vector<ReplayScript> _scripts;
+  uint64_t _packets{0};
+  std::chrono::microseconds _captureDuration{0};
+};
+
+int main(int argc, char** argv)
+{
+  return MQTTReplay{argc, argv}.run();
+}
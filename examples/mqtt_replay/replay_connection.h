@@ -0,0 +1,356 @@
+//
+//  replay_connection.h
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef acatl_mqtt_replay_connection_h
+#define acatl_mqtt_replay_connection_h
+
+#include <acatl_network/socket_type.h>
+
+#include <acatl_mqtt/mqtt_capture.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+
+/// The packets one client sent during the capture, each with its time since the capture started.
+struct ReplayScript
+{
+  uint32_t _connection{0};
+  std::vector<std::chrono::microseconds> _times;
+  std::vector<std::vector<uint8_t>> _packets;
+};
+
+
+/// Counters of one connection, merged after the run.
+struct ReplayStats
+{
+  void merge(const ReplayStats& other)
+  {
+    _sent += other._sent;
+    _skipped += other._skipped;
+    _received += other._received;
+    _bytesOut += other._bytesOut;
+    _bytesIn += other._bytesIn;
+    _maxLag = std::max(_maxLag, other._maxLag);
+  }
+
+  uint64_t _sent{0};
+  // acknowledgements of deliveries, the replay sends its own
+  uint64_t _skipped{0};
+  uint64_t _received{0};
+  uint64_t _bytesOut{0};
+  uint64_t _bytesIn{0};
+  // how far the replay fell behind the schedule of the capture
+  std::chrono::steady_clock::duration _maxLag{0};
+};
+
+
+/// Connections report to the run once their script is done or when they fail.
+struct ReplayRun
+{
+  std::atomic<size_t> _finished{0};
+  std::atomic<size_t> _failed{0};
+};
+
+
+/// Sends the packets of one captured client as they were recorded, each at its time of the capture divided by the
+/// speed, a speed of 0 sends as fast as the broker takes them. The connection is opened when its first packet is
+/// due. After the last one it stays open until the run closes all connections, so subscribers receive what the
+/// others publish after it at any speed. The deliveries of the broker are acknowledged by the replay, the captured
+/// acknowledgements are skipped, as their packet identifiers need not match those of the replayed deliveries.
+/// Runs on a single io_context, the methods other than stats() have to be called on it.
+template<typename Socket>
+class ReplayConnection : public std::enable_shared_from_this<ReplayConnection<Socket>>
+{
+public:
+  typedef Socket SocketType;
+  typedef std::shared_ptr<ReplayConnection> Ptr;
+
+  ReplayConnection(SocketType&& socket, asio::io_context& context, const ReplayScript& script, double speed, ReplayRun& run)
+  : _socket(std::move(socket))
+  , _context(context)
+  , _timer(context)
+  , _script(script)
+  , _speed(speed)
+  , _run(run)
+  {
+    _readBuf.resize(64 * 1024);
+  }
+
+  /// All connections of a run share the start, so their packets keep their order across connections.
+  void start(const asio::ip::tcp::endpoint& endpoint, std::chrono::steady_clock::time_point start)
+  {
+    _endpoint = endpoint;
+    _start = start;
+    wait();
+  }
+
+  void close()
+  {
+    _closed = true;
+    asio::error_code ignored;
+    _timer.cancel(ignored);
+    _socket.lowest_layer().close(ignored);
+  }
+
+  asio::io_context& context()
+  {
+    return _context;
+  }
+
+  const ReplayStats& stats() const
+  {
+    return _stats;
+  }
+
+private:
+  std::chrono::steady_clock::time_point due(size_t index) const
+  {
+    if(_speed <= 0) {
+      return _start;
+    }
+    auto time = std::chrono::duration<double, std::micro>(static_cast<double>(_script._times[index].count()) / _speed);
+    return _start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(time);
+  }
+
+  /// Waits until the next packet is due, the first one opens the connection.
+  void wait()
+  {
+    if(_timerArmed || _closed) {
+      return;
+    }
+    _timerArmed = true;
+    _timer.expires_at(due(_next));
+    auto self(this->shared_from_this());
+    _timer.async_wait([self](const std::error_code& ec) {
+      self->_timerArmed = false;
+      if(ec) {
+        return;
+      }
+      if(self->_connected) {
+        self->pump();
+      } else {
+        self->connect();
+      }
+    });
+  }
+
+  void connect()
+  {
+    auto self(this->shared_from_this());
+    _socket.lowest_layer().async_connect(_endpoint, [self](const std::error_code& ec) {
+      if(ec) {
+        self->fail(ec);
+        return;
+      }
+      asio::error_code ignored;
+      self->_socket.lowest_layer().set_option(asio::ip::tcp::no_delay(true), ignored);
+      self->_socket.clientHandshake([self](const std::error_code& ec) {
+        if(ec) {
+          self->fail(ec);
+          return;
+        }
+        self->_connected = true;
+        self->read();
+        self->pump();
+      });
+    });
+  }
+
+  /// Appends the packets that are due and writes them with one write.
+  void pump()
+  {
+    if(_writing || _closed) {
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    while(_next < _script._packets.size() && _outBuf.size() < maxWriteSize) {
+      auto scheduled = due(_next);
+      if(scheduled > now) {
+        break;
+      }
+      const std::vector<uint8_t>& packet = _script._packets[_next++];
+      if(isDeliveryAcknowledgement(packet)) {
+        ++_stats._skipped;
+        continue;
+      }
+      _stats._maxLag = std::max(_stats._maxLag, now - scheduled);
+      _outBuf.insert(_outBuf.end(), packet.begin(), packet.end());
+      ++_stats._sent;
+      _disconnected = (packet.front() & 0xF0) == static_cast<uint8_t>(acatl::mqtt::ControlPacketType::Disconnect);
+    }
+    if(!_outBuf.empty()) {
+      flush();
+    } else if(_next < _script._packets.size()) {
+      wait();
+    } else {
+      finish();
+    }
+  }
+
+  static bool isDeliveryAcknowledgement(const std::vector<uint8_t>& packet)
+  {
+    auto type = static_cast<acatl::mqtt::ControlPacketType>(packet.front() & 0xF0);
+    return type == acatl::mqtt::ControlPacketType::Puback || type == acatl::mqtt::ControlPacketType::Pubrec
+           || type == acatl::mqtt::ControlPacketType::Pubcomp;
+  }
+
+  void flush()
+  {
+    _writing = true;
+    std::swap(_outBuf, _writeBuf);
+    _outBuf.clear();
+    _stats._bytesOut += _writeBuf.size();
+    auto self(this->shared_from_this());
+    asio::async_write(_socket(), asio::buffer(_writeBuf), [self](const std::error_code& ec, std::size_t /*length*/) {
+      self->_writing = false;
+      if(ec) {
+        self->fail(ec);
+        return;
+      }
+      self->pump();
+    });
+  }
+
+  void read()
+  {
+    auto self(this->shared_from_this());
+    _socket().async_read_some(asio::buffer(_readBuf), [self](const std::error_code& ec, std::size_t length) {
+      if(ec) {
+        if(self->_disconnected) {
+          // the broker closes the connection after a DISCONNECT
+          self->finish();
+        } else {
+          self->fail(ec);
+        }
+        return;
+      }
+      self->handleRead(length);
+    });
+  }
+
+  void handleRead(size_t length)
+  {
+    _stats._bytesIn += length;
+    std::error_code ec;
+    if(!_framer.feed(_readBuf.data(), length, [this](const std::vector<uint8_t>& packet) { acknowledge(packet); }, ec)) {
+      fail(ec);
+      return;
+    }
+    pump();
+    read();
+  }
+
+  /// Answers a delivery of the broker. Only the packet identifier is needed, so the packet is not parsed, which
+  /// works for all protocol levels.
+  void acknowledge(const std::vector<uint8_t>& packet)
+  {
+    auto type = static_cast<acatl::mqtt::ControlPacketType>(packet.front() & 0xF0);
+    // skip the remaining length
+    size_t pos = 1;
+    while(pos < packet.size() && (packet[pos] & 0x80) != 0) {
+      ++pos;
+    }
+    ++pos;
+    if(type == acatl::mqtt::ControlPacketType::Publish) {
+      ++_stats._received;
+      uint8_t qos = (packet.front() >> 1) & 0x03;
+      if(qos == 0 || pos + 2 > packet.size()) {
+        return;
+      }
+      // the packet identifier follows the topic name
+      pos += 2 + ((static_cast<size_t>(packet[pos]) << 8) | packet[pos + 1]);
+      queueAcknowledgement(qos == 1 ? acatl::mqtt::ControlPacketType::Puback : acatl::mqtt::ControlPacketType::Pubrec, packet, pos);
+    } else if(type == acatl::mqtt::ControlPacketType::Pubrel) {
+      queueAcknowledgement(acatl::mqtt::ControlPacketType::Pubcomp, packet, pos);
+    }
+  }
+
+  void queueAcknowledgement(acatl::mqtt::ControlPacketType type, const std::vector<uint8_t>& packet, size_t pos)
+  {
+    if(pos + 2 > packet.size()) {
+      return;
+    }
+    _outBuf.insert(_outBuf.end(), { static_cast<uint8_t>(type), 2, packet[pos], packet[pos + 1] });
+  }
+
+  void finish()
+  {
+    if(_finished) {
+      return;
+    }
+    _finished = true;
+    _run._finished.fetch_add(1);
+  }
+
+  void fail(const std::error_code& ec)
+  {
+    if(_closed || _finished) {
+      close();
+      return;
+    }
+    std::cerr << "connection " << _script._connection << ": " << ec.message() << std::endl;
+    _finished = true;
+    close();
+    _run._failed.fetch_add(1);
+  }
+
+  static constexpr size_t maxWriteSize = 64 * 1024;
+
+  SocketType _socket;
+  asio::io_context& _context;
+  asio::steady_timer _timer;
+  const ReplayScript& _script;
+  double _speed;
+  ReplayRun& _run;
+  asio::ip::tcp::endpoint _endpoint;
+  std::chrono::steady_clock::time_point _start;
+  acatl::mqtt::PacketFramer _framer;
+  std::vector<uint8_t> _readBuf;
+  std::vector<uint8_t> _outBuf;
+  std::vector<uint8_t> _writeBuf;
+  size_t _next{0};
+  bool _connected{false};
+  bool _writing{false};
+  bool _timerArmed{false};
+  bool _disconnected{false};
+  bool _finished{false};
+  bool _closed{false};
+  ReplayStats _stats;
+};
+
+#endif
@@ -0,0 +1,216 @@
+//
+//  mqtt_acl_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_acl.h>
+#include <acatl_mqtt/mqtt_processor.h>
+
+
+namespace
+{
+    class NullSender : public acatl::mqtt::PacketSender
+    {
+    public:
+        virtual void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet)
+        {
+            _sendPackets.push_back(std::move(packet));
+        }
+        
+        std::vector<acatl::mqtt::ControlPacket::Ptr> _sendPackets;
+    };
+}
+
+
+TEST(MQTTAclTest, trie)
+{
+    acatl::mqtt::AclTrie trie;
+    trie.add("sport/tennis/+/player1", acatl::mqtt::AclAccess::Read);
+    trie.add("sport/#", acatl::mqtt::AclAccess::Write);
+    trie.add("news", acatl::mqtt::AclAccess::ReadWrite);
+    trie.add("#", acatl::mqtt::AclAccess::Read);
+    EXPECT_EQ(4u, trie.size());
+    
+    EXPECT_EQ(acatl::mqtt::AclAccess::ReadWrite, trie.access("sport/tennis/wimbledon/player1"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::ReadWrite, trie.access("sport"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::ReadWrite, trie.access("news"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::Read, trie.access("news/today"));
+    // wildcards on the first level do not match reserved topics
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, trie.access("$SYS/broker/clients/connected"));
+    
+    // a subscription is only granted what all of its topics are granted
+    EXPECT_EQ(acatl::mqtt::AclAccess::ReadWrite, trie.filterAccess("sport/tennis/+/player1"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::ReadWrite, trie.filterAccess("sport/#"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::Read, trie.filterAccess("news/#"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, trie.filterAccess("$SYS/#"));
+    
+    acatl::mqtt::AclTrie narrow;
+    narrow.add("sport/tennis/+/player1", acatl::mqtt::AclAccess::Read);
+    EXPECT_EQ(acatl::mqtt::AclAccess::Read, narrow.filterAccess("sport/tennis/+/player1"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, narrow.filterAccess("sport/tennis/+/+"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, narrow.filterAccess("sport/tennis/#"));
+}
+
+TEST(MQTTAclTest, substitution)
+{
+    acatl::mqtt::AclRules rules;
+    rules.emplace_back("devices/%c/#", acatl::mqtt::AclAccess::ReadWrite);
+    rules.emplace_back("users/%u/inbox", acatl::mqtt::AclAccess::Read);
+    rules.emplace_back("$SYS/#", acatl::mqtt::AclAccess::Read, "admin");
+    acatl::mqtt::Authorizer authorizer(rules);
+    
+    acatl::mqtt::AclTrie::ConstPtr acl = authorizer.compile("sensor1", "bob");
+    EXPECT_EQ(2u, acl->size());
+    EXPECT_EQ(acatl::mqtt::AclAccess::ReadWrite, acl->access("devices/sensor1/temperature"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->access("devices/sensor2/temperature"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::Read, acl->access("users/bob/inbox"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->access("$SYS/broker/messages/sent"));
+    
+    acl = authorizer.compile("console", "admin");
+    EXPECT_EQ(acatl::mqtt::AclAccess::Read, acl->access("$SYS/broker/messages/sent"));
+    
+    // a client id with wildcards must not widen a rule, a client without user name gets no %u rule
+    acl = authorizer.compile("#", "");
+    EXPECT_EQ(0u, acl->size());
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->access("devices/sensor1/temperature"));
+}
+
+TEST(MQTTAclTest, narrowRules)
+{
+    // the rules of examples/mqtt_broker/mqtt_broker_acl.json
+    acatl::mqtt::AclRules rules;
+    rules.emplace_back("devices/%c/#", acatl::mqtt::AclAccess::ReadWrite);
+    rules.emplace_back("commands/%c", acatl::mqtt::AclAccess::Read);
+    rules.emplace_back("commands/+", acatl::mqtt::AclAccess::Write, "operator");
+    rules.emplace_back("$SYS/#", acatl::mqtt::AclAccess::Read, "admin");
+    acatl::mqtt::Authorizer authorizer(rules);
+    
+    acatl::mqtt::AclTrie::ConstPtr acl = authorizer.compile("sensor1", "device");
+    EXPECT_EQ(acatl::mqtt::AclAccess::ReadWrite, acl->access("devices/sensor1/temperature"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->access("devices/sensor2/temperature"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::Read, acl->access("commands/sensor1"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->access("commands/sensor2"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->access("lights/kitchen"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->filterAccess("devices/#"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->filterAccess("$SYS/#"));
+    
+    acl = authorizer.compile("console", "operator");
+    EXPECT_EQ(acatl::mqtt::AclAccess::Write, acl->access("commands/sensor1"));
+    EXPECT_FALSE(acatl::mqtt::allows(acl->access("commands/sensor1"), acatl::mqtt::AclAccess::Read));
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->access("devices/sensor1/temperature"));
+    
+    // rules add up, a catch-all grants everything whatever the narrower rules say
+    rules.emplace_back("#", acatl::mqtt::AclAccess::ReadWrite);
+    authorizer.reload(rules);
+    acl = authorizer.compile("sensor1", "device");
+    EXPECT_EQ(acatl::mqtt::AclAccess::ReadWrite, acl->access("devices/sensor2/temperature"));
+}
+
+TEST(MQTTAclTest, reload)
+{
+    acatl::mqtt::AclRules rules;
+    rules.emplace_back("a/#", acatl::mqtt::AclAccess::Write);
+    acatl::mqtt::Authorizer authorizer(rules);
+    acatl::mqtt::AclTrie::ConstPtr acl = authorizer.compile("client", "");
+    EXPECT_EQ(authorizer.generation(), acl->generation());
+    
+    rules.clear();
+    rules.emplace_back("b/#", acatl::mqtt::AclAccess::Write);
+    authorizer.reload(rules);
+    EXPECT_NE(authorizer.generation(), acl->generation());
+    // tries compiled earlier stay valid until they are replaced
+    EXPECT_EQ(acatl::mqtt::AclAccess::Write, acl->access("a/x"));
+    
+    acl = authorizer.compile("client", "");
+    EXPECT_EQ(authorizer.generation(), acl->generation());
+    EXPECT_EQ(acatl::mqtt::AclAccess::None, acl->access("a/x"));
+    EXPECT_EQ(acatl::mqtt::AclAccess::Write, acl->access("b/x"));
+}
+
+TEST(MQTTAclTest, processor)
+{
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    acatl::mqtt::AclRules rules;
+    rules.emplace_back("devices/%c/#", acatl::mqtt::AclAccess::ReadWrite);
+    acatl::mqtt::Authorizer::Ptr authorizer = std::make_shared<acatl::mqtt::Authorizer>(rules);
+    std::shared_ptr<NullSender> sender(new NullSender);
+    
+    acatl::mqtt::Processor processor(subscriptionTreeManager, sessionManager);
+    processor.setPacketSender(sender);
+    processor.setAuthorizer(authorizer);
+    
+    std::error_code ec;
+    acatl::mqtt::ConnectControlPacket::Ptr connect = std::make_unique<acatl::mqtt::ConnectControlPacket>();
+    connect->_protocolLevel = acatl::mqtt::protocolLevel311;
+    connect->_cleanSession = true;
+    connect->_clientId = "sensor1";
+    processor.processPacket(std::move(connect), ec);
+    EXPECT_FALSE(ec);
+    
+    acatl::mqtt::SubscribeControlPacket::Ptr subscribe = std::make_unique<acatl::mqtt::SubscribeControlPacket>();
+    subscribe->_packetIdentifier = 1;
+    subscribe->_topicFilters.push_back(acatl::mqtt::TopicFilter("devices/sensor1/#", acatl::mqtt::QoSLevel::AtLeastOnce));
+    subscribe->_topicFilters.push_back(acatl::mqtt::TopicFilter("devices/#", acatl::mqtt::QoSLevel::AtLeastOnce));
+    auto result = processor.processPacket(std::move(subscribe), ec);
+    ASSERT_TRUE(std::get<1>(result));
+    const auto& suback = static_cast<const acatl::mqtt::SubAckControlPacket&>(*std::get<1>(result));
+    ASSERT_EQ(2u, suback._qosLevels.size());
+    EXPECT_EQ(acatl::mqtt::QoSLevel::AtLeastOnce, suback._qosLevels[0]);
+    EXPECT_EQ(acatl::mqtt::QoSLevel::Error, suback._qosLevels[1]);
+    
+    // a publish without permission is acknowledged, but not delivered
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->setQoS(acatl::mqtt::QoSLevel::AtLeastOnce);
+    pub->_packetIdentifier = 5;
+    pub->_topicName = "devices/sensor2/temperature";
+    pub->_payload = { '2', '1' };
+    result = processor.processPacket(std::move(pub), ec);
+    ASSERT_TRUE(std::get<1>(result));
+    EXPECT_EQ(acatl::mqtt::ControlPacketType::Puback, std::get<1>(result)->_header._controlPacketType);
+    EXPECT_TRUE(sender->_sendPackets.empty());
+    
+    pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_topicName = "devices/sensor1/temperature";
+    pub->_payload = { '2', '1' };
+    processor.processPacket(std::move(pub), ec);
+    EXPECT_EQ(1u, sender->_sendPackets.size());
+    
+    // the processor notices reloaded rules with its next publish
+    authorizer->reload(acatl::mqtt::AclRules());
+    pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_topicName = "devices/sensor1/temperature";
+    pub->_payload = { '2', '2' };
+    processor.processPacket(std::move(pub), ec);
+    EXPECT_EQ(1u, sender->_sendPackets.size());
+}
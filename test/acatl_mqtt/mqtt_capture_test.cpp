@@ -0,0 +1,170 @@
+//
+//  mqtt_capture_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_capture.h>
+
+#include <cstdio>
+#include <fstream>
+
+
+class MQTTCaptureTest : public ::testing::Test
+{
+public:
+    MQTTCaptureTest()
+    : _path("./mqtt_capture_test.bin")
+    {
+        std::remove(_path.c_str());
+    }
+    
+    ~MQTTCaptureTest()
+    {
+        std::remove(_path.c_str());
+    }
+    
+protected:
+    std::string _path;
+};
+
+
+TEST_F(MQTTCaptureTest, framesPacketsAcrossReads)
+{
+    // PUBLISH qos 0 'a/b' with payload 'xyz', PINGREQ, PUBLISH with a two byte remaining length
+    std::vector<uint8_t> bytes = { 0x30, 0x08, 0x00, 0x03, 'a', '/', 'b', 'x', 'y', 'z', 0xC0, 0x00 };
+    std::vector<uint8_t> large = { 0x30, 0x80, 0x01, 0x00, 0x01, 'c' };
+    large.resize(3 + 128, 'p');
+    bytes.insert(bytes.end(), large.begin(), large.end());
+    
+    for(size_t step : { 1, 2, 5, 200 }) {
+        acatl::mqtt::PacketFramer framer;
+        std::vector<std::vector<uint8_t>> packets;
+        std::error_code ec;
+        for(size_t pos = 0; pos < bytes.size(); pos += step) {
+            size_t length = std::min(step, bytes.size() - pos);
+            EXPECT_TRUE(framer.feed(bytes.data() + pos, length, [&packets](const std::vector<uint8_t>& packet) {
+                packets.push_back(packet);
+            }, ec));
+        }
+        ASSERT_EQ(3u, packets.size());
+        EXPECT_EQ(std::vector<uint8_t>(bytes.begin(), bytes.begin() + 10), packets[0]);
+        EXPECT_EQ(std::vector<uint8_t>({ 0xC0, 0x00 }), packets[1]);
+        EXPECT_EQ(large, packets[2]);
+    }
+    
+    acatl::mqtt::PacketFramer framer;
+    std::error_code ec;
+    uint8_t reserved = 0x00;
+    EXPECT_FALSE(framer.feed(&reserved, 1, [](const std::vector<uint8_t>&) {}, ec));
+    EXPECT_TRUE(ec);
+}
+
+TEST_F(MQTTCaptureTest, writeAndRead)
+{
+    std::vector<uint8_t> connect = { 0x10, 0x02, 0x01, 0x02 };
+    std::vector<uint8_t> large(300, 0x42);
+    large[0] = 0x30;
+    {
+        acatl::mqtt::CaptureWriter writer(_path);
+        std::error_code ec;
+        ASSERT_TRUE(writer.open(ec));
+        uint32_t first = writer.newConnection();
+        uint32_t second = writer.newConnection();
+        EXPECT_EQ(1u, first);
+        EXPECT_EQ(2u, second);
+        EXPECT_TRUE(writer.write(first, connect, ec));
+        EXPECT_TRUE(writer.write(second, large, ec));
+        EXPECT_TRUE(writer.end(first, ec));
+        EXPECT_EQ(3u, writer.records());
+        EXPECT_TRUE(writer.close(ec));
+        EXPECT_FALSE(writer.write(second, connect, ec));
+    }
+    
+    acatl::mqtt::CaptureReader reader(_path);
+    std::error_code ec;
+    ASSERT_TRUE(reader.open(ec));
+    acatl::mqtt::CaptureRecord record;
+    ASSERT_TRUE(reader.next(record, ec));
+    EXPECT_EQ(1u, record._connection);
+    EXPECT_EQ(connect, record._packet);
+    std::chrono::microseconds time = record._time;
+    ASSERT_TRUE(reader.next(record, ec));
+    EXPECT_EQ(2u, record._connection);
+    EXPECT_EQ(large, record._packet);
+    EXPECT_LE(time, record._time);
+    ASSERT_TRUE(reader.next(record, ec));
+    EXPECT_EQ(1u, record._connection);
+    EXPECT_TRUE(record._packet.empty());
+    EXPECT_FALSE(reader.next(record, ec));
+    EXPECT_FALSE(ec);
+}
+
+TEST_F(MQTTCaptureTest, truncatedAndCorruptedFiles)
+{
+    {
+        acatl::mqtt::CaptureWriter writer(_path);
+        std::error_code ec;
+        ASSERT_TRUE(writer.open(ec));
+        uint32_t connection = writer.newConnection();
+        writer.write(connection, { 0xC0, 0x00 }, ec);
+        writer.write(connection, { 0x30, 0x05, 0x00, 0x01, 't', 'a', 'b' }, ec);
+    }
+    // cut the last record in the middle, as a crash leaves it
+    std::string content;
+    {
+        std::ifstream in(_path, std::ios::binary);
+        content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream out(_path, std::ios::binary | std::ios::trunc);
+        out.write(content.data(), static_cast<std::streamsize>(content.size() - 3));
+    }
+    {
+        acatl::mqtt::CaptureReader reader(_path);
+        std::error_code ec;
+        ASSERT_TRUE(reader.open(ec));
+        acatl::mqtt::CaptureRecord record;
+        EXPECT_TRUE(reader.next(record, ec));
+        EXPECT_FALSE(reader.next(record, ec));
+        EXPECT_FALSE(ec);
+    }
+    
+    {
+        std::ofstream out(_path, std::ios::binary | std::ios::trunc);
+        out << "MQTT";
+    }
+    acatl::mqtt::CaptureReader reader(_path);
+    std::error_code ec;
+    EXPECT_FALSE(reader.open(ec));
+    EXPECT_EQ(std::error_code(acatl::mqtt::mqtt_error::capture_file_corrupted), ec);
+}
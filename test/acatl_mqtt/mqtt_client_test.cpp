@@ -0,0 +1,352 @@
+//
+//  mqtt_client_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_client.h>
+
+#include <set>
+
+
+namespace
+{
+    /// Serves one client at a time on a loopback port. Acknowledges everything and optionally sends the publishes
+    /// back to the client.
+    class FakeBroker
+    {
+    public:
+        FakeBroker(asio::io_context& context)
+        : _context(context)
+        , _acceptor(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+        , _socket(context)
+        {
+            _readBuf.resize(4096);
+            accept();
+        }
+        
+        uint16_t port() const
+        {
+            return _acceptor.local_endpoint().port();
+        }
+        
+        /// Sends the acknowledgements held back by holdAcknowledgements.
+        void releaseAcknowledgements()
+        {
+            _holdAcknowledgements = false;
+            for(auto packetIdentifier : _heldAcknowledgements) {
+                send(acatl::mqtt::PubAckControlPacket(packetIdentifier));
+            }
+            _heldAcknowledgements.clear();
+        }
+        
+        bool _echo{false};
+        bool _holdAcknowledgements{false};
+        // the connection is closed when it received this many publishes, 0 keeps it open
+        size_t _dropAfter{0};
+        size_t _connects{0};
+        size_t _subscribes{0};
+        size_t _disconnects{0};
+        size_t _duplicates{0};
+        std::vector<acatl::mqtt::PublishControlPacket> _publishes;
+        
+    private:
+        void accept()
+        {
+            _socket = asio::ip::tcp::socket(_context);
+            _acceptor.async_accept(_socket, [this](const std::error_code& ec) {
+                if(!ec) {
+                    _parser.reset(new acatl::mqtt::MQTTParser());
+                    _connectionPublishes = 0;
+                    read();
+                }
+            });
+        }
+        
+        void drop()
+        {
+            asio::error_code ignored;
+            _socket.close(ignored);
+            accept();
+        }
+        
+        void read()
+        {
+            _socket.async_read_some(asio::buffer(_readBuf), [this](const std::error_code& ec, std::size_t length) {
+                if(ec) {
+                    drop();
+                    return;
+                }
+                for(size_t index = 0; index < length; ++index) {
+                    std::error_code errc;
+                    acatl::Tribool ret = _parser->parse(_readBuf[index], errc);
+                    if(ret.isTrue() && !handle(_parser->consumePacket())) {
+                        drop();
+                        return;
+                    }
+                }
+                read();
+            });
+        }
+        
+        bool handle(acatl::mqtt::ControlPacket::Ptr packet)
+        {
+            using namespace acatl::mqtt;
+            switch(packet->_header._controlPacketType) {
+                case ControlPacketType::Connect: {
+                    ++_connects;
+                    ConnAckControlPacket connAck;
+                    connAck._connectAcknowledgeFlag = ConnectAcknowledgeFlags::None;
+                    connAck._connectReturnCode = ConnectReturnCode::ConnectionAccepted;
+                    send(connAck);
+                    break;
+                }
+                case ControlPacketType::Subscribe: {
+                    ++_subscribes;
+                    const auto& subscribe = static_cast<const SubscribeControlPacket&>(*packet);
+                    SubAckControlPacket subAck;
+                    subAck._packetIdentifier = subscribe._packetIdentifier;
+                    for(const auto& topicFilter : subscribe._topicFilters) {
+                        subAck._qosLevels.push_back(topicFilter._qos);
+                    }
+                    send(subAck);
+                    break;
+                }
+                case ControlPacketType::Publish: {
+                    const auto& publish = static_cast<const PublishControlPacket&>(*packet);
+                    if(_dropAfter != 0 && ++_connectionPublishes == _dropAfter) {
+                        _dropAfter = 0;
+                        return false;
+                    }
+                    if((publish._header._flags & 0x08) != 0) {
+                        ++_duplicates;
+                    }
+                    _publishes.push_back(publish);
+                    if(publish.qos() == QoSLevel::AtLeastOnce) {
+                        if(_holdAcknowledgements) {
+                            _heldAcknowledgements.push_back(publish._packetIdentifier);
+                        } else {
+                            send(PubAckControlPacket(publish._packetIdentifier));
+                        }
+                    } else if(publish.qos() == QoSLevel::ExactlyOnce) {
+                        send(PubRecControlPacket(publish._packetIdentifier));
+                    }
+                    if(_echo) {
+                        PublishControlPacket echo(publish);
+                        echo._header._flags &= 0x07;
+                        echo._packetIdentifier = ++_packetIdentifier;
+                        send(echo);
+                    }
+                    break;
+                }
+                case ControlPacketType::Pubrel:
+                    send(PubCompControlPacket(static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier));
+                    break;
+                case ControlPacketType::Pubrec:
+                    send(PubRelControlPacket(static_cast<const AcknowledgeControlPacket&>(*packet)._packetIdentifier));
+                    break;
+                case ControlPacketType::Disconnect:
+                    ++_disconnects;
+                    break;
+                default:
+                    break;
+            }
+            return true;
+        }
+        
+        void send(const acatl::mqtt::ControlPacket& packet)
+        {
+            auto buffer = std::make_shared<std::vector<uint8_t>>();
+            size_t length = 0;
+            std::error_code ec;
+            _serializer.serialize(packet, *buffer, length, ec);
+            buffer->resize(length);
+            asio::async_write(_socket, asio::buffer(*buffer), [buffer](const std::error_code& /*ec*/, std::size_t /*length*/) {});
+        }
+        
+        asio::io_context& _context;
+        asio::ip::tcp::acceptor _acceptor;
+        asio::ip::tcp::socket _socket;
+        std::unique_ptr<acatl::mqtt::MQTTParser> _parser;
+        acatl::mqtt::Serializer _serializer;
+        std::vector<uint8_t> _readBuf;
+        std::vector<acatl::mqtt::PacketIdentifier> _heldAcknowledgements;
+        acatl::mqtt::PacketIdentifier _packetIdentifier{0};
+        size_t _connectionPublishes{0};
+    };
+    
+    typedef acatl::mqtt::Client<acatl::net::Socket> Client;
+    
+    Client::Ptr makeClient(asio::io_context& context, uint16_t port, uint16_t receiveMaximum = 64)
+    {
+        static acatl::net::NullContext nullContext;
+        acatl::mqtt::ClientOptions options;
+        options._port = port;
+        options._clientId = "sheldon";
+        options._receiveMaximum = receiveMaximum;
+        options._reconnectDelay = std::chrono::milliseconds(10);
+        return acatl::mqtt::make_client<acatl::net::Socket>(context, options, nullContext);
+    }
+    
+    template<typename Predicate>
+    bool runUntil(asio::io_context& context, Predicate predicate)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while(!predicate() && std::chrono::steady_clock::now() < deadline) {
+            context.run_for(std::chrono::milliseconds(5));
+        }
+        return predicate();
+    }
+}
+
+
+TEST(MQTTClientTest, publishAndReceive)
+{
+    asio::io_context context;
+    FakeBroker broker(context);
+    broker._echo = true;
+    
+    Client::Ptr client = makeClient(context, broker.port());
+    std::vector<acatl::mqtt::PublishControlPacket> received;
+    client->setMessageHandler([&received](const acatl::mqtt::PublishControlPacket& publish) { received.push_back(publish); });
+    acatl::mqtt::QoSLevels granted;
+    client->subscribe({acatl::mqtt::TopicFilter("sheldon/#", acatl::mqtt::QoSLevel::ExactlyOnce)},
+                      [&granted](const acatl::mqtt::QoSLevels& qosLevels) { granted = qosLevels; });
+    
+    // publishes before the connection is established are queued
+    size_t completed = 0;
+    for(uint8_t i = 0; i < 30; ++i) {
+        client->publish("sheldon/bazinga", {i}, acatl::mqtt::QoSLevel(i % 3), false,
+                        [&completed](const std::error_code& ec) { completed += ec ? 0 : 1; });
+    }
+    EXPECT_EQ(30u, client->queued());
+    client->connect();
+    
+    ASSERT_TRUE(runUntil(context, [&]() { return completed == 30 && received.size() == 30; }));
+    EXPECT_TRUE(client->connected());
+    EXPECT_EQ(0u, client->inflight());
+    EXPECT_EQ(acatl::mqtt::QoSLevels{acatl::mqtt::QoSLevel::ExactlyOnce}, granted);
+    for(uint8_t i = 0; i < 30; ++i) {
+        EXPECT_EQ(acatl::mqtt::QoSLevel(i % 3), received[i].qos());
+        EXPECT_EQ(acatl::mqtt::Payload{i}, received[i]._payload);
+    }
+    
+    client->disconnect();
+    ASSERT_TRUE(runUntil(context, [&]() { return broker._disconnects == 1; }));
+    EXPECT_FALSE(client->connected());
+}
+
+TEST(MQTTClientTest, pipelinedPublishes)
+{
+    asio::io_context context;
+    FakeBroker broker(context);
+    broker._holdAcknowledgements = true;
+    
+    Client::Ptr client = makeClient(context, broker.port(), 8);
+    size_t completed = 0;
+    for(uint8_t i = 0; i < 20; ++i) {
+        client->publish("sheldon/bazinga", {i}, acatl::mqtt::QoSLevel::AtLeastOnce, false,
+                        [&completed](const std::error_code& ec) { completed += ec ? 0 : 1; });
+    }
+    client->connect();
+    
+    // the receive maximum is sent without waiting for an acknowledgement, the rest waits for room
+    ASSERT_TRUE(runUntil(context, [&]() { return broker._publishes.size() == 8; }));
+    context.run_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(8u, broker._publishes.size());
+    EXPECT_EQ(8u, client->inflight());
+    EXPECT_EQ(12u, client->queued());
+    EXPECT_EQ(0u, completed);
+    
+    broker.releaseAcknowledgements();
+    ASSERT_TRUE(runUntil(context, [&]() { return completed == 20; }));
+    for(uint8_t i = 0; i < 20; ++i) {
+        EXPECT_EQ(acatl::mqtt::Payload{i}, broker._publishes[i]._payload);
+    }
+}
+
+TEST(MQTTClientTest, reconnect)
+{
+    asio::io_context context;
+    FakeBroker broker(context);
+    broker._dropAfter = 5;
+    
+    Client::Ptr client = makeClient(context, broker.port());
+    std::vector<std::error_code> events;
+    client->setConnectionHandler([&events](const std::error_code& ec) { events.push_back(ec); });
+    client->subscribe({acatl::mqtt::TopicFilter("sheldon/#", acatl::mqtt::QoSLevel::AtLeastOnce)});
+    size_t completed = 0;
+    for(uint8_t i = 0; i < 20; ++i) {
+        client->publish("sheldon/bazinga", {i}, acatl::mqtt::QoSLevel::AtLeastOnce, false,
+                        [&completed](const std::error_code& ec) { completed += ec ? 0 : 1; });
+    }
+    client->connect();
+    
+    // the broker drops the connection at the fifth publish, the client sends the unacknowledged ones again
+    ASSERT_TRUE(runUntil(context, [&]() { return completed == 20; }));
+    EXPECT_EQ(2u, broker._connects);
+    EXPECT_EQ(2u, broker._subscribes);
+    EXPECT_LT(0u, broker._duplicates);
+    ASSERT_EQ(3u, events.size());
+    EXPECT_FALSE(events[0]);
+    EXPECT_TRUE(events[1]);
+    EXPECT_FALSE(events[2]);
+    
+    std::set<uint8_t> payloads;
+    for(const auto& publish : broker._publishes) {
+        payloads.insert(publish._payload[0]);
+    }
+    EXPECT_EQ(20u, payloads.size());
+}
+
+TEST(MQTTClientTest, disconnectCancelsPublishes)
+{
+    asio::io_context context;
+    FakeBroker broker(context);
+    broker._holdAcknowledgements = true;
+    
+    Client::Ptr client = makeClient(context, broker.port(), 4);
+    std::vector<std::error_code> results;
+    for(uint8_t i = 0; i < 10; ++i) {
+        client->publish("sheldon/bazinga", {i}, acatl::mqtt::QoSLevel::AtLeastOnce, false,
+                        [&results](const std::error_code& ec) { results.push_back(ec); });
+    }
+    client->connect();
+    ASSERT_TRUE(runUntil(context, [&]() { return broker._publishes.size() == 4; }));
+    
+    client->disconnect();
+    EXPECT_EQ(10u, results.size());
+    for(const auto& ec : results) {
+        EXPECT_EQ(std::errc::operation_canceled, ec);
+    }
+    ASSERT_TRUE(runUntil(context, [&]() { return broker._disconnects == 1; }));
+}
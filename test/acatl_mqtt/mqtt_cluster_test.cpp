@@ -0,0 +1,345 @@
+//
+//  mqtt_cluster_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_cluster.h>
+
+
+namespace
+{
+    class NullSubscriptionHandler : public acatl::mqtt::SubscriptionHandler
+    {
+    public:
+        void addSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+        {
+        }
+        
+        void removeSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+        {
+        }
+    };
+    
+    /// A connection of a loopback broker node: packets go through a real processor, as in the broker example.
+    class NodeConnection : public acatl::mqtt::PacketSender, public std::enable_shared_from_this<NodeConnection>
+    {
+    public:
+        NodeConnection(asio::ip::tcp::socket socket,
+                       acatl::mqtt::SubscriptionTreeManager& subscriptionTreeManager,
+                       acatl::mqtt::SessionManager& sessionManager,
+                       acatl::mqtt::ClusterCredentials::Ptr clusterCredentials)
+        : _socket(std::move(socket))
+        , _processor(subscriptionTreeManager, sessionManager)
+        {
+            _processor.setClusterCredentials(clusterCredentials);
+            _readBuf.resize(4096);
+        }
+        
+        void start()
+        {
+            _processor.setPacketSender(shared_from_this());
+            read();
+        }
+        
+        void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet) override
+        {
+            std::error_code ec;
+            size_t length = 0;
+            if(_serializer.serialize(*packet, _packetBuf, length, ec)) {
+                _outBuf.insert(_outBuf.end(), _packetBuf.begin(), _packetBuf.begin() + static_cast<std::ptrdiff_t>(length));
+            }
+            flush();
+        }
+        
+    private:
+        void read()
+        {
+            auto self(shared_from_this());
+            _socket.async_read_some(asio::buffer(_readBuf), [self](const std::error_code& ec, std::size_t length) {
+                if(ec) {
+                    return;
+                }
+                for(size_t index = 0; index < length; ++index) {
+                    std::error_code errc;
+                    acatl::Tribool ret = self->_parser.parse(self->_readBuf[index], errc);
+                    if(ret.isFalse()) {
+                        return;
+                    }
+                    if(ret.isTrue()) {
+                        auto result = self->_processor.processPacket(self->_parser.consumePacket(), errc);
+                        if(std::get<1>(result)) {
+                            self->addSendPacket(std::move(std::get<1>(result)));
+                        }
+                        if(errc || std::get<0>(result) == acatl::mqtt::ConnectionState::Close) {
+                            return;
+                        }
+                    }
+                }
+                self->read();
+            });
+        }
+        
+        void flush()
+        {
+            if(_writing || _outBuf.empty()) {
+                return;
+            }
+            _writing = true;
+            std::swap(_outBuf, _writeBuf);
+            auto self(shared_from_this());
+            asio::async_write(_socket, asio::buffer(_writeBuf), [self](const std::error_code& ec, std::size_t /*length*/) {
+                self->_writing = false;
+                self->_writeBuf.clear();
+                if(!ec) {
+                    self->flush();
+                }
+            });
+        }
+        
+        asio::ip::tcp::socket _socket;
+        acatl::mqtt::MQTTParser _parser;
+        acatl::mqtt::Serializer _serializer;
+        acatl::mqtt::Processor _processor;
+        std::vector<uint8_t> _readBuf;
+        std::vector<uint8_t> _packetBuf;
+        std::vector<uint8_t> _outBuf;
+        std::vector<uint8_t> _writeBuf;
+        bool _writing{false};
+    };
+    
+    /// A broker node listening on a loopback port, with the cluster links to its peers.
+    class Node
+    {
+    public:
+        Node(asio::io_context& context, const std::string& nodeId)
+        : _context(context)
+        , _acceptor(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0))
+        , _cluster(options(nodeId), _subscriptionTreeManager, _sessionManager)
+        {
+            accept();
+        }
+        
+        uint16_t port() const
+        {
+            return _acceptor.local_endpoint().port();
+        }
+        
+        void link(const Node& peer)
+        {
+            static acatl::net::NullContext nullContext;
+            acatl::mqtt::ClusterPeer clusterPeer;
+            clusterPeer._host = "127.0.0.1";
+            clusterPeer._port = peer.port();
+            _cluster.addLink(_context, clusterPeer, nullContext);
+        }
+        
+        /// @return The filters of all sessions, the links of the peers included.
+        std::set<std::string> subscriptions() const
+        {
+            std::set<std::string> filters;
+            _subscriptionTreeManager.getCurrentSubscriptionTree()->summarize(0, [](const acatl::mqtt::Session&) { return true; }, filters);
+            return filters;
+        }
+        
+        acatl::mqtt::SubscriptionTreeManager _subscriptionTreeManager;
+        acatl::mqtt::SessionManager _sessionManager;
+        
+    private:
+        static acatl::mqtt::ClusterOptions options(const std::string& nodeId)
+        {
+            acatl::mqtt::ClusterOptions options;
+            options._nodeId = nodeId;
+            options._summaryDepth = 2;
+            options._userName = "cluster";
+            options._password = "secret";
+            return options;
+        }
+        
+        void accept()
+        {
+            _acceptor.async_accept([this](const std::error_code& ec, asio::ip::tcp::socket socket) {
+                if(ec) {
+                    return;
+                }
+                auto credentials = std::make_shared<acatl::mqtt::ClusterCredentials>(
+                    acatl::mqtt::ClusterCredentials{_cluster.options()._userName, _cluster.options()._password});
+                auto connection = std::make_shared<NodeConnection>(std::move(socket), _subscriptionTreeManager, _sessionManager,
+                                                                   credentials);
+                connection->start();
+                _connections.push_back(connection);
+                accept();
+            });
+        }
+        
+        asio::io_context& _context;
+        asio::ip::tcp::acceptor _acceptor;
+        std::vector<std::shared_ptr<NodeConnection>> _connections;
+        
+    public:
+        acatl::mqtt::Cluster<acatl::net::Socket> _cluster;
+    };
+    
+    typedef acatl::mqtt::Client<acatl::net::Socket> Client;
+    
+    Client::Ptr makeClient(asio::io_context& context, uint16_t port, const std::string& clientId)
+    {
+        static acatl::net::NullContext nullContext;
+        acatl::mqtt::ClientOptions options;
+        options._port = port;
+        options._clientId = clientId;
+        return acatl::mqtt::make_client<acatl::net::Socket>(context, options, nullContext);
+    }
+    
+    template<typename Predicate>
+    bool runUntil(asio::io_context& context, Predicate predicate)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while(!predicate() && std::chrono::steady_clock::now() < deadline) {
+            context.run_for(std::chrono::milliseconds(5));
+        }
+        return predicate();
+    }
+}
+
+
+TEST(MQTTClusterTest, summary)
+{
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    acatl::mqtt::ClusterOptions options;
+    options._nodeId = "a";
+    options._summaryDepth = 2;
+    acatl::mqtt::Cluster<acatl::net::Socket> cluster(options, subscriptionTreeManager, sessionManager);
+    
+    NullSubscriptionHandler handler;
+    auto local = std::make_shared<acatl::mqtt::Session>("local", handler);
+    auto link = std::make_shared<acatl::mqtt::Session>("$cluster/b", handler);
+    std::error_code ec;
+    {
+        auto writableTree = subscriptionTreeManager.getWritableTree();
+        writableTree.tree()->addFilter(acatl::mqtt::TopicFilter("sensors/+/temperature"), local, ec);
+        writableTree.tree()->addFilter(acatl::mqtt::TopicFilter("sensors/kitchen/humidity"), local, ec);
+        writableTree.tree()->addFilter(acatl::mqtt::TopicFilter("lights"), local, ec);
+        writableTree.tree()->addFilter(acatl::mqtt::TopicFilter("alarm/#"), local, ec);
+        writableTree.tree()->addFilter(acatl::mqtt::TopicFilter("$SYS/broker/#"), local, ec);
+        writableTree.tree()->addFilter(acatl::mqtt::TopicFilter("doors/front"), link, ec);
+    }
+    
+    // deep filters are cut after two levels, the links of the peers and the reserved topics are left out
+    EXPECT_EQ(4u, cluster.updateSummary());
+    EXPECT_EQ(std::set<std::string>({"alarm/#", "lights", "sensors/+/#", "sensors/kitchen/#"}), cluster.summary());
+    // nothing changed since
+    EXPECT_EQ(0u, cluster.updateSummary());
+    
+    {
+        auto writableTree = subscriptionTreeManager.getWritableTree();
+        writableTree.tree()->addFilter(acatl::mqtt::TopicFilter("sensors/garden/temperature"), local, ec);
+        writableTree.tree()->addFilter(acatl::mqtt::TopicFilter("sensors/garden"), local, ec);
+    }
+    // only the new prefix is announced
+    EXPECT_EQ(2u, cluster.updateSummary());
+    EXPECT_EQ(1u, cluster.summary().count("sensors/garden"));
+    EXPECT_EQ(1u, cluster.summary().count("sensors/garden/#"));
+}
+
+TEST(MQTTClusterTest, forwarding)
+{
+    asio::io_context context;
+    Node a(context, "a");
+    Node b(context, "b");
+    Node c(context, "c");
+    a.link(b);
+    a.link(c);
+    b.link(a);
+    b.link(c);
+    c.link(a);
+    c.link(b);
+    a._cluster.start();
+    b._cluster.start();
+    c._cluster.start();
+    
+    std::vector<std::string> receivedB;
+    std::vector<std::string> receivedC;
+    Client::Ptr subscriberB = makeClient(context, b.port(), "subscriber-b");
+    subscriberB->setMessageHandler([&receivedB](const acatl::mqtt::PublishControlPacket& pub) {
+        receivedB.push_back(pub._topicName._name);
+    });
+    Client::Ptr subscriberC = makeClient(context, c.port(), "subscriber-c");
+    subscriberC->setMessageHandler([&receivedC](const acatl::mqtt::PublishControlPacket& pub) {
+        receivedC.push_back(pub._topicName._name);
+    });
+    size_t subscribed = 0;
+    subscriberB->connect();
+    subscriberB->subscribe({acatl::mqtt::TopicFilter("sensors/+/temperature", acatl::mqtt::QoSLevel::AtLeastOnce)},
+                           [&subscribed](const acatl::mqtt::QoSLevels&) { ++subscribed; });
+    subscriberC->connect();
+    subscriberC->subscribe({acatl::mqtt::TopicFilter("sensors/#", acatl::mqtt::QoSLevel::AtLeastOnce)},
+                           [&subscribed](const acatl::mqtt::QoSLevels&) { ++subscribed; });
+    ASSERT_TRUE(runUntil(context, [&]() { return subscribed == 2; }));
+    
+    EXPECT_EQ(1u, b._cluster.updateSummary());
+    EXPECT_EQ(1u, c._cluster.updateSummary());
+    // a has no local subscribers, the interest of its peers is not announced again
+    EXPECT_EQ(0u, a._cluster.updateSummary());
+    ASSERT_TRUE(runUntil(context, [&]() {
+        std::set<std::string> filters = a.subscriptions();
+        return filters.count("sensors/+/#") == 1 && filters.count("sensors/#") == 1;
+    }));
+    
+    Client::Ptr publisher = makeClient(context, a.port(), "publisher");
+    publisher->connect();
+    size_t completed = 0;
+    publisher->publish("sensors/kitchen/temperature", {'2', '1'}, acatl::mqtt::QoSLevel::AtLeastOnce, false,
+                       [&completed](const std::error_code&) { ++completed; });
+    publisher->publish("sensors/kitchen/humidity", {'4', '0'}, acatl::mqtt::QoSLevel::AtLeastOnce, false,
+                       [&completed](const std::error_code&) { ++completed; });
+    publisher->publish("lights/kitchen", {'1'}, acatl::mqtt::QoSLevel::AtLeastOnce, false,
+                       [&completed](const std::error_code&) { ++completed; });
+    ASSERT_TRUE(runUntil(context, [&]() { return completed == 3 && receivedB.size() == 1 && receivedC.size() == 2; }));
+    context.run_for(std::chrono::milliseconds(50));
+    
+    // every node gets what its clients want from a directly, once, nothing travels between b and c
+    EXPECT_EQ(std::vector<std::string>({"sensors/kitchen/temperature"}), receivedB);
+    EXPECT_EQ(std::vector<std::string>({"sensors/kitchen/temperature", "sensors/kitchen/humidity"}), receivedC);
+    EXPECT_EQ(2u, b._cluster.received());
+    EXPECT_EQ(2u, c._cluster.received());
+    EXPECT_EQ(0u, a._cluster.received());
+    
+    publisher->disconnect();
+    subscriberB->disconnect();
+    subscriberC->disconnect();
+    a._cluster.stop();
+    b._cluster.stop();
+    c._cluster.stop();
+    context.run_for(std::chrono::milliseconds(20));
+}
@@ -0,0 +1,387 @@
+//
+//  mqtt_file_session_store_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_file_session_store.h>
+#include <acatl_mqtt/mqtt_session_manager.h>
+
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+
+namespace
+{
+    class NullSender : public acatl::mqtt::PacketSender
+    {
+    public:
+        virtual void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet)
+        {
+        }
+    };
+}
+
+
+class MQTTFileSessionStoreTest : public acatl::mqtt::SubscriptionHandler, public ::testing::Test
+{
+public:
+    MQTTFileSessionStoreTest()
+    : _path("./mqtt_session_store_test.log")
+    {
+        std::remove(_path.c_str());
+    }
+    
+    ~MQTTFileSessionStoreTest()
+    {
+        std::remove(_path.c_str());
+    }
+    
+    virtual void addSubscriptions(const acatl::mqtt::TopicFilters& subscriptions)
+    {}
+    
+    virtual void removeSubscriptions(const acatl::mqtt::TopicFilters& subscriptions)
+    {}
+    
+protected:
+    acatl::mqtt::Session makeSession(const std::string& clientId, const acatl::mqtt::TopicFilters& subscriptions)
+    {
+        acatl::mqtt::Session session(clientId, *this);
+        session.addSubscriptions(subscriptions);
+        return session;
+    }
+    
+    std::string _path;
+};
+
+
+TEST_F(MQTTFileSessionStoreTest, persistAndReopen)
+{
+    acatl::mqtt::TopicFilters filters{{"a/b", acatl::mqtt::QoSLevel::AtMostOnce}, {"c/#", acatl::mqtt::QoSLevel::ExactlyOnce}};
+    std::error_code ec;
+    {
+        acatl::mqtt::FileSessionStore store(_path);
+        EXPECT_TRUE(store.open(ec));
+        EXPECT_FALSE(ec);
+        
+        auto session = makeSession("hutzli0815", filters);
+        EXPECT_TRUE(store.persistSession(session, ec));
+        auto other = makeSession("other", {{"x"}});
+        EXPECT_TRUE(store.persistSession(other, ec));
+        EXPECT_TRUE(store.removeSession("other", ec));
+        EXPECT_EQ(1u, store.count());
+    }
+    
+    acatl::mqtt::FileSessionStore store(_path);
+    EXPECT_TRUE(store.open(ec));
+    EXPECT_EQ(1u, store.count());
+    
+    acatl::mqtt::TopicFilters loaded;
+    EXPECT_TRUE(store.loadSession("hutzli0815", loaded, ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(filters, loaded);
+    
+    EXPECT_FALSE(store.loadSession("other", loaded, ec));
+    EXPECT_FALSE(ec);
+}
+
+TEST_F(MQTTFileSessionStoreTest, truncatedRecord)
+{
+    std::error_code ec;
+    uint64_t size = 0;
+    {
+        acatl::mqtt::FileSessionStore store(_path);
+        EXPECT_TRUE(store.open(ec));
+        auto session = makeSession("hutzli0815", {{"a/b"}});
+        EXPECT_TRUE(store.persistSession(session, ec));
+        size = store.fileSize();
+    }
+    {
+        // simulate a crash in the middle of writing the next record
+        std::ofstream out(_path, std::ios::binary | std::ios::app);
+        out.write("\x00\x00\x00\x20\x01\x00", 6);
+    }
+    
+    acatl::mqtt::FileSessionStore store(_path);
+    EXPECT_TRUE(store.open(ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(size, store.fileSize());
+    
+    auto session = makeSession("next", {{"c"}});
+    EXPECT_TRUE(store.persistSession(session, ec));
+    acatl::mqtt::TopicFilters loaded;
+    EXPECT_TRUE(store.loadSession("hutzli0815", loaded, ec));
+    EXPECT_TRUE(store.loadSession("next", loaded, ec));
+    EXPECT_EQ(acatl::mqtt::TopicFilters{{"c"}}, loaded);
+}
+
+TEST_F(MQTTFileSessionStoreTest, undecodableRecord)
+{
+    std::error_code ec;
+    uint64_t size = 0;
+    {
+        acatl::mqtt::FileSessionStore store(_path);
+        EXPECT_TRUE(store.open(ec));
+        auto session = makeSession("hutzli0815", {{"a/b"}});
+        EXPECT_TRUE(store.persistSession(session, ec));
+        auto other = makeSession("other", {{"x"}});
+        EXPECT_TRUE(store.persistSession(other, ec));
+        size = store.fileSize();
+    }
+    {
+        // garble the type of the first record, its length is still intact
+        std::fstream file(_path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(4);
+        file.put('\x7f');
+    }
+    
+    acatl::mqtt::FileSessionStore store(_path);
+    EXPECT_TRUE(store.open(ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(1u, store.skippedRecords());
+    EXPECT_EQ(size, store.fileSize());
+    EXPECT_EQ(1u, store.count());
+    acatl::mqtt::TopicFilters loaded;
+    EXPECT_FALSE(store.loadSession("hutzli0815", loaded, ec));
+    EXPECT_TRUE(store.loadSession("other", loaded, ec));
+    EXPECT_EQ(acatl::mqtt::TopicFilters{{"x"}}, loaded);
+}
+
+TEST_F(MQTTFileSessionStoreTest, compaction)
+{
+    acatl::mqtt::FileSessionStoreOptions options;
+    options._compactionMinBytes = 1024;
+    options._compactionRatio = 2.0;
+    
+    std::error_code ec;
+    acatl::mqtt::FileSessionStore store(_path, options);
+    EXPECT_TRUE(store.open(ec));
+    
+    auto session = makeSession("hutzli0815", {{"a/b/c/d/e/f"}});
+    auto other = makeSession("other", {{"x/y"}});
+    EXPECT_TRUE(store.persistSession(other, ec));
+    for(int i = 0; i < 200; ++i) {
+        if(i % 2 == 0) {
+            session.addSubscriptions({{"toggle"}});
+        } else {
+            session.removeSubscriptions({{"toggle"}});
+        }
+        EXPECT_TRUE(store.persistSession(session, ec));
+        EXPECT_FALSE(ec);
+    }
+    EXPECT_LT(store.fileSize(), 1024u);
+    EXPECT_LE(store.liveBytes(), store.fileSize());
+    
+    acatl::mqtt::TopicFilters loaded;
+    EXPECT_TRUE(store.loadSession("other", loaded, ec));
+    EXPECT_EQ(acatl::mqtt::TopicFilters{{"x/y"}}, loaded);
+    EXPECT_TRUE(store.loadSession("hutzli0815", loaded, ec));
+    EXPECT_EQ(acatl::mqtt::TopicFilters{{"a/b/c/d/e/f"}}, loaded);
+}
+
+TEST_F(MQTTFileSessionStoreTest, outdatedState)
+{
+    std::error_code ec;
+    acatl::mqtt::FileSessionStore store(_path);
+    EXPECT_TRUE(store.open(ec));
+    
+    auto session = makeSession("hutzli0815", {{"a/b"}});
+    acatl::mqtt::SessionState outdated = session.state();
+    session.addSubscriptions({{"c/d"}});
+    EXPECT_TRUE(store.persistSession(session, ec));
+    
+    // a state copied before the last change is written late, it must not replace the newer one
+    EXPECT_TRUE(store.persistSession(outdated, ec));
+    EXPECT_FALSE(ec);
+    acatl::mqtt::TopicFilters loaded;
+    EXPECT_TRUE(store.loadSession("hutzli0815", loaded, ec));
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"a/b"}, {"c/d"}}), loaded);
+}
+
+TEST_F(MQTTFileSessionStoreTest, stateAfterRemove)
+{
+    std::error_code ec;
+    acatl::mqtt::FileSessionStore store(_path);
+    EXPECT_TRUE(store.open(ec));
+    
+    // states copied before the removal are persisted late, with and without a stored record
+    auto session = makeSession("hutzli0815", {{"a/b"}});
+    EXPECT_TRUE(store.persistSession(session, ec));
+    acatl::mqtt::SessionState late = session.state();
+    auto other = makeSession("other", {{"x"}});
+    acatl::mqtt::SessionState otherLate = other.state();
+    EXPECT_TRUE(store.removeSession("hutzli0815", ec));
+    EXPECT_TRUE(store.removeSession("other", ec));
+    
+    EXPECT_TRUE(store.persistSession(late, ec));
+    EXPECT_TRUE(store.persistSession(otherLate, ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(0u, store.count());
+    acatl::mqtt::TopicFilters loaded;
+    EXPECT_FALSE(store.loadSession("hutzli0815", loaded, ec));
+    
+    // a session created after the removal is stored again
+    auto resumed = makeSession("hutzli0815", {{"c/d"}});
+    EXPECT_TRUE(store.persistSession(resumed, ec));
+    EXPECT_TRUE(store.loadSession("hutzli0815", loaded, ec));
+    EXPECT_EQ(acatl::mqtt::TopicFilters{{"c/d"}}, loaded);
+}
+
+TEST_F(MQTTFileSessionStoreTest, concurrentCompaction)
+{
+    acatl::mqtt::FileSessionStoreOptions options;
+    options._compactionMinBytes = 512;
+    
+    std::error_code ec;
+    {
+        acatl::mqtt::FileSessionStore store(_path, options);
+        EXPECT_TRUE(store.open(ec));
+        
+        // records are appended by the other threads while one of them copies the live records
+        std::vector<std::thread> threads;
+        for(int t = 0; t < 4; ++t) {
+            threads.emplace_back([&store, t, this]() {
+                auto session = makeSession("client" + std::to_string(t), {{"a/" + std::to_string(t)}});
+                for(int i = 0; i < 300; ++i) {
+                    session.addSubscriptions({{"toggle/" + std::to_string(i)}});
+                    session.removeSubscriptions({{"toggle/" + std::to_string(i)}});
+                    std::error_code errc;
+                    EXPECT_TRUE(store.persistSession(session, errc));
+                }
+            });
+        }
+        for(auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_LT(store.fileSize(), 4u * 512u);
+    }
+    
+    acatl::mqtt::FileSessionStore store(_path, options);
+    EXPECT_TRUE(store.open(ec));
+    EXPECT_EQ(4u, store.count());
+    for(int t = 0; t < 4; ++t) {
+        acatl::mqtt::TopicFilters loaded;
+        EXPECT_TRUE(store.loadSession("client" + std::to_string(t), loaded, ec));
+        EXPECT_EQ(acatl::mqtt::TopicFilters{{"a/" + std::to_string(t)}}, loaded);
+    }
+}
+
+TEST_F(MQTTFileSessionStoreTest, backgroundSync)
+{
+    acatl::mqtt::FileSessionStoreOptions options;
+    options._syncEvery = 1;
+    
+    std::error_code ec;
+    {
+        acatl::mqtt::FileSessionStore store(_path, options);
+        EXPECT_TRUE(store.open(ec));
+        std::vector<std::thread> threads;
+        for(int t = 0; t < 4; ++t) {
+            threads.emplace_back([&store, t, this]() {
+                for(int i = 0; i < 50; ++i) {
+                    auto session = makeSession("client" + std::to_string(t) + "/" + std::to_string(i), {{"a"}});
+                    std::error_code errc;
+                    EXPECT_TRUE(store.persistSession(session, errc));
+                }
+            });
+        }
+        for(auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_TRUE(store.close(ec));
+        EXPECT_FALSE(ec);
+    }
+    
+    acatl::mqtt::FileSessionStore store(_path, options);
+    EXPECT_TRUE(store.open(ec));
+    EXPECT_EQ(200u, store.count());
+    EXPECT_EQ(0u, store.skippedRecords());
+}
+
+TEST_F(MQTTFileSessionStoreTest, unchangedSession)
+{
+    std::error_code ec;
+    acatl::mqtt::FileSessionStore store(_path);
+    EXPECT_TRUE(store.open(ec));
+    
+    auto session = makeSession("hutzli0815", {{"a/b"}});
+    EXPECT_TRUE(store.persistSession(session, ec));
+    uint64_t fileSize = store.fileSize();
+    EXPECT_TRUE(store.persistSession(session, ec));
+    EXPECT_EQ(fileSize, store.fileSize());
+    
+    session.addSubscriptions({{"c/d"}});
+    EXPECT_TRUE(store.persistSession(session, ec));
+    EXPECT_LT(fileSize, store.fileSize());
+}
+
+TEST_F(MQTTFileSessionStoreTest, sessionManager)
+{
+    auto sender = std::make_shared<NullSender>();
+    std::error_code ec;
+    {
+        auto store = std::make_shared<acatl::mqtt::FileSessionStore>(_path);
+        EXPECT_TRUE(store->open(ec));
+        acatl::mqtt::SessionManager manager;
+        manager.setSessionStore(store);
+        
+        auto session = manager.getSession("persistent", false, sender, *this, ec);
+        session->addSubscriptions({{"a/b"}});
+        EXPECT_TRUE(manager.returnSession(session, ec));
+        
+        auto clean = manager.getSession("clean", true, sender, *this, ec);
+        clean->addSubscriptions({{"c/d"}});
+        EXPECT_TRUE(manager.persistSession(*clean, ec));
+        EXPECT_TRUE(manager.returnSession(clean, ec));
+        EXPECT_EQ(1u, manager.count());
+        EXPECT_EQ(1u, store->count());
+    }
+    
+    auto store = std::make_shared<acatl::mqtt::FileSessionStore>(_path);
+    EXPECT_TRUE(store->open(ec));
+    acatl::mqtt::SessionManager manager;
+    manager.setSessionStore(store);
+    EXPECT_EQ(0u, manager.count());
+    
+    auto session = manager.getSession("persistent", false, sender, *this, ec);
+    ASSERT_TRUE(session != nullptr);
+    EXPECT_EQ(acatl::mqtt::TopicFilters{{"a/b"}}, session->subscriptions());
+    EXPECT_EQ(acatl::mqtt::TopicFilters{{"a/b"}}, session->takeRestoredSubscriptions());
+    EXPECT_TRUE(session->takeRestoredSubscriptions().empty());
+    EXPECT_TRUE(manager.returnSession(session, ec));
+    
+    session = manager.getSession("persistent", true, sender, *this, ec);
+    ASSERT_TRUE(session != nullptr);
+    EXPECT_TRUE(session->subscriptions().empty());
+    EXPECT_EQ(0u, store->count());
+}
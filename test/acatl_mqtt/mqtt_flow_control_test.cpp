@@ -0,0 +1,79 @@
+//
+//  mqtt_flow_control_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_flow_control.h>
+
+
+TEST(MQTTFlowControlTest, disabled)
+{
+    acatl::mqtt::FlowControl::Ptr flowControl = std::make_shared<acatl::mqtt::FlowControl>(0, 0);
+    EXPECT_FALSE(flowControl->enabled());
+    
+    std::shared_ptr<acatl::mqtt::FlowCredit> credit = flowControl->acquire(1000);
+    EXPECT_FALSE(flowControl->shouldPause());
+}
+
+TEST(MQTTFlowControlTest, pauseAndResume)
+{
+    acatl::mqtt::FlowControl::Ptr flowControl = std::make_shared<acatl::mqtt::FlowControl>(100, 50);
+    int resumed = 0;
+    flowControl->setResumeHandler([&resumed]() { ++resumed; });
+    
+    std::shared_ptr<acatl::mqtt::FlowCredit> first = flowControl->acquire(60);
+    std::shared_ptr<acatl::mqtt::FlowCredit> second = flowControl->acquire(60);
+    EXPECT_EQ(120u, flowControl->pendingBytes());
+    EXPECT_TRUE(flowControl->shouldPause());
+    
+    // above the low watermark, still paused
+    first.reset();
+    EXPECT_EQ(60u, flowControl->pendingBytes());
+    EXPECT_EQ(0, resumed);
+    
+    second.reset();
+    EXPECT_EQ(0u, flowControl->pendingBytes());
+    EXPECT_EQ(1, resumed);
+    EXPECT_FALSE(flowControl->shouldPause());
+}
+
+TEST(MQTTFlowControlTest, noResumeWithoutPause)
+{
+    acatl::mqtt::FlowControl::Ptr flowControl = std::make_shared<acatl::mqtt::FlowControl>(100, 50);
+    int resumed = 0;
+    flowControl->setResumeHandler([&resumed]() { ++resumed; });
+    
+    flowControl->acquire(200);
+    EXPECT_EQ(0u, flowControl->pendingBytes());
+    EXPECT_EQ(0, resumed);
+}
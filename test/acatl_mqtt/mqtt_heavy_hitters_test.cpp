@@ -0,0 +1,142 @@
+//
+//  mqtt_heavy_hitters_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_heavy_hitters.h>
+
+#include <thread>
+
+
+using namespace std::chrono_literals;
+
+
+TEST(MQTTHeavyHittersTest, countMinSketch)
+{
+    acatl::mqtt::CountMinSketch sketch(64, 4);
+    std::hash<std::string> hash;
+    
+    // far more keys than counters, the estimates may only be too high
+    for(int i = 0; i < 1000; ++i) {
+        sketch.add(hash("topic/" + std::to_string(i)), static_cast<uint64_t>(i % 10 + 1));
+    }
+    for(int i = 0; i < 1000; ++i) {
+        EXPECT_LE(static_cast<uint64_t>(i % 10 + 1), sketch.estimate(hash("topic/" + std::to_string(i))));
+    }
+    
+    uint64_t before = sketch.estimate(hash("heavy"));
+    EXPECT_EQ(before + 1000, sketch.add(hash("heavy"), 1000));
+    
+    sketch.clear();
+    EXPECT_EQ(0u, sketch.estimate(hash("heavy")));
+}
+
+TEST(MQTTHeavyHittersTest, topK)
+{
+    acatl::mqtt::TopK topK(3, 256, 4);
+    
+    // three heavy topics hidden between many light ones
+    for(int round = 0; round < 100; ++round) {
+        for(int i = 0; i < 50; ++i) {
+            topK.add("light/" + std::to_string(round * 50 + i), 1);
+        }
+        topK.add("heavy/a", 30);
+        topK.add("heavy/b", 20);
+        topK.add("heavy/c", 10);
+    }
+    
+    std::vector<acatl::mqtt::TopK::Entry> top = topK.top();
+    ASSERT_EQ(3u, top.size());
+    EXPECT_EQ("heavy/a", top[0]._key);
+    EXPECT_EQ("heavy/b", top[1]._key);
+    EXPECT_EQ("heavy/c", top[2]._key);
+    EXPECT_LE(3000u, top[0]._count);
+    EXPECT_GT(3300u, top[0]._count);
+    
+    acatl::mqtt::TopK other(3, 256, 4);
+    other.add("heavy/c", 5000);
+    other.add("heavy/d", 2500);
+    topK.merge(other);
+    top = topK.top();
+    ASSERT_EQ(3u, top.size());
+    EXPECT_EQ("heavy/c", top[0]._key);
+    EXPECT_EQ("heavy/a", top[1]._key);
+    EXPECT_EQ("heavy/d", top[2]._key);
+}
+
+TEST(MQTTHeavyHittersTest, threadsAndWindows)
+{
+    acatl::mqtt::HeavyHitterOptions options;
+    options._topK = 2;
+    acatl::mqtt::HeavyHitters heavyHitters(options);
+    acatl::mqtt::HeavyHitters::Clock::time_point start = acatl::mqtt::HeavyHitters::Clock::now();
+    heavyHitters.reset(start);
+    
+    std::vector<std::thread> threads;
+    for(int i = 0; i < 4; ++i) {
+        threads.emplace_back([&heavyHitters, i]() {
+            std::string client = "client" + std::to_string(i);
+            for(int j = 0; j < 1000; ++j) {
+                heavyHitters.record("sensors/" + std::to_string(j % 100), client, 10);
+                if(i == 3) {
+                    heavyHitters.record("video/stream", client, 1000);
+                }
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    
+    acatl::mqtt::HeavyHitters::Report report = heavyHitters.report(start + 2s);
+    EXPECT_EQ(2.0, report._window.count());
+    ASSERT_EQ(2u, report._topicsByMessages.size());
+    EXPECT_EQ("video/stream", report._topicsByMessages[0]._key);
+    EXPECT_EQ(1000u, report._topicsByMessages[0]._count);
+    EXPECT_EQ(500.0, report._topicsByMessages[0]._rate);
+    EXPECT_EQ("video/stream", report._topicsByBytes[0]._key);
+    EXPECT_EQ(1000000u, report._topicsByBytes[0]._count);
+    ASSERT_EQ(2u, report._clientsByMessages.size());
+    EXPECT_EQ("client3", report._clientsByMessages[0]._key);
+    EXPECT_EQ(2000u, report._clientsByMessages[0]._count);
+    
+    json dump = acatl::mqtt::HeavyHitters::toJson(report);
+    EXPECT_EQ("video/stream", dump["topics"]["messages"][0]["topic"]);
+    EXPECT_EQ("client3", dump["clients"]["bytes"][0]["client"]);
+    EXPECT_EQ(1010000u, dump["clients"]["bytes"][0]["count"].get<uint64_t>());
+    
+    heavyHitters.reset(start + 2s);
+    report = heavyHitters.report(start + 3s);
+    EXPECT_TRUE(report._topicsByMessages.empty());
+    EXPECT_TRUE(report._clientsByBytes.empty());
+}
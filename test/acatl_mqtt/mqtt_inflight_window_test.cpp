@@ -0,0 +1,152 @@
+//
+//  mqtt_inflight_window_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_inflight_window.h>
+
+
+namespace
+{
+    acatl::mqtt::PublishControlPacket makePublish(acatl::mqtt::QoSLevel qos, uint8_t value)
+    {
+        acatl::mqtt::PublishControlPacket packet;
+        packet.setQoS(qos);
+        packet._topicName._name = "sheldon/bazinga";
+        packet._payload = { value };
+        return packet;
+    }
+}
+
+
+TEST(MQTTInflightWindowTest, atLeastOnce)
+{
+    acatl::mqtt::InflightWindow window(3);
+    EXPECT_TRUE(window.empty());
+    
+    std::vector<acatl::mqtt::PacketIdentifier> identifiers;
+    for(uint8_t i = 0; i < 3; ++i) {
+        acatl::mqtt::PublishControlPacket publish = makePublish(acatl::mqtt::QoSLevel::AtLeastOnce, i);
+        identifiers.push_back(window.add(publish));
+        EXPECT_EQ(identifiers.back(), publish._packetIdentifier);
+    }
+    EXPECT_EQ((std::vector<acatl::mqtt::PacketIdentifier>{1, 2, 3}), identifiers);
+    EXPECT_TRUE(window.full());
+    
+    // acknowledgements may arrive out of order, a freed slot takes the next identifier that maps to it
+    EXPECT_TRUE(window.acknowledge(2));
+    EXPECT_FALSE(window.acknowledge(2));
+    EXPECT_FALSE(window.receive(1));
+    EXPECT_EQ(1u, window.available());
+    acatl::mqtt::PublishControlPacket publish = makePublish(acatl::mqtt::QoSLevel::AtLeastOnce, 3);
+    EXPECT_EQ(5u, window.add(publish));
+    
+    std::vector<acatl::mqtt::ControlPacket::Ptr> packets;
+    window.retransmissions(packets);
+    ASSERT_EQ(3u, packets.size());
+    std::vector<uint8_t> order;
+    for(const auto& packet : packets) {
+        const acatl::mqtt::PublishControlPacket& resend = static_cast<const acatl::mqtt::PublishControlPacket&>(*packet);
+        EXPECT_EQ(0x08, resend._header._flags & 0x08);
+        order.push_back(resend._payload[0]);
+    }
+    EXPECT_EQ((std::vector<uint8_t>{0, 2, 3}), order);
+}
+
+TEST(MQTTInflightWindowTest, exactlyOnce)
+{
+    acatl::mqtt::InflightWindow window(2);
+    acatl::mqtt::PublishControlPacket first = makePublish(acatl::mqtt::QoSLevel::ExactlyOnce, 1);
+    acatl::mqtt::PublishControlPacket second = makePublish(acatl::mqtt::QoSLevel::ExactlyOnce, 2);
+    window.add(first);
+    window.add(second);
+    
+    EXPECT_FALSE(window.acknowledge(first._packetIdentifier));
+    EXPECT_FALSE(window.complete(first._packetIdentifier));
+    EXPECT_TRUE(window.receive(first._packetIdentifier));
+    EXPECT_FALSE(window.receive(first._packetIdentifier));
+    // a received message still occupies its slot until PUBCOMP
+    EXPECT_TRUE(window.full());
+    
+    std::vector<acatl::mqtt::ControlPacket::Ptr> packets;
+    window.retransmissions(packets);
+    ASSERT_EQ(2u, packets.size());
+    EXPECT_EQ(acatl::mqtt::ControlPacketType::Pubrel, packets[0]->_header._controlPacketType);
+    EXPECT_EQ(acatl::mqtt::ControlPacketType::Publish, packets[1]->_header._controlPacketType);
+    
+    EXPECT_TRUE(window.complete(first._packetIdentifier));
+    EXPECT_EQ(1u, window.size());
+}
+
+TEST(MQTTInflightWindowTest, identifierWrapAround)
+{
+    acatl::mqtt::InflightWindow window(16);
+    acatl::mqtt::PublishControlPacket pinned = makePublish(acatl::mqtt::QoSLevel::AtLeastOnce, 0);
+    window.add(pinned);
+    
+    // one message stays in flight while the identifiers wrap around twice, it is never handed out again
+    for(uint32_t i = 0; i < 2 * 0xFFFF; ++i) {
+        acatl::mqtt::PublishControlPacket publish = makePublish(acatl::mqtt::QoSLevel::AtLeastOnce, 1);
+        acatl::mqtt::PacketIdentifier packetIdentifier = window.add(publish);
+        ASSERT_NE(0u, packetIdentifier);
+        ASSERT_NE(pinned._packetIdentifier, packetIdentifier);
+        ASSERT_TRUE(window.acknowledge(packetIdentifier));
+    }
+    EXPECT_EQ(1u, window.size());
+    EXPECT_TRUE(window.acknowledge(pinned._packetIdentifier));
+    EXPECT_TRUE(window.empty());
+}
+
+TEST(MQTTInflightWindowTest, reservedIdentifier)
+{
+    acatl::mqtt::InflightWindow window(2);
+    acatl::mqtt::PacketIdentifier reserved = window.reserve();
+    EXPECT_EQ(1u, reserved);
+    EXPECT_EQ(1u, window.size());
+    
+    // a reserved identifier is neither acknowledged as publish nor sent again
+    EXPECT_FALSE(window.acknowledge(reserved));
+    EXPECT_FALSE(window.complete(reserved));
+    acatl::mqtt::PublishControlPacket publish = makePublish(acatl::mqtt::QoSLevel::AtLeastOnce, 0);
+    EXPECT_EQ(2u, window.add(publish));
+    EXPECT_TRUE(window.full());
+    std::vector<acatl::mqtt::ControlPacket::Ptr> packets;
+    window.retransmissions(packets);
+    EXPECT_EQ(1u, packets.size());
+    
+    EXPECT_TRUE(window.unreserve(reserved));
+    EXPECT_FALSE(window.unreserve(reserved));
+    EXPECT_FALSE(window.unreserve(2));
+    EXPECT_EQ(1u, window.size());
+    EXPECT_EQ(3u, window.add(publish));
+}
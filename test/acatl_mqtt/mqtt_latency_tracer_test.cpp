@@ -0,0 +1,152 @@
+//
+//  mqtt_latency_tracer_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_latency_tracer.h>
+#include <acatl_mqtt/mqtt_processor.h>
+
+#include <sstream>
+
+
+using namespace std::chrono_literals;
+
+namespace
+{
+    class NullSender : public acatl::mqtt::PacketSender
+    {
+    public:
+        virtual void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet)
+        {
+            _sendPackets.push_back(std::move(packet));
+        }
+        
+        std::vector<acatl::mqtt::ControlPacket::Ptr> _sendPackets;
+    };
+}
+
+
+TEST(MQTTLatencyTracerTest, histogram)
+{
+    acatl::mqtt::LatencyHistogram histogram;
+    EXPECT_EQ(0u, histogram.count());
+    EXPECT_EQ(0ns, histogram.percentile(0.99));
+    
+    for(int i = 1; i <= 1000; ++i) {
+        histogram.record(std::chrono::microseconds(i));
+    }
+    EXPECT_EQ(1000u, histogram.count());
+    EXPECT_EQ(1000us, histogram.max());
+    
+    // the buckets are accurate to about 6%
+    EXPECT_NEAR(500000, histogram.percentile(0.5).count(), 500000 * 0.07);
+    EXPECT_NEAR(990000, histogram.percentile(0.99).count(), 990000 * 0.07);
+    EXPECT_EQ(1000us, histogram.percentile(1.0));
+    
+    // small values are exact
+    histogram.clear();
+    histogram.record(7ns);
+    EXPECT_EQ(7ns, histogram.percentile(0.5));
+    histogram.record(-1ns);
+    EXPECT_EQ(0ns, histogram.percentile(0.1));
+}
+
+TEST(MQTTLatencyTracerTest, sampling)
+{
+    acatl::mqtt::LatencyTracer disabled(0);
+    uint64_t counter = 0;
+    EXPECT_FALSE(disabled.enabled());
+    EXPECT_FALSE(disabled.sample(counter));
+    
+    acatl::mqtt::LatencyTracer tracer(4);
+    size_t sampled = 0;
+    for(int i = 0; i < 100; ++i) {
+        sampled += tracer.sample(counter) ? 1 : 0;
+    }
+    EXPECT_EQ(25u, sampled);
+    
+    tracer.record(acatl::mqtt::TraceStage::Write, 3ms);
+    std::ostringstream dump;
+    tracer.dump(dump);
+    EXPECT_NE(std::string::npos, dump.str().find("write    samples=1 "));
+    EXPECT_NE(std::string::npos, dump.str().find("parse    samples=0 "));
+}
+
+TEST(MQTTLatencyTracerTest, matchStage)
+{
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    acatl::mqtt::LatencyTracer::Ptr tracer = std::make_shared<acatl::mqtt::LatencyTracer>(1);
+    std::shared_ptr<NullSender> sender(new NullSender);
+    
+    acatl::mqtt::Processor processor(subscriptionTreeManager, sessionManager);
+    processor.setPacketSender(sender);
+    processor.setLatencyTracer(tracer);
+    
+    std::error_code ec;
+    acatl::mqtt::ConnectControlPacket::Ptr connect = std::make_unique<acatl::mqtt::ConnectControlPacket>();
+    connect->_protocolLevel = acatl::mqtt::protocolLevel311;
+    connect->_cleanSession = true;
+    connect->_clientId = "tracer";
+    processor.processPacket(std::move(connect), ec);
+    acatl::mqtt::SubscribeControlPacket::Ptr subscribe = std::make_unique<acatl::mqtt::SubscribeControlPacket>();
+    subscribe->_packetIdentifier = 1;
+    subscribe->_topicFilters.push_back(acatl::mqtt::TopicFilter("sheldon/#", acatl::mqtt::QoSLevel::AtLeastOnce));
+    processor.processPacket(std::move(subscribe), ec);
+    sender->_sendPackets.clear();
+    
+    // a publish that was not sampled is not traced
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_topicName = "sheldon/bazinga";
+    pub->_payload = { 'x' };
+    processor.processPacket(std::move(pub), ec);
+    ASSERT_EQ(1u, sender->_sendPackets.size());
+    EXPECT_FALSE(static_cast<const acatl::mqtt::PublishControlPacket&>(*sender->_sendPackets[0]).traced());
+    EXPECT_EQ(0u, tracer->histogram(acatl::mqtt::TraceStage::Match).count());
+    
+    // the delivery of a sampled publish starts its enqueue stage after the match
+    acatl::mqtt::LatencyTracer::Clock::time_point parsed = acatl::mqtt::LatencyTracer::Clock::now();
+    pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->setQoS(acatl::mqtt::QoSLevel::AtLeastOnce);
+    pub->_packetIdentifier = 7;
+    pub->_topicName = "sheldon/bazinga";
+    pub->_payload = { 'x' };
+    pub->_traceTimestamp = parsed;
+    processor.processPacket(std::move(pub), ec);
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(1u, tracer->histogram(acatl::mqtt::TraceStage::Match).count());
+    ASSERT_EQ(2u, sender->_sendPackets.size());
+    const auto& delivery = static_cast<const acatl::mqtt::PublishControlPacket&>(*sender->_sendPackets[1]);
+    EXPECT_TRUE(delivery.traced());
+    EXPECT_LE(parsed, delivery._traceTimestamp);
+}
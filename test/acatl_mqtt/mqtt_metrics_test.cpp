@@ -0,0 +1,185 @@
+//
+//  mqtt_metrics_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_sys_publisher.h>
+
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+    class NullSender : public acatl::mqtt::PacketSender
+    {
+    public:
+        virtual void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet)
+        {
+            _sendPackets.push_back(std::move(packet));
+        }
+        
+        std::string payload(size_t index) const
+        {
+            const auto& pub = static_cast<const acatl::mqtt::PublishControlPacket&>(*_sendPackets[index]);
+            return std::string(pub._payload.begin(), pub._payload.end());
+        }
+        
+        std::vector<acatl::mqtt::ControlPacket::Ptr> _sendPackets;
+    };
+    
+    acatl::mqtt::ConnectControlPacket::Ptr makeConnectPacket(const std::string& clientId)
+    {
+        acatl::mqtt::ConnectControlPacket::Ptr ctrl = std::make_unique<acatl::mqtt::ConnectControlPacket>();
+        ctrl->_protocolLevel = acatl::mqtt::protocolLevel311;
+        ctrl->_cleanSession = true;
+        ctrl->_keepAlive = 60;
+        ctrl->_clientId = clientId;
+        return ctrl;
+    }
+}
+
+
+TEST(MQTTMetricsTest, perThreadCounters)
+{
+    acatl::mqtt::Metrics metrics;
+    EXPECT_EQ(0, metrics.value(acatl::mqtt::Metric::MessagesReceived));
+    
+    std::vector<std::thread> threads;
+    for(int i = 0; i < 4; ++i) {
+        threads.emplace_back([&metrics]() {
+            for(int j = 0; j < 10000; ++j) {
+                metrics.add(acatl::mqtt::Metric::MessagesReceived);
+                metrics.add(acatl::mqtt::Metric::BytesReceived, 10);
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    
+    acatl::mqtt::Metrics::Snapshot snapshot = metrics.snapshot();
+    EXPECT_EQ(40000, snapshot[static_cast<size_t>(acatl::mqtt::Metric::MessagesReceived)]);
+    EXPECT_EQ(400000, snapshot[static_cast<size_t>(acatl::mqtt::Metric::BytesReceived)]);
+    EXPECT_EQ(0, snapshot[static_cast<size_t>(acatl::mqtt::Metric::MessagesSent)]);
+}
+
+TEST(MQTTMetricsTest, gaugeAcrossThreads)
+{
+    acatl::mqtt::Metrics metrics;
+    acatl::mqtt::Metrics other;
+    
+    // raised on one thread and lowered on another, as a packet queued by a publisher and written by its subscriber
+    std::thread producer([&metrics, &other]() {
+        metrics.add(acatl::mqtt::Metric::QueuedMessages, 5);
+        other.add(acatl::mqtt::Metric::QueuedMessages, 7);
+    });
+    producer.join();
+    metrics.add(acatl::mqtt::Metric::QueuedMessages, -3);
+    
+    EXPECT_EQ(2, metrics.value(acatl::mqtt::Metric::QueuedMessages));
+    EXPECT_EQ(7, other.value(acatl::mqtt::Metric::QueuedMessages));
+}
+
+TEST(MQTTMetricsTest, sendQueue)
+{
+    acatl::mqtt::Metrics metrics;
+    {
+        acatl::mqtt::SendQueue queue(acatl::mqtt::SendQueueLimits(2, 0, acatl::mqtt::SlowConsumerPolicy::DropNewest));
+        queue.setMetrics(&metrics);
+        for(int i = 0; i < 3; ++i) {
+            queue.push(std::make_unique<acatl::mqtt::PublishControlPacket>());
+        }
+        EXPECT_EQ(2, metrics.value(acatl::mqtt::Metric::QueuedMessages));
+        EXPECT_EQ(1, metrics.value(acatl::mqtt::Metric::MessagesDropped));
+        
+        queue.pop();
+        EXPECT_EQ(1, metrics.value(acatl::mqtt::Metric::QueuedMessages));
+    }
+    // the packets left in a destroyed queue are not queued anymore
+    EXPECT_EQ(0, metrics.value(acatl::mqtt::Metric::QueuedMessages));
+}
+
+TEST(MQTTMetricsTest, sysTopics)
+{
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    acatl::mqtt::Metrics::Ptr metrics = std::make_shared<acatl::mqtt::Metrics>();
+    acatl::mqtt::RetainedStore::Ptr retainedStore = std::make_shared<acatl::mqtt::RetainedStore>();
+    
+    std::error_code ec;
+    std::shared_ptr<NullSender> sender(new NullSender);
+    acatl::mqtt::Processor processor(subscriptionTreeManager, sessionManager);
+    processor.setPacketSender(sender);
+    processor.setMetrics(metrics);
+    processor.processPacket(makeConnectPacket("monitor"), ec);
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(1, metrics->value(acatl::mqtt::Metric::ClientsConnected));
+    
+    acatl::mqtt::SubscribeControlPacket::Ptr subscribe = std::make_unique<acatl::mqtt::SubscribeControlPacket>();
+    subscribe->_packetIdentifier = 1;
+    subscribe->_topicFilters.push_back(acatl::mqtt::TopicFilter("$SYS/broker/clients/#", acatl::mqtt::QoSLevel::AtLeastOnce));
+    subscribe->_topicFilters.push_back(acatl::mqtt::TopicFilter("$SYS/broker/messages/received", acatl::mqtt::QoSLevel::AtMostOnce));
+    processor.processPacket(std::move(subscribe), ec);
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(2, metrics->value(acatl::mqtt::Metric::Subscriptions));
+    
+    acatl::mqtt::SysPublisher publisher(metrics, subscriptionTreeManager, sessionManager);
+    publisher.setRetainedStore(retainedStore);
+    EXPECT_EQ(9u, publisher.publish(ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(9u, retainedStore->size());
+    ASSERT_EQ(2u, sender->_sendPackets.size());
+    const auto& received = static_cast<const acatl::mqtt::PublishControlPacket&>(*sender->_sendPackets[0]);
+    EXPECT_EQ("$SYS/broker/messages/received", received._topicName._name);
+    EXPECT_EQ("0", sender->payload(0));
+    EXPECT_EQ("$SYS/broker/clients/connected", static_cast<const acatl::mqtt::PublishControlPacket&>(*sender->_sendPackets[1])._topicName._name);
+    EXPECT_EQ("1", sender->payload(1));
+    EXPECT_EQ(acatl::mqtt::QoSLevel::AtMostOnce, static_cast<const acatl::mqtt::PublishControlPacket&>(*sender->_sendPackets[1]).qos());
+    
+    // unchanged values are not published again
+    sender->_sendPackets.clear();
+    EXPECT_EQ(0u, publisher.publish(ec));
+    EXPECT_TRUE(sender->_sendPackets.empty());
+    
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_topicName = "sheldon/bazinga";
+    pub->_payload = { 'x' };
+    processor.processPacket(std::move(pub), ec);
+    EXPECT_EQ(1u, publisher.publish(ec));
+    ASSERT_EQ(1u, sender->_sendPackets.size());
+    EXPECT_EQ("1", sender->payload(0));
+    
+    processor.processPacket(std::make_unique<acatl::mqtt::DisconnectControlPacket>(), ec);
+    EXPECT_EQ(0, metrics->value(acatl::mqtt::Metric::ClientsConnected));
+}
@@ -0,0 +1,268 @@
+//
+//  mqtt_offline_queue_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_offline_queue.h>
+#include <acatl_mqtt/mqtt_session.h>
+
+#include <thread>
+
+
+namespace
+{
+    acatl::mqtt::PublishControlPacket::Ptr makePublish(const std::string& topic, uint8_t value, uint8_t qos = 1)
+    {
+        acatl::mqtt::PublishControlPacket::Ptr packet(new acatl::mqtt::PublishControlPacket);
+        packet->_header._flags = static_cast<uint8_t>(qos << 1);
+        packet->_topicName._name = topic;
+        packet->_payload.assign(32, value);
+        return packet;
+    }
+    
+    class CollectingSender : public acatl::mqtt::PacketSender
+    {
+    public:
+        virtual void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet)
+        {
+            _packets.push_back(std::move(packet));
+        }
+        
+        std::vector<acatl::mqtt::ControlPacket::Ptr> _packets;
+    };
+    
+    class NullHandler : public acatl::mqtt::SubscriptionHandler
+    {
+    public:
+        virtual void addSubscriptions(const acatl::mqtt::TopicFilters& subscriptions)
+        {}
+        
+        virtual void removeSubscriptions(const acatl::mqtt::TopicFilters& subscriptions)
+        {}
+    };
+}
+
+
+TEST(MQTTOfflineQueueTest, memoryOnly)
+{
+    acatl::mqtt::OfflineQueueOptions options;
+    options._memoryBudget = 100;
+    auto storage = std::make_shared<acatl::mqtt::OfflineStorage>(options);
+    
+    std::error_code ec;
+    acatl::mqtt::OfflineQueue queue(storage);
+    EXPECT_TRUE(queue.push(makePublish("a", 1), ec));
+    EXPECT_TRUE(queue.push(makePublish("a", 2), ec));
+    EXPECT_FALSE(queue.push(makePublish("a", 3), ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(2u, queue.size());
+    EXPECT_EQ(1u, storage->droppedMessages());
+    EXPECT_EQ(84u, storage->memoryBytes());
+    
+    std::vector<acatl::mqtt::PublishControlPacket::Ptr> out;
+    EXPECT_EQ(2u, queue.pop(10, out, ec));
+    EXPECT_EQ(1u, out[0]->_payload[0]);
+    EXPECT_EQ(2u, out[1]->_payload[0]);
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(0u, storage->memoryBytes());
+}
+
+TEST(MQTTOfflineQueueTest, spillToDisk)
+{
+    acatl::mqtt::OfflineQueueOptions options;
+    options._memoryBudget = 100;
+    options._spoolDirectory = ".";
+    options._segmentSize = 128;
+    auto storage = std::make_shared<acatl::mqtt::OfflineStorage>(options);
+    
+    std::error_code ec;
+    acatl::mqtt::OfflineQueue queue(storage);
+    for(uint8_t i = 0; i < 20; ++i) {
+        EXPECT_TRUE(queue.push(makePublish("topic/" + std::to_string(i), i), ec));
+        EXPECT_FALSE(ec);
+    }
+    EXPECT_EQ(20u, queue.size());
+    EXPECT_EQ(18u, queue.diskMessages());
+    EXPECT_EQ(18u, storage->spilledMessages());
+    
+    std::vector<acatl::mqtt::PublishControlPacket::Ptr> out;
+    EXPECT_EQ(5u, queue.pop(5, out, ec));
+    // memory is free again, but new messages have to queue up behind the spilled ones
+    EXPECT_TRUE(queue.push(makePublish("topic/20", 20), ec));
+    EXPECT_EQ(16u, queue.diskMessages());
+    
+    while(queue.pop(3, out, ec) > 0) {
+        EXPECT_FALSE(ec);
+    }
+    ASSERT_EQ(21u, out.size());
+    for(uint8_t i = 0; i < 21; ++i) {
+        EXPECT_EQ("topic/" + std::to_string(i), out[i]->_topicName._name);
+        EXPECT_EQ(i, out[i]->_payload[0]);
+        EXPECT_EQ(32u, out[i]->_payload.size());
+        EXPECT_EQ(0x02, out[i]->_header._flags);
+    }
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(0u, queue.diskMessages());
+}
+
+TEST(MQTTOfflineQueueTest, spillProperties)
+{
+    acatl::mqtt::OfflineQueueOptions options;
+    options._memoryBudget = 0;
+    options._spoolDirectory = ".";
+    auto storage = std::make_shared<acatl::mqtt::OfflineStorage>(options);
+    
+    std::error_code ec;
+    acatl::mqtt::OfflineQueue queue(storage);
+    auto packet = makePublish("a/b", 7);
+    packet->_packetIdentifier = 42;
+    packet->_properties._topicAlias = 3;
+    // content type "json" and user property "k" = "v"
+    std::vector<uint8_t> properties = {0x03, 0x00, 0x04, 'j', 's', 'o', 'n', 0x26, 0x00, 0x01, 'k', 0x00, 0x01, 'v'};
+    packet->_properties._other = properties;
+    EXPECT_TRUE(queue.push(std::move(packet), ec));
+    EXPECT_EQ(1u, queue.diskMessages());
+    
+    std::vector<acatl::mqtt::PublishControlPacket::Ptr> out;
+    EXPECT_EQ(1u, queue.pop(10, out, ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ("a/b", out[0]->_topicName._name);
+    EXPECT_EQ(42u, out[0]->_packetIdentifier);
+    EXPECT_EQ(3u, out[0]->_properties._topicAlias);
+    EXPECT_EQ(properties, out[0]->_properties._other);
+    EXPECT_EQ(32u, out[0]->_payload.size());
+    EXPECT_EQ(7u, out[0]->_payload[0]);
+}
+
+TEST(MQTTOfflineQueueTest, noOpenFiles)
+{
+    acatl::mqtt::OfflineQueueOptions options;
+    options._memoryBudget = 0;
+    options._spoolDirectory = ".";
+    auto storage = std::make_shared<acatl::mqtt::OfflineStorage>(options);
+    
+    auto openFiles = []() {
+        std::FILE* file = std::fopen("/dev/null", "r");
+        int fd = fileno(file);
+        std::fclose(file);
+        return fd;
+    };
+    int lowestFree = openFiles();
+    
+    std::error_code ec;
+    std::vector<acatl::mqtt::OfflineQueue::Ptr> queues;
+    for(size_t i = 0; i < 64; ++i) {
+        queues.emplace_back(new acatl::mqtt::OfflineQueue(storage));
+        for(uint8_t j = 0; j < 200; ++j) {
+            EXPECT_TRUE(queues.back()->push(makePublish("t", j), ec));
+        }
+    }
+    std::vector<acatl::mqtt::PublishControlPacket::Ptr> out;
+    for(auto& queue : queues) {
+        EXPECT_EQ(10u, queue->pop(10, out, ec));
+        EXPECT_FALSE(ec);
+    }
+    // neither the spilling nor the partially drained queues keep a file open
+    EXPECT_EQ(lowestFree, openFiles());
+    
+    for(auto& queue : queues) {
+        out.clear();
+        while(queue->pop(7, out, ec) > 0) {}
+        ASSERT_EQ(190u, out.size());
+        for(uint8_t j = 0; j < 190; ++j) {
+            EXPECT_EQ(j + 10, out[j]->_payload[0]);
+        }
+        EXPECT_TRUE(queue->empty());
+    }
+}
+
+TEST(MQTTOfflineQueueTest, expiry)
+{
+    acatl::mqtt::OfflineQueueOptions options;
+    options._messageExpiry = std::chrono::seconds(1);
+    auto storage = std::make_shared<acatl::mqtt::OfflineStorage>(options);
+    
+    std::error_code ec;
+    acatl::mqtt::OfflineQueue queue(storage);
+    EXPECT_TRUE(queue.push(makePublish("a", 1), ec));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    EXPECT_TRUE(queue.push(makePublish("a", 2), ec));
+    EXPECT_EQ(1u, storage->expiredMessages());
+    
+    std::vector<acatl::mqtt::PublishControlPacket::Ptr> out;
+    EXPECT_EQ(1u, queue.pop(10, out, ec));
+    EXPECT_EQ(2u, out[0]->_payload[0]);
+}
+
+TEST(MQTTOfflineQueueTest, sessionDelivery)
+{
+    acatl::mqtt::OfflineQueueOptions options;
+    options._maxMessages = 3;
+    auto storage = std::make_shared<acatl::mqtt::OfflineStorage>(options);
+    NullHandler handler;
+    
+    acatl::mqtt::Session session("hutzli0815", handler);
+    session.setOfflineStorage(storage);
+    
+    // offline: QoS 0 is dropped, QoS 1 is queued up to the session limit
+    EXPECT_FALSE(session.deliver(makePublish("a", 0, 0)));
+    for(uint8_t i = 1; i <= 4; ++i) {
+        EXPECT_EQ(i <= 3, session.deliver(makePublish("a", i)));
+    }
+    EXPECT_EQ(3u, session.offlineMessages());
+    
+    auto sender = std::make_shared<CollectingSender>();
+    session.setSender(sender);
+    // while draining, QoS 1 messages queue up behind the backlog, QoS 0 goes out right away
+    EXPECT_TRUE(session.deliver(makePublish("a", 5, 0)));
+    EXPECT_EQ(1u, sender->_packets.size());
+    EXPECT_EQ(2u, session.drainOfflineMessages(2));
+    EXPECT_TRUE(session.deliver(makePublish("a", 6)));
+    EXPECT_EQ(2u, session.offlineMessages());
+    EXPECT_EQ(2u, session.drainOfflineMessages(2));
+    EXPECT_EQ(0u, session.drainOfflineMessages(2));
+    ASSERT_EQ(5u, sender->_packets.size());
+    std::vector<uint8_t> order;
+    for(const auto& packet : sender->_packets) {
+        order.push_back(static_cast<const acatl::mqtt::PublishControlPacket&>(*packet)._payload[0]);
+    }
+    EXPECT_EQ((std::vector<uint8_t>{5, 1, 2, 3, 6}), order);
+    
+    // connected and nothing queued: straight through
+    EXPECT_TRUE(session.deliver(makePublish("a", 7)));
+    EXPECT_EQ(6u, sender->_packets.size());
+    
+    session.setCleanSession(true);
+    session.setSender(acatl::mqtt::PacketSender::Ptr());
+    EXPECT_FALSE(session.deliver(makePublish("a", 8)));
+}
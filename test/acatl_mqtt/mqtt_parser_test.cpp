@@ -282,12 +282,13 @@ TEST(MQTTParserTest, parseSubscribe)
     ASSERT_TRUE(subscribe);
     
     EXPECT_EQ(10u, subscribe->_packetIdentifier);
-    EXPECT_EQ("check/this/out", subscribe->_topicFilters[0]._filter);
-    EXPECT_EQ(acatl::mqtt::QoSLevel::AtMostOnce, subscribe->_topicFilters[0]._qos);
-    EXPECT_EQ("a/b", subscribe->_topicFilters[1]._filter);
-    EXPECT_EQ(acatl::mqtt::QoSLevel::AtLeastOnce, subscribe->_topicFilters[1]._qos);
-    EXPECT_EQ("c/d", subscribe->_topicFilters[2]._filter);
-    EXPECT_EQ(acatl::mqtt::QoSLevel::ExactlyOnce, subscribe->_topicFilters[2]._qos);
+    // the filters keep the order of the request, which the SUBACK follows
+    EXPECT_EQ("a/b", subscribe->_topicFilters[0]._filter);
+    EXPECT_EQ(acatl::mqtt::QoSLevel::AtLeastOnce, subscribe->_topicFilters[0]._qos);
+    EXPECT_EQ("c/d", subscribe->_topicFilters[1]._filter);
+    EXPECT_EQ(acatl::mqtt::QoSLevel::ExactlyOnce, subscribe->_topicFilters[1]._qos);
+    EXPECT_EQ("check/this/out", subscribe->_topicFilters[2]._filter);
+    EXPECT_EQ(acatl::mqtt::QoSLevel::AtMostOnce, subscribe->_topicFilters[2]._qos);
     
     // reuse parser
     index = 0;
@@ -425,3 +426,328 @@ TEST(MQTTParserTest, parsePingResp)
     EXPECT_EQ(0u, pingresp->_header._flags);
     EXPECT_EQ(0u, pingresp->_header._length);
 }
+
+TEST(MQTTParserTest, parseAcknowledgements)
+{
+    std::vector<uint8_t> buffer = {
+        0x40, 0x02, 0x00, 0x07,  // PUBACK
+        0x50, 0x02, 0x00, 0x08,  // PUBREC
+        0x62, 0x02, 0x01, 0x00,  // PUBREL
+        0x70, 0x02, 0xFF, 0xFF   // PUBCOMP
+    };
+    const std::vector<acatl::mqtt::ControlPacketType> types = {
+        acatl::mqtt::ControlPacketType::Puback,
+        acatl::mqtt::ControlPacketType::Pubrec,
+        acatl::mqtt::ControlPacketType::Pubrel,
+        acatl::mqtt::ControlPacketType::Pubcomp
+    };
+    const std::vector<acatl::mqtt::PacketIdentifier> identifiers = { 7, 8, 256, 0xFFFF };
+    
+    uint32_t index = 0;
+    std::error_code ec;
+    acatl::mqtt::MQTTParser parser;
+    for(size_t i = 0; i < types.size(); ++i) {
+        acatl::Tribool ret;
+        while(ret.isIndeterminate()) {
+            ret = parser.parse(buffer[index++], ec);
+        }
+        EXPECT_TRUE(ret.isTrue());
+        EXPECT_FALSE(ec);
+        
+        acatl::mqtt::ControlPacket::Ptr packet = parser.consumePacket();
+        const acatl::mqtt::AcknowledgeControlPacket* ack = dynamic_cast<const acatl::mqtt::AcknowledgeControlPacket*>(packet.get());
+        ASSERT_TRUE(ack);
+        EXPECT_EQ(types[i], ack->_header._controlPacketType);
+        EXPECT_EQ(identifiers[i], ack->_packetIdentifier);
+    }
+}
+
+TEST(MQTTParserTest, parseAcknowledgementWrongLength)
+{
+    std::vector<uint8_t> buffer = { 0x40, 0x03, 0x00, 0x07, 0x00 };
+    
+    uint32_t index = 0;
+    std::error_code ec;
+    acatl::mqtt::MQTTParser parser;
+    acatl::Tribool ret;
+    while(ret.isIndeterminate() && index < buffer.size()) {
+        ret = parser.parse(buffer[index++], ec);
+    }
+    EXPECT_TRUE(ret.isFalse());
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::control_packet_length), ec);
+}
+
+TEST(MQTTParserTest, parseStreamedPublish)
+{
+    std::vector<uint8_t> buffer = {
+        0x32, 0x0D,                     // PUBLISH QoS 1, remaining length
+        0x00, 0x01, 'a',                // topic name
+        0x00, 0x05,                     // packet identifier
+        '1', '2', '3', '4', '5', '6', '7', '8',
+        0xC0, 0x00                      // PINGREQ
+    };
+    
+    acatl::mqtt::StreamingOptions options;
+    options._threshold = 4;
+    options._chunkSize = 3;
+    acatl::mqtt::MQTTParser parser;
+    parser.setStreamingOptions(options);
+    
+    uint32_t index = 0;
+    std::error_code ec;
+    acatl::Tribool ret;
+    while(ret.isIndeterminate()) {
+        ret = parser.parse(buffer[index++], ec);
+    }
+    EXPECT_TRUE(ret.isTrue());
+    EXPECT_EQ(7u, index);
+    
+    // the publish is handed out before its payload
+    acatl::mqtt::ControlPacket::Ptr packet = parser.consumePacket();
+    const acatl::mqtt::PublishControlPacket* publish = dynamic_cast<const acatl::mqtt::PublishControlPacket*>(packet.get());
+    ASSERT_TRUE(publish);
+    EXPECT_EQ("a", publish->_topicName._name);
+    EXPECT_EQ(5u, publish->_packetIdentifier);
+    EXPECT_TRUE(publish->_payload.empty());
+    ASSERT_TRUE(publish->_stream);
+    EXPECT_EQ(8u, publish->payloadSize());
+    EXPECT_EQ(publish->_stream, parser.stream());
+    acatl::mqtt::PayloadStream::Reader::Ptr reader = publish->_stream->attach();
+    
+    ret = acatl::Tribool();
+    while(ret.isIndeterminate()) {
+        ret = parser.parse(buffer[index++], ec);
+    }
+    EXPECT_TRUE(ret.isTrue());
+    EXPECT_FALSE(ec);
+    EXPECT_FALSE(parser.stream());
+    packet = parser.consumePacket();
+    EXPECT_EQ(acatl::mqtt::ControlPacketType::Pingreq, packet->_header._controlPacketType);
+    
+    std::vector<uint8_t> payload;
+    acatl::mqtt::PayloadStream::Chunk chunk;
+    size_t chunks = 0;
+    while(reader->read(chunk, nullptr) == acatl::mqtt::PayloadStream::Result::Chunk) {
+        payload.insert(payload.end(), chunk->begin(), chunk->end());
+        ++chunks;
+    }
+    EXPECT_EQ(3u, chunks);
+    EXPECT_EQ((std::vector<uint8_t>{ '1', '2', '3', '4', '5', '6', '7', '8' }), payload);
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Finished, reader->read(chunk, nullptr));
+}
+
+TEST(MQTTParserTest, rejectOversizedPacket)
+{
+    // PUBLISH announcing 200 bytes, rejected after the remaining length without waiting for the data
+    std::vector<uint8_t> buffer = { 0x30, 0xC8, 0x01, 0x00, 0x01, 'a' };
+    
+    acatl::mqtt::ParserLimits limits;
+    limits._maxPacketSize = 128;
+    acatl::mqtt::MQTTParser parser;
+    parser.setLimits(limits);
+    
+    uint32_t index = 0;
+    std::error_code ec;
+    acatl::Tribool ret;
+    while(ret.isIndeterminate() && index < buffer.size()) {
+        ret = parser.parse(buffer[index++], ec);
+    }
+    EXPECT_TRUE(ret.isFalse());
+    EXPECT_EQ(3u, index);
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::packet_too_large), ec);
+    EXPECT_EQ(1u, parser.rejectedPackets());
+}
+
+TEST(MQTTParserTest, rejectLongTopic)
+{
+    std::vector<uint8_t> buffer = { 0x30, 0x0A, 0x00, 0x05, 'h', 'u', 't', 'z', 'l', 'x', 'y', 'z' };
+    
+    acatl::mqtt::ParserLimits limits;
+    limits._maxTopicLength = 4;
+    acatl::mqtt::MQTTParser parser;
+    parser.setLimits(limits);
+    
+    uint32_t index = 0;
+    std::error_code ec;
+    acatl::Tribool ret;
+    while(ret.isIndeterminate() && index < buffer.size()) {
+        ret = parser.parse(buffer[index++], ec);
+    }
+    EXPECT_TRUE(ret.isFalse());
+    EXPECT_EQ(4u, index);
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::topic_too_long), ec);
+    EXPECT_EQ(1u, parser.rejectedPackets());
+}
+
+TEST(MQTTParserTest, rejectTooManySubscriptions)
+{
+    std::vector<uint8_t> twoFilters = {
+        0x82, 0x0A,          // SUBSCRIBE
+        0x00, 0x01,          // packet identifier
+        0x00, 0x01, 'a', 0x00,
+        0x00, 0x01, 'b', 0x01
+    };
+    std::vector<uint8_t> threeFilters = {
+        0x82, 0x0E,
+        0x00, 0x02,
+        0x00, 0x01, 'a', 0x00,
+        0x00, 0x01, 'b', 0x00,
+        0x00, 0x01, 'c', 0x00
+    };
+    
+    acatl::mqtt::ParserLimits limits;
+    limits._maxSubscriptions = 2;
+    acatl::mqtt::MQTTParser parser;
+    parser.setLimits(limits);
+    
+    std::error_code ec;
+    acatl::Tribool ret;
+    for(uint8_t byte : twoFilters) {
+        ret = parser.parse(byte, ec);
+    }
+    EXPECT_TRUE(ret.isTrue());
+    acatl::mqtt::ControlPacket::Ptr packet = parser.consumePacket();
+    EXPECT_EQ(2u, static_cast<const acatl::mqtt::SubscribeControlPacket&>(*packet)._topicFilters.size());
+    
+    // the filters of the previous packet do not count against the next one
+    ret = acatl::Tribool();
+    for(uint8_t byte : twoFilters) {
+        ret = parser.parse(byte, ec);
+    }
+    EXPECT_TRUE(ret.isTrue());
+    parser.consumePacket();
+    
+    uint32_t index = 0;
+    ret = acatl::Tribool();
+    while(ret.isIndeterminate() && index < threeFilters.size()) {
+        ret = parser.parse(threeFilters[index++], ec);
+    }
+    EXPECT_TRUE(ret.isFalse());
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::too_many_subscriptions), ec);
+    EXPECT_EQ(1u, parser.rejectedPackets());
+    
+    // with a topic length limit the oversized SUBSCRIBE is already rejected by its remaining length
+    limits._maxTopicLength = 1;
+    acatl::mqtt::MQTTParser boundedParser;
+    boundedParser.setLimits(limits);
+    ec.clear();
+    index = 0;
+    ret = acatl::Tribool();
+    while(ret.isIndeterminate() && index < threeFilters.size()) {
+        ret = boundedParser.parse(threeFilters[index++], ec);
+    }
+    EXPECT_TRUE(ret.isFalse());
+    EXPECT_EQ(2u, index);
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::packet_too_large), ec);
+}
+
+TEST(MQTTParserTest, parseMQTT5Connect)
+{
+    std::vector<uint8_t> buffer = {
+        0x10, 0x1C,                           // CONNECT, remaining length
+        0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, // protocol name and level
+        0x02, 0x00, 0x3C,                     // connect flags, keep alive
+        0x0D,                                 // property length
+        0x22, 0x00, 0x0A,                     // topic alias maximum
+        0x21, 0x00, 0x14,                     // receive maximum
+        0x26, 0x00, 0x01, 'k', 0x00, 0x01, 'v', // user property
+        0x00, 0x02, 'c', '1'                  // client id
+    };
+    
+    uint32_t index = 0;
+    std::error_code ec;
+    acatl::mqtt::MQTTParser parser;
+    acatl::Tribool ret;
+    while(ret.isIndeterminate() && index < buffer.size()) {
+        ret = parser.parse(buffer[index++], ec);
+    }
+    EXPECT_TRUE(ret.isTrue());
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(buffer.size(), index);
+    EXPECT_EQ(acatl::mqtt::protocolLevel5, parser.protocolLevel());
+    
+    acatl::mqtt::ControlPacket::Ptr packet = parser.consumePacket();
+    const acatl::mqtt::ConnectControlPacket* connect = dynamic_cast<const acatl::mqtt::ConnectControlPacket*>(packet.get());
+    ASSERT_TRUE(connect);
+    EXPECT_EQ(acatl::mqtt::protocolLevel5, connect->_protocolLevel);
+    EXPECT_EQ(60, connect->_keepAlive);
+    EXPECT_EQ("c1", connect->_clientId);
+    EXPECT_EQ(10, connect->_properties._topicAliasMaximum);
+    EXPECT_EQ(20, connect->_properties._receiveMaximum);
+    EXPECT_EQ((std::vector<uint8_t>{ 0x26, 0x00, 0x01, 'k', 0x00, 0x01, 'v' }), connect->_properties._other);
+}
+
+TEST(MQTTParserTest, parseMQTT5PublishWithTopicAlias)
+{
+    std::vector<uint8_t> buffer = {
+        0x30, 0x0C, 0x00, 0x03, 'a', '/', 'b',      // PUBLISH establishing alias 1
+        0x05, 0x23, 0x00, 0x01, 0x01, 0x01, 'x',    // topic alias, payload format indicator, payload
+        0x30, 0x07, 0x00, 0x00,                     // PUBLISH with an empty topic
+        0x03, 0x23, 0x00, 0x01, 'y',
+        0x30, 0x07, 0x00, 0x00,                     // PUBLISH using an unknown alias
+        0x03, 0x23, 0x00, 0x02, 'z'
+    };
+    
+    uint32_t index = 0;
+    std::error_code ec;
+    acatl::mqtt::MQTTParser parser;
+    parser.setProtocolLevel(acatl::mqtt::protocolLevel5);
+    parser.setTopicAliasMaximum(4);
+    for(uint8_t payload : { 'x', 'y' }) {
+        acatl::Tribool ret;
+        while(ret.isIndeterminate()) {
+            ret = parser.parse(buffer[index++], ec);
+        }
+        EXPECT_TRUE(ret.isTrue());
+        EXPECT_FALSE(ec);
+        
+        acatl::mqtt::ControlPacket::Ptr packet = parser.consumePacket();
+        const acatl::mqtt::PublishControlPacket* publish = dynamic_cast<const acatl::mqtt::PublishControlPacket*>(packet.get());
+        ASSERT_TRUE(publish);
+        EXPECT_EQ("a/b", publish->_topicName._name);
+        EXPECT_EQ(acatl::mqtt::Payload{ payload }, publish->_payload);
+        // the alias is resolved, the other properties are kept for the subscribers
+        EXPECT_EQ(0, publish->_properties._topicAlias);
+        if(payload == 'x') {
+            EXPECT_EQ((std::vector<uint8_t>{ 0x01, 0x01 }), publish->_properties._other);
+        }
+    }
+    
+    acatl::Tribool ret;
+    while(ret.isIndeterminate() && index < buffer.size()) {
+        ret = parser.parse(buffer[index++], ec);
+    }
+    EXPECT_TRUE(ret.isFalse());
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::invalid_topic_alias), ec);
+}
+
+TEST(MQTTParserTest, parseMQTT5ReasonCodes)
+{
+    std::vector<uint8_t> buffer = {
+        0x40, 0x03, 0x00, 0x07, 0x10,        // PUBACK with reason code
+        0x50, 0x04, 0x00, 0x08, 0x00, 0x00,  // PUBREC with reason code and properties
+        0xE0, 0x01, 0x00,                    // DISCONNECT with reason code
+        0xC0, 0x00                           // PINGREQ
+    };
+    const std::vector<acatl::mqtt::ControlPacketType> types = {
+        acatl::mqtt::ControlPacketType::Puback,
+        acatl::mqtt::ControlPacketType::Pubrec,
+        acatl::mqtt::ControlPacketType::Disconnect,
+        acatl::mqtt::ControlPacketType::Pingreq
+    };
+    
+    uint32_t index = 0;
+    std::error_code ec;
+    acatl::mqtt::MQTTParser parser;
+    parser.setProtocolLevel(acatl::mqtt::protocolLevel5);
+    for(const auto& type : types) {
+        acatl::Tribool ret;
+        while(ret.isIndeterminate()) {
+            ret = parser.parse(buffer[index++], ec);
+        }
+        EXPECT_TRUE(ret.isTrue());
+        EXPECT_FALSE(ec);
+        EXPECT_EQ(type, parser.consumePacket()->_header._controlPacketType);
+    }
+    EXPECT_EQ(buffer.size(), index);
+}
@@ -0,0 +1,299 @@
+//
+//  mqtt_partitions_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_partitions.h>
+
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+
+
+namespace
+{
+    class NullSubscriptionHandler : public acatl::mqtt::SubscriptionHandler
+    {
+    public:
+        void addSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+        {
+        }
+        
+        void removeSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+        {
+        }
+    };
+    
+    /// Counts the deliveries per topic, the partitions deliver from all threads of the pool.
+    class CountingSender : public acatl::mqtt::PacketSender
+    {
+    public:
+        void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet) override
+        {
+            const acatl::mqtt::PublishControlPacket& pub = static_cast<const acatl::mqtt::PublishControlPacket&>(*packet);
+            std::unique_lock<std::mutex> guard(_mutex);
+            ++_received[pub._topicName._name];
+            ++_total;
+            _condition.notify_all();
+        }
+        
+        bool waitFor(size_t total)
+        {
+            std::unique_lock<std::mutex> guard(_mutex);
+            return _condition.wait_for(guard, std::chrono::seconds(10), [this, total]() { return _total >= total; });
+        }
+        
+        size_t received(const std::string& topic)
+        {
+            std::unique_lock<std::mutex> guard(_mutex);
+            return _received[topic];
+        }
+        
+    private:
+        std::mutex _mutex;
+        std::condition_variable _condition;
+        std::map<std::string, size_t> _received;
+        size_t _total = 0;
+    };
+    
+    acatl::mqtt::PublishControlPacket makePublish(const std::string& topic)
+    {
+        acatl::mqtt::PublishControlPacket pub;
+        pub._topicName = topic;
+        pub._payload = { 'p', 'a', 'r', 't' };
+        return pub;
+    }
+}
+
+
+TEST(MpscQueueTest, boundedFifo)
+{
+    acatl::mqtt::MpscQueue<int> queue(3);
+    EXPECT_EQ(4u, queue.capacity());
+    
+    for(int round = 0; round < 3; ++round) {
+        for(int i = 0; i < 4; ++i) {
+            int value = round * 10 + i;
+            EXPECT_TRUE(queue.push(value));
+        }
+        int value = 99;
+        EXPECT_FALSE(queue.push(value));
+        EXPECT_EQ(99, value);
+        for(int i = 0; i < 4; ++i) {
+            EXPECT_TRUE(queue.pop(value));
+            EXPECT_EQ(round * 10 + i, value);
+        }
+        EXPECT_FALSE(queue.pop(value));
+    }
+}
+
+TEST(MpscQueueTest, producerOrder)
+{
+    acatl::mqtt::MpscQueue<std::unique_ptr<std::pair<int, int>>> queue(16);
+    const int producers = 4;
+    const int count = 50000;
+    std::vector<std::thread> threads;
+    for(int p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, p, count]() {
+            for(int i = 0; i < count; ++i) {
+                std::unique_ptr<std::pair<int, int>> value(new std::pair<int, int>(p, i));
+                while(!queue.push(value)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    
+    // the values of every producer arrive in the order it pushed them
+    std::vector<int> expected(producers, 0);
+    std::unique_ptr<std::pair<int, int>> value;
+    for(int received = 0; received < producers * count;) {
+        if(queue.pop(value)) {
+            ASSERT_EQ(expected[value->first], value->second);
+            ++expected[value->first];
+            ++received;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+}
+
+TEST(PartitionsTest, partitionOfLeadingLevels)
+{
+    acatl::net::IoContextPool pool(4);
+    acatl::mqtt::PartitionOptions options;
+    options._levels = 2;
+    acatl::mqtt::Partitions partitions(pool, options);
+    EXPECT_EQ(4u, partitions.size());
+    
+    EXPECT_EQ(partitions.partitionOf("a/b"), partitions.partitionOf("a/b/c"));
+    EXPECT_EQ(partitions.partitionOf("a/b/c"), partitions.partitionOf("a/b/d/e"));
+    EXPECT_EQ(partitions.partitionOf("a"), partitions.partitionOf("a"));
+    EXPECT_LT(partitions.partitionOf("x/y/z"), partitions.size());
+    
+    EXPECT_FALSE(partitions.isBroadcast("a/b/#"));
+    EXPECT_FALSE(partitions.isBroadcast("a/b/+/c"));
+    EXPECT_TRUE(partitions.isBroadcast("a/+/c"));
+    EXPECT_TRUE(partitions.isBroadcast("a/#"));
+    EXPECT_TRUE(partitions.isBroadcast("#"));
+    EXPECT_TRUE(partitions.isBroadcast("+"));
+    
+    EXPECT_EQ(2u, partitions.index(pool.get(2)));
+    asio::io_context other;
+    EXPECT_THROW(partitions.index(other), std::invalid_argument);
+}
+
+TEST(PartitionsTest, routeAcrossContexts)
+{
+    const size_t contexts = 3;
+    const size_t topics = 12;
+    const size_t rounds = 50;
+    acatl::net::IoContextPool pool(static_cast<uint32_t>(contexts));
+    acatl::mqtt::Partitions partitions(pool);
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    NullSubscriptionHandler handler;
+    
+    std::error_code ec;
+    std::shared_ptr<CountingSender> exact = std::make_shared<CountingSender>();
+    std::shared_ptr<CountingSender> wildcard = std::make_shared<CountingSender>();
+    acatl::mqtt::Session::Ptr exactSession = sessionManager.getSession("exact", exact, handler, ec);
+    acatl::mqtt::Session::Ptr wildcardSession = sessionManager.getSession("wildcard", wildcard, handler, ec);
+    
+    std::vector<std::unique_ptr<acatl::mqtt::Processor>> processors;
+    for(size_t i = 0; i < contexts; ++i) {
+        processors.emplace_back(new acatl::mqtt::Processor(subscriptionTreeManager, sessionManager));
+        processors.back()->setPublishRouter(partitions.router(i));
+    }
+    
+    std::thread runner([&pool]() { pool.run(); });
+    
+    // the publishes of one context follow its subscriptions through the same queues
+    asio::post(pool.get(0), [&]() {
+        acatl::mqtt::PublishRouter::Ptr router = partitions.router(0);
+        for(size_t topic = 0; topic < topics; ++topic) {
+            router->addSubscription(acatl::mqtt::TopicFilter("t" + std::to_string(topic) + "/x", acatl::mqtt::QoSLevel::AtMostOnce), exactSession);
+        }
+        router->addSubscription(acatl::mqtt::TopicFilter("+/x", acatl::mqtt::QoSLevel::AtMostOnce), wildcardSession);
+        std::error_code ec;
+        for(size_t topic = 0; topic < topics; ++topic) {
+            processors[0]->publish(makePublish("t" + std::to_string(topic) + "/x"), ec);
+        }
+    });
+    ASSERT_TRUE(exact->waitFor(topics));
+    ASSERT_TRUE(wildcard->waitFor(topics));
+    
+    for(size_t i = 0; i < contexts; ++i) {
+        asio::post(pool.get(i), [&processors, i, topics, rounds]() {
+            std::error_code ec;
+            for(size_t round = 0; round < rounds; ++round) {
+                for(size_t topic = 0; topic < topics; ++topic) {
+                    processors[i]->publish(makePublish("t" + std::to_string(topic) + "/x"), ec);
+                }
+                processors[i]->publish(makePublish("t0/unsubscribed"), ec);
+            }
+        });
+    }
+    const size_t expected = topics + contexts * rounds * topics;
+    EXPECT_TRUE(exact->waitFor(expected));
+    EXPECT_TRUE(wildcard->waitFor(expected));
+    
+    pool.stop();
+    runner.join();
+    
+    for(size_t topic = 0; topic < topics; ++topic) {
+        EXPECT_EQ(1 + contexts * rounds, exact->received("t" + std::to_string(topic) + "/x"));
+        EXPECT_EQ(1 + contexts * rounds, wildcard->received("t" + std::to_string(topic) + "/x"));
+    }
+    EXPECT_EQ(0u, exact->received("t0/unsubscribed"));
+}
+
+TEST(PartitionsTest, fullInbox)
+{
+    const size_t contexts = 2;
+    const size_t publishes = 5000;
+    acatl::net::IoContextPool pool(static_cast<uint32_t>(contexts));
+    acatl::mqtt::PartitionOptions options;
+    options._queueCapacity = 2;
+    acatl::mqtt::Partitions partitions(pool, options);
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    NullSubscriptionHandler handler;
+    
+    std::error_code ec;
+    std::shared_ptr<CountingSender> wildcard = std::make_shared<CountingSender>();
+    acatl::mqtt::Session::Ptr wildcardSession = sessionManager.getSession("wildcard", wildcard, handler, ec);
+    std::vector<std::unique_ptr<acatl::mqtt::Processor>> processors;
+    for(size_t i = 0; i < contexts; ++i) {
+        processors.emplace_back(new acatl::mqtt::Processor(subscriptionTreeManager, sessionManager));
+        processors.back()->setPublishRouter(partitions.router(i));
+    }
+    
+    std::thread runner([&pool]() { pool.run(); });
+    
+    // the subscription is in all trees once the drains it scheduled ran, they precede a handler posted after it
+    std::promise<void> subscribed;
+    asio::post(pool.get(0), [&]() {
+        partitions.router(0)->addSubscription(acatl::mqtt::TopicFilter("+/x", acatl::mqtt::QoSLevel::AtMostOnce), wildcardSession);
+        subscribed.set_value();
+    });
+    subscribed.get_future().wait();
+    std::promise<void> drained;
+    asio::post(pool.get(1), [&]() { drained.set_value(); });
+    drained.get_future().wait();
+    
+    // both contexts flood each other, a sender finding the inbox full neither spins forever nor loses the route
+    for(size_t i = 0; i < contexts; ++i) {
+        asio::post(pool.get(i), [&processors, i, publishes]() {
+            std::error_code ec;
+            for(size_t n = 0; n < publishes; ++n) {
+                processors[i]->publish(makePublish("t" + std::to_string(n % 16) + "/x"), ec);
+            }
+        });
+    }
+    EXPECT_TRUE(wildcard->waitFor(contexts * publishes));
+    
+    pool.stop();
+    runner.join();
+    
+    size_t received = 0;
+    for(size_t topic = 0; topic < 16; ++topic) {
+        received += wildcard->received("t" + std::to_string(topic) + "/x");
+    }
+    EXPECT_EQ(contexts * publishes, received);
+}
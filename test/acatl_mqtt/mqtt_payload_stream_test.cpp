@@ -0,0 +1,122 @@
+//
+//  mqtt_payload_stream_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_payload_stream.h>
+
+
+TEST(MQTTPayloadStreamTest, readers)
+{
+    acatl::mqtt::PayloadStream::Ptr stream = std::make_shared<acatl::mqtt::PayloadStream>(6, 1024);
+    acatl::mqtt::PayloadStream::Reader::Ptr first = stream->attach();
+    acatl::mqtt::PayloadStream::Reader::Ptr second = stream->attach();
+    ASSERT_TRUE(first);
+    ASSERT_TRUE(second);
+    EXPECT_EQ(6u, first->size());
+    
+    acatl::mqtt::PayloadStream::Chunk chunk;
+    size_t wakeUps = 0;
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Pending, first->read(chunk, [&wakeUps]() { ++wakeUps; }));
+    
+    stream->append({ 'a', 'b', 'c' });
+    EXPECT_EQ(1u, wakeUps);
+    // a subscriber joining after the first chunk could not deliver the whole payload
+    EXPECT_FALSE(stream->attach());
+    stream->append({ 'd', 'e', 'f' });
+    EXPECT_EQ(1u, wakeUps);
+    EXPECT_EQ(6u, stream->bufferedBytes());
+    
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Chunk, first->read(chunk, nullptr));
+    EXPECT_EQ((std::vector<uint8_t>{ 'a', 'b', 'c' }), *chunk);
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Chunk, first->read(chunk, nullptr));
+    EXPECT_EQ((std::vector<uint8_t>{ 'd', 'e', 'f' }), *chunk);
+    // the second reader still needs both chunks
+    EXPECT_EQ(6u, stream->bufferedBytes());
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Chunk, second->read(chunk, nullptr));
+    EXPECT_EQ(3u, stream->bufferedBytes());
+    
+    stream->finish();
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Finished, first->read(chunk, nullptr));
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Chunk, second->read(chunk, nullptr));
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Finished, second->read(chunk, nullptr));
+    EXPECT_EQ(0u, stream->bufferedBytes());
+}
+
+TEST(MQTTPayloadStreamTest, budget)
+{
+    acatl::mqtt::PayloadStream::Ptr stream = std::make_shared<acatl::mqtt::PayloadStream>(16, 4);
+    acatl::mqtt::PayloadStream::Reader::Ptr fast = stream->attach();
+    acatl::mqtt::PayloadStream::Reader::Ptr slow = stream->attach();
+    size_t resumed = 0;
+    stream->setResumeHandler([&resumed]() { ++resumed; });
+    
+    stream->append({ 1, 2, 3 });
+    EXPECT_FALSE(stream->shouldPause());
+    stream->append({ 4, 5, 6 });
+    EXPECT_TRUE(stream->shouldPause());
+    
+    // the slowest reader holds the chunks
+    acatl::mqtt::PayloadStream::Chunk chunk;
+    fast->read(chunk, nullptr);
+    fast->read(chunk, nullptr);
+    EXPECT_EQ(0u, resumed);
+    slow->read(chunk, nullptr);
+    EXPECT_EQ(0u, resumed);
+    
+    // a disconnecting subscriber releases everything it did not read yet
+    slow.reset();
+    EXPECT_EQ(1u, resumed);
+    EXPECT_EQ(0u, stream->bufferedBytes());
+    EXPECT_FALSE(stream->shouldPause());
+}
+
+TEST(MQTTPayloadStreamTest, abort)
+{
+    acatl::mqtt::PayloadStream::Ptr stream = std::make_shared<acatl::mqtt::PayloadStream>(8, 1024);
+    acatl::mqtt::PayloadStream::Reader::Ptr reader = stream->attach();
+    std::vector<bool> completions;
+    stream->setCompletionHandler([&completions](bool complete) { completions.push_back(complete); });
+    
+    stream->append({ 1, 2, 3, 4 });
+    bool wokeUp = false;
+    acatl::mqtt::PayloadStream::Chunk chunk;
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Chunk, reader->read(chunk, nullptr));
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Pending, reader->read(chunk, [&wokeUp]() { wokeUp = true; }));
+    
+    stream->abort();
+    stream->finish();
+    EXPECT_TRUE(wokeUp);
+    EXPECT_EQ(std::vector<bool>{ false }, completions);
+    EXPECT_EQ(acatl::mqtt::PayloadStream::Result::Aborted, reader->read(chunk, nullptr));
+}
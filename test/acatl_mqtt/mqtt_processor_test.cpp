@@ -128,7 +128,9 @@ public:
 
 TEST_F(MQTTProcessorTest, disconnect)
 {
+    EXPECT_EQ(0u, _mqttProcessor.keepAlive());
     connect();
+    EXPECT_EQ(60u, _mqttProcessor.keepAlive());
     
     acatl::mqtt::ControlPacket::Ptr disconnect = std::make_unique<acatl::mqtt::DisconnectControlPacket>();
     
@@ -246,3 +248,284 @@ TEST_F(MQTTProcessorTest, subscribeAndPublish)
     const acatl::mqtt::PublishControlPacket* p = static_cast<const acatl::mqtt::PublishControlPacket*>(sender->_sendPackets[0].get());
     EXPECT_EQ("cool!", std::string(reinterpret_cast<const char*>(&p->_payload[0]), p->_payload.size()));
 }
+
+TEST_F(MQTTProcessorTest, flowControl)
+{
+    std::error_code ec;
+    std::shared_ptr<NullSender> sender(new NullSender);
+    MySubscriptionHandler handler(_subscriptionTreeManager);
+    
+    acatl::mqtt::Session::Ptr session = _sessionManager.getSession("0815-session", sender, handler, ec);
+    handler.setSession(session);
+    acatl::mqtt::TopicFilters filters;
+    filters.push_back(acatl::mqtt::TopicFilter("sheldon/bazinga", acatl::mqtt::QoSLevel::AtMostOnce));
+    session->addSubscriptions(filters);
+    
+    acatl::mqtt::FlowControl::Ptr flowControl = std::make_shared<acatl::mqtt::FlowControl>(10, 0);
+    bool resumed = false;
+    flowControl->setResumeHandler([&resumed]() { resumed = true; });
+    _mqttProcessor.setFlowControl(flowControl);
+    
+    connect();
+    
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_topicName = "sheldon/bazinga";
+    pub->_payload = { 'c', 'o', 'o', 'l', '!' };
+    
+    _mqttProcessor.processPacket(std::move(pub), ec);
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(1u, sender->_sendPackets.size());
+    EXPECT_LT(10u, flowControl->pendingBytes());
+    EXPECT_TRUE(flowControl->shouldPause());
+    
+    // the subscriber has written the packet
+    sender->_sendPackets.clear();
+    EXPECT_EQ(0u, flowControl->pendingBytes());
+    EXPECT_TRUE(resumed);
+}
+
+TEST_F(MQTTProcessorTest, retainedMessages)
+{
+    auto retainedStore = std::make_shared<acatl::mqtt::RetainedStore>();
+    _mqttProcessor.setRetainedStore(retainedStore);
+    connect();
+    
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_header._flags = 0x01;
+    pub->_topicName = "sheldon/bazinga";
+    pub->_payload = { 'c', 'o', 'o', 'l', '!' };
+    
+    std::error_code ec;
+    _mqttProcessor.processPacket(std::move(pub), ec);
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(1u, retainedStore->size());
+    
+    acatl::mqtt::SubscribeControlPacket::Ptr req = std::make_unique<acatl::mqtt::SubscribeControlPacket>();
+    req->_packetIdentifier = 15;
+    req->_topicFilters.push_back(acatl::mqtt::TopicFilter("sheldon/+", acatl::mqtt::QoSLevel::AtMostOnce));
+    
+    // the SUBACK goes through the sender, so it arrives before the retained message
+    std::tuple<acatl::mqtt::ConnectionState, acatl::mqtt::ControlPacket::Ptr> result = _mqttProcessor.processPacket(std::move(req), ec);
+    EXPECT_FALSE(std::get<1>(result));
+    EXPECT_FALSE(ec);
+    ASSERT_EQ(2u, _sender->_sendPackets.size());
+    EXPECT_EQ(acatl::mqtt::ControlPacketType::Suback, _sender->_sendPackets[0]->_header._controlPacketType);
+    const acatl::mqtt::PublishControlPacket& retained =
+        static_cast<const acatl::mqtt::PublishControlPacket&>(*_sender->_sendPackets[1]);
+    EXPECT_EQ("sheldon/bazinga", retained._topicName._name);
+    EXPECT_EQ(0x01, retained._header._flags);
+    EXPECT_EQ(5u, retained._payload.size());
+    
+    // a live delivery to the established subscription does not carry the RETAIN flag
+    pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_header._flags = 0x01;
+    pub->_topicName = "sheldon/cooper";
+    pub->_payload = { 'x' };
+    _mqttProcessor.processPacket(std::move(pub), ec);
+    ASSERT_EQ(3u, _sender->_sendPackets.size());
+    EXPECT_EQ(0x00, _sender->_sendPackets[2]->_header._flags);
+    EXPECT_EQ(2u, retainedStore->size());
+}
+
+TEST_F(MQTTProcessorTest, qualityOfService)
+{
+    acatl::mqtt::InflightOptions inflightOptions;
+    inflightOptions._receiveMaximum = 2;
+    _sessionManager.setInflightOptions(inflightOptions);
+    connect();
+    
+    std::error_code ec;
+    acatl::mqtt::SubscribeControlPacket::Ptr req = std::make_unique<acatl::mqtt::SubscribeControlPacket>();
+    req->_packetIdentifier = 1;
+    req->_topicFilters.push_back(acatl::mqtt::TopicFilter("sheldon/+", acatl::mqtt::QoSLevel::AtLeastOnce));
+    _mqttProcessor.processPacket(std::move(req), ec);
+    EXPECT_FALSE(ec);
+    
+    auto publish = [this, &ec](acatl::mqtt::QoSLevel qos, acatl::mqtt::PacketIdentifier packetIdentifier) {
+        acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+        pub->setQoS(qos);
+        pub->_packetIdentifier = packetIdentifier;
+        pub->_topicName = "sheldon/bazinga";
+        pub->_payload = { 'c', 'o', 'o', 'l', '!' };
+        return _mqttProcessor.processPacket(std::move(pub), ec);
+    };
+    auto delivered = [this](size_t index) -> const acatl::mqtt::PublishControlPacket& {
+        return static_cast<const acatl::mqtt::PublishControlPacket&>(*_sender->_sendPackets[index]);
+    };
+    
+    // every QoS 1 publish is acknowledged, the deliveries pipeline up to the receive maximum
+    for(acatl::mqtt::PacketIdentifier id = 7; id < 10; ++id) {
+        std::tuple<acatl::mqtt::ConnectionState, acatl::mqtt::ControlPacket::Ptr> result = publish(acatl::mqtt::QoSLevel::AtLeastOnce, id);
+        EXPECT_FALSE(ec);
+        ASSERT_TRUE(std::get<1>(result));
+        EXPECT_EQ(acatl::mqtt::ControlPacketType::Puback, std::get<1>(result)->_header._controlPacketType);
+        EXPECT_EQ(id, static_cast<const acatl::mqtt::AcknowledgeControlPacket&>(*std::get<1>(result))._packetIdentifier);
+    }
+    ASSERT_EQ(2u, _sender->_sendPackets.size());
+    EXPECT_EQ(acatl::mqtt::QoSLevel::AtLeastOnce, delivered(0).qos());
+    EXPECT_EQ(1u, delivered(0)._packetIdentifier);
+    EXPECT_EQ(2u, delivered(1)._packetIdentifier);
+    
+    // the PUBACK frees a slot for the waiting message
+    std::tuple<acatl::mqtt::ConnectionState, acatl::mqtt::ControlPacket::Ptr> result =
+        _mqttProcessor.processPacket(std::make_unique<acatl::mqtt::PubAckControlPacket>(1), ec);
+    EXPECT_FALSE(std::get<1>(result));
+    ASSERT_EQ(3u, _sender->_sendPackets.size());
+    EXPECT_EQ(3u, delivered(2)._packetIdentifier);
+    _mqttProcessor.processPacket(std::make_unique<acatl::mqtt::PubAckControlPacket>(2), ec);
+    _mqttProcessor.processPacket(std::make_unique<acatl::mqtt::PubAckControlPacket>(3), ec);
+    
+    // QoS 2 is delivered once with the granted QoS 1, a retransmission before PUBREL is only acknowledged
+    result = publish(acatl::mqtt::QoSLevel::ExactlyOnce, 20);
+    ASSERT_TRUE(std::get<1>(result));
+    EXPECT_EQ(acatl::mqtt::ControlPacketType::Pubrec, std::get<1>(result)->_header._controlPacketType);
+    ASSERT_EQ(4u, _sender->_sendPackets.size());
+    EXPECT_EQ(acatl::mqtt::QoSLevel::AtLeastOnce, delivered(3).qos());
+    result = publish(acatl::mqtt::QoSLevel::ExactlyOnce, 20);
+    EXPECT_EQ(acatl::mqtt::ControlPacketType::Pubrec, std::get<1>(result)->_header._controlPacketType);
+    EXPECT_EQ(4u, _sender->_sendPackets.size());
+    
+    result = _mqttProcessor.processPacket(std::make_unique<acatl::mqtt::PubRelControlPacket>(20), ec);
+    ASSERT_TRUE(std::get<1>(result));
+    EXPECT_EQ(acatl::mqtt::ControlPacketType::Pubcomp, std::get<1>(result)->_header._controlPacketType);
+    EXPECT_EQ(20u, static_cast<const acatl::mqtt::AcknowledgeControlPacket&>(*std::get<1>(result))._packetIdentifier);
+    
+    // after the release the identifier starts a new message
+    publish(acatl::mqtt::QoSLevel::ExactlyOnce, 20);
+    EXPECT_EQ(5u, _sender->_sendPackets.size());
+}
+
+TEST_F(MQTTProcessorTest, streamedPublish)
+{
+    acatl::mqtt::RetainedStore::Ptr retainedStore = std::make_shared<acatl::mqtt::RetainedStore>();
+    _mqttProcessor.setRetainedStore(retainedStore);
+    connect();
+    
+    std::error_code ec;
+    acatl::mqtt::SubscribeControlPacket::Ptr req = std::make_unique<acatl::mqtt::SubscribeControlPacket>();
+    req->_packetIdentifier = 1;
+    req->_topicFilters.push_back(acatl::mqtt::TopicFilter("firmware/#", acatl::mqtt::QoSLevel::AtLeastOnce));
+    _mqttProcessor.processPacket(std::move(req), ec);
+    
+    acatl::mqtt::PayloadStream::Ptr stream = std::make_shared<acatl::mqtt::PayloadStream>(4, 1024);
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->setQoS(acatl::mqtt::QoSLevel::AtLeastOnce);
+    pub->_header._flags |= 0x01;
+    pub->_packetIdentifier = 3;
+    pub->_topicName = "firmware/image";
+    pub->_stream = stream;
+    
+    // the subscriber gets the stream right away, the publisher is acknowledged once the payload is complete
+    std::tuple<acatl::mqtt::ConnectionState, acatl::mqtt::ControlPacket::Ptr> result = _mqttProcessor.processPacket(std::move(pub), ec);
+    EXPECT_FALSE(ec);
+    EXPECT_FALSE(std::get<1>(result));
+    ASSERT_EQ(1u, _sender->_sendPackets.size());
+    const acatl::mqtt::PublishControlPacket& delivery = static_cast<const acatl::mqtt::PublishControlPacket&>(*_sender->_sendPackets[0]);
+    ASSERT_TRUE(delivery._streamReader);
+    EXPECT_FALSE(delivery._stream);
+    EXPECT_EQ(acatl::mqtt::QoSLevel::AtMostOnce, delivery.qos());
+    EXPECT_EQ(0, delivery._header._flags & 0x01);
+    EXPECT_EQ(1u, stream->readers());
+    
+    stream->append({ 1, 2, 3, 4 });
+    EXPECT_EQ(1u, _sender->_sendPackets.size());
+    stream->finish();
+    ASSERT_EQ(2u, _sender->_sendPackets.size());
+    EXPECT_EQ(acatl::mqtt::ControlPacketType::Puback, _sender->_sendPackets[1]->_header._controlPacketType);
+    
+    // a streamed payload is never kept as retained message
+    EXPECT_EQ(0u, retainedStore->size());
+}
+
+TEST_F(MQTTProcessorTest, rateLimits)
+{
+    acatl::mqtt::RateLimitOptions options;
+    options._client = acatl::mqtt::RateLimit{1, 2};
+    options._policy = acatl::mqtt::RateLimitPolicy::Drop;
+    _mqttProcessor.setRateLimits(options);
+    connect();
+    
+    std::error_code ec;
+    acatl::mqtt::SubscribeControlPacket::Ptr req = std::make_unique<acatl::mqtt::SubscribeControlPacket>();
+    req->_packetIdentifier = 1;
+    req->_topicFilters.push_back(acatl::mqtt::TopicFilter("sheldon/+", acatl::mqtt::QoSLevel::AtMostOnce));
+    _mqttProcessor.processPacket(std::move(req), ec);
+    
+    for(int i = 0; i < 3; ++i) {
+        acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+        pub->_topicName = "sheldon/bazinga";
+        pub->_payload = { 'c', 'o', 'o', 'l', '!' };
+        _mqttProcessor.processPacket(std::move(pub), ec);
+        EXPECT_FALSE(ec);
+    }
+    
+    // the burst passes, the third publish within the same second is dropped before it is matched
+    EXPECT_EQ(2u, _sender->_sendPackets.size());
+    EXPECT_EQ(1u, _mqttProcessor.rateLimitedPublishes());
+    EXPECT_LT(acatl::mqtt::RateLimiter::Clock::duration::zero(), _mqttProcessor.throttleDelay());
+}
+
+TEST_F(MQTTProcessorTest, topicAliasMaximum)
+{
+    _mqttProcessor.setTopicAliasMaximum(32);
+    acatl::mqtt::ConnectControlPacket::Ptr connect = makeConnectPacket();
+    connect->_protocolLevel = acatl::mqtt::protocolLevel5;
+    
+    std::error_code ec;
+    std::tuple<acatl::mqtt::ConnectionState, acatl::mqtt::ControlPacket::Ptr> result = _mqttProcessor.processPacket(std::move(connect), ec);
+    EXPECT_FALSE(ec);
+    const acatl::mqtt::ConnAckControlPacket* connack = dynamic_cast<const acatl::mqtt::ConnAckControlPacket*>(std::get<1>(result).get());
+    ASSERT_TRUE(connack);
+    EXPECT_EQ(32, connack->_properties._topicAliasMaximum);
+}
+
+TEST_F(MQTTProcessorTest, clusterLinkReserved)
+{
+    auto connectLink = [&](acatl::mqtt::ClusterCredentials::Ptr credentials, const std::string& password) {
+        acatl::mqtt::Processor processor(_subscriptionTreeManager, _sessionManager);
+        processor.setPacketSender(_sender);
+        processor.setClusterCredentials(credentials);
+        acatl::mqtt::ConnectControlPacket::Ptr connect = makeConnectPacket();
+        connect->_clientId = "$cluster/b";
+        connect->_userNameFlag = true;
+        connect->_userName = "cluster";
+        connect->_passwordFlag = true;
+        connect->_password = password;
+        std::error_code ec;
+        std::tuple<acatl::mqtt::ConnectionState, acatl::mqtt::ControlPacket::Ptr> result = processor.processPacket(std::move(connect), ec);
+        EXPECT_FALSE(ec);
+        const acatl::mqtt::ConnAckControlPacket* connack = dynamic_cast<const acatl::mqtt::ConnAckControlPacket*>(std::get<1>(result).get());
+        EXPECT_TRUE(connack);
+        EXPECT_EQ(connack && connack->_connectReturnCode != acatl::mqtt::ConnectReturnCode::ConnectionAccepted,
+                  std::get<0>(result) == acatl::mqtt::ConnectionState::Close);
+        return connack ? connack->_connectReturnCode : acatl::mqtt::ConnectReturnCode::ServerUnavailable;
+    };
+    
+    // without cluster credentials nobody can take the client ID of a link
+    EXPECT_EQ(acatl::mqtt::ConnectReturnCode::IdentifierRejected, connectLink(nullptr, "secret"));
+    
+    auto credentials = std::make_shared<acatl::mqtt::ClusterCredentials>(acatl::mqtt::ClusterCredentials{"cluster", "secret"});
+    EXPECT_EQ(acatl::mqtt::ConnectReturnCode::BadUserNameOrPassword, connectLink(credentials, "guess"));
+    EXPECT_EQ(acatl::mqtt::ConnectReturnCode::ConnectionAccepted, connectLink(credentials, "secret"));
+}
+
+TEST_F(MQTTProcessorTest, sessionInUse)
+{
+    connect();
+    
+    acatl::mqtt::Processor processor(_subscriptionTreeManager, _sessionManager);
+    processor.setPacketSender(_sender);
+    std::error_code ec;
+    std::tuple<acatl::mqtt::ConnectionState, acatl::mqtt::ControlPacket::Ptr> result = processor.processPacket(makeConnectPacket(), ec);
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(acatl::mqtt::ConnectionState::Close, std::get<0>(result));
+    const acatl::mqtt::ConnAckControlPacket* connack = dynamic_cast<const acatl::mqtt::ConnAckControlPacket*>(std::get<1>(result).get());
+    ASSERT_TRUE(connack);
+    EXPECT_EQ(acatl::mqtt::ConnectReturnCode::IdentifierRejected, connack->_connectReturnCode);
+    
+    // the refused connection has no session, packets it sends anyway are not processed
+    acatl::mqtt::PubRelControlPacket::Ptr pubrel = std::make_unique<acatl::mqtt::PubRelControlPacket>(1);
+    result = processor.processPacket(std::move(pubrel), ec);
+    EXPECT_EQ(acatl::mqtt::mqtt_error::not_connected, ec);
+    EXPECT_EQ(acatl::mqtt::ConnectionState::Close, std::get<0>(result));
+}
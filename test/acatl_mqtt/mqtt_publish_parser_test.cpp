@@ -169,3 +169,37 @@ TEST(MQTTPublishParserTest, wildcardInTopicError)
     EXPECT_TRUE(ec);
     EXPECT_EQ(acatl::mqtt::mqtt_error::invalid_wildcard_in_topic, ec);
 }
+
+TEST(MQTTPublishParserTest, parseEmptyAtMostOnce)
+{
+    std::vector<uint8_t> buffer = { 0x00, 0x01, 'a' };
+    
+    uint32_t index = 0;
+    uint32_t length = 3;
+    std::error_code ec;
+    acatl::mqtt::PublishParser parser(acatl::mqtt::QoSLevel::AtMostOnce, length);
+    acatl::Tribool ret;
+    while(ret.isIndeterminate() && index < length) {
+        ret = parser.parse(buffer[index++], ec);
+    }
+    EXPECT_TRUE(ret.isTrue());
+    EXPECT_FALSE(ec);
+    EXPECT_EQ("a", parser.packet()._topicName._name);
+    EXPECT_EQ(0u, parser.packet()._payload.size());
+}
+
+TEST(MQTTPublishParserTest, zeroPacketIdentifierError)
+{
+    std::vector<uint8_t> buffer = { 0x00, 0x01, 'a', 0x00, 0x00, 'x' };
+    
+    uint32_t index = 0;
+    uint32_t length = 6;
+    std::error_code ec;
+    acatl::mqtt::PublishParser parser(acatl::mqtt::QoSLevel::AtLeastOnce, length);
+    acatl::Tribool ret;
+    while(ret.isIndeterminate() && index < length) {
+        ret = parser.parse(buffer[index++], ec);
+    }
+    EXPECT_TRUE(ret.isFalse());
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::publish_protocol_violation), ec);
+}
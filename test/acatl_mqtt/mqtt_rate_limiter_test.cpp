@@ -0,0 +1,115 @@
+//
+//  mqtt_rate_limiter_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_rate_limiter.h>
+
+
+using namespace std::chrono_literals;
+
+
+TEST(MQTTRateLimiterTest, tokenBucket)
+{
+    acatl::mqtt::TokenBucket::Clock::time_point now = acatl::mqtt::TokenBucket::Clock::now();
+    acatl::mqtt::TokenBucket bucket(100, 3);
+    EXPECT_TRUE(bucket.enabled());
+    EXPECT_FALSE(acatl::mqtt::TokenBucket().enabled());
+    
+    // a full bucket takes the burst at once
+    for(int i = 0; i < 3; ++i) {
+        EXPECT_TRUE(bucket.available(now));
+        bucket.take(now);
+    }
+    EXPECT_FALSE(bucket.available(now));
+    EXPECT_EQ(10ms, bucket.wait(now));
+    
+    // then one token every 10ms
+    EXPECT_TRUE(bucket.available(now + 10ms));
+    bucket.take(now + 10ms);
+    EXPECT_FALSE(bucket.available(now + 19ms));
+    
+    // taking more than available delays the next token
+    bucket.take(now + 10ms);
+    bucket.take(now + 10ms);
+    EXPECT_EQ(30ms, bucket.wait(now + 10ms));
+    
+    // an idle bucket fills up to the burst only
+    now += 1s;
+    EXPECT_EQ(acatl::mqtt::TokenBucket::Clock::duration::zero(), bucket.wait(now));
+    for(int i = 0; i < 3; ++i) {
+        bucket.take(now);
+    }
+    EXPECT_FALSE(bucket.available(now));
+}
+
+TEST(MQTTRateLimiterTest, topicPrefixes)
+{
+    acatl::mqtt::RateLimitOptions options;
+    options._topics.push_back(acatl::mqtt::TopicRateLimit{"sensors/", {10, 1}});
+    options._topics.push_back(acatl::mqtt::TopicRateLimit{"sensors/camera/", {1, 1}});
+    options._policy = acatl::mqtt::RateLimitPolicy::Drop;
+    acatl::mqtt::RateLimiter limiter(options);
+    EXPECT_TRUE(limiter.enabled());
+    EXPECT_FALSE(acatl::mqtt::RateLimiter().enabled());
+    
+    acatl::mqtt::RateLimiter::Clock::time_point now = acatl::mqtt::RateLimiter::Clock::now();
+    // topics without a limit pass
+    EXPECT_TRUE(limiter.admit("actors/light", acatl::mqtt::QoSLevel::AtMostOnce, now));
+    EXPECT_TRUE(limiter.admit("actors/light", acatl::mqtt::QoSLevel::AtMostOnce, now));
+    
+    // the most specific prefix applies
+    EXPECT_TRUE(limiter.admit("sensors/camera/1", acatl::mqtt::QoSLevel::AtMostOnce, now));
+    EXPECT_FALSE(limiter.admit("sensors/camera/1", acatl::mqtt::QoSLevel::AtMostOnce, now + 100ms));
+    EXPECT_TRUE(limiter.admit("sensors/temperature", acatl::mqtt::QoSLevel::AtMostOnce, now + 100ms));
+    EXPECT_EQ(1u, limiter.droppedPublishes());
+    
+    // acknowledged publishes are never dropped, they delay the client instead
+    EXPECT_TRUE(limiter.admit("sensors/camera/1", acatl::mqtt::QoSLevel::AtLeastOnce, now + 100ms));
+    EXPECT_EQ(2s, limiter.delay(now));
+}
+
+TEST(MQTTRateLimiterTest, clientThrottle)
+{
+    acatl::mqtt::RateLimitOptions options;
+    options._client = acatl::mqtt::RateLimit{1000, 10};
+    acatl::mqtt::RateLimiter limiter(options);
+    
+    acatl::mqtt::RateLimiter::Clock::time_point now = acatl::mqtt::RateLimiter::Clock::now();
+    for(int i = 0; i < 20; ++i) {
+        EXPECT_TRUE(limiter.admit("a", acatl::mqtt::QoSLevel::AtMostOnce, now));
+    }
+    // the ten publishes beyond the burst are paid back at the rate before the next token is available
+    EXPECT_EQ(11ms, limiter.delay(now));
+    EXPECT_EQ(0u, limiter.droppedPublishes());
+}
@@ -0,0 +1,130 @@
+//
+//  mqtt_retained_store_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_retained_store.h>
+
+#include <algorithm>
+
+
+namespace
+{
+    void retain(acatl::mqtt::RetainedStore& store, const std::string& topic, const std::string& payload)
+    {
+        acatl::mqtt::PublishControlPacket publish;
+        publish._header._flags = 0x01;
+        publish._topicName = topic;
+        publish._payload.assign(payload.begin(), payload.end());
+        store.retain(publish);
+    }
+    
+    std::vector<std::string> match(const acatl::mqtt::RetainedStore& store, const std::string& filter)
+    {
+        acatl::mqtt::RetainedStore::Messages messages;
+        store.match(acatl::mqtt::TopicFilter(filter), messages);
+        std::vector<std::string> topics;
+        for(const auto& message : messages) {
+            topics.push_back(message->_topicName._name);
+        }
+        std::sort(topics.begin(), topics.end());
+        return topics;
+    }
+}
+
+
+TEST(MQTTRetainedStoreTest, retainAndRemove)
+{
+    acatl::mqtt::RetainedStore store;
+    retain(store, "sport/tennis/player1", "1");
+    retain(store, "sport/tennis/player1", "2");
+    EXPECT_EQ(1u, store.size());
+    
+    acatl::mqtt::RetainedStore::Messages messages;
+    EXPECT_EQ(1u, store.match(acatl::mqtt::TopicFilter("sport/tennis/player1"), messages));
+    EXPECT_EQ('2', messages[0]->_payload[0]);
+    
+    retain(store, "sport/tennis/player1", "");
+    EXPECT_EQ(0u, store.size());
+    EXPECT_TRUE(match(store, "#").empty());
+    
+    // removing an unknown topic is fine
+    retain(store, "sport/tennis/player2", "");
+    EXPECT_EQ(0u, store.size());
+}
+
+TEST(MQTTRetainedStoreTest, wildcards)
+{
+    acatl::mqtt::RetainedStore store;
+    retain(store, "sport", "x");
+    retain(store, "sport/tennis/player1", "x");
+    retain(store, "sport/tennis/player2", "x");
+    retain(store, "sport/soccer/team1", "x");
+    retain(store, "sport/soccer/team1/score", "x");
+    retain(store, "/finance", "x");
+    retain(store, "$SYS/broker/clients", "x");
+    
+    EXPECT_EQ((std::vector<std::string>{"sport/tennis/player1", "sport/tennis/player2"}), match(store, "sport/tennis/+"));
+    EXPECT_EQ((std::vector<std::string>{"sport/soccer/team1", "sport/tennis/player1", "sport/tennis/player2"}),
+              match(store, "sport/+/+"));
+    EXPECT_EQ((std::vector<std::string>{"sport", "sport/soccer/team1", "sport/soccer/team1/score", "sport/tennis/player1",
+                                        "sport/tennis/player2"}),
+              match(store, "sport/#"));
+    EXPECT_EQ((std::vector<std::string>{"/finance"}), match(store, "+/finance"));
+    EXPECT_EQ((std::vector<std::string>{"sport"}), match(store, "+"));
+    EXPECT_EQ(6u, match(store, "#").size());
+    EXPECT_EQ((std::vector<std::string>{"$SYS/broker/clients"}), match(store, "$SYS/#"));
+}
+
+TEST(MQTTRetainedStoreTest, sharedPayload)
+{
+    acatl::mqtt::RetainedStore store;
+    acatl::mqtt::PublishControlPacket publish;
+    publish._topicName = "a/b";
+    publish._payload = { 1, 2, 3 };
+    store.retain(publish);
+    
+    acatl::mqtt::RetainedStore::Messages messages;
+    store.match(acatl::mqtt::TopicFilter("a/b"), messages);
+    ASSERT_EQ(1u, messages.size());
+    EXPECT_TRUE(messages[0]->_payload.shares(publish._payload));
+    
+    acatl::mqtt::PublishControlPacket delivery(*messages[0]);
+    EXPECT_TRUE(delivery._payload.shares(publish._payload));
+    
+    // modifying the publisher's packet does not touch the retained bytes
+    publish._payload.push_back(4);
+    EXPECT_FALSE(delivery._payload.shares(publish._payload));
+    EXPECT_EQ(3u, delivery._payload.size());
+    EXPECT_EQ(4u, publish._payload.size());
+}
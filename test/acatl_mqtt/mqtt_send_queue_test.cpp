@@ -0,0 +1,190 @@
+//
+//  mqtt_send_queue_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_send_queue.h>
+
+
+namespace
+{
+    acatl::mqtt::ControlPacket::Ptr makePublish(const std::string& payload,
+                                                acatl::mqtt::QoSLevel qos = acatl::mqtt::QoSLevel::AtMostOnce)
+    {
+        acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+        pub->_header._flags = static_cast<acatl::mqtt::HeaderFlags>(static_cast<uint8_t>(qos) << 1);
+        pub->_topicName = "sheldon/bazinga";
+        pub->_payload.assign(payload.begin(), payload.end());
+        return std::move(pub);
+    }
+    
+    std::string payload(const acatl::mqtt::ControlPacket::Ptr& packet)
+    {
+        const acatl::mqtt::PublishControlPacket& pub = static_cast<const acatl::mqtt::PublishControlPacket&>(*packet);
+        return std::string(pub._payload.begin(), pub._payload.end());
+    }
+}
+
+
+TEST(MQTTSendQueueTest, unlimited)
+{
+    acatl::mqtt::SendQueue queue;
+    for(int n = 0; n < 100; ++n) {
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("cool!")));
+    }
+    EXPECT_EQ(100u, queue.size());
+    EXPECT_EQ(100u, queue.highWaterPackets());
+    EXPECT_EQ(0u, queue.droppedPackets());
+    
+    while(!queue.empty()) {
+        EXPECT_EQ("cool!", payload(queue.pop()));
+    }
+    EXPECT_EQ(0u, queue.bytes());
+}
+
+TEST(MQTTSendQueueTest, dropOldest)
+{
+    acatl::mqtt::SendQueue queue(acatl::mqtt::SendQueueLimits(2, 0, acatl::mqtt::SlowConsumerPolicy::DropOldest));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("1")));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("2")));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("3")));
+    EXPECT_EQ(2u, queue.size());
+    EXPECT_EQ(1u, queue.droppedPackets());
+    EXPECT_EQ("2", payload(queue.pop()));
+    EXPECT_EQ("3", payload(queue.pop()));
+}
+
+TEST(MQTTSendQueueTest, dropOldestKeepsQoS1)
+{
+    acatl::mqtt::SendQueue queue(acatl::mqtt::SendQueueLimits(1, 0, acatl::mqtt::SlowConsumerPolicy::DropOldest));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("1", acatl::mqtt::QoSLevel::AtLeastOnce)));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Dropped, queue.push(makePublish("2")));
+    EXPECT_EQ(1u, queue.size());
+    EXPECT_EQ("1", payload(queue.pop()));
+}
+
+TEST(MQTTSendQueueTest, dropNewest)
+{
+    acatl::mqtt::SendQueue queue(acatl::mqtt::SendQueueLimits(0, 50, acatl::mqtt::SlowConsumerPolicy::DropNewest));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("1")));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Dropped, queue.push(makePublish(std::string(40, 'x'))));
+    EXPECT_EQ(1u, queue.size());
+    EXPECT_EQ(1u, queue.droppedPackets());
+    
+    // control packets are never dropped
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(std::make_unique<acatl::mqtt::PingRespControlPacket>()));
+    EXPECT_EQ(2u, queue.size());
+}
+
+TEST(MQTTSendQueueTest, disconnect)
+{
+    acatl::mqtt::SendQueue queue(acatl::mqtt::SendQueueLimits(1, 0, acatl::mqtt::SlowConsumerPolicy::Disconnect));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("1")));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Overflow, queue.push(makePublish("2")));
+    EXPECT_EQ(1u, queue.size());
+}
+
+TEST(MQTTSendQueueTest, pause)
+{
+    acatl::mqtt::SendQueue queue(acatl::mqtt::SendQueueLimits(1, 0, acatl::mqtt::SlowConsumerPolicy::Pause));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("1")));
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Paused, queue.push(makePublish("2")));
+    EXPECT_EQ(2u, queue.size());
+    EXPECT_EQ(2u, queue.highWaterPackets());
+    EXPECT_EQ(0u, queue.droppedPackets());
+}
+
+TEST(MQTTSendQueueTest, pauseIsBounded)
+{
+    acatl::mqtt::SendQueue queue(acatl::mqtt::SendQueueLimits(4, 0, acatl::mqtt::SlowConsumerPolicy::Pause));
+    for(int i = 0; i < 4; ++i) {
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("q")));
+    }
+    for(int i = 0; i < 4; ++i) {
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Paused, queue.push(makePublish("p")));
+    }
+    
+    // a consumer that does not catch up at twice the limit is disconnected instead of growing the queue
+    for(int i = 0; i < 100; ++i) {
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Overflow, queue.push(makePublish("o")));
+    }
+    EXPECT_EQ(8u, queue.size());
+    EXPECT_EQ(8u, queue.highWaterPackets());
+    
+    queue.pop();
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Paused, queue.push(makePublish("p")));
+    EXPECT_EQ(8u, queue.size());
+}
+
+TEST(MQTTSendQueueTest, qos1FloodIsBounded)
+{
+    acatl::mqtt::SendQueue queue(acatl::mqtt::SendQueueLimits(4, 0, acatl::mqtt::SlowConsumerPolicy::DropOldest));
+    // QoS 1 publishes are never dropped, they are queued beyond the limits up to twice the limits
+    for(int i = 0; i < 8; ++i) {
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("q", acatl::mqtt::QoSLevel::AtLeastOnce)));
+    }
+    for(int i = 0; i < 100; ++i) {
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Overflow,
+                  queue.push(makePublish("o", acatl::mqtt::QoSLevel::AtLeastOnce)));
+    }
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Overflow, queue.push(std::make_unique<acatl::mqtt::PingRespControlPacket>()));
+    EXPECT_EQ(8u, queue.size());
+    EXPECT_EQ(0u, queue.droppedPackets());
+    
+    queue.pop();
+    EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, queue.push(makePublish("q", acatl::mqtt::QoSLevel::AtLeastOnce)));
+    EXPECT_EQ(8u, queue.size());
+}
+
+TEST(MQTTSendQueueTest, memoryWatermark)
+{
+    acatl::mqtt::SendQueueMemory memory(40);
+    {
+        acatl::mqtt::SendQueue first(acatl::mqtt::SendQueueLimits(), &memory);
+        acatl::mqtt::SendQueue second(acatl::mqtt::SendQueueLimits(), &memory);
+        
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, first.push(makePublish("1")));
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, second.push(makePublish("2")));
+        EXPECT_TRUE(memory.exceeded());
+        EXPECT_EQ(first.bytes() + second.bytes(), memory.bytes());
+        
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Dropped, second.push(makePublish("3")));
+        EXPECT_EQ(acatl::mqtt::SendQueue::Result::Queued, second.push(makePublish("4", acatl::mqtt::QoSLevel::AtLeastOnce)));
+        EXPECT_EQ(1u, memory.droppedPackets());
+        
+        first.pop();
+        EXPECT_EQ(second.bytes(), memory.bytes());
+    }
+    EXPECT_EQ(0u, memory.bytes());
+    EXPECT_FALSE(memory.exceeded());
+}
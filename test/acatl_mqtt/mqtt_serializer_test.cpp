@@ -125,6 +125,24 @@ TEST(MQTTSerializerTest, serializePingResp)
     EXPECT_EQ(0x00, buffer[1]);
 }
 
+TEST(MQTTSerializerTest, serializePingReq)
+{
+    acatl::mqtt::Serializer serializer;
+    
+    acatl::mqtt::PingReqControlPacket pingreq;
+    
+    std::error_code ec;
+    size_t length = 0;
+    std::vector<uint8_t> buffer;
+    
+    EXPECT_TRUE(serializer.serialize(pingreq, buffer, length, ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ(2u, length);
+    
+    EXPECT_EQ(0xC0, buffer[0]);
+    EXPECT_EQ(0x00, buffer[1]);
+}
+
 TEST(MQTTSerializerTest, Publish)
 {
     acatl::mqtt::Serializer serializer;
@@ -170,6 +188,83 @@ TEST(MQTTSerializerTest, Publish)
     EXPECT_EQ('!', buffer[23]);
 }
 
+TEST(MQTTSerializerTest, publishRetain)
+{
+    acatl::mqtt::Serializer serializer;
+    
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_header._flags = 0x01;
+    pub->_topicName = "a";
+    pub->_payload = { 'x' };
+    
+    std::error_code ec;
+    size_t length = 0;
+    std::vector<uint8_t> buffer;
+    
+    EXPECT_TRUE(serializer.serialize(std::move(pub), buffer, length, ec));
+    EXPECT_EQ(6u, length);
+    EXPECT_EQ(0x31, buffer[0]);
+}
+
+TEST(MQTTSerializerTest, publishAtLeastOnce)
+{
+    acatl::mqtt::Serializer serializer;
+    
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->setQoS(acatl::mqtt::QoSLevel::AtLeastOnce);
+    pub->_packetIdentifier = 0x0102;
+    pub->_topicName = "a";
+    pub->_payload = { 'x' };
+    
+    std::error_code ec;
+    size_t length = 0;
+    std::vector<uint8_t> buffer;
+    
+    EXPECT_TRUE(serializer.serialize(std::move(pub), buffer, length, ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ((std::vector<uint8_t>{ 0x32, 0x06, 0x00, 0x01, 'a', 0x01, 0x02, 'x' }), buffer);
+    EXPECT_EQ(8u, length);
+}
+
+TEST(MQTTSerializerTest, serializeAcknowledgements)
+{
+    acatl::mqtt::Serializer serializer;
+    std::error_code ec;
+    size_t length = 0;
+    std::vector<uint8_t> buffer;
+    
+    EXPECT_TRUE(serializer.serialize(std::make_unique<acatl::mqtt::PubAckControlPacket>(0x0A0B), buffer, length, ec));
+    EXPECT_EQ((std::vector<uint8_t>{ 0x40, 0x02, 0x0A, 0x0B }), buffer);
+    EXPECT_TRUE(serializer.serialize(std::make_unique<acatl::mqtt::PubRecControlPacket>(1), buffer, length, ec));
+    EXPECT_EQ((std::vector<uint8_t>{ 0x50, 0x02, 0x00, 0x01 }), buffer);
+    EXPECT_TRUE(serializer.serialize(std::make_unique<acatl::mqtt::PubRelControlPacket>(2), buffer, length, ec));
+    EXPECT_EQ((std::vector<uint8_t>{ 0x62, 0x02, 0x00, 0x02 }), buffer);
+    EXPECT_TRUE(serializer.serialize(std::make_unique<acatl::mqtt::PubCompControlPacket>(3), buffer, length, ec));
+    EXPECT_EQ((std::vector<uint8_t>{ 0x70, 0x02, 0x00, 0x03 }), buffer);
+    EXPECT_EQ(4u, length);
+    EXPECT_FALSE(ec);
+}
+
+TEST(MQTTSerializerTest, publishStreamed)
+{
+    acatl::mqtt::Serializer serializer;
+    
+    acatl::mqtt::PayloadStream::Ptr stream = std::make_shared<acatl::mqtt::PayloadStream>(200, 1024);
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_topicName = "a";
+    pub->_streamReader = stream->attach();
+    
+    std::error_code ec;
+    size_t length = 0;
+    std::vector<uint8_t> buffer;
+    
+    // the remaining length covers the streamed payload, which is not part of the serialized bytes
+    EXPECT_TRUE(serializer.serialize(std::move(pub), buffer, length, ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ((std::vector<uint8_t>{ 0x30, 0xCB, 0x01, 0x00, 0x01, 'a' }), buffer);
+    EXPECT_EQ(6u, length);
+}
+
 TEST(MQTTSerializerTest, serializeSubscribe)
 {
     acatl::mqtt::Serializer serializer;
@@ -253,3 +348,46 @@ TEST(MQTTSerializerTest, serializeDisco)
     EXPECT_EQ(0xE0, buffer[0]);
     EXPECT_EQ(0x00, buffer[1]);
 }
+
+TEST(MQTTSerializerTest, serializeMQTT5ConnAck)
+{
+    acatl::mqtt::Serializer serializer;
+    serializer.setProtocolLevel(acatl::mqtt::protocolLevel5);
+    
+    acatl::mqtt::ConnAckControlPacket::Ptr connack = std::make_unique<acatl::mqtt::ConnAckControlPacket>();
+    connack->_properties._topicAliasMaximum = 16;
+    
+    std::error_code ec;
+    size_t length = 0;
+    std::vector<uint8_t> buffer;
+    
+    EXPECT_TRUE(serializer.serialize(std::move(connack), buffer, length, ec));
+    EXPECT_FALSE(ec);
+    EXPECT_EQ((std::vector<uint8_t>{ 0x20, 0x06, 0x00, 0x00, 0x03, 0x22, 0x00, 0x10 }),
+              std::vector<uint8_t>(buffer.begin(), buffer.begin() + length));
+}
+
+TEST(MQTTSerializerTest, publishTopicAlias)
+{
+    acatl::mqtt::Serializer serializer;
+    serializer.setProtocolLevel(acatl::mqtt::protocolLevel5);
+    serializer.setTopicAliasMaximum(2);
+    
+    std::error_code ec;
+    size_t length = 0;
+    std::vector<uint8_t> buffer;
+    
+    acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+    pub->_topicName = "a/b";
+    pub->_payload = { 'x' };
+    acatl::mqtt::PublishControlPacket::Ptr again = std::make_unique<acatl::mqtt::PublishControlPacket>(*pub);
+    
+    // the first publish establishes the alias, the next one only carries the alias
+    EXPECT_TRUE(serializer.serialize(std::move(pub), buffer, length, ec));
+    EXPECT_EQ((std::vector<uint8_t>{ 0x30, 0x0A, 0x00, 0x03, 'a', '/', 'b', 0x03, 0x23, 0x00, 0x01, 'x' }),
+              std::vector<uint8_t>(buffer.begin(), buffer.begin() + length));
+    EXPECT_TRUE(serializer.serialize(std::move(again), buffer, length, ec));
+    EXPECT_EQ((std::vector<uint8_t>{ 0x30, 0x07, 0x00, 0x00, 0x03, 0x23, 0x00, 0x01, 'x' }),
+              std::vector<uint8_t>(buffer.begin(), buffer.begin() + length));
+    EXPECT_FALSE(ec);
+}
@@ -35,6 +35,9 @@
 
 #include <acatl_mqtt/mqtt_session_manager.h>
 
+#include <future>
+#include <thread>
+
 
 namespace
 {
@@ -45,6 +48,44 @@ namespace
         {
         }
     };
+    
+    /// Holds loadSession until it is released, like a store waiting for a slow disk.
+    class BlockingStore : public acatl::mqtt::SessionStore
+    {
+    public:
+        using acatl::mqtt::SessionStore::persistSession;
+        
+        virtual bool persistSession(const acatl::mqtt::SessionState& state, std::error_code& ec)
+        {
+            ec.clear();
+            return true;
+        }
+        
+        virtual bool loadSession(const std::string& clientId, acatl::mqtt::TopicFilters& subscriptions,
+                                 std::error_code& ec)
+        {
+            _entered.set_value();
+            _release.get_future().wait();
+            subscriptions = {{"a/b"}};
+            ec.clear();
+            return true;
+        }
+        
+        virtual bool removeSession(const std::string& clientId, std::error_code& ec)
+        {
+            ec.clear();
+            return true;
+        }
+        
+        virtual bool flush(std::error_code& ec)
+        {
+            ec.clear();
+            return true;
+        }
+        
+        std::promise<void> _entered;
+        std::promise<void> _release;
+    };
 }
 
 
@@ -57,14 +98,20 @@ public:
     }
     
     virtual void addSubscriptions(const acatl::mqtt::TopicFilters& subscriptions)
-    {}
+    {
+        _added.push_back(subscriptions);
+    }
     
     virtual void removeSubscriptions(const acatl::mqtt::TopicFilters& subscriptions)
-    {}
+    {
+        _removed.push_back(subscriptions);
+    }
 
 protected:
     acatl::mqtt::SessionManager _sessionManager;
     std::shared_ptr<NullSender> _sender;
+    std::vector<acatl::mqtt::TopicFilters> _added;
+    std::vector<acatl::mqtt::TopicFilters> _removed;
 };
 
 
@@ -107,6 +154,57 @@ TEST_F(MQTTSessionTest, duplSession)
     EXPECT_FALSE(ec);
 }
 
+TEST_F(MQTTSessionTest, resumedSessionHandler)
+{
+    class CountingHandler : public acatl::mqtt::SubscriptionHandler
+    {
+    public:
+        void addSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+        {
+            _added += subscriptions.size();
+        }
+        
+        void removeSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+        {}
+        
+        size_t _added = 0;
+    };
+    
+    acatl::mqtt::SessionManager manager;
+    std::error_code ec;
+    CountingHandler first;
+    acatl::mqtt::Session::Ptr session = manager.getSession("hutzli0815", _sender, first, ec);
+    session->addSubscriptions({acatl::mqtt::TopicFilter("a", acatl::mqtt::QoSLevel::AtMostOnce)});
+    EXPECT_TRUE(manager.returnSession(session, ec));
+    
+    // the subscriptions of the resumed session go to the handler of the new connection
+    CountingHandler second;
+    session = manager.getSession("hutzli0815", _sender, second, ec);
+    session->addSubscriptions({acatl::mqtt::TopicFilter("b", acatl::mqtt::QoSLevel::AtMostOnce)});
+    EXPECT_EQ(1u, first._added);
+    EXPECT_EQ(1u, second._added);
+}
+
+TEST_F(MQTTSessionTest, subscriptions)
+{
+    acatl::mqtt::Session session("hutzli0815", *this);
+    session.addSubscriptions({{"c/d"}, {"a/b", acatl::mqtt::QoSLevel::AtLeastOnce}});
+    // unchanged subscriptions are not passed on again, a new QoS is
+    session.addSubscriptions({{"a/b", acatl::mqtt::QoSLevel::AtLeastOnce}, {"c/d"}});
+    session.addSubscriptions({{"c/d", acatl::mqtt::QoSLevel::ExactlyOnce}, {"a/b", acatl::mqtt::QoSLevel::AtLeastOnce}});
+    ASSERT_EQ(2u, _added.size());
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"c/d"}, {"a/b", acatl::mqtt::QoSLevel::AtLeastOnce}}), _added[0]);
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"c/d", acatl::mqtt::QoSLevel::ExactlyOnce}}), _added[1]);
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"c/d", acatl::mqtt::QoSLevel::ExactlyOnce}, {"a/b", acatl::mqtt::QoSLevel::AtLeastOnce}}),
+              session.subscriptions());
+    
+    session.removeSubscriptions({{"x/y"}, {"c/d"}});
+    session.removeSubscriptions({{"c/d"}});
+    ASSERT_EQ(1u, _removed.size());
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"c/d"}}), _removed[0]);
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"a/b", acatl::mqtt::QoSLevel::AtLeastOnce}}), session.subscriptions());
+}
+
 TEST_F(MQTTSessionTest, removeSession)
 {
     acatl::mqtt::SessionManager manager;
@@ -132,3 +230,61 @@ TEST_F(MQTTSessionTest, removeSession)
     EXPECT_EQ(acatl::mqtt::mqtt_error::session_not_found, ec);
 }
 
+TEST_F(MQTTSessionTest, storeOutsideShardLock)
+{
+    // a single shard, so every client would wait for the load if it ran under the shard lock
+    acatl::mqtt::SessionManager manager(1);
+    auto store = std::make_shared<BlockingStore>();
+    manager.setSessionStore(store);
+    
+    acatl::mqtt::Session::Ptr slow;
+    std::thread loader([&]() {
+        std::error_code errc;
+        slow = manager.getSession("slow", false, _sender, *this, errc);
+    });
+    store->_entered.get_future().wait();
+    
+    std::error_code ec;
+    auto other = manager.getSession("other", true, _sender, *this, ec);
+    EXPECT_TRUE(other != nullptr);
+    EXPECT_FALSE(ec);
+    EXPECT_TRUE(manager.getSession("slow", false, _sender, *this, ec) == nullptr);
+    EXPECT_EQ(acatl::mqtt::mqtt_error::session_in_use, ec);
+    
+    store->_release.set_value();
+    loader.join();
+    ASSERT_TRUE(slow != nullptr);
+    EXPECT_EQ(acatl::mqtt::TopicFilters{{"a/b"}}, slow->subscriptions());
+    EXPECT_EQ(2u, manager.count());
+}
+
+TEST_F(MQTTSessionTest, concurrentSessions)
+{
+    acatl::mqtt::SessionManager manager(8);
+    EXPECT_EQ(8u, manager.shardCount());
+    
+    const size_t threadCount = 4;
+    const size_t clientsPerThread = 500;
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < threadCount; ++t) {
+        threads.emplace_back([this, &manager, t, clientsPerThread]() {
+            std::error_code ec;
+            for(size_t i = 0; i < clientsPerThread; ++i) {
+                std::string clientId = "client-" + std::to_string(t) + "-" + std::to_string(i);
+                acatl::mqtt::Session::Ptr session = manager.getSession(clientId, _sender, *this, ec);
+                EXPECT_TRUE(session != nullptr);
+                EXPECT_TRUE(manager.returnSession(session, ec));
+                session = manager.getSession(clientId, _sender, *this, ec);
+                EXPECT_TRUE(session != nullptr);
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(threadCount * clientsPerThread, manager.count());
+    
+    std::error_code ec;
+    EXPECT_FALSE(manager.getSession("client-0-0", _sender, *this, ec));
+    EXPECT_EQ(acatl::mqtt::mqtt_error::session_in_use, ec);
+}
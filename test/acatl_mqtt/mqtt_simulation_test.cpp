@@ -0,0 +1,148 @@
+//
+//  mqtt_simulation_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_simulation.h>
+
+
+namespace
+{
+    acatl::mqtt::ClientScript subscriberScript(const std::string& filter, acatl::mqtt::QoSLevel qos)
+    {
+        acatl::mqtt::ClientScript script;
+        script._steps.push_back({acatl::mqtt::ClientAction::Connect});
+        script._steps.push_back({acatl::mqtt::ClientAction::Subscribe, 10, filter, qos});
+        return script;
+    }
+}
+
+
+TEST(MQTTSimulationTest, virtualClock)
+{
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    acatl::mqtt::Simulation simulation(subscriptionTreeManager, sessionManager);
+    
+    acatl::mqtt::ClientScript script;
+    script._steps.push_back({acatl::mqtt::ClientAction::Connect});
+    script._steps.push_back({acatl::mqtt::ClientAction::Disconnect, 1000});
+    EXPECT_EQ(0u, simulation.addClients(4, script, 400));
+    
+    EXPECT_EQ(2u, simulation.run(150));
+    EXPECT_EQ(150u, simulation.clock().now());
+    EXPECT_EQ(2u, simulation.connected());
+    
+    EXPECT_EQ(2u, simulation.run(999));
+    EXPECT_EQ(4u, simulation.connected());
+    
+    EXPECT_EQ(4u, simulation.run());
+    EXPECT_EQ(1300u, simulation.clock().now());
+    EXPECT_EQ(0u, simulation.connected());
+    EXPECT_EQ(4u, simulation.stats()._connects._count);
+    EXPECT_EQ(4u, simulation.stats()._connacks);
+    EXPECT_EQ(4u, simulation.stats()._disconnects._count);
+    EXPECT_EQ(0u, simulation.stats()._errors);
+}
+
+TEST(MQTTSimulationTest, publishCycles)
+{
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    acatl::mqtt::Simulation simulation(subscriptionTreeManager, sessionManager);
+    
+    simulation.addClients(3, subscriberScript("sim/+", acatl::mqtt::QoSLevel::AtLeastOnce));
+    
+    acatl::mqtt::ClientScript publisher;
+    publisher._steps.push_back({acatl::mqtt::ClientAction::Connect, 1000});
+    publisher._steps.push_back({acatl::mqtt::ClientAction::Publish, 100, "sim/%i", acatl::mqtt::QoSLevel::AtLeastOnce, 2});
+    publisher._steps.push_back({acatl::mqtt::ClientAction::Disconnect, 100});
+    publisher._cycles = 2;
+    publisher._acknowledgeDelay = 50;
+    EXPECT_EQ(3u, simulation.addClients(10, publisher, 100));
+    EXPECT_EQ(13u, simulation.clients());
+    
+    simulation.run();
+    
+    const acatl::mqtt::SimulationStats& stats = simulation.stats();
+    EXPECT_EQ(0u, stats._errors);
+    EXPECT_EQ(23u, stats._connects._count);
+    EXPECT_EQ(3u, stats._subscribes._count);
+    EXPECT_EQ(3u, stats._subacks);
+    EXPECT_EQ(40u, stats._publishes._count);
+    EXPECT_EQ(120u, stats._deliveries);
+    // only the subscribers acknowledge, the publishers just receive their PUBACKs
+    EXPECT_EQ(120u, stats._acknowledgements._count);
+    EXPECT_EQ(20u, stats._disconnects._count);
+    EXPECT_EQ(3u, simulation.connected());
+}
+
+TEST(MQTTSimulationTest, exactlyOnce)
+{
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    acatl::mqtt::Simulation simulation(subscriptionTreeManager, sessionManager);
+    
+    simulation.addClients(1, subscriberScript("sim/0", acatl::mqtt::QoSLevel::ExactlyOnce));
+    
+    acatl::mqtt::ClientScript publisher;
+    publisher._steps.push_back({acatl::mqtt::ClientAction::Connect, 100});
+    publisher._steps.push_back({acatl::mqtt::ClientAction::Publish, 10, "sim/%i", acatl::mqtt::QoSLevel::ExactlyOnce});
+    simulation.addClients(1, publisher);
+    
+    simulation.run();
+    
+    const acatl::mqtt::SimulationStats& stats = simulation.stats();
+    EXPECT_EQ(0u, stats._errors);
+    EXPECT_EQ(1u, stats._deliveries);
+    // PUBREL of the publisher, PUBREC and PUBCOMP of the subscriber
+    EXPECT_EQ(3u, stats._acknowledgements._count);
+    EXPECT_EQ(2u, simulation.connected());
+}
+
+TEST(MQTTSimulationTest, notConnected)
+{
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    acatl::mqtt::Simulation simulation(subscriptionTreeManager, sessionManager);
+    
+    acatl::mqtt::ClientScript script;
+    script._steps.push_back({acatl::mqtt::ClientAction::Publish, 0, "sim/%i"});
+    script._steps.push_back({acatl::mqtt::ClientAction::Disconnect});
+    simulation.addClients(2, script);
+    
+    simulation.run();
+    
+    EXPECT_EQ(4u, simulation.stats()._errors);
+    EXPECT_EQ(0u, simulation.stats()._publishes._count);
+}
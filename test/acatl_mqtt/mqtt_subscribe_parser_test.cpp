@@ -87,12 +87,13 @@ TEST(MQTTSubscribeParserTest, parse)
     
     const acatl::mqtt::SubscribeControlPacket& packet = parser.packet();
     EXPECT_EQ(10u, packet._packetIdentifier);
-    EXPECT_EQ("check/this/out", packet._topicFilters[0]._filter);
-    EXPECT_EQ(acatl::mqtt::QoSLevel::AtMostOnce, packet._topicFilters[0]._qos);
-    EXPECT_EQ("a/b", packet._topicFilters[1]._filter);
-    EXPECT_EQ(acatl::mqtt::QoSLevel::AtLeastOnce, packet._topicFilters[1]._qos);
-    EXPECT_EQ("c/d", packet._topicFilters[2]._filter);
-    EXPECT_EQ(acatl::mqtt::QoSLevel::ExactlyOnce, packet._topicFilters[2]._qos);
+    // the filters keep the order of the request, which the SUBACK follows
+    EXPECT_EQ("a/b", packet._topicFilters[0]._filter);
+    EXPECT_EQ(acatl::mqtt::QoSLevel::AtLeastOnce, packet._topicFilters[0]._qos);
+    EXPECT_EQ("c/d", packet._topicFilters[1]._filter);
+    EXPECT_EQ(acatl::mqtt::QoSLevel::ExactlyOnce, packet._topicFilters[1]._qos);
+    EXPECT_EQ("check/this/out", packet._topicFilters[2]._filter);
+    EXPECT_EQ(acatl::mqtt::QoSLevel::AtMostOnce, packet._topicFilters[2]._qos);
 }
 
 TEST(MQTTSubscribeParserTest, error)
@@ -0,0 +1,112 @@
+//
+//  mqtt_subscription_index_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_subscription_index.h>
+
+#include <map>
+#include <random>
+
+
+TEST(MQTTSubscriptionIndexTest, addAndReplace)
+{
+    acatl::mqtt::SubscriptionIndex index;
+    EXPECT_TRUE(index.empty());
+    EXPECT_EQ(nullptr, index.find("a/b"));
+    
+    EXPECT_TRUE(index.add({"a/b", acatl::mqtt::QoSLevel::AtMostOnce}));
+    EXPECT_TRUE(index.add({"c/#", acatl::mqtt::QoSLevel::AtLeastOnce}));
+    EXPECT_FALSE(index.add({"a/b", acatl::mqtt::QoSLevel::AtMostOnce}));
+    EXPECT_EQ(2u, index.size());
+    
+    // subscribing again replaces the QoS
+    EXPECT_TRUE(index.add({"a/b", acatl::mqtt::QoSLevel::ExactlyOnce}));
+    ASSERT_NE(nullptr, index.find("a/b"));
+    EXPECT_EQ(acatl::mqtt::QoSLevel::ExactlyOnce, index.find("a/b")->_qos);
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"a/b", acatl::mqtt::QoSLevel::ExactlyOnce}, {"c/#", acatl::mqtt::QoSLevel::AtLeastOnce}}),
+              index.filters());
+    
+    index.assign({{"x"}, {"y"}, {"x", acatl::mqtt::QoSLevel::AtLeastOnce}});
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"x", acatl::mqtt::QoSLevel::AtLeastOnce}, {"y"}}), index.filters());
+    EXPECT_EQ(nullptr, index.find("a/b"));
+}
+
+TEST(MQTTSubscriptionIndexTest, remove)
+{
+    acatl::mqtt::SubscriptionIndex index;
+    index.assign({{"a"}, {"b"}, {"c"}});
+    
+    EXPECT_FALSE(index.remove("d"));
+    EXPECT_TRUE(index.remove("a"));
+    EXPECT_FALSE(index.remove("a"));
+    EXPECT_EQ(nullptr, index.find("a"));
+    // the last filter moved into the place of the removed one
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"c"}, {"b"}}), index.filters());
+    ASSERT_NE(nullptr, index.find("c"));
+    EXPECT_EQ("c", index.find("c")->_filter);
+    
+    EXPECT_TRUE(index.remove("b"));
+    EXPECT_TRUE(index.remove("c"));
+    EXPECT_TRUE(index.empty());
+    EXPECT_TRUE(index.add({"a"}));
+}
+
+TEST(MQTTSubscriptionIndexTest, manyFilters)
+{
+    acatl::mqtt::SubscriptionIndex index;
+    std::map<std::string, acatl::mqtt::QoSLevel> expected;
+    std::mt19937 random(4711);
+    
+    for(size_t i = 0; i < 50000; ++i) {
+        std::string filter = "gateway/" + std::to_string(random() % 20000) + "/#";
+        if(random() % 3 == 0) {
+            EXPECT_EQ(expected.erase(filter) == 1, index.remove(filter));
+        } else {
+            auto qos = acatl::mqtt::QoSLevel(random() % 3);
+            auto iter = expected.find(filter);
+            EXPECT_EQ(iter == expected.end() || iter->second != qos, index.add({filter, qos}));
+            expected[filter] = qos;
+        }
+    }
+    
+    ASSERT_EQ(expected.size(), index.size());
+    for(const auto& entry : expected) {
+        const acatl::mqtt::TopicFilter* filter = index.find(entry.first);
+        ASSERT_NE(nullptr, filter);
+        EXPECT_EQ(entry.second, filter->_qos);
+    }
+    for(const auto& filter : index.filters()) {
+        EXPECT_EQ(1u, expected.count(filter._filter));
+    }
+}
@@ -256,3 +256,31 @@ TEST_F(MQTTSubscriptionTreeTest, sessionMatching)
         EXPECT_TRUE(sessions.find(session3) != sessions.end());
     }
 }
+
+TEST_F(MQTTSubscriptionTreeTest, systemTopics)
+{
+    std::error_code ec;
+    acatl::mqtt::SubscriptionTree subscriptions;
+    
+    acatl::mqtt::Session::Ptr session1(new acatl::mqtt::Session("session1", *this));
+    acatl::mqtt::Session::Ptr session2(new acatl::mqtt::Session("session2", *this));
+    
+    acatl::mqtt::TopicFilter filter = { "#" };
+    subscriptions.addFilter(filter, session1, ec);
+    filter = { "+/broker/#" };
+    subscriptions.addFilter(filter, session1, ec);
+    filter = { "$SYS/#" };
+    subscriptions.addFilter(filter, session2, ec);
+    
+    // wildcards on the first level do not match topics starting with '$'
+    acatl::mqtt::TopicName topic("$SYS/broker/clients/connected");
+    acatl::mqtt::Sessions sessions;
+    EXPECT_TRUE(subscriptions.match(topic, sessions, ec));
+    EXPECT_EQ(1u, sessions.size());
+    EXPECT_TRUE(sessions.find(session2) != sessions.end());
+    
+    sessions.clear();
+    EXPECT_TRUE(subscriptions.match(acatl::mqtt::TopicName("sport/broker"), sessions, ec));
+    EXPECT_EQ(1u, sessions.size());
+    EXPECT_TRUE(sessions.find(session1) != sessions.end());
+}
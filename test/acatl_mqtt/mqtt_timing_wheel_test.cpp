@@ -0,0 +1,131 @@
+//
+//  mqtt_timing_wheel_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_timing_wheel.h>
+
+#include <vector>
+
+
+TEST(MQTTTimingWheelTest, expireAfterTicks)
+{
+    acatl::mqtt::TimingWheel wheel;
+    acatl::mqtt::TimingWheel::Handle handle;
+    int fired = 0;
+    wheel.schedule(handle, 10, [&fired]() { ++fired; });
+    EXPECT_TRUE(wheel.armed(handle));
+    EXPECT_EQ(1u, wheel.size());
+    
+    EXPECT_EQ(0u, wheel.advance(9));
+    EXPECT_EQ(0, fired);
+    EXPECT_EQ(1u, wheel.advance(1));
+    EXPECT_EQ(1, fired);
+    EXPECT_FALSE(wheel.armed(handle));
+    EXPECT_EQ(0u, wheel.size());
+    
+    // a stale handle is ignored
+    EXPECT_FALSE(wheel.reset(handle, 5));
+    EXPECT_FALSE(wheel.cancel(handle));
+}
+
+TEST(MQTTTimingWheelTest, resetAndCancel)
+{
+    acatl::mqtt::TimingWheel wheel;
+    acatl::mqtt::TimingWheel::Handle kept;
+    acatl::mqtt::TimingWheel::Handle cancelled;
+    int fired = 0;
+    wheel.schedule(kept, 30, [&fired]() { ++fired; });
+    wheel.schedule(cancelled, 30, [&fired]() { fired += 100; });
+    EXPECT_TRUE(wheel.cancel(cancelled));
+    
+    // every reset pushes the deadline out again
+    for(int i = 0; i < 10; ++i) {
+        wheel.advance(20);
+        EXPECT_TRUE(wheel.reset(kept, 30));
+    }
+    EXPECT_EQ(0, fired);
+    wheel.advance(29);
+    EXPECT_EQ(0, fired);
+    wheel.advance(1);
+    EXPECT_EQ(1, fired);
+    
+    // pulling a deadline in is honoured as well
+    wheel.schedule(kept, 1000, [&fired]() { ++fired; });
+    EXPECT_TRUE(wheel.reset(kept, 3));
+    wheel.advance(3);
+    EXPECT_EQ(2, fired);
+}
+
+TEST(MQTTTimingWheelTest, cascadeAcrossLevels)
+{
+    acatl::mqtt::TimingWheel wheel;
+    const std::vector<uint64_t> delays = {1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 300000, 20000000};
+    std::vector<acatl::mqtt::TimingWheel::Handle> handles(delays.size());
+    std::vector<uint64_t> firedAt(delays.size(), 0);
+    
+    // start off an unaligned position, so the cascades do not line up with the deadlines
+    wheel.advance(12345);
+    const uint64_t start = wheel.now();
+    for(size_t i = 0; i < delays.size(); ++i) {
+        wheel.schedule(handles[i], delays[i], [&wheel, &firedAt, i]() { firedAt[i] = wheel.now(); });
+    }
+    wheel.advance(20000000);
+    for(size_t i = 0; i < delays.size(); ++i) {
+        EXPECT_EQ(start + delays[i], firedAt[i]) << "delay " << delays[i];
+    }
+    EXPECT_EQ(0u, wheel.size());
+}
+
+TEST(MQTTTimingWheelTest, callbacksMayReschedule)
+{
+    acatl::mqtt::TimingWheel wheel;
+    acatl::mqtt::TimingWheel::Handle first;
+    acatl::mqtt::TimingWheel::Handle second;
+    int fired = 0;
+    
+    wheel.schedule(second, 5, [&fired]() { fired += 100; });
+    std::function<void()> rearm = [&]() {
+        ++fired;
+        // cancel the sibling expiring in the same slot and keep the own timer running
+        wheel.cancel(second);
+        if(fired < 3) {
+            wheel.schedule(first, 5, rearm);
+        }
+    };
+    wheel.schedule(first, 5, rearm);
+    
+    wheel.advance(100);
+    EXPECT_EQ(3, fired);
+    EXPECT_EQ(0u, wheel.size());
+}
@@ -0,0 +1,125 @@
+//
+//  mqtt_topic_alias_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_parser.h>
+#include <acatl_mqtt/mqtt_serializer.h>
+#include <acatl_mqtt/mqtt_topic_alias.h>
+
+
+TEST(MQTTTopicAliasTest, inboundAliases)
+{
+    acatl::mqtt::InboundTopicAliases aliases;
+    aliases.setMaximum(2);
+    std::error_code ec;
+    
+    std::string topic = "sensors/1/temperature";
+    EXPECT_TRUE(aliases.resolve(topic, 1, ec));
+    EXPECT_FALSE(ec);
+    
+    topic.clear();
+    EXPECT_TRUE(aliases.resolve(topic, 1, ec));
+    EXPECT_EQ("sensors/1/temperature", topic);
+    
+    // an alias can be redefined
+    topic = "sensors/2/temperature";
+    EXPECT_TRUE(aliases.resolve(topic, 1, ec));
+    topic.clear();
+    EXPECT_TRUE(aliases.resolve(topic, 1, ec));
+    EXPECT_EQ("sensors/2/temperature", topic);
+    EXPECT_FALSE(ec);
+    
+    // unknown alias
+    topic.clear();
+    EXPECT_FALSE(aliases.resolve(topic, 2, ec));
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::invalid_topic_alias), ec);
+    
+    // above the maximum
+    ec.clear();
+    topic = "sensors/3/temperature";
+    EXPECT_FALSE(aliases.resolve(topic, 3, ec));
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::invalid_topic_alias), ec);
+    
+    // neither topic nor alias
+    ec.clear();
+    topic.clear();
+    EXPECT_FALSE(aliases.resolve(topic, 0, ec));
+    EXPECT_EQ(acatl::mqtt::make_error_code(acatl::mqtt::mqtt_error::invalid_topic_alias), ec);
+}
+
+TEST(MQTTTopicAliasTest, outboundAliases)
+{
+    acatl::mqtt::OutboundTopicAliases aliases;
+    EXPECT_EQ(std::make_pair(uint16_t(0), true), aliases.assign("a"));
+    
+    aliases.setMaximum(2);
+    EXPECT_EQ(std::make_pair(uint16_t(1), true), aliases.assign("a"));
+    EXPECT_EQ(std::make_pair(uint16_t(2), true), aliases.assign("b"));
+    EXPECT_EQ(std::make_pair(uint16_t(1), false), aliases.assign("a"));
+    
+    // all aliases are in use, further topics are sent as they are
+    EXPECT_EQ(std::make_pair(uint16_t(0), true), aliases.assign("c"));
+    EXPECT_EQ(std::make_pair(uint16_t(0), true), aliases.assign("c"));
+    EXPECT_EQ(std::make_pair(uint16_t(2), false), aliases.assign("b"));
+}
+
+TEST(MQTTTopicAliasTest, roundTrip)
+{
+    acatl::mqtt::Serializer serializer;
+    serializer.setProtocolLevel(acatl::mqtt::protocolLevel5);
+    serializer.setTopicAliasMaximum(1);
+    acatl::mqtt::MQTTParser parser;
+    parser.setProtocolLevel(acatl::mqtt::protocolLevel5);
+    parser.setTopicAliasMaximum(1);
+    
+    const std::vector<std::string> topics = { "a", "a", "b", "b", "a" };
+    std::error_code ec;
+    std::vector<uint8_t> buffer;
+    for(const auto& topic : topics) {
+        acatl::mqtt::PublishControlPacket::Ptr pub = std::make_unique<acatl::mqtt::PublishControlPacket>();
+        pub->_topicName = topic;
+        pub->_payload = { '1' };
+        size_t length = 0;
+        ASSERT_TRUE(serializer.serialize(std::move(pub), buffer, length, ec));
+        
+        acatl::Tribool ret;
+        for(size_t i = 0; i < length && ret.isIndeterminate(); ++i) {
+            ret = parser.parse(buffer[i], ec);
+        }
+        ASSERT_TRUE(ret.isTrue());
+        acatl::mqtt::ControlPacket::Ptr packet = parser.consumePacket();
+        EXPECT_EQ(topic, dynamic_cast<const acatl::mqtt::PublishControlPacket&>(*packet)._topicName._name);
+    }
+    EXPECT_FALSE(ec);
+}
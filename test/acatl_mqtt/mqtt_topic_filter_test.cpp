@@ -198,6 +198,10 @@ TEST(MQTTTopicFilterTest, construct)
     
     filter1 = {"a/b", acatl::mqtt::QoSLevel::AtLeastOnce};
     EXPECT_LT(filter1, filter2);
+    
+    filter2 = {"a/b", acatl::mqtt::QoSLevel::AtMostOnce};
+    EXPECT_LT(filter2, filter1);
+    EXPECT_FALSE(filter3 < filter1);
 }
 
 TEST(MQTTTopicFilterTest, stream)
@@ -230,6 +234,23 @@ TEST(MQTTTopicFilterTest, difference)
     EXPECT_EQ(2u, result.size());
     EXPECT_EQ(acatl::mqtt::TopicFilter("a/b", acatl::mqtt::QoSLevel::AtLeastOnce), result[0]);
     EXPECT_EQ(acatl::mqtt::TopicFilter("e/f", acatl::mqtt::QoSLevel::AtLeastOnce), result[1]);
+    
+    // neither list has to be sorted, duplicates are only added once
+    toAddTopics = {
+        {"e/f", acatl::mqtt::QoSLevel::AtLeastOnce},
+        {"c/d", acatl::mqtt::QoSLevel::AtMostOnce},
+        {"a/b", acatl::mqtt::QoSLevel::AtLeastOnce},
+        {"e/f", acatl::mqtt::QoSLevel::AtLeastOnce},
+        {"c/d", acatl::mqtt::QoSLevel::ExactlyOnce}
+    };
+    currentTopics = {
+        {"x/y", acatl::mqtt::QoSLevel::AtMostOnce},
+        {"c/d", acatl::mqtt::QoSLevel::AtMostOnce},
+        {"a/b", acatl::mqtt::QoSLevel::AtLeastOnce}
+    };
+    result = acatl::mqtt::TopicFilterHelper::findDifference(toAddTopics, currentTopics);
+    EXPECT_EQ((acatl::mqtt::TopicFilters{{"e/f", acatl::mqtt::QoSLevel::AtLeastOnce}, {"c/d", acatl::mqtt::QoSLevel::ExactlyOnce}}),
+              result);
 }
 
 TEST(MQTTTopicTest, validate)
@@ -0,0 +1,177 @@
+//
+//  mqtt_worker_pool_test.cpp
+//  acatl_mqtt
+//
+//  BSD 3-Clause License
+//  Copyright (c) 2019, Lars-Christian Fürstenberg
+//  All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are permitted
+//  provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice, this list of
+//  conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice, this list of
+//  conditions and the following disclaimer in the documentation and/or other materials provided
+//  with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors may be used to
+//  endorse or promote products derived from this software without specific prior written
+//  permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+//  IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+//  AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+//  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+//  OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <gtest/gtest.h>
+
+#include <acatl_mqtt/mqtt_processor.h>
+#include <acatl_mqtt/mqtt_worker_pool.h>
+
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+
+
+namespace
+{
+    class NullSubscriptionHandler : public acatl::mqtt::SubscriptionHandler
+    {
+    public:
+        void addSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+        {
+        }
+        
+        void removeSubscriptions(const acatl::mqtt::TopicFilters& subscriptions) override
+        {
+        }
+    };
+    
+    /// Records the topics in the order they arrive, the chunks of a fan-out deliver from several threads.
+    class RecordingSender : public acatl::mqtt::PacketSender
+    {
+    public:
+        void addSendPacket(acatl::mqtt::ControlPacket::Ptr packet) override
+        {
+            const acatl::mqtt::PublishControlPacket& pub = static_cast<const acatl::mqtt::PublishControlPacket&>(*packet);
+            std::unique_lock<std::mutex> guard(_mutex);
+            _received.push_back(pub._topicName._name);
+        }
+        
+        std::vector<std::string> received()
+        {
+            std::unique_lock<std::mutex> guard(_mutex);
+            return _received;
+        }
+        
+    private:
+        std::mutex _mutex;
+        std::vector<std::string> _received;
+    };
+}
+
+
+TEST(WorkerPoolTest, everyChunkOnce)
+{
+    acatl::mqtt::WorkerOptions options;
+    options._threads = 3;
+    options._fanOutChunk = 10;
+    acatl::mqtt::WorkerPool workers(options);
+    EXPECT_EQ(3u, workers.size());
+    
+    for(size_t count : { 0, 1, 10, 11, 95, 1000 }) {
+        std::vector<std::atomic<int>> calls(count);
+        std::mutex mutex;
+        std::map<size_t, size_t> chunks;
+        workers.forEachChunk(count, [&](size_t begin, size_t end) {
+            EXPECT_LE(end - begin, 10u);
+            for(size_t i = begin; i < end; ++i) {
+                ++calls[i];
+            }
+            std::unique_lock<std::mutex> guard(mutex);
+            chunks[begin] = end;
+        });
+        for(size_t i = 0; i < count; ++i) {
+            EXPECT_EQ(1, calls[i].load());
+        }
+        EXPECT_EQ(count == 0 ? 1u : (count + 9) / 10, chunks.size());
+    }
+}
+
+TEST(WorkerPoolTest, chunksFromWorker)
+{
+    // every worker is busy splitting a fan-out, so the callers have to do the chunks on their own
+    acatl::mqtt::WorkerOptions options;
+    options._threads = 2;
+    options._fanOutChunk = 4;
+    acatl::mqtt::WorkerPool workers(options);
+    
+    std::vector<std::future<size_t>> results;
+    for(size_t n = 0; n < 2; ++n) {
+        auto promise = std::make_shared<std::promise<size_t>>();
+        results.push_back(promise->get_future());
+        workers.post([&workers, promise]() {
+            std::atomic<size_t> sum(0);
+            workers.forEachChunk(100, [&sum](size_t begin, size_t end) {
+                sum += end - begin;
+            });
+            promise->set_value(sum.load());
+        });
+    }
+    for(auto& result : results) {
+        ASSERT_EQ(std::future_status::ready, result.wait_for(std::chrono::seconds(10)));
+        EXPECT_EQ(100u, result.get());
+    }
+}
+
+TEST(WorkerPoolTest, processorSplitsFanOut)
+{
+    const size_t subscribers = 100;
+    acatl::mqtt::WorkerOptions options;
+    options._threads = 4;
+    options._fanOutChunk = 8;
+    acatl::mqtt::WorkerPool workers(options);
+    acatl::mqtt::SubscriptionTreeManager subscriptionTreeManager;
+    acatl::mqtt::SessionManager sessionManager;
+    NullSubscriptionHandler handler;
+    
+    std::error_code ec;
+    std::vector<std::shared_ptr<RecordingSender>> senders;
+    std::vector<acatl::mqtt::Session::Ptr> sessions;
+    {
+        acatl::mqtt::SubscriptionTreeManager::WritableTree writableTree = subscriptionTreeManager.getWritableTree();
+        for(size_t i = 0; i < subscribers; ++i) {
+            senders.push_back(std::make_shared<RecordingSender>());
+            sessions.push_back(sessionManager.getSession("sub" + std::to_string(i), senders.back(), handler, ec));
+            writableTree.tree()->addFilter(acatl::mqtt::TopicFilter("fan/#", acatl::mqtt::QoSLevel::AtMostOnce), sessions.back(), ec);
+        }
+    }
+    
+    acatl::mqtt::Processor processor(subscriptionTreeManager, sessionManager);
+    processor.setWorkerPool(&workers);
+    for(size_t n = 0; n < 20; ++n) {
+        acatl::mqtt::PublishControlPacket pub;
+        pub._topicName = "fan/" + std::to_string(n);
+        pub._payload = { 'f', 'a', 'n' };
+        processor.publish(pub, ec);
+        EXPECT_FALSE(ec);
+    }
+    
+    // every subscriber got each publish once, in the order of the publisher
+    for(const auto& sender : senders) {
+        std::vector<std::string> received = sender->received();
+        ASSERT_EQ(20u, received.size());
+        for(size_t n = 0; n < 20; ++n) {
+            EXPECT_EQ("fan/" + std::to_string(n), received[n]);
+        }
+    }
+}